@@ -20,14 +20,38 @@
 ***/
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
-#include <lzma.h>
+
+#ifdef HAVE_XZ
+#  include <lzma.h>
+#endif
+
+#ifdef HAVE_LZ4
+#  include <lz4.h>
+#endif
 
 #include "macro.h"
+#include "util.h"
+#include "sparse-endian.h"
 #include "compress.h"
 
-bool compress_blob(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
+/* LZ4 does not store the size of the uncompressed data, hence we
+ * prefix the compressed block with it, as little endian 64bit
+ * value. */
+#define LZ4_SIZE_PREFIX sizeof(le64_t)
+
+static const char* const object_compressed_table[_OBJECT_COMPRESSED_MAX] = {
+        [OBJECT_COMPRESSED_XZ] = "XZ",
+        [OBJECT_COMPRESSED_LZ4] = "LZ4",
+};
+
+DEFINE_STRING_TABLE_LOOKUP(object_compressed, int);
+
+bool compress_blob_xz(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
+#ifdef HAVE_XZ
         lzma_stream s = LZMA_STREAM_INIT;
         lzma_ret ret;
         bool b = false;
@@ -64,11 +88,67 @@ fail:
         lzma_end(&s);
 
         return b;
+#else
+        return false;
+#endif
 }
 
-bool uncompress_blob(const void *src, uint64_t src_size,
-                     void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+bool compress_blob_lz4(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
+#ifdef HAVE_LZ4
+        int r;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_size);
+
+        /* Returns false if we couldn't compress the data or the
+         * compressed result (including the size prefix) is not
+         * shorter than the original */
+
+        if (src_size <= LZ4_SIZE_PREFIX + 1)
+                return false;
+
+        /* LZ4 works on int sized buffers only */
+        if (src_size > (uint64_t) INT_MAX)
+                return false;
 
+        r = LZ4_compress_default(src,
+                                 (char*) dst + LZ4_SIZE_PREFIX,
+                                 (int) src_size,
+                                 (int) (src_size - LZ4_SIZE_PREFIX - 1));
+        if (r <= 0)
+                return false;
+
+        *(le64_t*) dst = htole64(src_size);
+        *dst_size = r + LZ4_SIZE_PREFIX;
+
+        return true;
+#else
+        return false;
+#endif
+}
+
+bool compress_blob(int compression,
+                   const void *src, uint64_t src_size, void *dst, uint64_t *dst_size) {
+
+        switch (compression) {
+
+        case OBJECT_COMPRESSED_XZ:
+                return compress_blob_xz(src, src_size, dst, dst_size);
+
+        case OBJECT_COMPRESSED_LZ4:
+                return compress_blob_lz4(src, src_size, dst, dst_size);
+
+        default:
+                return false;
+        }
+}
+
+bool uncompress_blob_xz(const void *src, uint64_t src_size,
+                        void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+
+#ifdef HAVE_XZ
         lzma_stream s = LZMA_STREAM_INIT;
         lzma_ret ret;
         uint64_t space;
@@ -137,13 +217,90 @@ fail:
         lzma_end(&s);
 
         return b;
+#else
+        return false;
+#endif
 }
 
-bool uncompress_startswith(const void *src, uint64_t src_size,
-                           void **buffer, uint64_t *buffer_size,
-                           const void *prefix, uint64_t prefix_len,
-                           uint8_t extra) {
+bool uncompress_blob_lz4(const void *src, uint64_t src_size,
+                         void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+
+#ifdef HAVE_LZ4
+        uint64_t size, want;
+        int r;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+        assert(*dst_alloc_size == 0 || *dst);
+
+        if (src_size <= LZ4_SIZE_PREFIX)
+                return false;
+
+        size = le64toh(*(const le64_t*) src);
+        if (size <= 0 || size > (uint64_t) INT_MAX || src_size - LZ4_SIZE_PREFIX > (uint64_t) INT_MAX)
+                return false;
+
+        /* If the caller is only interested in the beginning of the
+         * blob, don't bother decompressing the rest. Note that we
+         * always allocate enough space for the full object, so that
+         * the buffer can be reused for the next call. */
+        want = dst_max > 0 ? MIN(size, dst_max) : size;
+
+        if (*dst_alloc_size < size) {
+                void *p;
+
+                p = realloc(*dst, size);
+                if (!p)
+                        return false;
+
+                *dst = p;
+                *dst_alloc_size = size;
+        }
+
+        if (want < size)
+                r = LZ4_decompress_safe_partial((const char*) src + LZ4_SIZE_PREFIX, *dst,
+                                                (int) (src_size - LZ4_SIZE_PREFIX),
+                                                (int) want, (int) size);
+        else
+                r = LZ4_decompress_safe((const char*) src + LZ4_SIZE_PREFIX, *dst,
+                                        (int) (src_size - LZ4_SIZE_PREFIX),
+                                        (int) size);
+        if (r < 0 || (uint64_t) r < want)
+                return false;
+
+        *dst_size = (uint64_t) r;
+        return true;
+#else
+        return false;
+#endif
+}
+
+bool uncompress_blob(int compression,
+                     const void *src, uint64_t src_size,
+                     void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max) {
+
+        switch (compression) {
+
+        case OBJECT_COMPRESSED_XZ:
+                return uncompress_blob_xz(src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+
+        case OBJECT_COMPRESSED_LZ4:
+                return uncompress_blob_lz4(src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+
+        default:
+                return false;
+        }
+}
+
+bool uncompress_startswith_xz(const void *src, uint64_t src_size,
+                              void **buffer, uint64_t *buffer_size,
+                              const void *prefix, uint64_t prefix_len,
+                              uint8_t extra) {
 
+#ifdef HAVE_XZ
         lzma_stream s = LZMA_STREAM_INIT;
         lzma_ret ret;
         bool b = false;
@@ -213,4 +370,178 @@ fail:
         lzma_end(&s);
 
         return b;
+#else
+        return false;
+#endif
+}
+
+bool uncompress_startswith_lz4(const void *src, uint64_t src_size,
+                               void **buffer, uint64_t *buffer_size,
+                               const void *prefix, uint64_t prefix_len,
+                               uint8_t extra) {
+
+#ifdef HAVE_LZ4
+        uint64_t size;
+
+        /* Checks whether the uncompressed blob starts with the
+         * mentioned prefix. The byte extra needs to follow the
+         * prefix. Only the prefix is actually decompressed. */
+
+        assert(src);
+        assert(src_size > 0);
+        assert(buffer);
+        assert(buffer_size);
+        assert(prefix);
+        assert(*buffer_size == 0 || *buffer);
+
+        if (!uncompress_blob_lz4(src, src_size, buffer, buffer_size, &size, prefix_len + 1))
+                return false;
+
+        return size > prefix_len &&
+                memcmp(*buffer, prefix, prefix_len) == 0 &&
+                ((const uint8_t*) *buffer)[prefix_len] == extra;
+#else
+        return false;
+#endif
+}
+
+bool uncompress_startswith(int compression,
+                           const void *src, uint64_t src_size,
+                           void **buffer, uint64_t *buffer_size,
+                           const void *prefix, uint64_t prefix_len,
+                           uint8_t extra) {
+
+        switch (compression) {
+
+        case OBJECT_COMPRESSED_XZ:
+                return uncompress_startswith_xz(src, src_size, buffer, buffer_size,
+                                                prefix, prefix_len, extra);
+
+        case OBJECT_COMPRESSED_LZ4:
+                return uncompress_startswith_lz4(src, src_size, buffer, buffer_size,
+                                                 prefix, prefix_len, extra);
+
+        default:
+                return false;
+        }
+}
+
+#ifdef HAVE_XZ
+static int xz_code_stream(lzma_stream *s, int fdf, int fdt, uint64_t max_in, uint64_t max_out) {
+        uint8_t in[64*1024], out[64*1024];
+        lzma_action action = LZMA_RUN;
+        uint64_t n_in = 0, n_out = 0;
+
+        assert(s);
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        /* Feeds what is read from fdf through the coder and writes
+         * what comes out to fdt, one buffer at a time. Fails with
+         * -EFBIG if more than max_in bytes are read or max_out bytes
+         * would be written. */
+
+        s->next_out = out;
+        s->avail_out = sizeof(out);
+
+        for (;;) {
+                lzma_ret ret;
+
+                if (s->avail_in == 0 && action == LZMA_RUN) {
+                        ssize_t n;
+
+                        n = loop_read(fdf, in, sizeof(in), false);
+                        if (n < 0)
+                                return (int) n;
+
+                        if (n == 0)
+                                action = LZMA_FINISH;
+                        else {
+                                n_in += n;
+                                if (n_in > max_in)
+                                        return -EFBIG;
+
+                                s->next_in = in;
+                                s->avail_in = n;
+                        }
+                }
+
+                /* If the input ends before the stream does, this
+                 * fails with LZMA_BUF_ERROR eventually */
+                ret = lzma_code(s, action);
+                if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+                        return ret == LZMA_MEM_ERROR ? -ENOMEM : -EBADMSG;
+
+                if (s->avail_out == 0 || ret == LZMA_STREAM_END) {
+                        size_t n;
+                        ssize_t k;
+
+                        n = sizeof(out) - s->avail_out;
+
+                        n_out += n;
+                        if (n_out > max_out)
+                                return -EFBIG;
+
+                        k = loop_write(fdt, out, n, false);
+                        if (k < 0)
+                                return (int) k;
+                        if ((size_t) k != n)
+                                return -EIO;
+
+                        s->next_out = out;
+                        s->avail_out = sizeof(out);
+                }
+
+                if (ret == LZMA_STREAM_END)
+                        return 0;
+        }
+}
+#endif
+
+int compress_stream(int fdf, int fdt, uint64_t max_bytes) {
+#ifdef HAVE_XZ
+        lzma_stream s = LZMA_STREAM_INIT;
+        int r;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        /* Compresses everything read from fdf into an .xz stream
+         * written to fdt, with no more than two buffers in memory at
+         * a time. Favours speed over size, since whoever waits for
+         * us might be holding on to a lot of memory. */
+
+        if (lzma_easy_encoder(&s, 1, LZMA_CHECK_CRC64) != LZMA_OK)
+                return -ENOMEM;
+
+        r = xz_code_stream(&s, fdf, fdt, max_bytes, (uint64_t) -1);
+        lzma_end(&s);
+
+        return r;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int decompress_stream(int fdf, int fdt, uint64_t max_bytes) {
+#ifdef HAVE_XZ
+        lzma_stream s = LZMA_STREAM_INIT;
+        int r;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        /* The reverse of compress_stream(), accepting any .xz
+         * stream. max_bytes limits the decompressed size. */
+
+        if (lzma_stream_decoder(&s, UINT64_MAX, 0) != LZMA_OK)
+                return -ENOMEM;
+
+        r = xz_code_stream(&s, fdf, fdt, (uint64_t) -1, max_bytes);
+        lzma_end(&s);
+
+        return r;
+#else
+        return -EPROTONOSUPPORT;
+#endif
 }
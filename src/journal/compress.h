@@ -24,12 +24,40 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
-bool compress_blob(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size);
+#include "journal-def.h"
 
-bool uncompress_blob(const void *src, uint64_t src_size,
+const char* object_compressed_to_string(int compression);
+int object_compressed_from_string(const char *compression);
+
+bool compress_blob_xz(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size);
+bool compress_blob_lz4(const void *src, uint64_t src_size, void *dst, uint64_t *dst_size);
+
+bool compress_blob(int compression,
+                   const void *src, uint64_t src_size, void *dst, uint64_t *dst_size);
+
+bool uncompress_blob_xz(const void *src, uint64_t src_size,
+                        void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max);
+bool uncompress_blob_lz4(const void *src, uint64_t src_size,
+                         void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max);
+
+bool uncompress_blob(int compression,
+                     const void *src, uint64_t src_size,
                      void **dst, uint64_t *dst_alloc_size, uint64_t* dst_size, uint64_t dst_max);
 
-bool uncompress_startswith(const void *src, uint64_t src_size,
+bool uncompress_startswith_xz(const void *src, uint64_t src_size,
+                              void **buffer, uint64_t *buffer_size,
+                              const void *prefix, uint64_t prefix_len,
+                              uint8_t extra);
+bool uncompress_startswith_lz4(const void *src, uint64_t src_size,
+                               void **buffer, uint64_t *buffer_size,
+                               const void *prefix, uint64_t prefix_len,
+                               uint8_t extra);
+
+bool uncompress_startswith(int compression,
+                           const void *src, uint64_t src_size,
                            void **buffer, uint64_t *buffer_size,
                            const void *prefix, uint64_t prefix_len,
                            uint8_t extra);
+
+int compress_stream(int fdf, int fdt, uint64_t max_bytes);
+int decompress_stream(int fdf, int fdt, uint64_t max_bytes);
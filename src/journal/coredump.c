@@ -22,7 +22,15 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <sys/prctl.h>
+#include <sys/statvfs.h>
+
+#ifdef HAVE_ACL
+#include <sys/acl.h>
+#include "acl-util.h"
+#endif
 
 #include <systemd/sd-journal.h>
 
@@ -36,12 +44,30 @@
 #include "mkdir.h"
 #include "special.h"
 #include "cgroup-util.h"
+#include "path-util.h"
+#include "compress.h"
 
 /* Few programs have less than 3MiB resident */
 #define COREDUMP_MIN_START (3*1024*1024)
-/* Make sure to not make this larger than the maximum journal entry
+
+/* Cores are streamed into files, hence these may be large */
+#define COREDUMP_FILE_MAX (4ULL*1024ULL*1024ULL*1024ULL)
+
+/* Only if a core cannot be stored in a file it is kept in memory and
+ * logged to the journal, and only if it is no larger than this. Make
+ * sure to not make this larger than the maximum journal entry
  * size. See ENTRY_SIZE_MAX in journald-native.c. */
-#define COREDUMP_MAX (767*1024*1024)
+#define COREDUMP_JOURNAL_MAX (16*1024*1024)
+
+/* Stored cores may use up to 10% of the file system, but no more
+ * than this */
+#define COREDUMP_DIR_USE_MAX (4ULL*1024ULL*1024ULL*1024ULL)
+
+#ifdef HAVE_XZ
+#  define COREDUMP_SUFFIX ".xz"
+#else
+#  define COREDUMP_SUFFIX ""
+#endif
 
 enum {
         ARG_PID = 1,
@@ -97,6 +123,161 @@ static int divert_coredump(void) {
         return 0;
 }
 
+static int open_coredump_file(char *argv[], uid_t uid, char **ret_path, char **ret_temp) {
+        _cleanup_free_ char *c = NULL, *p = NULL, *t = NULL;
+        sd_id128_t boot;
+        char b[33];
+        int fd, r;
+
+        assert(argv);
+        assert(ret_path);
+        assert(ret_temp);
+
+        r = sd_id128_get_boot(&boot);
+        if (r < 0) {
+                log_error("Failed to determine boot ID: %s", strerror(-r));
+                return r;
+        }
+
+        /* The dots separate the parts of the name */
+        c = xescape(argv[ARG_COMM], "./");
+        if (!c)
+                return log_oom();
+
+        if (asprintf(&p, "/var/lib/systemd/coredump/core.%s.%s.%s.%s.%s000000" COREDUMP_SUFFIX,
+                     c, argv[ARG_UID], sd_id128_to_string(boot, b), argv[ARG_PID], argv[ARG_TIMESTAMP]) < 0)
+                return log_oom();
+
+        t = strdup("/var/lib/systemd/coredump/.#core.XXXXXX");
+        if (!t)
+                return log_oom();
+
+        mkdir_p_label("/var/lib/systemd/coredump", 0755);
+
+        fd = mkostemp(t, O_CLOEXEC|O_RDWR);
+        if (fd < 0) {
+                log_error("Failed to create coredump file: %m");
+                return -errno;
+        }
+
+        /* Readable by the user who owns the crashed process, but not
+         * writable, like the journal files */
+        if (fchmod(fd, 0640) < 0)
+                log_warning("Failed to fix access mode on coredump file, ignoring: %m");
+
+#ifdef HAVE_ACL
+        if (uid > 0) {
+                r = acl_add_user_read_fd(fd, uid);
+                if (r < 0)
+                        log_warning("Failed to patch ACL on coredump file, ignoring: %s", strerror(-r));
+        }
+#endif
+
+        *ret_path = p;
+        *ret_temp = t;
+        p = t = NULL;
+
+        return fd;
+}
+
+static int write_coredump_file(int fd, const char *temp, const char *path) {
+        int r;
+
+        assert(fd >= 0);
+        assert(temp);
+        assert(path);
+
+        /* Stream the core through a buffer of fixed size, so that
+         * we never need more memory than that, however large it
+         * is */
+#ifdef HAVE_XZ
+        r = compress_stream(STDIN_FILENO, fd, COREDUMP_FILE_MAX);
+#else
+        r = copy_bytes(STDIN_FILENO, fd, COREDUMP_FILE_MAX);
+#endif
+        if (r == -EFBIG)
+                log_error("Core too large, core will not be stored.");
+        else if (r < 0)
+                log_error("Failed to write coredump file: %s", strerror(-r));
+        else if (rename(temp, path) < 0) {
+                log_error("Failed to rename coredump file: %m");
+                r = -errno;
+        }
+
+        if (r < 0)
+                unlink(temp);
+
+        return r;
+}
+
+static void vacuum_coredumps(const char *exclude) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct statvfs ss;
+        uint64_t max_use;
+
+        /* Removes the oldest cores until what is left fits into the
+         * limits, except for the one just stored */
+
+        d = opendir("/var/lib/systemd/coredump");
+        if (!d) {
+                log_warning("Failed to open coredump directory: %m");
+                return;
+        }
+
+        if (fstatvfs(dirfd(d), &ss) < 0) {
+                log_warning("Failed to determine file system size of coredump directory: %m");
+                return;
+        }
+
+        max_use = MIN((uint64_t) ss.f_frsize * (uint64_t) ss.f_blocks / 10, COREDUMP_DIR_USE_MAX);
+
+        for (;;) {
+                _cleanup_free_ char *oldest = NULL;
+                usec_t oldest_usec = 0;
+                uint64_t sum = 0;
+                struct dirent *de;
+
+                rewinddir(d);
+
+                FOREACH_DIRENT(de, d, return) {
+                        struct stat st;
+
+                        if (!startswith(de->d_name, "core."))
+                                continue;
+
+                        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0 ||
+                            !S_ISREG(st.st_mode))
+                                continue;
+
+                        sum += (uint64_t) st.st_blocks * 512ULL;
+
+                        if (exclude && streq(de->d_name, exclude))
+                                continue;
+
+                        if (!oldest || timespec_load(&st.st_mtim) < oldest_usec) {
+                                free(oldest);
+                                oldest = strdup(de->d_name);
+                                if (!oldest) {
+                                        log_oom();
+                                        return;
+                                }
+
+                                oldest_usec = timespec_load(&st.st_mtim);
+                        }
+                }
+
+                if (sum <= max_use || !oldest)
+                        return;
+
+                if (unlinkat(dirfd(d), oldest, 0) < 0) {
+                        log_warning("Failed to remove old coredump %s: %m", oldest);
+                        return;
+                }
+
+                log_info("Removed old coredump %s.", oldest);
+        }
+}
+
 int main(int argc, char* argv[]) {
         int r, j = 0;
         char *t;
@@ -104,11 +285,13 @@ int main(int argc, char* argv[]) {
         pid_t pid;
         uid_t uid;
         gid_t gid;
-        struct iovec iovec[14];
+        struct iovec iovec[15];
         size_t coredump_bufsize, coredump_size;
         _cleanup_free_ char *core_pid = NULL, *core_uid = NULL, *core_gid = NULL, *core_signal = NULL,
                 *core_timestamp = NULL, *core_comm = NULL, *core_exe = NULL, *core_unit = NULL,
-                *core_session = NULL, *core_message = NULL, *core_cmdline = NULL, *coredump_data = NULL;
+                *core_session = NULL, *core_message = NULL, *core_cmdline = NULL, *coredump_data = NULL,
+                *coredump_path = NULL, *coredump_temp = NULL, *core_filename = NULL;
+        _cleanup_close_ int coredump_fd = -1;
 
         prctl(PR_SET_DUMPABLE, 0);
 
@@ -224,6 +407,20 @@ int main(int argc, char* argv[]) {
         if (core_message)
                 IOVEC_SET_STRING(iovec[j++], core_message);
 
+        /* Store the core in a file, and only refer to it from the
+         * journal. This needs to happen before we drop privileges,
+         * since only root may write to the directory. */
+        coredump_fd = open_coredump_file(argv, uid, &coredump_path, &coredump_temp);
+        if (coredump_fd >= 0 &&
+            write_coredump_file(coredump_fd, coredump_temp, coredump_path) >= 0) {
+
+                vacuum_coredumps(path_get_file_name(coredump_path));
+
+                core_filename = strappend("COREDUMP_FILENAME=", coredump_path);
+                if (core_filename)
+                        IOVEC_SET_STRING(iovec[j++], core_filename);
+        }
+
         /* Now, let's drop privileges to become the user who owns the
          * segfaulted process and allocate the coredump memory under
          * his uid. This also ensures that the credentials journald
@@ -237,6 +434,11 @@ int main(int argc, char* argv[]) {
                 goto finish;
         }
 
+        /* Whether it worked or not, the core has been consumed
+         * already if we could create the file */
+        if (coredump_fd >= 0)
+                goto finalize;
+
         coredump_bufsize = COREDUMP_MIN_START;
         coredump_data = malloc(coredump_bufsize);
         if (!coredump_data) {
@@ -259,7 +461,7 @@ int main(int argc, char* argv[]) {
 
                 coredump_size += n;
 
-                if (coredump_size > COREDUMP_MAX) {
+                if (coredump_size > COREDUMP_JOURNAL_MAX) {
                         log_error("Core too large, core will not be stored.");
                         goto finalize;
                 }
@@ -36,6 +36,7 @@
 #include "pager.h"
 #include "macro.h"
 #include "journal-internal.h"
+#include "compress.h"
 
 static enum {
         ACTION_NONE,
@@ -378,25 +379,54 @@ static int focus(sd_journal *j) {
         return r;
 }
 
-static int dump_core(sd_journal* j) {
+static int save_core(sd_journal *j, int fd) {
         const void *data;
-        size_t len, ret;
+        size_t len;
+        ssize_t n;
         int r;
 
         assert(j);
+        assert(fd >= 0);
 
-        /* We want full data, nothing truncated. */
-        sd_journal_set_data_threshold(j, 0);
+        /* The core is either stored in a file of its own, or in the
+         * COREDUMP= field */
 
-        r = focus(j);
-        if (r < 0)
-                return r;
+        r = sd_journal_get_data(j, "COREDUMP_FILENAME", (const void**) &data, &len);
+        if (r >= 0) {
+                _cleanup_free_ char *fn = NULL;
+                _cleanup_close_ int fdf = -1;
 
-        print_entry(output ? stdout : stderr, j, false);
+                assert(len >= 18);
+                fn = strndup((const char*) data + 18, len - 18);
+                if (!fn)
+                        return log_oom();
 
-        if (on_tty() && !output) {
-                log_error("Refusing to dump core to tty");
-                return -ENOTTY;
+                fdf = open(fn, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+                if (fdf < 0) {
+                        log_error("Failed to open %s: %m", fn);
+                        return -errno;
+                }
+
+                if (endswith(fn, ".xz")) {
+                        r = decompress_stream(fdf, fd, (uint64_t) -1);
+                        if (r == -EPROTONOSUPPORT) {
+                                log_error("Cannot decompress %s, compiled without XZ support.", fn);
+                                return r;
+                        }
+                } else
+                        r = copy_bytes(fdf, fd, (uint64_t) -1);
+
+                if (r < 0) {
+                        log_error("Failed to retrieve core from %s: %s", fn, strerror(-r));
+                        return r;
+                }
+
+                return 0;
+        }
+
+        if (r != -ENOENT) {
+                log_error("Failed to retrieve COREDUMP_FILENAME field: %s", strerror(-r));
+                return r;
         }
 
         r = sd_journal_get_data(j, "COREDUMP", (const void**) &data, &len);
@@ -409,12 +439,45 @@ static int dump_core(sd_journal* j) {
         data = (const uint8_t*) data + 9;
         len -= 9;
 
-        ret = fwrite(data, len, 1, output ? output : stdout);
-        if (ret != 1) {
-                log_error("dumping coredump: %m (%zu)", ret);
-                return -errno;
+        n = loop_write(fd, data, len, false);
+        if (n < 0) {
+                log_error("Failed to write core: %s", strerror(-n));
+                return (int) n;
+        }
+        if ((size_t) n != len) {
+                log_error("Short write of core.");
+                return -EIO;
+        }
+
+        return 0;
+}
+
+static int dump_core(sd_journal* j) {
+        int r;
+
+        assert(j);
+
+        /* We want full data, nothing truncated. */
+        sd_journal_set_data_threshold(j, 0);
+
+        r = focus(j);
+        if (r < 0)
+                return r;
+
+        print_entry(output ? stdout : stderr, j, false);
+
+        if (on_tty() && !output) {
+                log_error("Refusing to dump core to tty");
+                return -ENOTTY;
         }
 
+        if (output)
+                fflush(output);
+
+        r = save_core(j, output ? fileno(output) : STDOUT_FILENO);
+        if (r < 0)
+                return r;
+
         r = sd_journal_previous(j);
         if (r >= 0)
                 log_warning("More than one entry matches, ignoring rest.\n");
@@ -426,7 +489,6 @@ static int run_gdb(sd_journal *j) {
         char path[] = "/var/tmp/coredump-XXXXXX";
         const void *data;
         size_t len;
-        ssize_t sz;
         pid_t pid;
         _cleanup_free_ char *exe = NULL;
         int r;
@@ -462,33 +524,15 @@ static int run_gdb(sd_journal *j) {
                 return -ENOENT;
         }
 
-        r = sd_journal_get_data(j, "COREDUMP", (const void**) &data, &len);
-        if (r < 0) {
-                log_error("Failed to retrieve COREDUMP field: %s", strerror(-r));
-                return r;
-        }
-
-        assert(len >= 9);
-        data = (const uint8_t*) data + 9;
-        len -= 9;
-
         fd = mkostemp(path, O_WRONLY);
         if (fd < 0) {
                 log_error("Failed to create temporary file: %m");
                 return -errno;
         }
 
-        sz = write(fd, data, len);
-        if (sz < 0) {
-                log_error("Failed to write temporary file: %s", strerror(errno));
-                r = -errno;
-                goto finish;
-        }
-        if (sz != (ssize_t) len) {
-                log_error("Short write to temporary file.");
-                r = -EIO;
+        r = save_core(j, fd);
+        if (r < 0)
                 goto finish;
-        }
 
         close_nointr_nofail(fd);
         fd = -1;
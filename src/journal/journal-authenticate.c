@@ -274,9 +274,21 @@ int journal_file_hmac_put_object(JournalFile *f, int type, Object *o, uint64_t p
         case OBJECT_FIELD_HASH_TABLE:
         case OBJECT_DATA_HASH_TABLE:
         case OBJECT_ENTRY_ARRAY:
+        case OBJECT_ENTRY_ARRAY_INDEX:
+        case OBJECT_BOOT_INDEX:
                 /* Nothing: everything is mutable */
                 break;
 
+        case OBJECT_FIELD_SUMMARY:
+                /* All */
+                gcry_md_write(f->hmac, &o->field_summary.field_offset, le64toh(o->object.size) - offsetof(FieldSummaryObject, field_offset));
+                break;
+
+        case OBJECT_TEXT_INDEX:
+                /* All */
+                gcry_md_write(f->hmac, &o->text_index.n_entries, le64toh(o->object.size) - offsetof(TextIndexObject, n_entries));
+                break;
+
         case OBJECT_TAG:
                 /* All but the tag itself */
                 gcry_md_write(f->hmac, &o->tag.seqnum, sizeof(o->tag.seqnum));
@@ -306,7 +318,10 @@ int journal_file_hmac_put_header(JournalFile *f) {
          * tail_entry_seqnum, head_entry_seqnum, entry_array_offset,
          * head_entry_realtime, tail_entry_realtime,
          * tail_entry_monotonic, n_data, n_fields, n_tags,
-         * n_entry_arrays. */
+         * n_entry_arrays, data_hash_chain_depth,
+         * field_hash_chain_depth, entry_array_index_offset,
+         * field_summary_offset, boot_index_offset,
+         * text_index_offset. */
 
         gcry_md_write(f->hmac, f->header->signature, offsetof(Header, state) - offsetof(Header, signature));
         gcry_md_write(f->hmac, &f->header->file_id, offsetof(Header, boot_id) - offsetof(Header, file_id));
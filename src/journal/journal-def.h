@@ -45,9 +45,17 @@ typedef struct EntryObject EntryObject;
 typedef struct HashTableObject HashTableObject;
 typedef struct EntryArrayObject EntryArrayObject;
 typedef struct TagObject TagObject;
+typedef struct EntryArrayIndexObject EntryArrayIndexObject;
+typedef struct FieldSummaryObject FieldSummaryObject;
+typedef struct BootIndexObject BootIndexObject;
+typedef struct TextIndexObject TextIndexObject;
 
 typedef struct EntryItem EntryItem;
 typedef struct HashItem HashItem;
+typedef struct EntryArrayIndexItem EntryArrayIndexItem;
+typedef struct FieldSummaryItem FieldSummaryItem;
+typedef struct BootIndexItem BootIndexItem;
+typedef struct TextIndexToken TextIndexToken;
 
 typedef struct FSSHeader FSSHeader;
 
@@ -61,14 +69,22 @@ enum {
         OBJECT_FIELD_HASH_TABLE,
         OBJECT_ENTRY_ARRAY,
         OBJECT_TAG,
+        OBJECT_ENTRY_ARRAY_INDEX,
+        OBJECT_FIELD_SUMMARY,
+        OBJECT_BOOT_INDEX,
+        OBJECT_TEXT_INDEX,
         _OBJECT_TYPE_MAX
 };
 
 /* Object flags */
 enum {
-        OBJECT_COMPRESSED = 1
+        OBJECT_COMPRESSED_XZ = 1 << 0,
+        OBJECT_COMPRESSED_LZ4 = 1 << 1,
+        _OBJECT_COMPRESSED_MAX
 };
 
+#define OBJECT_COMPRESSION_MASK (OBJECT_COMPRESSED_XZ | OBJECT_COMPRESSED_LZ4)
+
 struct ObjectHeader {
         uint8_t type;
         uint8_t flags;
@@ -136,6 +152,92 @@ struct TagObject {
         uint8_t tag[TAG_LENGTH]; /* SHA-256 HMAC */
 } _packed_;
 
+/* One fence post per array in the main entry array chain, so that
+ * seeks can jump straight to the right array instead of walking the
+ * chain from its head. Since each array is twice the size of the
+ * previous one, a fixed number of slots covers any file. */
+#define ENTRY_ARRAY_INDEX_ITEMS_MAX 64
+
+struct EntryArrayIndexItem {
+        le64_t entry_array_offset;
+        le64_t total; /* the number of items in all arrays before this one */
+        le64_t entry_offset; /* the first entry in this array */
+        le64_t seqnum;
+        le64_t realtime;
+} _packed_;
+
+struct EntryArrayIndexObject {
+        ObjectHeader object;
+        le64_t n_items;
+        EntryArrayIndexItem items[];
+} _packed_;
+
+/* The distinct values of one field, with the number of entries and
+ * the time range they appear in. Written when a file is closed, for
+ * fields with at most FIELD_SUMMARY_ITEMS_MAX distinct values. */
+#define FIELD_SUMMARY_ITEMS_MAX 1024
+
+struct FieldSummaryItem {
+        le64_t data_offset;
+        le64_t n_entries;
+        le64_t first_realtime;
+        le64_t last_realtime;
+} _packed_;
+
+struct FieldSummaryObject {
+        ObjectHeader object;
+        le64_t field_offset;
+        le64_t next_summary_offset;
+        le64_t n_entries; /* n_entries of the file when this was written */
+        FieldSummaryItem items[];
+} _packed_;
+
+/* The range of entries each boot wrote to the file, updated as
+ * entries are appended. Objects are chained from the newest one
+ * referenced by the header back to the oldest. */
+#define BOOT_INDEX_ITEMS_MAX 16
+
+struct BootIndexItem {
+        sd_id128_t boot_id;
+        le64_t first_seqnum;
+        le64_t last_seqnum;
+        le64_t first_realtime;
+        le64_t last_realtime;
+        le64_t first_entry_offset;
+        le64_t last_entry_offset;
+} _packed_;
+
+struct BootIndexObject {
+        ObjectHeader object;
+        le64_t previous_index_offset;
+        le64_t n_items;
+        BootIndexItem items[];
+} _packed_;
+
+/* The words of all MESSAGE= values in the file, each with the data
+ * objects it appears in, in the order of their offsets. Words are
+ * stored as the hash64() of their lowercase form, and the postings
+ * of all words follow the last word as one array of data object
+ * offsets. Written when a file is archived, unless it would take
+ * more than TEXT_INDEX_POSTINGS_MAX postings. This happens on
+ * journald's main thread, and building an index of this size takes
+ * somewhere around 60ms, hence don't go higher. */
+#define TEXT_INDEX_POSTINGS_MAX (256U*1024U)
+
+struct TextIndexToken {
+        le64_t hash;
+        le64_t first_posting;
+        le64_t n_postings;
+} _packed_;
+
+struct TextIndexObject {
+        ObjectHeader object;
+        le64_t n_entries; /* n_entries of the file when this was written */
+        le64_t n_tokens;
+        le64_t n_postings;
+        TextIndexToken tokens[];
+} _packed_;
+
 union Object {
         ObjectHeader object;
         DataObject data;
@@ -144,6 +246,10 @@ union Object {
         HashTableObject hash_table;
         EntryArrayObject entry_array;
         TagObject tag;
+        EntryArrayIndexObject entry_array_index;
+        FieldSummaryObject field_summary;
+        BootIndexObject boot_index;
+        TextIndexObject text_index;
 };
 
 enum {
@@ -155,13 +261,38 @@ enum {
 
 /* Header flags */
 enum {
-        HEADER_INCOMPATIBLE_COMPRESSED = 1
+        HEADER_INCOMPATIBLE_COMPRESSED_XZ = 1 << 0,
+        HEADER_INCOMPATIBLE_COMPRESSED_LZ4 = 1 << 1,
 };
 
+#define HEADER_INCOMPATIBLE_ANY (HEADER_INCOMPATIBLE_COMPRESSED_XZ|HEADER_INCOMPATIBLE_COMPRESSED_LZ4)
+
+#if defined(HAVE_XZ) && defined(HAVE_LZ4)
+#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_ANY
+#elif defined(HAVE_XZ)
+#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_COMPRESSED_XZ
+#elif defined(HAVE_LZ4)
+#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_COMPRESSED_LZ4
+#else
+#  define HEADER_INCOMPATIBLE_SUPPORTED 0
+#endif
+
 enum {
-        HEADER_COMPATIBLE_SEALED = 1
+        HEADER_COMPATIBLE_SEALED = 1 << 0,
+        HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX = 1 << 1,
+        HEADER_COMPATIBLE_FIELD_SUMMARY = 1 << 2,
+        HEADER_COMPATIBLE_BOOT_INDEX = 1 << 3,
+        HEADER_COMPATIBLE_TEXT_INDEX = 1 << 4,
 };
 
+#define HEADER_COMPATIBLE_ANY (HEADER_COMPATIBLE_SEALED|HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX|HEADER_COMPATIBLE_FIELD_SUMMARY|HEADER_COMPATIBLE_BOOT_INDEX|HEADER_COMPATIBLE_TEXT_INDEX)
+
+#ifdef HAVE_GCRYPT
+#  define HEADER_COMPATIBLE_SUPPORTED HEADER_COMPATIBLE_ANY
+#else
+#  define HEADER_COMPATIBLE_SUPPORTED (HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX|HEADER_COMPATIBLE_FIELD_SUMMARY|HEADER_COMPATIBLE_BOOT_INDEX|HEADER_COMPATIBLE_TEXT_INDEX)
+#endif
+
 #define HEADER_SIGNATURE ((char[]) { 'L', 'P', 'K', 'S', 'H', 'H', 'R', 'H' })
 
 struct Header {
@@ -195,8 +326,15 @@ struct Header {
         /* Added in 189 */
         le64_t n_tags;
         le64_t n_entry_arrays;
-
-        /* Size: 224 */
+        /* Added in 209 */
+        le64_t data_hash_chain_depth;
+        le64_t field_hash_chain_depth;
+        le64_t entry_array_index_offset;
+        le64_t field_summary_offset;
+        le64_t boot_index_offset;
+        le64_t text_index_offset;
+
+        /* Size: 288 */
 } _packed_;
 
 #define FSS_HEADER_SIGNATURE ((char[]) { 'K', 'S', 'H', 'H', 'R', 'H', 'L', 'P' })
@@ -26,6 +26,7 @@
 #include <sys/statvfs.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <signal.h>
 
 #ifdef HAVE_XATTR
 #include <attr/xattr.h>
@@ -37,6 +38,7 @@
 #include "lookup3.h"
 #include "compress.h"
 #include "fsprg.h"
+#include "set.h"
 
 #define DEFAULT_DATA_HASH_TABLE_SIZE (2047ULL*sizeof(HashItem))
 #define DEFAULT_FIELD_HASH_TABLE_SIZE (333ULL*sizeof(HashItem))
@@ -62,13 +64,209 @@
  * size */
 #define DEFAULT_KEEP_FREE (1024ULL*1024ULL)                    /* 1 MB */
 
+/* How much to allocate ahead of the tail of a file at most, if not
+ * set explicitly */
+#define DEFAULT_PREALLOCATE_UPPER (8ULL*1024ULL*1024ULL)       /* 8 MiB */
+
 /* n_data was the first entry we added after the initial file format design */
 #define HEADER_SIZE_MIN ALIGN64(offsetof(Header, n_data))
 
 /* How many entries to keep in the entry array chain cache at max */
 #define CHAIN_CACHE_MAX 20
 
+/* If a hash table chain grows longer than this, suggest a rotation,
+ * so that the next file gets a bigger hash table */
+#define HASH_CHAIN_DEPTH_MAX 100
+
+static int journal_file_check_keep_free(JournalFile *f, uint64_t old_size, uint64_t new_size) {
+        struct statvfs svfs;
+        uint64_t available;
+
+        assert(f);
+
+        if (new_size <= f->metrics.min_size ||
+            f->metrics.keep_free <= 0)
+                return 0;
+
+        if (fstatvfs(f->fd, &svfs) < 0)
+                return 0;
+
+        available = svfs.f_bfree * svfs.f_bsize;
+
+        if (available >= f->metrics.keep_free)
+                available -= f->metrics.keep_free;
+        else
+                available = 0;
+
+        if (new_size - old_size > available)
+                return -E2BIG;
+
+        return 0;
+}
+
+/* Runs in the offline thread. Tops up the space allocated ahead of
+ * the tail, so that writers don't have to wait for the file to grow
+ * in the middle of a burst. Only the file and preallocated_size are
+ * touched here, the main thread claims the space later on. */
+static void journal_file_preallocate(JournalFile *f) {
+        uint64_t tail, target;
+        struct stat st;
+        int r;
+
+        assert(f);
+
+        if (f->metrics.preallocate <= 0)
+                return;
+
+        if (fstat(f->fd, &st) < 0)
+                return;
+
+        tail = le64toh(f->header->tail_object_offset);
+
+        /* Enough left still */
+        if ((uint64_t) st.st_size >= tail + f->metrics.preallocate / 2)
+                return;
+
+        target = PAGE_ALIGN(tail + f->metrics.preallocate);
+        if (f->metrics.max_size > 0 &&
+            target > f->metrics.max_size)
+                target = f->metrics.max_size;
+
+        if (target <= (uint64_t) st.st_size)
+                return;
+
+        if (journal_file_check_keep_free(f, st.st_size, target) < 0)
+                return;
+
+        r = posix_fallocate(f->fd, st.st_size, target - st.st_size);
+        if (r != 0)
+                return;
+
+        f->preallocated_size = target;
+        __sync_synchronize();
+}
+
+static int journal_file_set_offline_thread_join(JournalFile *f) {
+        int r;
+
+        assert(f);
+
+        if (f->offline_state == OFFLINE_JOINED)
+                return 0;
+
+        r = pthread_join(f->offline_thread, NULL);
+        if (r)
+                return -r;
+
+        f->offline_state = OFFLINE_JOINED;
+
+        return 0;
+}
+
+/* Runs in the offline thread, or in the main thread when waiting */
+static void journal_file_set_offline_internal(JournalFile *f) {
+        assert(f);
+        assert(f->fd >= 0);
+        assert(f->header);
+
+        for (;;) {
+                switch (f->offline_state) {
+
+                case OFFLINE_CANCEL:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_CANCEL, OFFLINE_DONE))
+                                continue;
+                        return;
+
+                case OFFLINE_AGAIN_FROM_SYNCING:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_AGAIN_FROM_SYNCING, OFFLINE_SYNCING))
+                                continue;
+                        break;
+
+                case OFFLINE_AGAIN_FROM_OFFLINING:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_AGAIN_FROM_OFFLINING, OFFLINE_SYNCING))
+                                continue;
+                        break;
+
+                case OFFLINE_SYNCING:
+                        fsync(f->fd);
+
+                        /* If the main thread appended in the
+                         * meantime the file stays online */
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_SYNCING, OFFLINE_OFFLINING))
+                                continue;
+
+                        f->header->state = STATE_OFFLINE;
+                        fsync(f->fd);
+                        break;
+
+                case OFFLINE_OFFLINING:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_OFFLINING, OFFLINE_DONE))
+                                continue;
+                        return;
+
+                case OFFLINE_DONE:
+                        return;
+
+                case OFFLINE_JOINED:
+                        log_debug("Unexpected offline state OFFLINE_JOINED for %s", f->path);
+                        return;
+                }
+        }
+}
+
+static void *journal_file_set_offline_thread(void *arg) {
+        JournalFile *f = arg;
+
+        journal_file_preallocate(f);
+        journal_file_set_offline_internal(f);
+
+        return NULL;
+}
+
+/* Makes a thread that is still running go through another round,
+ * so that it covers what was appended since it started */
+static int journal_file_set_offline_try_restart(JournalFile *f) {
+        for (;;) {
+                switch (f->offline_state) {
+
+                case OFFLINE_AGAIN_FROM_SYNCING:
+                case OFFLINE_AGAIN_FROM_OFFLINING:
+                        return 0;
+
+                case OFFLINE_CANCEL:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_CANCEL, OFFLINE_AGAIN_FROM_SYNCING))
+                                continue;
+                        return 0;
+
+                case OFFLINE_SYNCING:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_SYNCING, OFFLINE_AGAIN_FROM_SYNCING))
+                                continue;
+                        return 0;
+
+                case OFFLINE_OFFLINING:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_OFFLINING, OFFLINE_AGAIN_FROM_OFFLINING))
+                                continue;
+                        return 0;
+
+                default:
+                        return -EBUSY;
+                }
+        }
+}
+
+bool journal_file_is_offlining(JournalFile *f) {
+        assert(f);
+
+        __sync_synchronize();
+
+        return f->offline_state != OFFLINE_DONE &&
+                f->offline_state != OFFLINE_JOINED;
+}
+
 int journal_file_set_online(JournalFile *f) {
+        bool wait = true;
+        int r;
+
         assert(f);
 
         if (!f->writable)
@@ -77,6 +275,44 @@ int journal_file_set_online(JournalFile *f) {
         if (!(f->fd >= 0 && f->header))
                 return -EINVAL;
 
+        /* Cancel an offlining that hasn't touched the header yet,
+         * otherwise wait for it to finish before we mark the file
+         * online again */
+        while (wait) {
+                switch (f->offline_state) {
+
+                case OFFLINE_JOINED:
+                        wait = false;
+                        break;
+
+                case OFFLINE_SYNCING:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_SYNCING, OFFLINE_CANCEL))
+                                continue;
+                        wait = false;
+                        break;
+
+                case OFFLINE_AGAIN_FROM_SYNCING:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_AGAIN_FROM_SYNCING, OFFLINE_CANCEL))
+                                continue;
+                        wait = false;
+                        break;
+
+                case OFFLINE_AGAIN_FROM_OFFLINING:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_AGAIN_FROM_OFFLINING, OFFLINE_CANCEL))
+                                continue;
+                        /* fall through, the header is being
+                         * written still */
+
+                default:
+                        r = journal_file_set_offline_thread_join(f);
+                        if (r < 0)
+                                return r;
+
+                        wait = false;
+                        break;
+                }
+        }
+
         switch(f->header->state) {
                 case STATE_ONLINE:
                         return 0;
@@ -91,7 +327,13 @@ int journal_file_set_online(JournalFile *f) {
         }
 }
 
-int journal_file_set_offline(JournalFile *f) {
+/* Syncs the file and marks it offline. Unless told to wait this
+ * happens in a thread of its own, so that the caller can go on
+ * appending, which cancels the offlining again. */
+int journal_file_set_offline(JournalFile *f, bool wait) {
+        sigset_t ss, saved_ss;
+        int r, restarted;
+
         assert(f);
 
         if (!f->writable)
@@ -100,14 +342,44 @@ int journal_file_set_offline(JournalFile *f) {
         if (!(f->fd >= 0 && f->header))
                 return -EINVAL;
 
-        if (f->header->state != STATE_ONLINE)
+        /* An offlining file is implicitly online, any other file
+         * that is not online may still have a finished thread to
+         * join */
+        if (!journal_file_is_offlining(f) && f->header->state != STATE_ONLINE)
+                return journal_file_set_offline_thread_join(f);
+
+        restarted = journal_file_set_offline_try_restart(f);
+        if (restarted < 0 || wait) {
+                r = journal_file_set_offline_thread_join(f);
+                if (r < 0)
+                        return r;
+        }
+
+        if (restarted >= 0)
+                return 0;
+
+        f->offline_state = OFFLINE_SYNCING;
+
+        if (wait) {
+                journal_file_set_offline_internal(f);
+                f->offline_state = OFFLINE_JOINED;
                 return 0;
+        }
+
+        /* Signals are for the main thread only */
+        assert_se(sigfillset(&ss) >= 0);
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r)
+                return -r;
 
-        fsync(f->fd);
+        r = pthread_create(&f->offline_thread, NULL, journal_file_set_offline_thread, f);
 
-        f->header->state = STATE_OFFLINE;
+        assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
 
-        fsync(f->fd);
+        if (r) {
+                f->offline_state = OFFLINE_JOINED;
+                return -r;
+        }
 
         return 0;
 }
@@ -115,6 +387,13 @@ int journal_file_set_offline(JournalFile *f) {
 void journal_file_close(JournalFile *f) {
         assert(f);
 
+        /* Summarize what we wrote, before the final tag, so that it
+         * is covered by it. The text index is more expensive to
+         * build and hence only written when the file is archived,
+         * see journal_file_rotate(). */
+        if (f->writable && f->header && f->header->state == STATE_ONLINE)
+                journal_file_append_field_summaries(f);
+
 #ifdef HAVE_GCRYPT
         /* Write the final tag */
         if (f->seal && f->writable)
@@ -125,7 +404,7 @@ void journal_file_close(JournalFile *f) {
         if (f->mmap && f->fd >= 0)
                 mmap_cache_close_fd(f->mmap, f->fd);
 
-        journal_file_set_offline(f);
+        journal_file_set_offline(f, true);
 
         if (f->header)
                 munmap(f->header, PAGE_ALIGN(sizeof(Header)));
@@ -139,8 +418,10 @@ void journal_file_close(JournalFile *f) {
                 mmap_cache_unref(f->mmap);
 
         hashmap_free_free(f->chain_cache);
+        hashmap_free_free(f->match_cache);
+        free(f->field_cache);
 
-#ifdef HAVE_XZ
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
         free(f->compress_buffer);
 #endif
 
@@ -171,10 +452,15 @@ static int journal_file_init_header(JournalFile *f, JournalFile *template) {
         h.header_size = htole64(ALIGN64(sizeof(h)));
 
         h.incompatible_flags =
-                htole32(f->compress ? HEADER_INCOMPATIBLE_COMPRESSED : 0);
+                htole32((f->compress_xz ? HEADER_INCOMPATIBLE_COMPRESSED_XZ : 0) |
+                        (f->compress_lz4 ? HEADER_INCOMPATIBLE_COMPRESSED_LZ4 : 0));
 
         h.compatible_flags =
-                htole32(f->seal ? HEADER_COMPATIBLE_SEALED : 0);
+                htole32((f->seal ? HEADER_COMPATIBLE_SEALED : 0) |
+                        HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX |
+                        HEADER_COMPATIBLE_FIELD_SUMMARY |
+                        HEADER_COMPATIBLE_BOOT_INDEX |
+                        HEADER_COMPATIBLE_TEXT_INDEX);
 
         r = sd_id128_randomize(&h.file_id);
         if (r < 0)
@@ -232,25 +518,14 @@ static int journal_file_verify_header(JournalFile *f) {
 
         /* In both read and write mode we refuse to open files with
          * incompatible flags we don't know */
-#ifdef HAVE_XZ
-        if ((le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_COMPRESSED) != 0)
-                return -EPROTONOSUPPORT;
-#else
-        if (f->header->incompatible_flags != 0)
+        if ((le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_SUPPORTED) != 0)
                 return -EPROTONOSUPPORT;
-#endif
 
         /* When open for writing we refuse to open files with
          * compatible flags, too */
-        if (f->writable) {
-#ifdef HAVE_GCRYPT
-                if ((le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SEALED) != 0)
-                        return -EPROTONOSUPPORT;
-#else
-                if (f->header->compatible_flags != 0)
+        if (f->writable)
+                if ((le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SUPPORTED) != 0)
                         return -EPROTONOSUPPORT;
-#endif
-        }
 
         if (f->header->state >= _STATE_MAX)
                 return -EBADMSG;
@@ -305,7 +580,8 @@ static int journal_file_verify_header(JournalFile *f) {
                 }
         }
 
-        f->compress = JOURNAL_HEADER_COMPRESSED(f->header);
+        f->compress_xz = JOURNAL_HEADER_COMPRESSED_XZ(f->header);
+        f->compress_lz4 = JOURNAL_HEADER_COMPRESSED_LZ4(f->header);
 
         f->seal = JOURNAL_HEADER_SEALED(f->header);
 
@@ -313,7 +589,8 @@ static int journal_file_verify_header(JournalFile *f) {
 }
 
 static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size) {
-        uint64_t old_size, new_size;
+        uint64_t old_size, new_size, target;
+        usec_t start = 0;
         int r;
 
         assert(f);
@@ -337,36 +614,57 @@ static int journal_file_allocate(JournalFile *f, uint64_t offset, uint64_t size)
             new_size > f->metrics.max_size)
                 return -E2BIG;
 
-        if (new_size > f->metrics.min_size &&
-            f->metrics.keep_free > 0) {
-                struct statvfs svfs;
+        __sync_synchronize();
 
-                if (fstatvfs(f->fd, &svfs) >= 0) {
-                        uint64_t available;
+        if (new_size <= f->preallocated_size)
+                /* The offline thread got there first, claim all of
+                 * what it allocated. The blocks are there already,
+                 * which makes posix_fallocate() below cheap. */
+                target = f->preallocated_size;
+        else {
+                /* Grow by more than we need right now, so that the
+                 * next appends don't have to wait for this again.
+                 * If the preallocation is as large as the file may
+                 * grow, this reserves the whole file up front. */
+                target = new_size;
 
-                        available = svfs.f_bfree * svfs.f_bsize;
+                if (f->metrics.preallocate > 0) {
+                        target = PAGE_ALIGN(new_size + f->metrics.preallocate);
 
-                        if (available >= f->metrics.keep_free)
-                                available -= f->metrics.keep_free;
-                        else
-                                available = 0;
+                        if (f->metrics.max_size > 0 &&
+                            target > f->metrics.max_size)
+                                target = f->metrics.max_size;
 
-                        if (new_size - old_size > available)
-                                return -E2BIG;
+                        if (journal_file_check_keep_free(f, old_size, target) < 0)
+                                target = new_size;
                 }
+
+                r = journal_file_check_keep_free(f, old_size, target);
+                if (r < 0)
+                        return r;
+
+                /* Growing the file before anything was written to
+                 * it is expected, afterwards writers wait for it */
+                if (old_size > le64toh(f->header->header_size))
+                        start = now(CLOCK_MONOTONIC);
         }
 
         /* Note that the glibc fallocate() fallback is very
            inefficient, hence we try to minimize the allocation area
            as we can. */
-        r = posix_fallocate(f->fd, old_size, new_size - old_size);
+        r = posix_fallocate(f->fd, old_size, target - old_size);
         if (r != 0)
                 return -r;
 
         if (fstat(f->fd, &f->last_stat) < 0)
                 return -errno;
 
-        f->header->arena_size = htole64(new_size - le64toh(f->header->header_size));
+        f->header->arena_size = htole64(target - le64toh(f->header->header_size));
+
+        if (start > 0) {
+                f->n_allocation_stalls++;
+                f->allocation_stall_usec += now(CLOCK_MONOTONIC) - start;
+        }
 
         return 0;
 }
@@ -401,6 +699,10 @@ static uint64_t minimum_header_size(Object *o) {
                 [OBJECT_FIELD_HASH_TABLE] = sizeof(HashTableObject),
                 [OBJECT_ENTRY_ARRAY] = sizeof(EntryArrayObject),
                 [OBJECT_TAG] = sizeof(TagObject),
+                [OBJECT_ENTRY_ARRAY_INDEX] = sizeof(EntryArrayIndexObject),
+                [OBJECT_FIELD_SUMMARY] = sizeof(FieldSummaryObject),
+                [OBJECT_BOOT_INDEX] = sizeof(BootIndexObject),
+                [OBJECT_TEXT_INDEX] = sizeof(TextIndexObject),
         };
 
         if (o->object.type >= ELEMENTSOF(table) || table[o->object.type] <= 0)
@@ -458,21 +760,26 @@ int journal_file_move_to_object(JournalFile *f, int type, uint64_t offset, Objec
 }
 
 static uint64_t journal_file_entry_seqnum(JournalFile *f, uint64_t *seqnum) {
-        uint64_t r;
+        uint64_t r, t;
 
         assert(f);
 
-        r = le64toh(f->header->tail_entry_seqnum) + 1;
+        r = t = le64toh(f->header->tail_entry_seqnum) + 1;
 
         if (seqnum) {
+                uint64_t e;
+
                 /* If an external seqnum counter was passed, we update
                  * both the local and the external one, and set it to
-                 * the maximum of both */
-
-                if (*seqnum + 1 > r)
-                        r = *seqnum + 1;
-
-                *seqnum = r;
+                 * the maximum of both. The external one might be
+                 * shared with threads appending to other files, hence
+                 * update it atomically, so that no number is handed
+                 * out twice. */
+
+                do {
+                        e = *(volatile uint64_t*) seqnum;
+                        r = MAX(t, e + 1);
+                } while (!__sync_bool_compare_and_swap(seqnum, e, r));
         }
 
         f->header->tail_entry_seqnum = htole64(r);
@@ -483,22 +790,14 @@ static uint64_t journal_file_entry_seqnum(JournalFile *f, uint64_t *seqnum) {
         return r;
 }
 
-int journal_file_append_object(JournalFile *f, int type, uint64_t size, Object **ret, uint64_t *offset) {
-        int r;
+static int journal_file_tail_end(JournalFile *f, uint64_t *ret) {
+        Object *tail;
         uint64_t p;
-        Object *tail, *o;
-        void *t;
+        int r;
 
         assert(f);
-        assert(type > 0 && type < _OBJECT_TYPE_MAX);
-        assert(size >= sizeof(ObjectHeader));
-        assert(offset);
         assert(ret);
 
-        r = journal_file_set_online(f);
-        if (r < 0)
-                return r;
-
         p = le64toh(f->header->tail_object_offset);
         if (p == 0)
                 p = le64toh(f->header->header_size);
@@ -510,6 +809,30 @@ int journal_file_append_object(JournalFile *f, int type, uint64_t size, Object *
                 p += ALIGN64(le64toh(tail->object.size));
         }
 
+        *ret = p;
+        return 0;
+}
+
+int journal_file_append_object(JournalFile *f, int type, uint64_t size, Object **ret, uint64_t *offset) {
+        int r;
+        uint64_t p;
+        Object *o;
+        void *t;
+
+        assert(f);
+        assert(type > 0 && type < _OBJECT_TYPE_MAX);
+        assert(size >= sizeof(ObjectHeader));
+        assert(offset);
+        assert(ret);
+
+        r = journal_file_set_online(f);
+        if (r < 0)
+                return r;
+
+        r = journal_file_tail_end(f, &p);
+        if (r < 0)
+                return r;
+
         r = journal_file_allocate(f, p, size);
         if (r < 0)
                 return r;
@@ -533,7 +856,31 @@ int journal_file_append_object(JournalFile *f, int type, uint64_t size, Object *
         return 0;
 }
 
-static int journal_file_setup_data_hash_table(JournalFile *f) {
+static uint64_t journal_file_successor_hash_table_size(JournalFile *f, le64_t n_objects, le64_t chain_depth) {
+        uint64_t n, s;
+
+        assert(f);
+
+        /* Make sure the successor of a file has room for as many
+           objects as its predecessor ended up with, at 75% fill
+           level. If the hash chains of the predecessor got too
+           long, allow for twice as many. But never let a hash table
+           take more than a quarter of the file. */
+
+        n = le64toh(n_objects);
+
+        if (le64toh(chain_depth) > HASH_CHAIN_DEPTH_MAX)
+                n *= 2;
+
+        s = n * 4 / 3 * sizeof(HashItem);
+
+        if (f->metrics.max_size > 0)
+                s = MIN(s, f->metrics.max_size / 4 / sizeof(HashItem) * sizeof(HashItem));
+
+        return s;
+}
+
+static int journal_file_setup_data_hash_table(JournalFile *f, JournalFile *template) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -549,6 +896,11 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         if (s < DEFAULT_DATA_HASH_TABLE_SIZE)
                 s = DEFAULT_DATA_HASH_TABLE_SIZE;
 
+        if (template && JOURNAL_HEADER_CONTAINS(template->header, data_hash_chain_depth))
+                s = MAX(s, journal_file_successor_hash_table_size(f,
+                                                                  template->header->n_data,
+                                                                  template->header->data_hash_chain_depth));
+
         log_debug("Reserving %"PRIu64" entries in hash table.", s / sizeof(HashItem));
 
         r = journal_file_append_object(f,
@@ -566,7 +918,7 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         return 0;
 }
 
-static int journal_file_setup_field_hash_table(JournalFile *f) {
+static int journal_file_setup_field_hash_table(JournalFile *f, JournalFile *template) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -574,9 +926,16 @@ static int journal_file_setup_field_hash_table(JournalFile *f) {
         assert(f);
 
         /* We use a fixed size hash table for the fields as this
-         * number should grow very slowly only */
+         * number should grow very slowly only, unless our
+         * predecessor proved otherwise */
 
         s = DEFAULT_FIELD_HASH_TABLE_SIZE;
+
+        if (template && JOURNAL_HEADER_CONTAINS(template->header, field_hash_chain_depth))
+                s = MAX(s, journal_file_successor_hash_table_size(f,
+                                                                  template->header->n_fields,
+                                                                  template->header->field_hash_chain_depth));
+
         r = journal_file_append_object(f,
                                        OBJECT_FIELD_HASH_TABLE,
                                        offsetof(Object, hash_table.items) + s,
@@ -727,7 +1086,7 @@ int journal_file_find_field_object_with_hash(
                 const void *field, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h;
+        uint64_t p, osize, h, depth = 0;
         int r;
 
         assert(f);
@@ -761,8 +1120,16 @@ int journal_file_find_field_object_with_hash(
                 }
 
                 p = le64toh(o->field.next_hash_offset);
+                depth++;
         }
 
+        /* Remember the longest chain we had to walk to its end,
+         * i.e. before appending a new object to it */
+        if (f->writable &&
+            JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth) &&
+            depth > le64toh(f->header->field_hash_chain_depth))
+                f->header->field_hash_chain_depth = htole64(depth);
+
         return 0;
 }
 
@@ -788,7 +1155,7 @@ int journal_file_find_data_object_with_hash(
                 const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h;
+        uint64_t p, osize, h, depth = 0;
         int r;
 
         assert(f);
@@ -812,8 +1179,8 @@ int journal_file_find_data_object_with_hash(
                 if (le64toh(o->data.hash) != hash)
                         goto next;
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
+                if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
                         uint64_t l, rsize;
 
                         l = le64toh(o->object.size);
@@ -822,7 +1189,9 @@ int journal_file_find_data_object_with_hash(
 
                         l -= offsetof(Object, data.payload);
 
-                        if (!uncompress_blob(o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0))
+                        if (!uncompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                                             o->data.payload, l,
+                                             &f->compress_buffer, &f->compress_buffer_size, &rsize, 0))
                                 return -EBADMSG;
 
                         if (rsize == size &&
@@ -854,8 +1223,16 @@ int journal_file_find_data_object_with_hash(
 
         next:
                 p = le64toh(o->data.next_hash_offset);
+                depth++;
         }
 
+        /* Remember the longest chain we had to walk to its end,
+         * i.e. before appending a new object to it */
+        if (f->writable &&
+            JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth) &&
+            depth > le64toh(f->header->data_hash_chain_depth))
+                f->header->data_hash_chain_depth = htole64(depth);
+
         return 0;
 }
 
@@ -938,23 +1315,20 @@ static int journal_file_append_field(
         return 0;
 }
 
-static int journal_file_append_data(
+static int journal_file_append_data_with_hash(
                 JournalFile *f,
-                const void *data, uint64_t size,
+                const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t hash, p;
+        uint64_t p;
         uint64_t osize;
         Object *o;
-        int r;
-        bool compressed = false;
+        int r, compression = 0;
         const void *eq;
 
         assert(f);
         assert(data || size == 0);
 
-        hash = hash64(data, size);
-
         r = journal_file_find_data_object_with_hash(f, data, size, hash, &o, &p);
         if (r < 0)
                 return r;
@@ -976,23 +1350,25 @@ static int journal_file_append_data(
 
         o->data.hash = htole64(hash);
 
-#ifdef HAVE_XZ
-        if (f->compress &&
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        if (JOURNAL_FILE_COMPRESS(f) &&
             size >= COMPRESSION_SIZE_THRESHOLD) {
                 uint64_t rsize;
 
-                compressed = compress_blob(data, size, o->data.payload, &rsize);
+                compression = f->compress_lz4 ? OBJECT_COMPRESSED_LZ4 : OBJECT_COMPRESSED_XZ;
 
-                if (compressed) {
+                if (compress_blob(compression, data, size, o->data.payload, &rsize)) {
                         o->object.size = htole64(offsetof(Object, data.payload) + rsize);
-                        o->object.flags |= OBJECT_COMPRESSED;
+                        o->object.flags |= compression;
 
-                        log_debug("Compressed data object %"PRIu64" -> %"PRIu64, size, rsize);
-                }
+                        log_debug("Compressed data object %"PRIu64" -> %"PRIu64" using %s",
+                                  size, rsize, object_compressed_to_string(compression));
+                } else
+                        compression = 0;
         }
 #endif
 
-        if (!compressed && size > 0)
+        if (!compression && size > 0)
                 memcpy(o->data.payload, data, size);
 
         r = journal_file_link_data(f, o, p, hash);
@@ -1035,6 +1411,17 @@ static int journal_file_append_data(
         return 0;
 }
 
+static int journal_file_append_data(
+                JournalFile *f,
+                const void *data, uint64_t size,
+                Object **ret, uint64_t *offset) {
+
+        assert(f);
+        assert(data || size == 0);
+
+        return journal_file_append_data_with_hash(f, data, size, hash64(data, size), ret, offset);
+}
+
 uint64_t journal_file_entry_n_items(Object *o) {
         assert(o);
 
@@ -1053,50 +1440,148 @@ uint64_t journal_file_entry_array_n_items(Object *o) {
         return (le64toh(o->object.size) - offsetof(Object, entry_array.items)) / sizeof(uint64_t);
 }
 
-uint64_t journal_file_hash_table_n_items(Object *o) {
+uint64_t journal_file_entry_array_index_n_items(Object *o) {
         assert(o);
 
-        if (o->object.type != OBJECT_DATA_HASH_TABLE &&
-            o->object.type != OBJECT_FIELD_HASH_TABLE)
+        if (o->object.type != OBJECT_ENTRY_ARRAY_INDEX)
                 return 0;
 
-        return (le64toh(o->object.size) - offsetof(Object, hash_table.items)) / sizeof(HashItem);
+        return (le64toh(o->object.size) - offsetof(Object, entry_array_index.items)) / sizeof(EntryArrayIndexItem);
 }
 
-static int link_entry_into_array(JournalFile *f,
-                                 le64_t *first,
-                                 le64_t *idx,
-                                 uint64_t p) {
-        int r;
-        uint64_t n = 0, ap = 0, q, i, a, hidx;
-        Object *o;
+uint64_t journal_file_field_summary_n_items(Object *o) {
+        assert(o);
 
-        assert(f);
-        assert(first);
-        assert(idx);
-        assert(p > 0);
+        if (o->object.type != OBJECT_FIELD_SUMMARY)
+                return 0;
 
-        a = le64toh(*first);
-        i = hidx = le64toh(*idx);
-        while (a > 0) {
+        return (le64toh(o->object.size) - offsetof(Object, field_summary.items)) / sizeof(FieldSummaryItem);
+}
 
-                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
-                if (r < 0)
-                        return r;
+uint64_t journal_file_boot_index_n_items(Object *o) {
+        assert(o);
 
-                n = journal_file_entry_array_n_items(o);
-                if (i < n) {
-                        o->entry_array.items[i] = htole64(p);
-                        *idx = htole64(hidx + 1);
-                        return 0;
-                }
+        if (o->object.type != OBJECT_BOOT_INDEX)
+                return 0;
 
-                i -= n;
-                ap = a;
-                a = le64toh(o->entry_array.next_entry_array_offset);
-        }
+        return (le64toh(o->object.size) - offsetof(Object, boot_index.items)) / sizeof(BootIndexItem);
+}
 
-        if (hidx > n)
+le64_t *journal_file_text_index_postings(Object *o) {
+        assert(o);
+        assert(o->object.type == OBJECT_TEXT_INDEX);
+
+        return (le64_t*) (o->text_index.tokens + le64toh(o->text_index.n_tokens));
+}
+
+static bool journal_file_has_entry_array_index(JournalFile *f) {
+        assert(f);
+
+        return JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header) &&
+                JOURNAL_HEADER_CONTAINS(f->header, entry_array_index_offset);
+}
+
+static int journal_file_link_entry_array_index(JournalFile *f, uint64_t array, uint64_t total, uint64_t p) {
+        uint64_t q, n;
+        le64_t seqnum, realtime;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(array > 0);
+        assert(p > 0);
+
+        if (!f->writable || !journal_file_has_entry_array_index(f))
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
+        if (r < 0)
+                return r;
+
+        seqnum = o->entry.seqnum;
+        realtime = o->entry.realtime;
+
+        q = le64toh(f->header->entry_array_index_offset);
+        if (q == 0) {
+                r = journal_file_append_object(f, OBJECT_ENTRY_ARRAY_INDEX,
+                                               offsetof(Object, entry_array_index.items) + ENTRY_ARRAY_INDEX_ITEMS_MAX * sizeof(EntryArrayIndexItem),
+                                               &o, &q);
+                if (r < 0)
+                        return r;
+
+#ifdef HAVE_GCRYPT
+                r = journal_file_hmac_put_object(f, OBJECT_ENTRY_ARRAY_INDEX, o, q);
+                if (r < 0)
+                        return r;
+#endif
+
+                f->header->entry_array_index_offset = htole64(q);
+        } else {
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY_INDEX, q, &o);
+                if (r < 0)
+                        return r;
+        }
+
+        /* If the index is full the remaining arrays are simply
+         * found by walking the chain from the last one indexed */
+        n = le64toh(o->entry_array_index.n_items);
+        if (n >= journal_file_entry_array_index_n_items(o))
+                return 0;
+
+        o->entry_array_index.items[n].entry_array_offset = htole64(array);
+        o->entry_array_index.items[n].total = htole64(total);
+        o->entry_array_index.items[n].entry_offset = htole64(p);
+        o->entry_array_index.items[n].seqnum = seqnum;
+        o->entry_array_index.items[n].realtime = realtime;
+        o->entry_array_index.n_items = htole64(n + 1);
+
+        return 0;
+}
+
+uint64_t journal_file_hash_table_n_items(Object *o) {
+        assert(o);
+
+        if (o->object.type != OBJECT_DATA_HASH_TABLE &&
+            o->object.type != OBJECT_FIELD_HASH_TABLE)
+                return 0;
+
+        return (le64toh(o->object.size) - offsetof(Object, hash_table.items)) / sizeof(HashItem);
+}
+
+static int link_entry_into_array(JournalFile *f,
+                                 le64_t *first,
+                                 le64_t *idx,
+                                 uint64_t p) {
+        int r;
+        uint64_t n = 0, ap = 0, q, i, a, hidx;
+        Object *o;
+
+        assert(f);
+        assert(first);
+        assert(idx);
+        assert(p > 0);
+
+        a = le64toh(*first);
+        i = hidx = le64toh(*idx);
+        while (a > 0) {
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
+                if (r < 0)
+                        return r;
+
+                n = journal_file_entry_array_n_items(o);
+                if (i < n) {
+                        o->entry_array.items[i] = htole64(p);
+                        *idx = htole64(hidx + 1);
+                        return 0;
+                }
+
+                i -= n;
+                ap = a;
+                a = le64toh(o->entry_array.next_entry_array_offset);
+        }
+
+        if (hidx > n)
                 n = (hidx+1) * 2;
         else
                 n = n * 2;
@@ -1131,6 +1616,12 @@ static int link_entry_into_array(JournalFile *f,
         if (JOURNAL_HEADER_CONTAINS(f->header, n_entry_arrays))
                 f->header->n_entry_arrays = htole64(le64toh(f->header->n_entry_arrays) + 1);
 
+        if (first == &f->header->entry_array_offset) {
+                r = journal_file_link_entry_array_index(f, q, hidx, p);
+                if (r < 0)
+                        return r;
+        }
+
         *idx = htole64(hidx + 1);
 
         return 0;
@@ -1187,6 +1678,130 @@ static int journal_file_link_entry_item(JournalFile *f, Object *o, uint64_t offs
                                               offset);
 }
 
+static bool journal_file_has_boot_index(JournalFile *f) {
+        assert(f);
+
+        return JOURNAL_HEADER_BOOT_INDEX(f->header) &&
+                JOURNAL_HEADER_CONTAINS(f->header, boot_index_offset);
+}
+
+static int journal_file_link_boot_index(JournalFile *f, uint64_t p) {
+        sd_id128_t boot_id;
+        le64_t seqnum, realtime;
+        uint64_t q, n = 0;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(p > 0);
+
+        if (!f->writable || !journal_file_has_boot_index(f))
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
+        if (r < 0)
+                return r;
+
+        boot_id = o->entry.boot_id;
+        seqnum = o->entry.seqnum;
+        realtime = o->entry.realtime;
+
+        q = le64toh(f->header->boot_index_offset);
+        if (q != 0) {
+                r = journal_file_move_to_object(f, OBJECT_BOOT_INDEX, q, &o);
+                if (r < 0)
+                        return r;
+
+                /* The common case: another entry from the same boot
+                 * as the last one, just move the end of its range */
+                n = le64toh(o->boot_index.n_items);
+                if (n > 0 && sd_id128_equal(o->boot_index.items[n-1].boot_id, boot_id)) {
+                        o->boot_index.items[n-1].last_seqnum = seqnum;
+                        o->boot_index.items[n-1].last_realtime = realtime;
+                        o->boot_index.items[n-1].last_entry_offset = htole64(p);
+                        return 0;
+                }
+        }
+
+        if (q == 0 || n >= journal_file_boot_index_n_items(o)) {
+                uint64_t previous = q;
+
+                r = journal_file_append_object(f, OBJECT_BOOT_INDEX,
+                                               offsetof(Object, boot_index.items) + BOOT_INDEX_ITEMS_MAX * sizeof(BootIndexItem),
+                                               &o, &q);
+                if (r < 0)
+                        return r;
+
+#ifdef HAVE_GCRYPT
+                r = journal_file_hmac_put_object(f, OBJECT_BOOT_INDEX, o, q);
+                if (r < 0)
+                        return r;
+#endif
+
+                o->boot_index.previous_index_offset = htole64(previous);
+                f->header->boot_index_offset = htole64(q);
+                n = 0;
+        }
+
+        o->boot_index.items[n].boot_id = boot_id;
+        o->boot_index.items[n].first_seqnum = o->boot_index.items[n].last_seqnum = seqnum;
+        o->boot_index.items[n].first_realtime = o->boot_index.items[n].last_realtime = realtime;
+        o->boot_index.items[n].first_entry_offset = o->boot_index.items[n].last_entry_offset = htole64(p);
+        o->boot_index.n_items = htole64(n + 1);
+
+        return 0;
+}
+
+int journal_file_get_boot_index(JournalFile *f, BootIndexItem **ret, unsigned *n_ret) {
+        _cleanup_free_ BootIndexItem *items = NULL;
+        size_t n_allocated = 0;
+        unsigned n_items = 0;
+        uint64_t q, n, i;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(ret);
+        assert(n_ret);
+
+        /* Returns 0 if the file has no boot index, in which case
+         * the caller has to look at the entries themselves */
+        if (!journal_file_has_boot_index(f))
+                return 0;
+
+        q = le64toh(f->header->boot_index_offset);
+        while (q != 0) {
+                r = journal_file_move_to_object(f, OBJECT_BOOT_INDEX, q, &o);
+                if (r < 0)
+                        return r;
+
+                n = MIN(le64toh(o->boot_index.n_items), journal_file_boot_index_n_items(o));
+
+                if (!GREEDY_REALLOC(items, n_allocated, n_items + n + 1))
+                        return -ENOMEM;
+
+                /* Walking from the newest object backwards, hence
+                 * collect in reverse and flip it around at the end */
+                for (i = n; i > 0; i--)
+                        items[n_items++] = o->boot_index.items[i-1];
+
+                q = le64toh(o->boot_index.previous_index_offset);
+        }
+
+        for (i = 0; i < n_items / 2; i++) {
+                BootIndexItem t = items[i];
+
+                items[i] = items[n_items - 1 - i];
+                items[n_items - 1 - i] = t;
+        }
+
+        *ret = items;
+        *n_ret = n_items;
+        items = NULL;
+
+        return 1;
+}
+
 static int journal_file_link_entry(JournalFile *f, Object *o, uint64_t offset) {
         uint64_t n, i;
         int r;
@@ -1226,7 +1841,7 @@ static int journal_file_link_entry(JournalFile *f, Object *o, uint64_t offset) {
                         return r;
         }
 
-        return 0;
+        return journal_file_link_boot_index(f, offset);
 }
 
 static int journal_file_append_entry_internal(
@@ -1287,7 +1902,11 @@ void journal_file_post_change(JournalFile *f) {
 
         __sync_synchronize();
 
-        if (ftruncate(f->fd, f->last_stat.st_size) < 0)
+        /* Don't cut off what the offline thread allocated ahead of
+         * us. Should it not have succeeded yet the file ends up
+         * sparse beyond the arena, which is fine, since we always
+         * posix_fallocate() before claiming space. */
+        if (ftruncate(f->fd, MAX((uint64_t) f->last_stat.st_size, f->preallocated_size)) < 0)
                 log_error("Failed to truncate file to its own size: %m");
 }
 
@@ -1301,7 +1920,42 @@ static int entry_item_cmp(const void *_a, const void *_b) {
         return 0;
 }
 
-int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
+/* Payloads already appended during the current batch, so that
+ * fields repeated in every entry (_HOSTNAME=, _BOOT_ID=, ...) are
+ * looked up in memory rather than in the on-disk hash table */
+typedef struct DataCacheItem {
+        const void *data;
+        uint64_t size;
+        uint64_t hash;
+        uint64_t offset;
+} DataCacheItem;
+
+static unsigned data_cache_item_hash_func(const void *p) {
+        const DataCacheItem *i = p;
+
+        return (unsigned) i->hash;
+}
+
+static int data_cache_item_compare_func(const void *_a, const void *_b) {
+        const DataCacheItem *a = _a, *b = _b;
+
+        if (a->size != b->size)
+                return a->size < b->size ? -1 : 1;
+
+        if (a->size == 0)
+                return 0;
+
+        return memcmp(a->data, b->data, a->size);
+}
+
+static int journal_file_append_entry_cached(
+                JournalFile *f,
+                const dual_timestamp *ts,
+                const struct iovec iovec[], unsigned n_iovec,
+                Set *cache, DataCacheItem *cache_items,
+                uint64_t *seqnum,
+                Object **ret, uint64_t *offset) {
+
         unsigned i;
         EntryItem *items;
         int r;
@@ -1310,6 +1964,7 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
 
         assert(f);
         assert(iovec || n_iovec == 0);
+        assert(!cache || cache_items || n_iovec == 0);
 
         if (!ts) {
                 dual_timestamp_get(&_ts);
@@ -1330,23 +1985,130 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
         items = alloca(sizeof(EntryItem) * MAX(1u, n_iovec));
 
         for (i = 0; i < n_iovec; i++) {
-                uint64_t p;
-                Object *o;
+                DataCacheItem *c = NULL;
+                uint64_t hash, p;
 
-                r = journal_file_append_data(f, iovec[i].iov_base, iovec[i].iov_len, &o, &p);
-                if (r < 0)
-                        return r;
+                hash = hash64(iovec[i].iov_base, iovec[i].iov_len);
+
+                if (cache) {
+                        DataCacheItem key = {
+                                .data = iovec[i].iov_base,
+                                .size = iovec[i].iov_len,
+                                .hash = hash,
+                        };
+
+                        c = set_get(cache, &key);
+                }
 
-                xor_hash ^= le64toh(o->data.hash);
+                if (c)
+                        p = c->offset;
+                else {
+                        r = journal_file_append_data_with_hash(f, iovec[i].iov_base, iovec[i].iov_len, hash, NULL, &p);
+                        if (r < 0)
+                                return r;
+
+                        if (cache) {
+                                c = cache_items + i;
+                                c->data = iovec[i].iov_base;
+                                c->size = iovec[i].iov_len;
+                                c->hash = hash;
+                                c->offset = p;
+
+                                r = set_put(cache, c);
+                                if (r < 0)
+                                        return r;
+                        }
+                }
+
+                xor_hash ^= hash;
                 items[i].object_offset = htole64(p);
-                items[i].hash = o->data.hash;
+                items[i].hash = htole64(hash);
         }
 
         /* Order by the position on disk, in order to improve seek
          * times for rotating media. */
         qsort_safe(items, n_iovec, sizeof(EntryItem), entry_item_cmp);
 
-        r = journal_file_append_entry_internal(f, ts, xor_hash, items, n_iovec, seqnum, ret, offset);
+        return journal_file_append_entry_internal(f, ts, xor_hash, items, n_iovec, seqnum, ret, offset);
+}
+
+int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqnum, Object **ret, uint64_t *offset) {
+        int r;
+
+        assert(f);
+        assert(iovec || n_iovec == 0);
+
+        r = journal_file_append_entry_cached(f, ts, iovec, n_iovec, NULL, NULL, seqnum, ret, offset);
+
+        journal_file_post_change(f);
+
+        return r;
+}
+
+int journal_file_append_entries(JournalFile *f, const JournalBatchEntry entries[], unsigned n_entries, uint64_t *seqnum, unsigned *n_appended) {
+        /* The set hashes the items while it is freed, hence it
+         * needs to go first */
+        _cleanup_free_ DataCacheItem *cache_items = NULL;
+        _cleanup_set_free_ Set *cache = NULL;
+        uint64_t estimate = 0, p;
+        unsigned i, j, n_items = 0;
+        int r = 0;
+
+        assert(f);
+        assert(entries || n_entries == 0);
+
+        if (n_appended)
+                *n_appended = 0;
+
+        if (n_entries <= 0)
+                return 0;
+
+        for (i = 0; i < n_entries; i++) {
+                n_items += entries[i].n_iovec;
+
+                estimate += ALIGN64(offsetof(Object, entry.items) + entries[i].n_iovec * sizeof(EntryItem));
+                for (j = 0; j < entries[i].n_iovec; j++)
+                        estimate += ALIGN64(offsetof(Object, data.payload) + entries[i].iovec[j].iov_len);
+        }
+
+        cache = set_new(data_cache_item_hash_func, data_cache_item_compare_func);
+        if (!cache)
+                return -ENOMEM;
+
+        cache_items = new(DataCacheItem, MAX(1u, n_items));
+        if (!cache_items)
+                return -ENOMEM;
+
+        r = journal_file_set_online(f);
+        if (r < 0)
+                return r;
+
+        /* Grow the file once for the whole batch rather than once
+         * per object. The estimate ignores payloads that are
+         * already in the file, hence if it does not fit we leave it
+         * to the individual appends to decide. */
+        r = journal_file_tail_end(f, &p);
+        if (r < 0)
+                return r;
+
+        journal_file_allocate(f, p, estimate);
+
+        for (i = 0, j = 0; i < n_entries; i++) {
+                r = journal_file_append_entry_cached(
+                                f,
+                                dual_timestamp_is_set(&entries[i].ts) ? &entries[i].ts : NULL,
+                                entries[i].iovec, entries[i].n_iovec,
+                                cache, cache_items + j,
+                                seqnum,
+                                NULL, NULL);
+                if (r < 0)
+                        break;
+
+                j += entries[i].n_iovec;
+        }
+
+        if (n_appended)
+                *n_appended = i;
 
         journal_file_post_change(f);
 
@@ -1396,27 +2158,227 @@ static void chain_cache_put(
         ci->total = total;
 }
 
-static int generic_array_get(JournalFile *f,
-                             uint64_t first,
-                             uint64_t i,
-                             Object **ret, uint64_t *offset) {
+enum {
+        TEST_FOUND,
+        TEST_LEFT,
+        TEST_RIGHT
+};
+
+/* What a bisection of the main entry array chain compares the
+ * needle with, if it is one of the keys the index carries */
+typedef enum IndexKey {
+        INDEX_KEY_NONE,
+        INDEX_KEY_OFFSET,
+        INDEX_KEY_SEQNUM,
+        INDEX_KEY_REALTIME
+} IndexKey;
+
+static int entry_array_index_test(JournalFile *f,
+                                  const EntryArrayIndexItem *item,
+                                  int (*test_object)(JournalFile *f, uint64_t p, uint64_t needle),
+                                  IndexKey key,
+                                  uint64_t needle) {
+        uint64_t k;
+
+        /* For the keys the index carries we don't have to look at
+         * the entry itself */
+        switch (key) {
+
+        case INDEX_KEY_OFFSET:
+                k = le64toh(item->entry_offset);
+                break;
+
+        case INDEX_KEY_SEQNUM:
+                k = le64toh(item->seqnum);
+                break;
+
+        case INDEX_KEY_REALTIME:
+                k = le64toh(item->realtime);
+                break;
+
+        default:
+                return test_object(f, le64toh(item->entry_offset), needle);
+        }
+
+        if (k == needle)
+                return TEST_FOUND;
+        else if (k < needle)
+                return TEST_LEFT;
+        else
+                return TEST_RIGHT;
+}
 
+static int entry_array_index_get(JournalFile *f, uint64_t i, EntryArrayIndexItem *ret) {
         Object *o;
-        uint64_t p = 0, a, t = 0;
         int r;
-        ChainCacheItem *ci;
 
         assert(f);
+        assert(ret);
 
-        a = first;
+        r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY_INDEX, le64toh(f->header->entry_array_index_offset), &o);
+        if (r < 0)
+                return r;
 
-        /* Try the chain cache first */
-        ci = hashmap_get(f->chain_cache, &first);
-        if (ci && i > ci->total) {
-                a = ci->array;
-                i -= ci->total;
-                t = ci->total;
-        }
+        if (i >= MIN(le64toh(o->entry_array_index.n_items), journal_file_entry_array_index_n_items(o)))
+                return 0;
+
+        *ret = o->entry_array_index.items[i];
+        return 1;
+}
+
+static int entry_array_index_n_items(JournalFile *f, uint64_t *ret) {
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(ret);
+
+        if (!journal_file_has_entry_array_index(f) ||
+            f->header->entry_array_index_offset == 0) {
+                *ret = 0;
+                return 0;
+        }
+
+        r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY_INDEX, le64toh(f->header->entry_array_index_offset), &o);
+        if (r < 0)
+                return r;
+
+        *ret = MIN(le64toh(o->entry_array_index.n_items), journal_file_entry_array_index_n_items(o));
+        return 0;
+}
+
+/* Returns the last array of the main entry array chain that the
+ * index knows about, which starts with an entry left of the needle
+ * and at most n items into the chain. */
+static int entry_array_index_bisect(JournalFile *f,
+                                    uint64_t n,
+                                    uint64_t needle,
+                                    int (*test_object)(JournalFile *f, uint64_t p, uint64_t needle),
+                                    IndexKey key,
+                                    uint64_t *array,
+                                    uint64_t *total) {
+
+        EntryArrayIndexItem item;
+        uint64_t left = 0, right;
+        int r;
+
+        assert(f);
+        assert(array);
+        assert(total);
+
+        r = entry_array_index_n_items(f, &right);
+        if (r < 0)
+                return r;
+
+        while (left < right) {
+                uint64_t i = (left + right) / 2;
+
+                r = entry_array_index_get(f, i, &item);
+                if (r <= 0)
+                        return r;
+
+                if (le64toh(item.total) >= n)
+                        r = TEST_RIGHT;
+                else {
+                        r = entry_array_index_test(f, &item, test_object, key, needle);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (r == TEST_LEFT)
+                        left = i + 1;
+                else
+                        right = i;
+        }
+
+        if (left <= 0)
+                return 0;
+
+        r = entry_array_index_get(f, left - 1, &item);
+        if (r <= 0)
+                return r;
+
+        *array = le64toh(item.entry_array_offset);
+        *total = le64toh(item.total);
+        return 1;
+}
+
+/* Returns the array of the main entry array chain that contains
+ * item i, if the index knows about it */
+static int entry_array_index_lookup(JournalFile *f, uint64_t i, uint64_t *array, uint64_t *total) {
+        EntryArrayIndexItem item;
+        uint64_t left = 0, right;
+        int r;
+
+        assert(f);
+        assert(array);
+        assert(total);
+
+        r = entry_array_index_n_items(f, &right);
+        if (r < 0)
+                return r;
+
+        while (left < right) {
+                uint64_t k = (left + right) / 2;
+
+                r = entry_array_index_get(f, k, &item);
+                if (r <= 0)
+                        return r;
+
+                if (le64toh(item.total) <= i)
+                        left = k + 1;
+                else
+                        right = k;
+        }
+
+        if (left <= 0)
+                return 0;
+
+        r = entry_array_index_get(f, left - 1, &item);
+        if (r <= 0)
+                return r;
+
+        *array = le64toh(item.entry_array_offset);
+        *total = le64toh(item.total);
+        return 1;
+}
+
+static int generic_array_get(JournalFile *f,
+                             uint64_t first,
+                             uint64_t i,
+                             Object **ret, uint64_t *offset) {
+
+        Object *o;
+        uint64_t p = 0, a, t = 0;
+        int r;
+        ChainCacheItem *ci;
+
+        assert(f);
+
+        a = first;
+
+        /* Try the chain cache first */
+        ci = hashmap_get(f->chain_cache, &first);
+        if (ci && i > ci->total) {
+                a = ci->array;
+                i -= ci->total;
+                t = ci->total;
+        }
+
+        /* For the main chain the index might get us further */
+        if (first == le64toh(f->header->entry_array_offset)) {
+                uint64_t ia = 0, it = 0;
+
+                r = entry_array_index_lookup(f, i + t, &ia, &it);
+                if (r < 0)
+                        return r;
+
+                if (r > 0 && it > t) {
+                        a = ia;
+                        i = i + t - it;
+                        t = it;
+                }
+        }
 
         while (a > 0) {
                 uint64_t k;
@@ -1484,17 +2446,12 @@ static int generic_array_get_plus_one(JournalFile *f,
         return generic_array_get(f, first, i-1, ret, offset);
 }
 
-enum {
-        TEST_FOUND,
-        TEST_LEFT,
-        TEST_RIGHT
-};
-
 static int generic_array_bisect(JournalFile *f,
                                 uint64_t first,
                                 uint64_t n,
                                 uint64_t needle,
                                 int (*test_object)(JournalFile *f, uint64_t p, uint64_t needle),
+                                IndexKey key,
                                 direction_t direction,
                                 Object **ret,
                                 uint64_t *offset,
@@ -1536,6 +2493,21 @@ static int generic_array_bisect(JournalFile *f,
                 }
         }
 
+        /* For the main chain the index might get us further */
+        if (first == le64toh(f->header->entry_array_offset)) {
+                uint64_t ia = 0, it = 0;
+
+                r = entry_array_index_bisect(f, n + t, needle, test_object, key, &ia, &it);
+                if (r < 0)
+                        return r;
+
+                if (r > 0 && it > t) {
+                        a = ia;
+                        n = n + t - it;
+                        t = it;
+                }
+        }
+
         while (a > 0) {
                 uint64_t left, right, k, lp;
 
@@ -1687,7 +2659,7 @@ static int generic_array_bisect_plus_one(JournalFile *f,
                         return 0;
         }
 
-        r = generic_array_bisect(f, first, n-1, needle, test_object, direction, ret, offset, idx);
+        r = generic_array_bisect(f, first, n-1, needle, test_object, INDEX_KEY_NONE, direction, ret, offset, idx);
 
         if (r == 0 && step_back)
                 goto found;
@@ -1738,6 +2710,7 @@ int journal_file_move_to_entry_by_offset(
                                     le64toh(f->header->n_entries),
                                     p,
                                     test_object_offset,
+                                    INDEX_KEY_OFFSET,
                                     direction,
                                     ret, offset, NULL);
 }
@@ -1774,6 +2747,7 @@ int journal_file_move_to_entry_by_seqnum(
                                     le64toh(f->header->n_entries),
                                     seqnum,
                                     test_object_seqnum,
+                                    INDEX_KEY_SEQNUM,
                                     direction,
                                     ret, offset, NULL);
 }
@@ -1809,6 +2783,7 @@ int journal_file_move_to_entry_by_realtime(
                                     le64toh(f->header->n_entries),
                                     realtime,
                                     test_object_realtime,
+                                    INDEX_KEY_REALTIME,
                                     direction,
                                     ret, offset, NULL);
 }
@@ -1899,6 +2874,7 @@ int journal_file_next_entry(
                                          le64toh(f->header->n_entries),
                                          p,
                                          test_object_offset,
+                                         INDEX_KEY_OFFSET,
                                          DIRECTION_DOWN,
                                          NULL, NULL,
                                          &i);
@@ -1946,6 +2922,7 @@ int journal_file_skip_entry(
                                  le64toh(f->header->n_entries),
                                  p,
                                  test_object_offset,
+                                 INDEX_KEY_OFFSET,
                                  DIRECTION_DOWN,
                                  NULL, NULL,
                                  &i);
@@ -1981,222 +2958,967 @@ int journal_file_next_entry_for_data(
                 direction_t direction,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t n, i;
-        int r;
-        Object *d;
+        uint64_t n, i;
+        int r;
+        Object *d;
+
+        assert(f);
+        assert(p > 0 || !o);
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
+        if (r < 0)
+                return r;
+
+        n = le64toh(d->data.n_entries);
+        if (n <= 0)
+                return n;
+
+        if (!o)
+                i = direction == DIRECTION_DOWN ? 0 : n - 1;
+        else {
+                if (o->object.type != OBJECT_ENTRY)
+                        return -EINVAL;
+
+                r = generic_array_bisect_plus_one(f,
+                                                  le64toh(d->data.entry_offset),
+                                                  le64toh(d->data.entry_array_offset),
+                                                  le64toh(d->data.n_entries),
+                                                  p,
+                                                  test_object_offset,
+                                                  DIRECTION_DOWN,
+                                                  NULL, NULL,
+                                                  &i);
+
+                if (r <= 0)
+                        return r;
+
+                if (direction == DIRECTION_DOWN) {
+                        if (i >= n - 1)
+                                return 0;
+
+                        i++;
+                } else {
+                        if (i <= 0)
+                                return 0;
+
+                        i--;
+                }
+
+        }
+
+        return generic_array_get_plus_one(f,
+                                          le64toh(d->data.entry_offset),
+                                          le64toh(d->data.entry_array_offset),
+                                          i,
+                                          ret, offset);
+}
+
+int journal_file_move_to_entry_by_offset_for_data(
+                JournalFile *f,
+                uint64_t data_offset,
+                uint64_t p,
+                direction_t direction,
+                Object **ret, uint64_t *offset) {
+
+        int r;
+        Object *d;
+
+        assert(f);
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
+        if (r < 0)
+                return r;
+
+        return generic_array_bisect_plus_one(f,
+                                             le64toh(d->data.entry_offset),
+                                             le64toh(d->data.entry_array_offset),
+                                             le64toh(d->data.n_entries),
+                                             p,
+                                             test_object_offset,
+                                             direction,
+                                             ret, offset, NULL);
+}
+
+int journal_file_move_to_entry_by_monotonic_for_data(
+                JournalFile *f,
+                uint64_t data_offset,
+                sd_id128_t boot_id,
+                uint64_t monotonic,
+                direction_t direction,
+                Object **ret, uint64_t *offset) {
+
+        Object *o, *d;
+        int r;
+        uint64_t b, z;
+
+        assert(f);
+
+        /* First, seek by time */
+        r = find_data_object_by_boot_id(f, boot_id, &o, &b);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return -ENOENT;
+
+        r = generic_array_bisect_plus_one(f,
+                                          le64toh(o->data.entry_offset),
+                                          le64toh(o->data.entry_array_offset),
+                                          le64toh(o->data.n_entries),
+                                          monotonic,
+                                          test_object_monotonic,
+                                          direction,
+                                          NULL, &z, NULL);
+        if (r <= 0)
+                return r;
+
+        /* And now, continue seeking until we find an entry that
+         * exists in both bisection arrays */
+
+        for (;;) {
+                Object *qo;
+                uint64_t p, q;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
+                if (r < 0)
+                        return r;
+
+                r = generic_array_bisect_plus_one(f,
+                                                  le64toh(d->data.entry_offset),
+                                                  le64toh(d->data.entry_array_offset),
+                                                  le64toh(d->data.n_entries),
+                                                  z,
+                                                  test_object_offset,
+                                                  direction,
+                                                  NULL, &p, NULL);
+                if (r <= 0)
+                        return r;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, b, &o);
+                if (r < 0)
+                        return r;
+
+                r = generic_array_bisect_plus_one(f,
+                                                  le64toh(o->data.entry_offset),
+                                                  le64toh(o->data.entry_array_offset),
+                                                  le64toh(o->data.n_entries),
+                                                  p,
+                                                  test_object_offset,
+                                                  direction,
+                                                  &qo, &q, NULL);
+
+                if (r <= 0)
+                        return r;
+
+                if (p == q) {
+                        if (ret)
+                                *ret = qo;
+                        if (offset)
+                                *offset = q;
+
+                        return 1;
+                }
+
+                z = q;
+        }
+
+        return 0;
+}
+
+int journal_file_move_to_entry_by_seqnum_for_data(
+                JournalFile *f,
+                uint64_t data_offset,
+                uint64_t seqnum,
+                direction_t direction,
+                Object **ret, uint64_t *offset) {
+
+        Object *d;
+        int r;
+
+        assert(f);
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
+        if (r < 0)
+                return r;
+
+        return generic_array_bisect_plus_one(f,
+                                             le64toh(d->data.entry_offset),
+                                             le64toh(d->data.entry_array_offset),
+                                             le64toh(d->data.n_entries),
+                                             seqnum,
+                                             test_object_seqnum,
+                                             direction,
+                                             ret, offset, NULL);
+}
+
+int journal_file_move_to_entry_by_realtime_for_data(
+                JournalFile *f,
+                uint64_t data_offset,
+                uint64_t realtime,
+                direction_t direction,
+                Object **ret, uint64_t *offset) {
+
+        Object *d;
+        int r;
+
+        assert(f);
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
+        if (r < 0)
+                return r;
+
+        return generic_array_bisect_plus_one(f,
+                                             le64toh(d->data.entry_offset),
+                                             le64toh(d->data.entry_array_offset),
+                                             le64toh(d->data.n_entries),
+                                             realtime,
+                                             test_object_realtime,
+                                             direction,
+                                             ret, offset, NULL);
+}
+
+static bool journal_file_has_field_summary(JournalFile *f) {
+        assert(f);
+
+        return JOURNAL_HEADER_FIELD_SUMMARY(f->header) &&
+                JOURNAL_HEADER_CONTAINS(f->header, field_summary_offset);
+}
+
+bool journal_file_field_summaries_current(JournalFile *f) {
+        Object *o;
+        uint64_t q;
+        int r;
+
+        assert(f);
+
+        if (!journal_file_has_field_summary(f))
+                return false;
+
+        q = le64toh(f->header->field_summary_offset);
+        if (q == 0)
+                return false;
+
+        r = journal_file_move_to_object(f, OBJECT_FIELD_SUMMARY, q, &o);
+        if (r < 0)
+                return false;
+
+        /* All summaries are written in one go, so the first one
+         * tells us whether entries were added since */
+        return o->field_summary.n_entries == f->header->n_entries;
+}
+
+int journal_file_find_field_summary(JournalFile *f, const void *field, uint64_t size, Object **ret, uint64_t *offset) {
+        Object *o;
+        uint64_t p, q;
+        int r;
+
+        assert(f);
+        assert(field && size > 0);
+
+        if (!journal_file_field_summaries_current(f))
+                return 0;
+
+        r = journal_file_find_field_object(f, field, size, NULL, &p);
+        if (r <= 0)
+                return r;
+
+        q = le64toh(f->header->field_summary_offset);
+        while (q > 0) {
+                r = journal_file_move_to_object(f, OBJECT_FIELD_SUMMARY, q, &o);
+                if (r < 0)
+                        return r;
+
+                if (le64toh(o->field_summary.field_offset) == p) {
+                        if (ret)
+                                *ret = o;
+                        if (offset)
+                                *offset = q;
+
+                        return 1;
+                }
+
+                q = le64toh(o->field_summary.next_summary_offset);
+        }
+
+        return 0;
+}
+
+static int journal_file_summarize_field(JournalFile *f, uint64_t field_offset, FieldSummaryItem **ret, uint64_t *n_ret) {
+        _cleanup_free_ FieldSummaryItem *items = NULL;
+        uint64_t head, p, n = 0;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(ret);
+        assert(n_ret);
+
+        r = journal_file_move_to_object(f, OBJECT_FIELD, field_offset, &o);
+        if (r < 0)
+                return r;
+
+        head = le64toh(o->field.head_data_offset);
+
+        /* Count first, fields with many distinct values are not
+         * worth summarizing */
+        for (p = head; p > 0; p = le64toh(o->data.next_field_offset)) {
+                if (n >= FIELD_SUMMARY_ITEMS_MAX)
+                        return 0;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                if (r < 0)
+                        return r;
+
+                n++;
+        }
+
+        if (n == 0)
+                return 0;
+
+        items = new(FieldSummaryItem, n);
+        if (!items)
+                return -ENOMEM;
+
+        n = 0;
+        p = head;
+        while (p > 0) {
+                uint64_t next, n_entries;
+                Object *e;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                if (r < 0)
+                        return r;
+
+                next = le64toh(o->data.next_field_offset);
+                n_entries = le64toh(o->data.n_entries);
+
+                if (n_entries > 0) {
+                        r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_DOWN, &e, NULL);
+                        if (r < 0)
+                                return r;
+                        if (r == 0)
+                                return -EBADMSG;
+
+                        items[n].first_realtime = e->entry.realtime;
+
+                        r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_UP, &e, NULL);
+                        if (r < 0)
+                                return r;
+                        if (r == 0)
+                                return -EBADMSG;
+
+                        items[n].last_realtime = e->entry.realtime;
+                        items[n].data_offset = htole64(p);
+                        items[n].n_entries = htole64(n_entries);
+                        n++;
+                }
+
+                p = next;
+        }
+
+        *ret = items;
+        *n_ret = n;
+        items = NULL;
+
+        return 1;
+}
+
+int journal_file_append_field_summaries(JournalFile *f) {
+        uint64_t head = 0, i, m;
+        int r;
+
+        assert(f);
+
+        if (!f->writable || !journal_file_has_field_summary(f))
+                return 0;
+
+        /* Not fully opened? */
+        if (!f->field_hash_table || !f->data_hash_table)
+                return 0;
+
+        if (f->header->n_entries == 0 ||
+            journal_file_field_summaries_current(f))
+                return 0;
+
+        m = le64toh(f->header->field_hash_table_size) / sizeof(HashItem);
+
+        for (i = 0; i < m; i++) {
+                uint64_t p;
+
+                p = le64toh(f->field_hash_table[i].head_hash_offset);
+                while (p > 0) {
+                        _cleanup_free_ FieldSummaryItem *items = NULL;
+                        uint64_t next, n = 0, q;
+                        Object *o;
+
+                        r = journal_file_move_to_object(f, OBJECT_FIELD, p, &o);
+                        if (r < 0)
+                                return r;
+
+                        next = le64toh(o->field.next_hash_offset);
+
+                        r = journal_file_summarize_field(f, p, &items, &n);
+                        if (r < 0)
+                                return r;
+                        if (r > 0) {
+                                r = journal_file_append_object(f, OBJECT_FIELD_SUMMARY,
+                                                               offsetof(Object, field_summary.items) + n * sizeof(FieldSummaryItem),
+                                                               &o, &q);
+                                if (r < 0)
+                                        return r;
+
+                                o->field_summary.field_offset = htole64(p);
+                                o->field_summary.next_summary_offset = htole64(head);
+                                o->field_summary.n_entries = f->header->n_entries;
+                                memcpy(o->field_summary.items, items, n * sizeof(FieldSummaryItem));
+
+#ifdef HAVE_GCRYPT
+                                r = journal_file_hmac_put_object(f, OBJECT_FIELD_SUMMARY, o, q);
+                                if (r < 0)
+                                        return r;
+#endif
+
+                                head = q;
+                        }
+
+                        p = next;
+                }
+        }
+
+        f->header->field_summary_offset = htole64(head);
+
+        return 0;
+}
+
+static bool is_token_char(uint8_t c) {
+        /* Anything not ASCII is taken to be part of a word in
+         * some script */
+        return (c >= '0' && c <= '9') ||
+                (c >= 'a' && c <= 'z') ||
+                (c >= 'A' && c <= 'Z') ||
+                c >= 128;
+}
+
+/* Calls cb for the hash of each word in text, which is a run of
+ * letters and digits, taken in lowercase and cut off after
+ * TEXT_TOKEN_LENGTH_MAX bytes. Stops when cb returns false. */
+#define TEXT_TOKEN_LENGTH_MAX 64
+
+static void text_foreach_token(const void *text, size_t size, bool (*cb)(uint64_t hash, void *userdata), void *userdata) {
+        const uint8_t *t = text;
+        size_t i = 0;
+
+        while (i < size) {
+                char buf[TEXT_TOKEN_LENGTH_MAX];
+                size_t n = 0;
+
+                if (!is_token_char(t[i])) {
+                        i++;
+                        continue;
+                }
+
+                for (; i < size && is_token_char(t[i]); i++)
+                        if (n < sizeof(buf))
+                                buf[n++] = t[i] >= 'A' && t[i] <= 'Z' ? t[i] - 'A' + 'a' : t[i];
+
+                if (!cb(hash64(buf, n), userdata))
+                        return;
+        }
+}
+
+typedef struct TokenList {
+        uint64_t *tokens;
+        size_t n_tokens, n_allocated;
+        bool oom;
+} TokenList;
+
+static bool token_list_add(uint64_t hash, void *userdata) {
+        TokenList *l = userdata;
+
+        if (!GREEDY_REALLOC(l->tokens, l->n_allocated, l->n_tokens + 1)) {
+                l->oom = true;
+                return false;
+        }
+
+        l->tokens[l->n_tokens++] = hash;
+        return true;
+}
+
+static int uint64_compare(const void *_a, const void *_b) {
+        uint64_t a = *(const uint64_t*) _a, b = *(const uint64_t*) _b;
+
+        return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static size_t uint64_unique(uint64_t *a, size_t n) {
+        size_t i, k = 0;
+
+        for (i = 0; i < n; i++)
+                if (k == 0 || a[k-1] != a[i])
+                        a[k++] = a[i];
+
+        return k;
+}
+
+int journal_text_tokenize(const void *text, size_t size, uint64_t **ret, unsigned *n_ret) {
+        TokenList l = {};
+
+        assert(text || size == 0);
+        assert(ret);
+        assert(n_ret);
+
+        /* The words of text, as they are looked up in the index:
+         * sorted, and without duplicates */
+
+        text_foreach_token(text, size, token_list_add, &l);
+        if (l.oom) {
+                free(l.tokens);
+                return -ENOMEM;
+        }
+
+        if (l.n_tokens > 0) {
+                qsort(l.tokens, l.n_tokens, sizeof(uint64_t), uint64_compare);
+                l.n_tokens = uint64_unique(l.tokens, l.n_tokens);
+        }
+
+        if (l.n_tokens > TEXT_TOKENS_MAX) {
+                free(l.tokens);
+                return -E2BIG;
+        }
+
+        *ret = l.tokens;
+        *n_ret = l.n_tokens;
+
+        return 0;
+}
+
+typedef struct TokenMatch {
+        const uint64_t *tokens;
+        unsigned n_tokens;
+        uint64_t found;
+} TokenMatch;
+
+static bool token_match_check(uint64_t hash, void *userdata) {
+        TokenMatch *m = userdata;
+        const uint64_t *k;
+
+        k = bsearch(&hash, m->tokens, m->n_tokens, sizeof(uint64_t), uint64_compare);
+        if (k)
+                m->found |= UINT64_C(1) << (k - m->tokens);
+
+        return m->found != (UINT64_C(1) << (m->n_tokens - 1) << 1) - 1;
+}
+
+static int journal_file_message_payload(JournalFile *f, Object *o, const void **ret, uint64_t *size) {
+        uint64_t l;
+
+        assert(f);
+        assert(o);
+        assert(ret);
+        assert(size);
+
+        /* Returns what follows MESSAGE= in a data object of the
+         * field */
+
+        l = le64toh(o->object.size);
+        if (l <= offsetof(Object, data.payload))
+                return -EBADMSG;
+
+        l -= offsetof(Object, data.payload);
+
+        if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+                if (!uncompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                                     o->data.payload, l,
+                                     &f->compress_buffer, &f->compress_buffer_size, &l, 0))
+                        return -EBADMSG;
+
+                *ret = f->compress_buffer;
+#else
+                return -EPROTONOSUPPORT;
+#endif
+        } else
+                *ret = o->data.payload;
+
+        if (l < strlen("MESSAGE="))
+                return -EBADMSG;
+
+        *ret = (const uint8_t*) *ret + strlen("MESSAGE=");
+        *size = l - strlen("MESSAGE=");
+
+        return 0;
+}
+
+static int journal_file_message_has_tokens(JournalFile *f, uint64_t p, const uint64_t *tokens, unsigned n_tokens) {
+        TokenMatch m = {
+                .tokens = tokens,
+                .n_tokens = n_tokens,
+        };
+        const void *t;
+        uint64_t l;
+        Object *o;
+        int r;
+
+        assert(f);
+        assert(tokens);
+        assert(n_tokens > 0 && n_tokens <= TEXT_TOKENS_MAX);
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+        if (r < 0)
+                return r;
+
+        r = journal_file_message_payload(f, o, &t, &l);
+        if (r < 0)
+                return r;
+
+        text_foreach_token(t, l, token_match_check, &m);
+
+        return m.found == (UINT64_C(1) << (n_tokens - 1) << 1) - 1;
+}
+
+static bool journal_file_has_text_index(JournalFile *f) {
+        assert(f);
+
+        return JOURNAL_HEADER_TEXT_INDEX(f->header) &&
+                JOURNAL_HEADER_CONTAINS(f->header, text_index_offset);
+}
+
+static int journal_file_get_text_index(JournalFile *f, Object **ret) {
+        Object *o;
+        uint64_t q;
+        int r;
+
+        assert(f);
+        assert(ret);
+
+        if (!journal_file_has_text_index(f))
+                return 0;
+
+        q = le64toh(f->header->text_index_offset);
+        if (q == 0)
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_TEXT_INDEX, q, &o);
+        if (r < 0)
+                return r;
+
+        if (o->text_index.n_entries != f->header->n_entries)
+                return 0;
+
+        *ret = o;
+        return 1;
+}
+
+bool journal_file_text_index_current(JournalFile *f) {
+        Object *o;
+
+        return journal_file_get_text_index(f, &o) > 0;
+}
+
+typedef struct Posting {
+        uint64_t hash;
+        uint64_t offset;
+} Posting;
+
+static int posting_compare(const void *_a, const void *_b) {
+        const Posting *a = _a, *b = _b;
+
+        if (a->hash != b->hash)
+                return a->hash < b->hash ? -1 : 1;
+
+        return a->offset < b->offset ? -1 : a->offset > b->offset ? 1 : 0;
+}
+
+int journal_file_append_text_index(JournalFile *f) {
+        _cleanup_free_ Posting *postings = NULL;
+        size_t n_postings = 0, n_allocated = 0, i, k;
+        uint64_t p, q, n_tokens = 0;
+        TokenList l = {};
+        le64_t *a;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        if (!f->writable || !journal_file_has_text_index(f))
+                return 0;
+
+        /* Not fully opened? */
+        if (!f->field_hash_table || !f->data_hash_table)
+                return 0;
+
+        if (f->header->n_entries == 0 ||
+            journal_file_text_index_current(f))
+                return 0;
+
+        r = journal_file_find_field_object(f, "MESSAGE", strlen("MESSAGE"), &o, NULL);
+        if (r <= 0)
+                return r;
+
+        for (p = le64toh(o->field.head_data_offset); p > 0; p = le64toh(o->data.next_field_offset)) {
+                const void *t;
+                uint64_t size;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                if (r < 0)
+                        goto finish;
+
+                if (o->data.n_entries == 0)
+                        continue;
+
+                r = journal_file_message_payload(f, o, &t, &size);
+                if (r < 0)
+                        goto finish;
+
+                l.n_tokens = 0;
+                text_foreach_token(t, size, token_list_add, &l);
+                if (l.oom) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
+
+                qsort(l.tokens, l.n_tokens, sizeof(uint64_t), uint64_compare);
+                l.n_tokens = uint64_unique(l.tokens, l.n_tokens);
+
+                /* Too large to be worth it, readers will look at
+                 * the messages themselves */
+                if (n_postings + l.n_tokens > TEXT_INDEX_POSTINGS_MAX) {
+                        log_debug("%s: too many words to index.", f->path);
+                        r = 0;
+                        goto finish;
+                }
+
+                if (!GREEDY_REALLOC(postings, n_allocated, n_postings + l.n_tokens)) {
+                        r = -ENOMEM;
+                        goto finish;
+                }
 
-        assert(f);
-        assert(p > 0 || !o);
+                for (i = 0; i < l.n_tokens; i++) {
+                        postings[n_postings].hash = l.tokens[i];
+                        postings[n_postings].offset = p;
+                        n_postings++;
+                }
+        }
 
-        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
-        if (r < 0)
-                return r;
+        if (n_postings == 0) {
+                r = 0;
+                goto finish;
+        }
 
-        n = le64toh(d->data.n_entries);
-        if (n <= 0)
-                return n;
+        qsort(postings, n_postings, sizeof(Posting), posting_compare);
 
-        if (!o)
-                i = direction == DIRECTION_DOWN ? 0 : n - 1;
-        else {
-                if (o->object.type != OBJECT_ENTRY)
-                        return -EINVAL;
+        for (i = 0; i < n_postings; i++)
+                if (i == 0 || postings[i].hash != postings[i-1].hash)
+                        n_tokens++;
 
-                r = generic_array_bisect_plus_one(f,
-                                                  le64toh(d->data.entry_offset),
-                                                  le64toh(d->data.entry_array_offset),
-                                                  le64toh(d->data.n_entries),
-                                                  p,
-                                                  test_object_offset,
-                                                  DIRECTION_DOWN,
-                                                  NULL, NULL,
-                                                  &i);
+        r = journal_file_append_object(f, OBJECT_TEXT_INDEX,
+                                       offsetof(Object, text_index.tokens) + n_tokens * sizeof(TextIndexToken) + n_postings * sizeof(le64_t),
+                                       &o, &q);
+        if (r < 0)
+                goto finish;
 
-                if (r <= 0)
-                        return r;
+        o->text_index.n_entries = f->header->n_entries;
+        o->text_index.n_tokens = htole64(n_tokens);
+        o->text_index.n_postings = htole64(n_postings);
 
-                if (direction == DIRECTION_DOWN) {
-                        if (i >= n - 1)
-                                return 0;
+        a = journal_file_text_index_postings(o);
 
-                        i++;
-                } else {
-                        if (i <= 0)
-                                return 0;
+        for (i = 0, k = 0; i < n_postings; i++) {
+                if (i == 0 || postings[i].hash != postings[i-1].hash) {
+                        if (i > 0)
+                                k++;
 
-                        i--;
+                        o->text_index.tokens[k].hash = htole64(postings[i].hash);
+                        o->text_index.tokens[k].first_posting = htole64(i);
+                        o->text_index.tokens[k].n_postings = 0;
                 }
 
+                o->text_index.tokens[k].n_postings = htole64(le64toh(o->text_index.tokens[k].n_postings) + 1);
+                a[i] = htole64(postings[i].offset);
         }
 
-        return generic_array_get_plus_one(f,
-                                          le64toh(d->data.entry_offset),
-                                          le64toh(d->data.entry_array_offset),
-                                          i,
-                                          ret, offset);
+#ifdef HAVE_GCRYPT
+        r = journal_file_hmac_put_object(f, OBJECT_TEXT_INDEX, o, q);
+        if (r < 0)
+                goto finish;
+#endif
+
+        f->header->text_index_offset = htole64(q);
+        r = 0;
+
+finish:
+        free(l.tokens);
+        return r;
 }
 
-int journal_file_move_to_entry_by_offset_for_data(
-                JournalFile *f,
-                uint64_t data_offset,
-                uint64_t p,
-                direction_t direction,
-                Object **ret, uint64_t *offset) {
+static int text_index_token_compare(const void *_key, const void *_t) {
+        const uint64_t *key = _key;
+        const TextIndexToken *t = _t;
+
+        return *key < le64toh(t->hash) ? -1 : *key > le64toh(t->hash) ? 1 : 0;
+}
 
+static int journal_file_find_text_in_index(JournalFile *f, Object *o, const uint64_t *tokens, unsigned n_tokens, uint64_t **ret, size_t *n_ret) {
+        const TextIndexToken *shortest = NULL;
+        _cleanup_free_ uint64_t *offsets = NULL;
+        size_t n = 0, i;
+        unsigned k;
+        le64_t *a;
         int r;
-        Object *d;
 
         assert(f);
+        assert(o);
 
-        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
-        if (r < 0)
-                return r;
+        /* Start with the rarest word, and check the candidates
+         * against the messages, since hashes might collide */
 
-        return generic_array_bisect_plus_one(f,
-                                             le64toh(d->data.entry_offset),
-                                             le64toh(d->data.entry_array_offset),
-                                             le64toh(d->data.n_entries),
-                                             p,
-                                             test_object_offset,
-                                             direction,
-                                             ret, offset, NULL);
-}
+        for (k = 0; k < n_tokens; k++) {
+                const TextIndexToken *t;
 
-int journal_file_move_to_entry_by_monotonic_for_data(
-                JournalFile *f,
-                uint64_t data_offset,
-                sd_id128_t boot_id,
-                uint64_t monotonic,
-                direction_t direction,
-                Object **ret, uint64_t *offset) {
+                t = bsearch(tokens + k, o->text_index.tokens, le64toh(o->text_index.n_tokens), sizeof(TextIndexToken), text_index_token_compare);
+                if (!t)
+                        goto finish;
 
-        Object *o, *d;
+                if (!shortest || le64toh(t->n_postings) < le64toh(shortest->n_postings))
+                        shortest = t;
+        }
+
+        if (!shortest)
+                goto finish;
+
+        offsets = new(uint64_t, le64toh(shortest->n_postings));
+        if (!offsets)
+                return -ENOMEM;
+
+        a = journal_file_text_index_postings(o) + le64toh(shortest->first_posting);
+        for (i = 0; i < le64toh(shortest->n_postings); i++)
+                offsets[i] = le64toh(a[i]);
+
+        for (i = 0; i < le64toh(shortest->n_postings); i++) {
+                r = journal_file_message_has_tokens(f, offsets[i], tokens, n_tokens);
+                if (r < 0)
+                        return r;
+                if (r > 0)
+                        offsets[n++] = offsets[i];
+        }
+
+finish:
+        *ret = offsets;
+        *n_ret = n;
+        offsets = NULL;
+
+        return 0;
+}
+
+int journal_file_find_text(JournalFile *f, const uint64_t *tokens, unsigned n_tokens, uint64_t after_offset, uint64_t **ret, size_t *n_ret) {
+        _cleanup_free_ uint64_t *offsets = NULL;
+        size_t n = 0, n_allocated = 0;
+        uint64_t p;
+        Object *o;
         int r;
-        uint64_t b, z;
 
         assert(f);
+        assert(tokens || n_tokens == 0);
+        assert(n_tokens <= TEXT_TOKENS_MAX);
+        assert(ret);
+        assert(n_ret);
 
-        /* First, seek by time */
-        r = find_data_object_by_boot_id(f, boot_id, &o, &b);
-        if (r < 0)
-                return r;
-        if (r == 0)
-                return -ENOENT;
+        /* Looks for the MESSAGE= data objects beyond after_offset
+         * that contain all words, and returns their offsets in
+         * ascending order */
 
-        r = generic_array_bisect_plus_one(f,
-                                          le64toh(o->data.entry_offset),
-                                          le64toh(o->data.entry_array_offset),
-                                          le64toh(o->data.n_entries),
-                                          monotonic,
-                                          test_object_monotonic,
-                                          direction,
-                                          NULL, &z, NULL);
-        if (r <= 0)
+        if (n_tokens == 0)
+                goto finish;
+
+        r = journal_file_get_text_index(f, &o);
+        if (r < 0)
                 return r;
+        if (r > 0 && after_offset == 0)
+                return journal_file_find_text_in_index(f, o, tokens, n_tokens, ret, n_ret);
 
-        /* And now, continue seeking until we find an entry that
-         * exists in both bisection arrays */
+        /* No index, or only messages added since we looked last: go
+         * through the messages themselves, newest first */
 
-        for (;;) {
-                Object *qo;
-                uint64_t p, q;
+        r = journal_file_find_field_object(f, "MESSAGE", strlen("MESSAGE"), &o, NULL);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                goto finish;
 
-                r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
+        for (p = le64toh(o->field.head_data_offset); p > after_offset; p = le64toh(o->data.next_field_offset)) {
+                r = journal_file_message_has_tokens(f, p, tokens, n_tokens);
                 if (r < 0)
                         return r;
+                if (r > 0) {
+                        if (!GREEDY_REALLOC(offsets, n_allocated, n + 1))
+                                return -ENOMEM;
 
-                r = generic_array_bisect_plus_one(f,
-                                                  le64toh(d->data.entry_offset),
-                                                  le64toh(d->data.entry_array_offset),
-                                                  le64toh(d->data.n_entries),
-                                                  z,
-                                                  test_object_offset,
-                                                  direction,
-                                                  NULL, &p, NULL);
-                if (r <= 0)
-                        return r;
+                        offsets[n++] = p;
+                }
 
-                r = journal_file_move_to_object(f, OBJECT_DATA, b, &o);
+                /* Checking the message might have moved the window */
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
                 if (r < 0)
                         return r;
+        }
 
-                r = generic_array_bisect_plus_one(f,
-                                                  le64toh(o->data.entry_offset),
-                                                  le64toh(o->data.entry_array_offset),
-                                                  le64toh(o->data.n_entries),
-                                                  p,
-                                                  test_object_offset,
-                                                  direction,
-                                                  &qo, &q, NULL);
-
-                if (r <= 0)
-                        return r;
-
-                if (p == q) {
-                        if (ret)
-                                *ret = qo;
-                        if (offset)
-                                *offset = q;
-
-                        return 1;
-                }
+        /* Reverse into ascending order */
+        for (p = 0; p < n / 2; p++) {
+                uint64_t t = offsets[p];
 
-                z = q;
+                offsets[p] = offsets[n - p - 1];
+                offsets[n - p - 1] = t;
         }
 
+finish:
+        *ret = offsets;
+        *n_ret = n;
+        offsets = NULL;
+
         return 0;
 }
 
-int journal_file_move_to_entry_by_seqnum_for_data(
-                JournalFile *f,
-                uint64_t data_offset,
-                uint64_t seqnum,
-                direction_t direction,
-                Object **ret, uint64_t *offset) {
-
-        Object *d;
+int journal_file_append_data_entries(JournalFile *f, uint64_t p, uint64_t **entries, size_t *n_entries, size_t *n_allocated) {
+        uint64_t n, a, i, m;
+        Object *o;
         int r;
 
         assert(f);
+        assert(entries);
+        assert(n_entries);
+        assert(n_allocated);
 
-        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
+        /* Adds the offsets of all entries referencing the data
+         * object to entries, in the order they were appended */
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
         if (r < 0)
                 return r;
 
-        return generic_array_bisect_plus_one(f,
-                                             le64toh(d->data.entry_offset),
-                                             le64toh(d->data.entry_array_offset),
-                                             le64toh(d->data.n_entries),
-                                             seqnum,
-                                             test_object_seqnum,
-                                             direction,
-                                             ret, offset, NULL);
-}
+        n = le64toh(o->data.n_entries);
+        if (n == 0)
+                return 0;
 
-int journal_file_move_to_entry_by_realtime_for_data(
-                JournalFile *f,
-                uint64_t data_offset,
-                uint64_t realtime,
-                direction_t direction,
-                Object **ret, uint64_t *offset) {
+        if (!GREEDY_REALLOC(*entries, *n_allocated, *n_entries + n))
+                return -ENOMEM;
 
-        Object *d;
-        int r;
+        (*entries)[(*n_entries)++] = le64toh(o->data.entry_offset);
+        n--;
 
-        assert(f);
+        a = le64toh(o->data.entry_array_offset);
+        while (n > 0 && a > 0) {
+                r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
+                if (r < 0)
+                        return r;
 
-        r = journal_file_move_to_object(f, OBJECT_DATA, data_offset, &d);
-        if (r < 0)
-                return r;
+                m = MIN(n, journal_file_entry_array_n_items(o));
+                for (i = 0; i < m; i++)
+                        (*entries)[(*n_entries)++] = le64toh(o->entry_array.items[i]);
 
-        return generic_array_bisect_plus_one(f,
-                                             le64toh(d->data.entry_offset),
-                                             le64toh(d->data.entry_array_offset),
-                                             le64toh(d->data.n_entries),
-                                             realtime,
-                                             test_object_realtime,
-                                             direction,
-                                             ret, offset, NULL);
+                n -= m;
+                a = le64toh(o->entry_array.next_entry_array_offset);
+        }
+
+        return 0;
 }
 
 void journal_file_dump(JournalFile *f) {
@@ -2253,13 +3975,35 @@ void journal_file_dump(JournalFile *f) {
                                le64toh(o->tag.epoch));
                         break;
 
+                case OBJECT_ENTRY_ARRAY_INDEX:
+                        printf("Type: OBJECT_ENTRY_ARRAY_INDEX n_items=%"PRIu64"\n",
+                               le64toh(o->entry_array_index.n_items));
+                        break;
+
+                case OBJECT_FIELD_SUMMARY:
+                        printf("Type: OBJECT_FIELD_SUMMARY n_items=%"PRIu64"\n",
+                               journal_file_field_summary_n_items(o));
+                        break;
+
+                case OBJECT_BOOT_INDEX:
+                        printf("Type: OBJECT_BOOT_INDEX n_items=%"PRIu64"\n",
+                               le64toh(o->boot_index.n_items));
+                        break;
+
+                case OBJECT_TEXT_INDEX:
+                        printf("Type: OBJECT_TEXT_INDEX n_tokens=%"PRIu64" n_postings=%"PRIu64"\n",
+                               le64toh(o->text_index.n_tokens),
+                               le64toh(o->text_index.n_postings));
+                        break;
+
                 default:
                         printf("Type: unknown (%u)\n", o->object.type);
                         break;
                 }
 
-                if (o->object.flags & OBJECT_COMPRESSED)
-                        printf("Flags: COMPRESSED\n");
+                if (o->object.flags & OBJECT_COMPRESSION_MASK)
+                        printf("Flags: %s\n",
+                               object_compressed_to_string(o->object.flags & OBJECT_COMPRESSION_MASK));
 
                 if (p == le64toh(f->header->tail_object_offset))
                         p = 0;
@@ -2295,8 +4039,8 @@ void journal_file_print_header(JournalFile *f) {
                "Boot ID: %s\n"
                "Sequential Number ID: %s\n"
                "State: %s\n"
-               "Compatible Flags:%s%s\n"
-               "Incompatible Flags:%s%s\n"
+               "Compatible Flags:%s%s%s%s%s%s\n"
+               "Incompatible Flags:%s%s%s\n"
                "Header size: %"PRIu64"\n"
                "Arena size: %"PRIu64"\n"
                "Data Hash Table Size: %"PRIu64"\n"
@@ -2318,9 +4062,14 @@ void journal_file_print_header(JournalFile *f) {
                f->header->state == STATE_ONLINE ? "ONLINE" :
                f->header->state == STATE_ARCHIVED ? "ARCHIVED" : "UNKNOWN",
                JOURNAL_HEADER_SEALED(f->header) ? " SEALED" : "",
-               (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SEALED) ? " ???" : "",
-               JOURNAL_HEADER_COMPRESSED(f->header) ? " COMPRESSED" : "",
-               (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_COMPRESSED) ? " ???" : "",
+               JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header) ? " ENTRY-ARRAY-INDEX" : "",
+               JOURNAL_HEADER_FIELD_SUMMARY(f->header) ? " FIELD-SUMMARY" : "",
+               JOURNAL_HEADER_BOOT_INDEX(f->header) ? " BOOT-INDEX" : "",
+               JOURNAL_HEADER_TEXT_INDEX(f->header) ? " TEXT-INDEX" : "",
+               (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_ANY) ? " ???" : "",
+               JOURNAL_HEADER_COMPRESSED_XZ(f->header) ? " COMPRESSED-XZ" : "",
+               JOURNAL_HEADER_COMPRESSED_LZ4(f->header) ? " COMPRESSED-LZ4" : "",
+               (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_ANY) ? " ???" : "",
                le64toh(f->header->header_size),
                le64toh(f->header->arena_size),
                le64toh(f->header->data_hash_table_size) / sizeof(HashItem),
@@ -2353,6 +4102,24 @@ void journal_file_print_header(JournalFile *f) {
                 printf("Entry Array Objects: %"PRIu64"\n",
                        le64toh(f->header->n_entry_arrays));
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth))
+                printf("Deepest Field Hash Chain: %"PRIu64"\n",
+                       le64toh(f->header->field_hash_chain_depth));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth))
+                printf("Deepest Data Hash Chain: %"PRIu64"\n",
+                       le64toh(f->header->data_hash_chain_depth));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_summary_offset))
+                printf("Field Summaries: %s\n",
+                       journal_file_field_summaries_current(f) ? "current" :
+                       f->header->field_summary_offset != 0 ? "outdated" : "none");
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, text_index_offset))
+                printf("Text Index: %s\n",
+                       journal_file_text_index_current(f) ? "current" :
+                       f->header->text_index_offset != 0 ? "outdated" : "none");
+
         if (fstat(f->fd, &st) >= 0)
                 printf("Disk usage: %s\n", format_bytes(bytes, sizeof(bytes), (off_t) st.st_blocks * 512ULL));
 }
@@ -2393,8 +4160,12 @@ int journal_file_open(
         f->flags = flags;
         f->prot = prot_from_flags(flags);
         f->writable = (flags & O_ACCMODE) != O_RDONLY;
-#ifdef HAVE_XZ
-        f->compress = compress;
+        /* Files compressed with LZ4 cannot be read by older
+         * versions, hence only use it if XZ is not available */
+#if defined(HAVE_XZ)
+        f->compress_xz = compress;
+#elif defined(HAVE_LZ4)
+        f->compress_lz4 = compress;
 #endif
 #ifdef HAVE_GCRYPT
         f->seal = seal;
@@ -2518,11 +4289,11 @@ int journal_file_open(
 #endif
 
         if (newly_created) {
-                r = journal_file_setup_field_hash_table(f);
+                r = journal_file_setup_field_hash_table(f, template);
                 if (r < 0)
                         goto fail;
 
-                r = journal_file_setup_data_hash_table(f);
+                r = journal_file_setup_data_hash_table(f, template);
                 if (r < 0)
                         goto fail;
 
@@ -2550,9 +4321,29 @@ fail:
         return r;
 }
 
+/* The name the file gets when it is rotated */
+int journal_file_get_archived_path(JournalFile *f, char **ret) {
+        size_t l;
+
+        assert(f);
+        assert(ret);
+
+        if (!endswith(f->path, ".journal"))
+                return -EINVAL;
+
+        l = strlen(f->path);
+        if (asprintf(ret, "%.*s@" SD_ID128_FORMAT_STR "-%016"PRIx64"-%016"PRIx64".journal",
+                     (int) l - 8, f->path,
+                     SD_ID128_FORMAT_VAL(f->header->seqnum_id),
+                     le64toh(f->header->head_entry_seqnum),
+                     le64toh(f->header->head_entry_realtime)) < 0)
+                return -ENOMEM;
+
+        return 0;
+}
+
 int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         _cleanup_free_ char *p = NULL;
-        size_t l;
         JournalFile *old_file, *new_file = NULL;
         int r;
 
@@ -2564,22 +4355,23 @@ int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         if (!old_file->writable)
                 return -EINVAL;
 
-        if (!endswith(old_file->path, ".journal"))
-                return -EINVAL;
-
-        l = strlen(old_file->path);
-        r = asprintf(&p, "%.*s@" SD_ID128_FORMAT_STR "-%016"PRIx64"-%016"PRIx64".journal",
-                     (int) l - 8, old_file->path,
-                     SD_ID128_FORMAT_VAL(old_file->header->seqnum_id),
-                     le64toh((*f)->header->head_entry_seqnum),
-                     le64toh((*f)->header->head_entry_realtime));
+        r = journal_file_get_archived_path(old_file, &p);
         if (r < 0)
-                return -ENOMEM;
+                return r;
 
         r = rename(old_file->path, p);
         if (r < 0)
                 return -errno;
 
+        /* Don't let a pending offlining overwrite the archived state */
+        r = journal_file_set_offline_thread_join(old_file);
+        if (r < 0)
+                return r;
+
+        /* Nothing can be appended anymore once the file is archived */
+        journal_file_append_field_summaries(old_file);
+        journal_file_append_text_index(old_file);
+
         old_file->header->state = STATE_ARCHIVED;
 
         r = journal_file_open(old_file->path, old_file->flags, old_file->mode, compress, seal, NULL, old_file->mmap, old_file, &new_file);
@@ -2691,11 +4483,13 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                 if ((uint64_t) t != l)
                         return -E2BIG;
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
+                if (o->object.flags & OBJECT_COMPRESSION_MASK) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
                         uint64_t rsize;
 
-                        if (!uncompress_blob(o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0))
+                        if (!uncompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
+                                             o->data.payload, l,
+                                             &from->compress_buffer, &from->compress_buffer_size, &rsize, 0))
                                 return -EBADMSG;
 
                         data = from->compress_buffer;
@@ -2725,7 +4519,7 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
 void journal_default_metrics(JournalMetrics *m, int fd) {
         uint64_t fs_size = 0;
         struct statvfs ss;
-        char a[FORMAT_BYTES_MAX], b[FORMAT_BYTES_MAX], c[FORMAT_BYTES_MAX], d[FORMAT_BYTES_MAX];
+        char a[FORMAT_BYTES_MAX], b[FORMAT_BYTES_MAX], c[FORMAT_BYTES_MAX], d[FORMAT_BYTES_MAX], e[FORMAT_BYTES_MAX];
 
         assert(m);
         assert(fd >= 0);
@@ -2790,11 +4584,25 @@ void journal_default_metrics(JournalMetrics *m, int fd) {
                         m->keep_free = DEFAULT_KEEP_FREE;
         }
 
-        log_debug("Fixed max_use=%s max_size=%s min_size=%s keep_free=%s",
+        if (m->preallocate == (uint64_t) -1) {
+                /* Small files, such as those on /run, should not
+                 * pin much memory or disk space up front */
+                m->preallocate = PAGE_ALIGN(m->max_size / 16);
+
+                if (m->preallocate > DEFAULT_PREALLOCATE_UPPER)
+                        m->preallocate = DEFAULT_PREALLOCATE_UPPER;
+        } else
+                m->preallocate = PAGE_ALIGN(m->preallocate);
+
+        if (m->preallocate > m->max_size)
+                m->preallocate = m->max_size;
+
+        log_debug("Fixed max_use=%s max_size=%s min_size=%s keep_free=%s preallocate=%s",
                   format_bytes(a, sizeof(a), m->max_use),
                   format_bytes(b, sizeof(b), m->max_size),
                   format_bytes(c, sizeof(c), m->min_size),
-                  format_bytes(d, sizeof(d), m->keep_free));
+                  format_bytes(d, sizeof(d), m->keep_free),
+                  format_bytes(e, sizeof(e), m->preallocate));
 }
 
 int journal_file_get_cutoff_realtime_usec(JournalFile *f, usec_t *from, usec_t *to) {
@@ -2898,6 +4706,23 @@ bool journal_file_rotate_suggested(JournalFile *f, usec_t max_file_usec) {
                         return true;
                 }
 
+        /* Let's check whether the hash chains got too long, which
+         * makes every append and lookup slow, even if the fill
+         * level looks fine. */
+        if (JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth))
+                if (le64toh(f->header->data_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX) {
+                        log_debug("Data hash table of %s has deepest hash chain of length %"PRIu64", suggesting rotation.",
+                                  f->path, le64toh(f->header->data_hash_chain_depth));
+                        return true;
+                }
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth))
+                if (le64toh(f->header->field_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX) {
+                        log_debug("Field hash table of %s has deepest hash chain of length %"PRIu64", suggesting rotation.",
+                                  f->path, le64toh(f->header->field_hash_chain_depth));
+                        return true;
+                }
+
         /* Are the data objects properly indexed by field objects? */
         if (JOURNAL_HEADER_CONTAINS(f->header, n_data) &&
             JOURNAL_HEADER_CONTAINS(f->header, n_fields) &&
@@ -22,6 +22,7 @@
 ***/
 
 #include <inttypes.h>
+#include <pthread.h>
 
 #ifdef HAVE_GCRYPT
 #include <gcrypt.h>
@@ -40,6 +41,7 @@ typedef struct JournalMetrics {
         uint64_t max_size;
         uint64_t min_size;
         uint64_t keep_free;
+        uint64_t preallocate; /* how much to allocate ahead of the tail */
 } JournalMetrics;
 
 typedef enum direction {
@@ -47,6 +49,24 @@ typedef enum direction {
         DIRECTION_DOWN
 } direction_t;
 
+/* The state of the thread taking a file offline. The main thread
+ * may cancel or restart an offlining that is still syncing, but has
+ * to wait for one that is already changing the header. */
+typedef enum OfflineState {
+        OFFLINE_JOINED,
+        OFFLINE_SYNCING,
+        OFFLINE_OFFLINING,
+        OFFLINE_CANCEL,
+        OFFLINE_AGAIN_FROM_SYNCING,
+        OFFLINE_AGAIN_FROM_OFFLINING,
+        OFFLINE_DONE
+} OfflineState;
+
+typedef struct FieldCacheItem {
+        uint64_t data_offset;
+        uint64_t field_hash;
+} FieldCacheItem;
+
 typedef struct JournalFile {
         int fd;
 
@@ -55,7 +75,8 @@ typedef struct JournalFile {
         int flags;
         int prot;
         bool writable;
-        bool compress;
+        bool compress_xz;
+        bool compress_lz4;
         bool seal;
 
         bool tail_entry_monotonic_valid;
@@ -71,12 +92,36 @@ typedef struct JournalFile {
 
         uint64_t current_offset;
 
+        /* Position of this file in the merge queue of sd_journal */
+        uint64_t candidate_offset;
+        uint64_t candidate_n_entries;
+        unsigned candidate_idx;
+
+        /* What the matches of sd_journal resolve to in this file, as
+         * of match_generation of sd_journal */
+        Hashmap *match_cache;
+        uint64_t match_generation;
+
+        /* Which field recently seen data objects belong to, see
+         * sd_journal_get_data() */
+        FieldCacheItem *field_cache;
+
         JournalMetrics metrics;
         MMapCache *mmap;
 
         Hashmap *chain_cache;
 
-#ifdef HAVE_XZ
+        pthread_t offline_thread;
+        volatile OfflineState offline_state;
+
+        /* The file size the offline thread allocated up to */
+        volatile uint64_t preallocated_size;
+
+        /* Appends that had to wait for the file to grow */
+        unsigned n_allocation_stalls;
+        usec_t allocation_stall_usec;
+
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
         void *compress_buffer;
         uint64_t compress_buffer_size;
 #endif
@@ -110,8 +155,9 @@ int journal_file_open(
                 JournalFile *template,
                 JournalFile **ret);
 
-int journal_file_set_offline(JournalFile *f);
+int journal_file_set_offline(JournalFile *f, bool wait);
 int journal_file_set_online(JournalFile *f);
+bool journal_file_is_offlining(JournalFile *f);
 void journal_file_close(JournalFile *j);
 
 int journal_file_open_reliably(
@@ -149,24 +195,71 @@ static inline bool VALID_EPOCH(uint64_t u) {
 #define JOURNAL_HEADER_SEALED(h) \
         (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_SEALED))
 
-#define JOURNAL_HEADER_COMPRESSED(h) \
-        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED))
+#define JOURNAL_HEADER_ENTRY_ARRAY_INDEX(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX))
+
+#define JOURNAL_HEADER_FIELD_SUMMARY(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_FIELD_SUMMARY))
+
+#define JOURNAL_HEADER_BOOT_INDEX(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_BOOT_INDEX))
+
+#define JOURNAL_HEADER_TEXT_INDEX(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_TEXT_INDEX))
+
+#define JOURNAL_HEADER_COMPRESSED_XZ(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_XZ))
+
+#define JOURNAL_HEADER_COMPRESSED_LZ4(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
+
+static inline bool JOURNAL_FILE_COMPRESS(JournalFile *f) {
+        assert(f);
+        return f->compress_xz || f->compress_lz4;
+}
 
 int journal_file_move_to_object(JournalFile *f, int type, uint64_t offset, Object **ret);
 
 uint64_t journal_file_entry_n_items(Object *o) _pure_;
 uint64_t journal_file_entry_array_n_items(Object *o) _pure_;
+uint64_t journal_file_entry_array_index_n_items(Object *o) _pure_;
+uint64_t journal_file_field_summary_n_items(Object *o) _pure_;
+uint64_t journal_file_boot_index_n_items(Object *o) _pure_;
+le64_t *journal_file_text_index_postings(Object *o) _pure_;
 uint64_t journal_file_hash_table_n_items(Object *o) _pure_;
 
 int journal_file_append_object(JournalFile *f, int type, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const struct iovec iovec[], unsigned n_iovec, uint64_t *seqno, Object **ret, uint64_t *offset);
 
+typedef struct JournalBatchEntry {
+        dual_timestamp ts; /* if unset, the time of the append is used */
+        const struct iovec *iovec;
+        unsigned n_iovec;
+} JournalBatchEntry;
+
+int journal_file_append_entries(JournalFile *f, const JournalBatchEntry entries[], unsigned n_entries, uint64_t *seqno, unsigned *n_appended);
+
 int journal_file_find_data_object(JournalFile *f, const void *data, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_data_object_with_hash(JournalFile *f, const void *data, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
 
 int journal_file_find_field_object(JournalFile *f, const void *field, uint64_t size, Object **ret, uint64_t *offset);
 int journal_file_find_field_object_with_hash(JournalFile *f, const void *field, uint64_t size, uint64_t hash, Object **ret, uint64_t *offset);
 
+int journal_file_find_field_summary(JournalFile *f, const void *field, uint64_t size, Object **ret, uint64_t *offset);
+bool journal_file_field_summaries_current(JournalFile *f);
+int journal_file_append_field_summaries(JournalFile *f);
+
+int journal_file_get_boot_index(JournalFile *f, BootIndexItem **ret, unsigned *n_ret);
+
+/* At most this many words are looked for at once */
+#define TEXT_TOKENS_MAX 64
+
+int journal_text_tokenize(const void *text, size_t size, uint64_t **ret, unsigned *n_ret);
+bool journal_file_text_index_current(JournalFile *f);
+int journal_file_append_text_index(JournalFile *f);
+int journal_file_find_text(JournalFile *f, const uint64_t *tokens, unsigned n_tokens, uint64_t after_offset, uint64_t **ret, size_t *n_ret);
+int journal_file_append_data_entries(JournalFile *f, uint64_t p, uint64_t **entries, size_t *n_entries, size_t *n_allocated);
+
 int journal_file_next_entry(JournalFile *f, Object *o, uint64_t p, direction_t direction, Object **ret, uint64_t *offset);
 int journal_file_skip_entry(JournalFile *f, Object *o, uint64_t p, int64_t skip, Object **ret, uint64_t *offset);
 
@@ -187,6 +280,7 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
 void journal_file_dump(JournalFile *f);
 void journal_file_print_header(JournalFile *f);
 
+int journal_file_get_archived_path(JournalFile *f, char **ret);
 int journal_file_rotate(JournalFile **f, bool compress, bool seal);
 
 void journal_file_post_change(JournalFile *f);
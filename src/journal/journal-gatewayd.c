@@ -34,10 +34,16 @@
 #include "sd-bus.h"
 #include "bus-util.h"
 #include "logs-show.h"
+#include "logs-pipeline.h"
 #include "microhttpd-util.h"
 #include "build.h"
 #include "fileio.h"
 
+/* Entries are formatted in buffers of about this size, and handed
+ * to microhttpd in blocks of this size, each becoming one HTTP chunk */
+#define ENTRIES_BUFFER_SIZE (1024*1024)
+#define ENTRIES_BLOCK_SIZE (64*1024)
+
 typedef struct RequestMeta {
         sd_journal *journal;
 
@@ -48,9 +54,16 @@ typedef struct RequestMeta {
         uint64_t n_entries;
         bool n_entries_set;
 
+        /* What we formatted and haven't sent yet */
+        OutputPipeline *pipeline;
         FILE *tmp;
+        char *buf;
+        size_t buf_size;
         uint64_t delta, size;
 
+        /* No more entries to send, even when following */
+        bool eof;
+
         int argument_parse_error;
 
         bool follow;
@@ -92,23 +105,30 @@ static void request_meta_free(
         if (!m)
                 return;
 
+        output_pipeline_free(m->pipeline);
+
         if (m->journal)
                 sd_journal_close(m->journal);
 
         if (m->tmp)
                 fclose(m->tmp);
+        free(m->buf);
 
         free(m->cursor);
         free(m);
 }
 
+static int open_pipeline_journal(sd_journal **ret, void *userdata) {
+        return sd_journal_open(ret, SD_JOURNAL_LOCAL_ONLY|SD_JOURNAL_SYSTEM);
+}
+
 static int open_journal(RequestMeta *m) {
         assert(m);
 
         if (m->journal)
                 return 0;
 
-        return sd_journal_open(&m->journal, SD_JOURNAL_LOCAL_ONLY|SD_JOURNAL_SYSTEM);
+        return open_pipeline_journal(&m->journal, NULL);
 }
 
 static int respond_oom_internal(struct MHD_Connection *connection) {
@@ -164,6 +184,53 @@ static int respond_error(
         return r;
 }
 
+static int request_next_entry(RequestMeta *m) {
+        int r;
+
+        assert(m);
+
+        if (m->n_entries_set &&
+            m->n_entries <= 0) {
+                m->eof = true;
+                return 0;
+        }
+
+        if (m->n_skip < 0)
+                r = sd_journal_previous_skip(m->journal, (uint64_t) -m->n_skip + 1);
+        else if (m->n_skip > 0)
+                r = sd_journal_next_skip(m->journal, (uint64_t) m->n_skip + 1);
+        else
+                r = sd_journal_next(m->journal);
+
+        if (r < 0) {
+                log_error("Failed to advance journal pointer: %s", strerror(-r));
+                return r;
+        } else if (r == 0)
+                return 0;
+
+        if (m->discrete) {
+                assert(m->cursor);
+
+                r = sd_journal_test_cursor(m->journal, m->cursor);
+                if (r < 0) {
+                        log_error("Failed to test cursor: %s", strerror(-r));
+                        return r;
+                }
+
+                if (r == 0) {
+                        m->eof = true;
+                        return 0;
+                }
+        }
+
+        if (m->n_entries_set)
+                m->n_entries -= 1;
+
+        m->n_skip = 0;
+
+        return 1;
+}
+
 static ssize_t request_reader_entries(
                 void *cls,
                 uint64_t pos,
@@ -172,7 +239,7 @@ static ssize_t request_reader_entries(
 
         RequestMeta *m = cls;
         int r;
-        size_t n, k;
+        size_t n;
 
         assert(m);
         assert(buf);
@@ -182,103 +249,94 @@ static ssize_t request_reader_entries(
         pos -= m->delta;
 
         while (pos >= m->size) {
-                off_t sz;
-
-                /* End of this entry, so let's serialize the next
-                 * one */
+                long sz;
+                bool end = false;
 
-                if (m->n_entries_set &&
-                    m->n_entries <= 0)
-                        return MHD_CONTENT_READER_END_OF_STREAM;
-
-                if (m->n_skip < 0)
-                        r = sd_journal_previous_skip(m->journal, (uint64_t) -m->n_skip + 1);
-                else if (m->n_skip > 0)
-                        r = sd_journal_next_skip(m->journal, (uint64_t) m->n_skip + 1);
-                else
-                        r = sd_journal_next(m->journal);
+                /* Everything sent, so let's serialize the next
+                 * bunch of entries. The pipeline writes them out in
+                 * order, some possibly only while we fill the buffer
+                 * the next time. */
 
-                if (r < 0) {
-                        log_error("Failed to advance journal pointer: %s", strerror(-r));
-                        return MHD_CONTENT_READER_END_WITH_ERROR;
-                } else if (r == 0) {
-
-                        if (m->follow) {
-                                r = sd_journal_wait(m->journal, (uint64_t) -1);
-                                if (r < 0) {
-                                        log_error("Couldn't wait for journal event: %s", strerror(-r));
-                                        return MHD_CONTENT_READER_END_WITH_ERROR;
-                                }
+                pos -= m->size;
+                m->delta += m->size;
+                m->size = 0;
 
-                                continue;
+                if (m->tmp)
+                        rewind(m->tmp);
+                else {
+                        m->tmp = open_memstream(&m->buf, &m->buf_size);
+                        if (!m->tmp) {
+                                log_error("Failed to create memory stream: %m");
+                                return MHD_CONTENT_READER_END_WITH_ERROR;
                         }
 
-                        return MHD_CONTENT_READER_END_OF_STREAM;
+                        r = output_pipeline_new(m->journal, m->tmp, m->mode, 0, OUTPUT_FULL_WIDTH, false,
+                                                open_pipeline_journal, NULL, &m->pipeline);
+                        if (r < 0) {
+                                log_oom();
+                                return MHD_CONTENT_READER_END_WITH_ERROR;
+                        }
                 }
 
-                if (m->discrete) {
-                        assert(m->cursor);
+                while (ftell(m->tmp) < ENTRIES_BUFFER_SIZE) {
+                        r = request_next_entry(m);
+                        if (r < 0)
+                                return MHD_CONTENT_READER_END_WITH_ERROR;
+                        if (r == 0) {
+                                end = true;
+                                break;
+                        }
 
-                        r = sd_journal_test_cursor(m->journal, m->cursor);
+                        r = output_pipeline_add_entry(m->pipeline);
                         if (r < 0) {
-                                log_error("Failed to test cursor: %s", strerror(-r));
+                                log_error("Failed to serialize item: %s", strerror(-r));
                                 return MHD_CONTENT_READER_END_WITH_ERROR;
                         }
-
-                        if (r == 0)
-                                return MHD_CONTENT_READER_END_OF_STREAM;
                 }
 
-                pos -= m->size;
-                m->delta += m->size;
-
-                if (m->n_entries_set)
-                        m->n_entries -= 1;
-
-                m->n_skip = 0;
-
-                if (m->tmp)
-                        rewind(m->tmp);
-                else {
-                        m->tmp = tmpfile();
-                        if (!m->tmp) {
-                                log_error("Failed to create temporary file: %m");
+                if (end) {
+                        r = output_pipeline_flush(m->pipeline);
+                        if (r < 0) {
+                                log_error("Failed to serialize item: %s", strerror(-r));
                                 return MHD_CONTENT_READER_END_WITH_ERROR;
                         }
                 }
 
-                r = output_journal(m->tmp, m->journal, m->mode, 0, OUTPUT_FULL_WIDTH, NULL);
-                if (r < 0) {
-                        log_error("Failed to serialize item: %s", strerror(-r));
+                if (fflush(m->tmp) != 0) {
+                        log_error("Failed to serialize items: %m");
                         return MHD_CONTENT_READER_END_WITH_ERROR;
                 }
 
-                sz = ftello(m->tmp);
-                if (sz == (off_t) -1) {
-                        log_error("Failed to retrieve file position: %m");
+                sz = ftell(m->tmp);
+                if (sz < 0) {
+                        log_error("Failed to retrieve stream position: %m");
                         return MHD_CONTENT_READER_END_WITH_ERROR;
                 }
 
                 m->size = (uint64_t) sz;
-        }
 
-        if (fseeko(m->tmp, pos, SEEK_SET) < 0) {
-                log_error("Failed to seek to position: %m");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
+                if (end && m->size <= 0) {
+                        if (m->follow && !m->eof) {
+                                r = sd_journal_wait(m->journal, (uint64_t) -1);
+                                if (r < 0) {
+                                        log_error("Couldn't wait for journal event: %s", strerror(-r));
+                                        return MHD_CONTENT_READER_END_WITH_ERROR;
+                                }
+
+                                continue;
+                        }
+
+                        return MHD_CONTENT_READER_END_OF_STREAM;
+                }
         }
 
         n = m->size - pos;
         if (n > max)
                 n = max;
 
-        errno = 0;
-        k = fread(buf, 1, n, m->tmp);
-        if (k != n) {
-                log_error("Failed to read from file: %s", errno ? strerror(errno) : "Premature EOF");
-                return MHD_CONTENT_READER_END_WITH_ERROR;
-        }
+        memcpy(buf, m->buf + pos, n);
 
-        return (ssize_t) k;
+        return (ssize_t) n;
 }
 
 static int request_parse_accept(
@@ -522,7 +580,7 @@ static int request_handler_entries(
         if (r < 0)
                 return respond_error(connection, MHD_HTTP_BAD_REQUEST, "Failed to seek in journal.\n");
 
-        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, 4*1024, request_reader_entries, m, NULL);
+        response = MHD_create_response_from_callback(MHD_SIZE_UNKNOWN, ENTRIES_BLOCK_SIZE, request_reader_entries, m, NULL);
         if (!response)
                 return respond_oom(connection);
 
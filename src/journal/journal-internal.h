@@ -31,6 +31,7 @@
 #include "list.h"
 #include "hashmap.h"
 #include "set.h"
+#include "prioq.h"
 #include "journal-file.h"
 
 typedef struct Match Match;
@@ -40,7 +41,8 @@ typedef struct Directory Directory;
 typedef enum MatchType {
         MATCH_DISCRETE,
         MATCH_OR_TERM,
-        MATCH_AND_TERM
+        MATCH_AND_TERM,
+        MATCH_TEXT
 } MatchType;
 
 struct Match {
@@ -53,6 +55,10 @@ struct Match {
         size_t size;
         le64_t le_hash;
 
+        /* For text matches, the words of data */
+        uint64_t *tokens;
+        unsigned n_tokens;
+
         /* For terms */
         LIST_HEAD(Match, matches);
 };
@@ -107,8 +113,19 @@ struct sd_journal {
         JournalFile *current_file;
         uint64_t current_field;
 
+        /* Files ordered by their next entry in the iteration
+         * direction, and the files that ran out of entries */
+        Prioq *candidates;
+        direction_t candidates_direction;
+        bool candidates_consumed;
+        Set *candidates_exhausted;
+
         Match *level0, *level1, *level2;
 
+        /* Bumped whenever the matches change, which invalidates
+         * what was resolved for them in the files */
+        uint64_t match_generation;
+
         pid_t original_pid;
 
         int inotify_fd;
@@ -118,6 +135,9 @@ struct sd_journal {
         char *unique_field;
         JournalFile *unique_file;
         uint64_t unique_offset;
+        uint64_t unique_summary_offset, unique_summary_item;
+        Set *unique_values;
+        uint64_t unique_values_size;
 
         int flags;
 
@@ -132,7 +152,34 @@ struct sd_journal {
         Set *errors;
 };
 
+/* A distinct value of a field, with the number of entries it
+ * appears in and their time range, over all files */
+typedef struct UniqueValue {
+        uint64_t hash;
+        const void *data;
+        size_t size;
+
+        uint64_t n_entries;
+        usec_t first_realtime;
+        usec_t last_realtime;
+} UniqueValue;
+
+int journal_get_unique_values(sd_journal *j, const char *field, UniqueValue ***ret, unsigned *n_ret);
+void unique_values_free(UniqueValue **values, unsigned n);
+
+/* The time range of one boot, over all files */
+typedef struct BootRange {
+        sd_id128_t boot_id;
+        usec_t first_realtime;
+        usec_t last_realtime;
+} BootRange;
+
+int journal_get_boots(sd_journal *j, BootRange **ret, unsigned *n_ret);
+
+int journal_get_data_last(sd_journal *j, const char *field, const void **data, size_t *size);
+
 char *journal_make_match_string(sd_journal *j);
+int journal_copy_matches(sd_journal *j, sd_journal *source);
 void journal_print_header(sd_journal *j);
 
 DEFINE_TRIVIAL_CLEANUP_FUNC(sd_journal*, sd_journal_close);
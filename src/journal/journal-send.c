@@ -21,6 +21,7 @@
 
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <stddef.h>
 #include <unistd.h>
@@ -32,6 +33,7 @@
 #include "sd-journal.h"
 #include "util.h"
 #include "socket-util.h"
+#include "missing.h"
 
 #define SNDBUF_SIZE (8*1024*1024)
 
@@ -223,6 +225,7 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
          * and where unprivileged users can create files. */
         char path[] = "/dev/shm/journal.XXXXXX";
         bool have_syslog_identifier = false;
+        bool seal = true;
 
         if (_unlikely_(!iov))
                 return -EINVAL;
@@ -308,17 +311,25 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
         if (errno != EMSGSIZE && errno != ENOBUFS)
                 return -errno;
 
-        /* Message doesn't fit... Let's dump the data in a temporary
-         * file and just pass a file descriptor of it to the other
-         * side */
+        /* Message doesn't fit... Let's dump the data in a memfd and
+         * just pass a file descriptor of it to the other side. Once
+         * sealed, the other side can map it without having to fear
+         * that we modify or truncate it underneath. If we can't have
+         * a memfd, fall back to a temporary file, which the other
+         * side has to copy. */
 
-        buffer_fd = mkostemp(path, O_CLOEXEC|O_RDWR);
-        if (buffer_fd < 0)
-                return -errno;
+        buffer_fd = memfd_create("journal-message", MFD_ALLOW_SEALING|MFD_CLOEXEC);
+        if (buffer_fd < 0) {
+                seal = false;
 
-        if (unlink(path) < 0) {
-                close_nointr_nofail(buffer_fd);
-                return -errno;
+                buffer_fd = mkostemp(path, O_CLOEXEC|O_RDWR);
+                if (buffer_fd < 0)
+                        return -errno;
+
+                if (unlink(path) < 0) {
+                        close_nointr_nofail(buffer_fd);
+                        return -errno;
+                }
         }
 
         n = writev(buffer_fd, w, j);
@@ -327,6 +338,12 @@ _public_ int sd_journal_sendv(const struct iovec *iov, int n) {
                 return -errno;
         }
 
+        if (seal &&
+            fcntl(buffer_fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) < 0) {
+                close_nointr_nofail(buffer_fd);
+                return -errno;
+        }
+
         mh.msg_iov = NULL;
         mh.msg_iovlen = 0;
 
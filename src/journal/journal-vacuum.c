@@ -34,6 +34,8 @@
 #include "journal-vacuum.h"
 #include "sd-id128.h"
 #include "util.h"
+#include "hashmap.h"
+#include "prioq.h"
 
 struct vacuum_info {
         uint64_t usage;
@@ -44,6 +46,27 @@ struct vacuum_info {
         uint64_t seqnum;
 
         bool have_seqnum;
+
+        /* Active files are only accounted for, never vacuumed */
+        bool active;
+        unsigned idx;
+};
+
+struct VacuumLedger {
+        char *directory;
+
+        /* Archived and corrupted files, oldest first, ... */
+        Prioq *archived;
+        uint64_t archived_usage;
+
+        /* ...active ones, and all of them by name */
+        Hashmap *active;
+        Hashmap *files;
+
+        /* Whether the above matches the directory as of its
+         * modification time */
+        bool valid;
+        struct timespec mtime;
 };
 
 static int vacuum_compare(const void *_a, const void *_b) {
@@ -147,196 +170,473 @@ static int journal_file_empty(int dir_fd, const char *name) {
         return le64toh(n_entries) == 0;
 }
 
-int journal_directory_vacuum(
-                const char *directory,
-                uint64_t max_use,
-                uint64_t min_free,
-                usec_t max_retention_usec,
-                usec_t *oldest_usec) {
+static void vacuum_info_free(struct vacuum_info *i) {
+        if (!i)
+                return;
 
-        _cleanup_closedir_ DIR *d = NULL;
-        int r = 0;
-        struct vacuum_info *list = NULL;
-        unsigned n_list = 0, i;
-        size_t n_allocated = 0;
-        uint64_t sum = 0, freed = 0;
-        usec_t retention_limit = 0;
+        free(i->filename);
+        free(i);
+}
+
+/* Returns -EINVAL for files which are no journal files */
+static int vacuum_info_new(const char *directory, int dir_fd, const char *name, struct vacuum_info **ret) {
+        struct vacuum_info *i;
+        unsigned long long seqnum = 0, realtime = 0;
+        sd_id128_t seqnum_id = {};
+        bool have_seqnum = false, active = false;
+        struct stat st;
+        size_t q;
 
         assert(directory);
+        assert(name);
+        assert(ret);
 
-        if (max_use <= 0 && min_free <= 0 && max_retention_usec <= 0)
+        q = strlen(name);
+
+        if (endswith(name, ".journal")) {
+                _cleanup_free_ char *id = NULL;
+
+                if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8 ||
+                    name[q-8-16-1] != '-' ||
+                    name[q-8-16-1-16-1] != '-' ||
+                    name[q-8-16-1-16-1-32-1] != '@')
+                        active = true;
+                else {
+                        /* Archived file */
+
+                        id = strndup(name + q-8-16-1-16-1-32, 32);
+                        if (!id)
+                                return -ENOMEM;
+
+                        if (sd_id128_from_string(id, &seqnum_id) < 0)
+                                return -EINVAL;
+
+                        if (sscanf(name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2)
+                                return -EINVAL;
+
+                        have_seqnum = true;
+                }
+
+        } else if (endswith(name, ".journal~")) {
+                unsigned long long tmp;
+
+                /* Corrupted file */
+
+                if (q < 1 + 16 + 1 + 16 + 8 + 1)
+                        return -EINVAL;
+
+                if (name[q-1-8-16-1] != '-' ||
+                    name[q-1-8-16-1-16-1] != '@')
+                        return -EINVAL;
+
+                if (sscanf(name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2)
+                        return -EINVAL;
+        } else
+                return -EINVAL;
+
+        if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return -errno;
+
+        if (!S_ISREG(st.st_mode))
+                return -EINVAL;
+
+        if (!active)
+                patch_realtime(directory, name, &st, &realtime);
+
+        i = new0(struct vacuum_info, 1);
+        if (!i)
+                return -ENOMEM;
+
+        i->filename = strdup(name);
+        if (!i->filename) {
+                free(i);
+                return -ENOMEM;
+        }
+
+        i->usage = 512UL * (uint64_t) st.st_blocks;
+        i->seqnum = seqnum;
+        i->realtime = realtime;
+        i->seqnum_id = seqnum_id;
+        i->have_seqnum = have_seqnum;
+        i->active = active;
+        i->idx = PRIOQ_IDX_NULL;
+
+        *ret = i;
+        return 0;
+}
+
+static void ledger_remove(VacuumLedger *l, struct vacuum_info *i) {
+        assert(l);
+        assert(i);
+
+        hashmap_remove(l->files, i->filename);
+
+        if (i->active)
+                hashmap_remove(l->active, i->filename);
+        else {
+                prioq_remove(l->archived, i, &i->idx);
+                l->archived_usage -= MIN(i->usage, l->archived_usage);
+        }
+
+        vacuum_info_free(i);
+}
+
+static void ledger_clear(VacuumLedger *l) {
+        struct vacuum_info *i;
+
+        assert(l);
+
+        while ((i = hashmap_first(l->files)))
+                ledger_remove(l, i);
+
+        l->valid = false;
+}
+
+static int ledger_update_mtime(VacuumLedger *l, int dir_fd) {
+        struct stat st;
+
+        assert(l);
+
+        if (fstat(dir_fd, &st) < 0)
+                return -errno;
+
+        l->mtime = st.st_mtim;
+        return 0;
+}
+
+/* Takes possession of i */
+static int ledger_put(VacuumLedger *l, int dir_fd, struct vacuum_info *i) {
+        struct vacuum_info *old;
+        int r;
+
+        assert(l);
+        assert(i);
+
+        old = hashmap_get(l->files, i->filename);
+        if (old)
+                ledger_remove(l, old);
+
+        if (!i->active && journal_file_empty(dir_fd, i->filename) > 0) {
+                /* Always vacuum empty non-online files. */
+
+                if (unlinkat(dir_fd, i->filename, 0) >= 0)
+                        log_info("Deleted empty journal %s/%s (%"PRIu64" bytes).",
+                                 l->directory, i->filename, i->usage);
+                else if (errno != ENOENT)
+                        log_warning("Failed to delete %s/%s: %m", l->directory, i->filename);
+
+                vacuum_info_free(i);
                 return 0;
+        }
 
-        if (max_retention_usec > 0) {
-                retention_limit = now(CLOCK_REALTIME);
-                if (retention_limit > max_retention_usec)
-                        retention_limit -= max_retention_usec;
-                else
-                        max_retention_usec = retention_limit = 0;
+        r = hashmap_put(l->files, i->filename, i);
+        if (r < 0) {
+                vacuum_info_free(i);
+                return r;
+        }
+
+        if (i->active)
+                r = hashmap_put(l->active, i->filename, i);
+        else {
+                r = prioq_put(l->archived, i, &i->idx);
+                if (r >= 0)
+                        l->archived_usage += i->usage;
         }
+        if (r < 0) {
+                hashmap_remove(l->files, i->filename);
+                vacuum_info_free(i);
+                return r;
+        }
+
+        return 0;
+}
+
+static int ledger_scan(VacuumLedger *l, int dir_fd) {
+        _cleanup_closedir_ DIR *d = NULL;
+        int r;
+
+        assert(l);
 
-        d = opendir(directory);
+        ledger_clear(l);
+
+        /* Take the time first, so that changes made while we are
+         * reading are noticed next time */
+        r = ledger_update_mtime(l, dir_fd);
+        if (r < 0)
+                return r;
+
+        d = opendir(l->directory);
         if (!d)
                 return -errno;
 
         for (;;) {
-                int k;
                 struct dirent *de;
                 union dirent_storage buf;
-                size_t q;
-                struct stat st;
-                char *p;
-                unsigned long long seqnum = 0, realtime;
-                sd_id128_t seqnum_id;
-                bool have_seqnum;
-
-                k = readdir_r(d, &buf.de, &de);
-                if (k != 0) {
-                        r = -k;
-                        goto finish;
+                struct vacuum_info *i;
+
+                r = readdir_r(d, &buf.de, &de);
+                if (r != 0) {
+                        ledger_clear(l);
+                        return -r;
                 }
 
                 if (!de)
                         break;
 
-                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                r = vacuum_info_new(l->directory, dirfd(d), de->d_name, &i);
+                if (r == -ENOMEM) {
+                        ledger_clear(l);
+                        return r;
+                }
+                if (r < 0)
                         continue;
 
-                if (!S_ISREG(st.st_mode))
-                        continue;
+                r = ledger_put(l, dirfd(d), i);
+                if (r < 0) {
+                        ledger_clear(l);
+                        return r;
+                }
+        }
 
-                q = strlen(de->d_name);
+        log_debug("Read %u archived and %u active journal files in %s.",
+                  prioq_size(l->archived), hashmap_size(l->active), l->directory);
 
-                if (endswith(de->d_name, ".journal")) {
+        l->valid = true;
+        return 0;
+}
 
-                        /* Vacuum archived files */
+/* Returns a file descriptor for the directory, with the ledger
+ * matching its contents */
+static int ledger_open(VacuumLedger *l) {
+        _cleanup_close_ int fd = -1;
+        struct stat st;
+        int r;
 
-                        if (q < 1 + 32 + 1 + 16 + 1 + 16 + 8)
-                                continue;
+        assert(l);
 
-                        if (de->d_name[q-8-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1] != '-' ||
-                            de->d_name[q-8-16-1-16-1-32-1] != '@')
-                                continue;
+        fd = open(l->directory, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0) {
+                ledger_clear(l);
+                return -errno;
+        }
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+        if (fstat(fd, &st) < 0)
+                return -errno;
 
-                        de->d_name[q-8-16-1-16-1] = 0;
-                        if (sd_id128_from_string(de->d_name + q-8-16-1-16-1-32, &seqnum_id) < 0) {
-                                free(p);
-                                continue;
-                        }
+        if (!l->valid ||
+            st.st_mtim.tv_sec != l->mtime.tv_sec ||
+            st.st_mtim.tv_nsec != l->mtime.tv_nsec) {
+                r = ledger_scan(l, fd);
+                if (r < 0)
+                        return r;
+        }
 
-                        if (sscanf(de->d_name + q-8-16-1-16, "%16llx-%16llx.journal", &seqnum, &realtime) != 2) {
-                                free(p);
-                                continue;
-                        }
+        r = fd;
+        fd = -1;
+        return r;
+}
 
-                        have_seqnum = true;
+int vacuum_ledger_new(const char *directory, VacuumLedger **ret) {
+        VacuumLedger *l;
 
-                } else if (endswith(de->d_name, ".journal~")) {
-                        unsigned long long tmp;
+        assert(directory);
+        assert(ret);
+
+        l = new0(VacuumLedger, 1);
+        if (!l)
+                return -ENOMEM;
+
+        l->directory = strdup(directory);
+        l->archived = prioq_new(vacuum_compare);
+        l->active = hashmap_new(string_hash_func, string_compare_func);
+        l->files = hashmap_new(string_hash_func, string_compare_func);
+        if (!l->directory || !l->archived || !l->active || !l->files) {
+                vacuum_ledger_free(l);
+                return -ENOMEM;
+        }
 
-                        /* Vacuum corrupted files */
+        *ret = l;
+        return 0;
+}
 
-                        if (q < 1 + 16 + 1 + 16 + 8 + 1)
-                                continue;
+void vacuum_ledger_free(VacuumLedger *l) {
+        if (!l)
+                return;
 
-                        if (de->d_name[q-1-8-16-1] != '-' ||
-                            de->d_name[q-1-8-16-1-16-1] != '@')
-                                continue;
+        if (l->files)
+                ledger_clear(l);
 
-                        p = strdup(de->d_name);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+        hashmap_free(l->files);
+        hashmap_free(l->active);
+        prioq_free(l->archived);
+        free(l->directory);
+        free(l);
+}
 
-                        if (sscanf(de->d_name + q-1-8-16-1-16, "%16llx-%16llx.journal~", &realtime, &tmp) != 2) {
-                                free(p);
-                                continue;
-                        }
+const char *vacuum_ledger_get_directory(VacuumLedger *l) {
+        assert(l);
 
-                        have_seqnum = false;
-                } else
-                        /* We do not vacuum active files or unknown files! */
-                        continue;
+        return l->directory;
+}
+
+int vacuum_ledger_add(VacuumLedger *l, const char *name) {
+        _cleanup_close_ int fd = -1;
+        struct vacuum_info *i;
+        int r;
+
+        assert(l);
+        assert(name);
+
+        /* Not read yet, it will be seen then */
+        if (!l->valid)
+                return 0;
+
+        fd = open(l->directory, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0) {
+                ledger_clear(l);
+                return -errno;
+        }
+
+        r = vacuum_info_new(l->directory, fd, name, &i);
+        if (r == -ENOENT) {
+                i = hashmap_get(l->files, name);
+                if (i)
+                        ledger_remove(l, i);
+        } else if (r >= 0)
+                r = ledger_put(l, fd, i);
+
+        if (r < 0 && r != -ENOENT && r != -EINVAL) {
+                ledger_clear(l);
+                return r;
+        }
+
+        return ledger_update_mtime(l, fd);
+}
 
-                if (journal_file_empty(dirfd(d), p)) {
-                        /* Always vacuum empty non-online files. */
+int vacuum_ledger_get_usage(VacuumLedger *l, uint64_t *ret) {
+        _cleanup_close_ int fd = -1;
+        struct vacuum_info *i;
+        Iterator j;
+        uint64_t sum;
 
-                        uint64_t size = 512UL * (uint64_t) st.st_blocks;
+        assert(l);
+        assert(ret);
 
-                        if (unlinkat(dirfd(d), p, 0) >= 0) {
-                                log_info("Deleted empty journal %s/%s (%"PRIu64" bytes).",
-                                         directory, p, size);
-                                freed += size;
-                        } else if (errno != ENOENT)
-                                log_warning("Failed to delete %s/%s: %m", directory, p);
+        fd = ledger_open(l);
+        if (fd < 0)
+                return fd;
+
+        sum = l->archived_usage;
 
-                        free(p);
+        /* Active files may have grown since, there are only a few
+         * of them however */
+        HASHMAP_FOREACH(i, l->active, j) {
+                struct stat st;
 
+                if (fstatat(fd, i->filename, &st, AT_SYMLINK_NOFOLLOW) < 0)
                         continue;
-                }
 
-                patch_realtime(directory, p, &st, &realtime);
+                i->usage = 512UL * (uint64_t) st.st_blocks;
+                sum += i->usage;
+        }
 
-                GREEDY_REALLOC(list, n_allocated, n_list + 1);
+        *ret = sum;
+        return 0;
+}
+
+int vacuum_ledger_vacuum(
+                VacuumLedger *l,
+                uint64_t max_use,
+                uint64_t min_free,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec) {
 
-                list[n_list].filename = p;
-                list[n_list].usage = 512UL * (uint64_t) st.st_blocks;
-                list[n_list].seqnum = seqnum;
-                list[n_list].realtime = realtime;
-                list[n_list].seqnum_id = seqnum_id;
-                list[n_list].have_seqnum = have_seqnum;
+        _cleanup_close_ int fd = -1;
+        struct vacuum_info *i;
+        uint64_t freed = 0;
+        usec_t retention_limit = 0;
+        bool failed = false;
+        int r = 0;
 
-                sum += list[n_list].usage;
+        assert(l);
+
+        if (max_use <= 0 && min_free <= 0 && max_retention_usec <= 0)
+                return 0;
 
-                n_list ++;
+        if (max_retention_usec > 0) {
+                retention_limit = now(CLOCK_REALTIME);
+                if (retention_limit > max_retention_usec)
+                        retention_limit -= max_retention_usec;
+                else
+                        max_retention_usec = retention_limit = 0;
         }
 
-        qsort_safe(list, n_list, sizeof(struct vacuum_info), vacuum_compare);
+        fd = ledger_open(l);
+        if (fd < 0)
+                return fd;
 
-        for (i = 0; i < n_list; i++) {
+        while ((i = prioq_peek(l->archived))) {
                 struct statvfs ss;
 
-                if (fstatvfs(dirfd(d), &ss) < 0) {
+                if (fstatvfs(fd, &ss) < 0) {
                         r = -errno;
-                        goto finish;
+                        break;
                 }
 
-                if ((max_retention_usec <= 0 || list[i].realtime >= retention_limit) &&
-                    (max_use <= 0 || sum <= max_use) &&
+                if ((max_retention_usec <= 0 || i->realtime >= retention_limit) &&
+                    (max_use <= 0 || l->archived_usage <= max_use) &&
                     (min_free <= 0 || (uint64_t) ss.f_bavail * (uint64_t) ss.f_bsize >= min_free))
                         break;
 
-                if (unlinkat(dirfd(d), list[i].filename, 0) >= 0) {
+                if (unlinkat(fd, i->filename, 0) >= 0) {
                         log_debug("Deleted archived journal %s/%s (%"PRIu64" bytes).",
-                                  directory, list[i].filename, list[i].usage);
-                        freed += list[i].usage;
-
-                        if (list[i].usage < sum)
-                                sum -= list[i].usage;
-                        else
-                                sum = 0;
+                                  l->directory, i->filename, i->usage);
+                        freed += i->usage;
+                } else if (errno != ENOENT) {
+                        log_warning("Failed to delete %s/%s: %m", l->directory, i->filename);
+
+                        /* Still there, but skipped, until the
+                         * directory is read again next time */
+                        failed = true;
+                }
 
-                } else if (errno != ENOENT)
-                        log_warning("Failed to delete %s/%s: %m", directory, list[i].filename);
+                ledger_remove(l, i);
         }
 
-        if (oldest_usec && i < n_list && (*oldest_usec == 0 || list[i].realtime < *oldest_usec))
-                *oldest_usec = list[i].realtime;
+        if (oldest_usec && i && (*oldest_usec == 0 || i->realtime < *oldest_usec))
+                *oldest_usec = i->realtime;
 
-finish:
-        for (i = 0; i < n_list; i++)
-                free(list[i].filename);
-        free(list);
+        if (failed)
+                l->valid = false;
+        else if (freed > 0)
+                ledger_update_mtime(l, fd);
 
         log_info("Vacuuming done, freed %"PRIu64" bytes", freed);
 
         return r;
 }
+
+int journal_directory_vacuum(
+                const char *directory,
+                uint64_t max_use,
+                uint64_t min_free,
+                usec_t max_retention_usec,
+                usec_t *oldest_usec) {
+
+        VacuumLedger *l;
+        int r;
+
+        assert(directory);
+
+        if (max_use <= 0 && min_free <= 0 && max_retention_usec <= 0)
+                return 0;
+
+        r = vacuum_ledger_new(directory, &l);
+        if (r < 0)
+                return r;
+
+        r = vacuum_ledger_vacuum(l, max_use, min_free, max_retention_usec, oldest_usec);
+        vacuum_ledger_free(l);
+
+        return r;
+}
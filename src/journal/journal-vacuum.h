@@ -23,4 +23,21 @@
 
 #include <inttypes.h>
 
+#include "util.h"
+
+/* What is in a journal directory, read once and kept up-to-date as
+ * we are told about files archived or created in it. Changes made by
+ * others are noticed by the modification time of the directory, which
+ * makes us read it again. */
+typedef struct VacuumLedger VacuumLedger;
+
+int vacuum_ledger_new(const char *directory, VacuumLedger **ret);
+void vacuum_ledger_free(VacuumLedger *l);
+
+const char *vacuum_ledger_get_directory(VacuumLedger *l);
+
+int vacuum_ledger_add(VacuumLedger *l, const char *name);
+int vacuum_ledger_get_usage(VacuumLedger *l, uint64_t *ret);
+int vacuum_ledger_vacuum(VacuumLedger *l, uint64_t max_use, uint64_t min_free, usec_t max_retention_usec, usec_t *oldest_usec);
+
 int journal_directory_vacuum(const char *directory, uint64_t max_use, uint64_t min_free, usec_t max_retention_usec, usec_t *oldest_usec);
@@ -23,6 +23,7 @@
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <pthread.h>
 
 #include "util.h"
 #include "macro.h"
@@ -49,7 +50,7 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
          * possible field values. It does not follow any references to
          * other objects. */
 
-        if ((o->object.flags & OBJECT_COMPRESSED) &&
+        if ((o->object.flags & OBJECT_COMPRESSION_MASK) &&
             o->object.type != OBJECT_DATA)
                 return -EBADMSG;
 
@@ -57,6 +58,7 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
 
         case OBJECT_DATA: {
                 uint64_t h1, h2;
+                int compression;
 
                 if (le64toh(o->data.entry_offset) == 0)
                         log_warning(OFSfmt": unused data (entry_offset==0)", offset);
@@ -76,12 +78,14 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
 
                 h1 = le64toh(o->data.hash);
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
+                compression = o->object.flags & OBJECT_COMPRESSION_MASK;
+                if (compression) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
                         void *b = NULL;
                         uint64_t alloc = 0, b_size;
 
-                        if (!uncompress_blob(o->data.payload,
+                        if (!uncompress_blob(compression,
+                                             o->data.payload,
                                              le64toh(o->object.size) - offsetof(Object, data.payload),
                                              &b, &alloc, &b_size, 0)) {
                                 log_error(OFSfmt": uncompression failed", offset);
@@ -260,6 +264,126 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
 
                 break;
 
+        case OBJECT_ENTRY_ARRAY_INDEX:
+                if ((le64toh(o->object.size) - offsetof(EntryArrayIndexObject, items)) % sizeof(EntryArrayIndexItem) != 0 ||
+                    le64toh(o->entry_array_index.n_items) > journal_file_entry_array_index_n_items(o)) {
+                        log_error(OFSfmt": invalid object entry array index size: %"PRIu64,
+                                  offset,
+                                  le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                for (i = 0; i < le64toh(o->entry_array_index.n_items); i++)
+                        if (!VALID64(o->entry_array_index.items[i].entry_array_offset) ||
+                            !VALID64(o->entry_array_index.items[i].entry_offset)) {
+                                log_error(OFSfmt": invalid object entry array index item (%"PRIu64"/%"PRIu64")",
+                                          offset,
+                                          i, le64toh(o->entry_array_index.n_items));
+                                return -EBADMSG;
+                        }
+
+                break;
+
+        case OBJECT_FIELD_SUMMARY:
+                if ((le64toh(o->object.size) - offsetof(FieldSummaryObject, items)) % sizeof(FieldSummaryItem) != 0 ||
+                    journal_file_field_summary_n_items(o) <= 0 ||
+                    journal_file_field_summary_n_items(o) > FIELD_SUMMARY_ITEMS_MAX) {
+                        log_error(OFSfmt": invalid object field summary size: %"PRIu64,
+                                  offset,
+                                  le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                if (o->field_summary.field_offset == 0 ||
+                    !VALID64(o->field_summary.field_offset) ||
+                    !VALID64(o->field_summary.next_summary_offset)) {
+                        log_error(OFSfmt": invalid object field summary offsets", offset);
+                        return -EBADMSG;
+                }
+
+                for (i = 0; i < journal_file_field_summary_n_items(o); i++)
+                        if (!VALID64(o->field_summary.items[i].data_offset) ||
+                            o->field_summary.items[i].data_offset == 0 ||
+                            le64toh(o->field_summary.items[i].n_entries) <= 0 ||
+                            le64toh(o->field_summary.items[i].first_realtime) > le64toh(o->field_summary.items[i].last_realtime)) {
+                                log_error(OFSfmt": invalid object field summary item (%"PRIu64"/%"PRIu64")",
+                                          offset,
+                                          i, journal_file_field_summary_n_items(o));
+                                return -EBADMSG;
+                        }
+
+                break;
+
+        case OBJECT_BOOT_INDEX:
+                if ((le64toh(o->object.size) - offsetof(BootIndexObject, items)) % sizeof(BootIndexItem) != 0 ||
+                    le64toh(o->boot_index.n_items) > journal_file_boot_index_n_items(o)) {
+                        log_error(OFSfmt": invalid object boot index size: %"PRIu64,
+                                  offset,
+                                  le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                if (!VALID64(o->boot_index.previous_index_offset) ||
+                    le64toh(o->boot_index.previous_index_offset) >= offset) {
+                        log_error(OFSfmt": invalid object boot index previous offset", offset);
+                        return -EBADMSG;
+                }
+
+                for (i = 0; i < le64toh(o->boot_index.n_items); i++)
+                        if (!VALID64(o->boot_index.items[i].first_entry_offset) ||
+                            !VALID64(o->boot_index.items[i].last_entry_offset) ||
+                            o->boot_index.items[i].first_entry_offset == 0 ||
+                            le64toh(o->boot_index.items[i].first_entry_offset) > le64toh(o->boot_index.items[i].last_entry_offset) ||
+                            le64toh(o->boot_index.items[i].first_seqnum) > le64toh(o->boot_index.items[i].last_seqnum)) {
+                                log_error(OFSfmt": invalid object boot index item (%"PRIu64"/%"PRIu64")",
+                                          offset,
+                                          i, le64toh(o->boot_index.n_items));
+                                return -EBADMSG;
+                        }
+
+                break;
+
+        case OBJECT_TEXT_INDEX: {
+                uint64_t n_tokens, n_postings;
+                le64_t *a;
+
+                n_tokens = le64toh(o->text_index.n_tokens);
+                n_postings = le64toh(o->text_index.n_postings);
+
+                if (n_tokens <= 0 ||
+                    n_postings > TEXT_INDEX_POSTINGS_MAX ||
+                    n_tokens > n_postings ||
+                    le64toh(o->object.size) != offsetof(TextIndexObject, tokens) + n_tokens * sizeof(TextIndexToken) + n_postings * sizeof(le64_t)) {
+                        log_error(OFSfmt": invalid object text index size: %"PRIu64,
+                                  offset,
+                                  le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                for (i = 0; i < n_tokens; i++)
+                        if (le64toh(o->text_index.tokens[i].n_postings) <= 0 ||
+                            le64toh(o->text_index.tokens[i].first_posting) + le64toh(o->text_index.tokens[i].n_postings) > n_postings ||
+                            (i > 0 && le64toh(o->text_index.tokens[i-1].hash) >= le64toh(o->text_index.tokens[i].hash))) {
+                                log_error(OFSfmt": invalid object text index token (%"PRIu64"/%"PRIu64")",
+                                          offset,
+                                          i, n_tokens);
+                                return -EBADMSG;
+                        }
+
+                a = journal_file_text_index_postings(o);
+                for (i = 0; i < n_postings; i++)
+                        if (!VALID64(a[i]) ||
+                            a[i] == 0 ||
+                            le64toh(a[i]) >= offset) {
+                                log_error(OFSfmt": invalid object text index posting (%"PRIu64"/%"PRIu64")",
+                                          offset,
+                                          i, n_postings);
+                                return -EBADMSG;
+                        }
+
+                break;
+        }
+
         case OBJECT_TAG:
                 if (le64toh(o->object.size) != sizeof(TagObject)) {
                         log_error(OFSfmt": invalid object tag size: %"PRIu64,
@@ -619,6 +743,27 @@ static int verify_hash_table(
         return 0;
 }
 
+typedef struct HashTableVerify {
+        JournalFile *f;
+        int data_fd, entry_fd, entry_array_fd;
+        uint64_t n_data, n_entries, n_entry_arrays;
+        int r;
+} HashTableVerify;
+
+static void *verify_hash_table_thread(void *p) {
+        HashTableVerify *v = p;
+        usec_t last_usec = 0;
+
+        v->r = verify_hash_table(v->f,
+                                 v->data_fd, v->n_data,
+                                 v->entry_fd, v->n_entries,
+                                 v->entry_array_fd, v->n_entry_arrays,
+                                 &last_usec,
+                                 false);
+
+        return NULL;
+}
+
 static int data_object_in_hash_table(JournalFile *f, uint64_t hash, uint64_t p) {
         uint64_t n, h, q;
         int r;
@@ -690,6 +835,57 @@ static int verify_entry(
         return 0;
 }
 
+static int verify_entry_array_index_item(JournalFile *f, uint64_t k, uint64_t a, uint64_t i) {
+        EntryArrayIndexItem item;
+        uint64_t q, p;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        if (!JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header) ||
+            !JOURNAL_HEADER_CONTAINS(f->header, entry_array_index_offset))
+                return 0;
+
+        q = le64toh(f->header->entry_array_index_offset);
+        if (q == 0)
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY_INDEX, q, &o);
+        if (r < 0)
+                return r;
+
+        if (k >= le64toh(o->entry_array_index.n_items))
+                return 0;
+
+        item = o->entry_array_index.items[k];
+
+        r = journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY, a, &o);
+        if (r < 0)
+                return r;
+
+        p = le64toh(o->entry_array.items[0]);
+
+        if (le64toh(item.entry_array_offset) != a ||
+            le64toh(item.total) != i ||
+            le64toh(item.entry_offset) != p) {
+                log_error("Entry array index item %"PRIu64" does not match array at "OFSfmt, k, a);
+                return -EBADMSG;
+        }
+
+        r = journal_file_move_to_object(f, OBJECT_ENTRY, p, &o);
+        if (r < 0)
+                return r;
+
+        if (item.seqnum != o->entry.seqnum ||
+            item.realtime != o->entry.realtime) {
+                log_error("Entry array index item %"PRIu64" does not match entry at "OFSfmt, k, p);
+                return -EBADMSG;
+        }
+
+        return 0;
+}
+
 static int verify_entry_array(
                 JournalFile *f,
                 int data_fd, uint64_t n_data,
@@ -698,7 +894,7 @@ static int verify_entry_array(
                 usec_t *last_usec,
                 bool show_progress) {
 
-        uint64_t i = 0, a, n, last = 0;
+        uint64_t i = 0, a, n, last = 0, k = 0;
         int r;
 
         assert(f);
@@ -713,6 +909,10 @@ static int verify_entry_array(
                 uint64_t next, m, j;
                 Object *o;
 
+                r = verify_entry_array_index_item(f, k++, a, i);
+                if (r < 0)
+                        return r;
+
                 if (show_progress)
                         draw_progress(0x8000 + (0x3FFF * i / n), last_usec);
 
@@ -789,6 +989,9 @@ int journal_file_verify(
         uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0;
         usec_t last_usec = 0;
         int data_fd = -1, entry_fd = -1, entry_array_fd = -1;
+        JournalFile *hf = NULL;
+        HashTableVerify v = {};
+        pthread_t t;
         char data_path[] = "/var/tmp/journal-data-XXXXXX",
                 entry_path[] = "/var/tmp/journal-entry-XXXXXX",
                 entry_array_path[] = "/var/tmp/journal-entry-array-XXXXXX";
@@ -836,12 +1039,7 @@ int journal_file_verify(
         }
         unlink(entry_array_path);
 
-#ifdef HAVE_GCRYPT
-        if ((le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SEALED) != 0)
-#else
-        if (f->header->compatible_flags != 0)
-#endif
-        {
+        if ((le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_SUPPORTED) != 0) {
                 log_error("Cannot verify file with unknown extensions.");
                 r = -ENOTSUP;
                 goto fail;
@@ -885,8 +1083,16 @@ int journal_file_verify(
                         goto fail;
                 }
 
-                if ((o->object.flags & OBJECT_COMPRESSED) && !JOURNAL_HEADER_COMPRESSED(f->header)) {
-                        log_error("Compressed object in file without compression at "OFSfmt, p);
+                if ((o->object.flags & OBJECT_COMPRESSED_XZ) &&
+                    !JOURNAL_HEADER_COMPRESSED_XZ(f->header)) {
+                        log_error("XZ compressed object in file without XZ compression at "OFSfmt, p);
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
+                if ((o->object.flags & OBJECT_COMPRESSED_LZ4) &&
+                    !JOURNAL_HEADER_COMPRESSED_LZ4(f->header)) {
+                        log_error("LZ4 compressed object in file without LZ4 compression at "OFSfmt, p);
                         r = -EBADMSG;
                         goto fail;
                 }
@@ -1016,6 +1222,49 @@ int journal_file_verify(
                         n_entry_arrays++;
                         break;
 
+                case OBJECT_ENTRY_ARRAY_INDEX:
+                        if (!JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header) ||
+                            !JOURNAL_HEADER_CONTAINS(f->header, entry_array_index_offset) ||
+                            p != le64toh(f->header->entry_array_index_offset)) {
+                                log_error("Entry array index not referenced by header at "OFSfmt, p);
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+                        break;
+
+                case OBJECT_FIELD_SUMMARY:
+                        /* Summaries from before the file was last
+                         * appended to are left behind unreferenced,
+                         * hence don't insist on a reference */
+                        if (!JOURNAL_HEADER_FIELD_SUMMARY(f->header)) {
+                                log_error("Field summary object in file without field summaries at "OFSfmt, p);
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+                        break;
+
+                case OBJECT_BOOT_INDEX:
+                        /* Only the newest object is referenced by
+                         * the header, the others through the chain */
+                        if (!JOURNAL_HEADER_BOOT_INDEX(f->header) ||
+                            !JOURNAL_HEADER_CONTAINS(f->header, boot_index_offset) ||
+                            p > le64toh(f->header->boot_index_offset)) {
+                                log_error("Boot index not referenced by header at "OFSfmt, p);
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+                        break;
+
+                case OBJECT_TEXT_INDEX:
+                        /* Like summaries, outdated indexes are left
+                         * behind unreferenced */
+                        if (!JOURNAL_HEADER_TEXT_INDEX(f->header)) {
+                                log_error("Text index object in file without text index at "OFSfmt, p);
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+                        break;
+
                 case OBJECT_TAG:
                         if (!JOURNAL_HEADER_SEALED(f->header)) {
                                 log_error("Tag object in file without sealing at "OFSfmt, p);
@@ -1207,21 +1456,47 @@ int journal_file_verify(
          * unreferenced objects. We only care that everything that is
          * referenced is consistent. */
 
+        /* The hash table is followed in a thread of its own, through
+         * a second handle for the file, since neither JournalFile
+         * objects nor their mmap caches may be shared between
+         * threads. If that doesn't work out, both are followed one
+         * after the other. */
+        if (journal_file_open(f->path, O_RDONLY, 0, false, false, NULL, NULL, NULL, &hf) >= 0) {
+                v.f = hf;
+                v.data_fd = data_fd;
+                v.n_data = n_data;
+                v.entry_fd = entry_fd;
+                v.n_entries = n_entries;
+                v.entry_array_fd = entry_array_fd;
+                v.n_entry_arrays = n_entry_arrays;
+
+                if (pthread_create(&t, NULL, verify_hash_table_thread, &v) != 0) {
+                        journal_file_close(hf);
+                        hf = NULL;
+                }
+        }
+
         r = verify_entry_array(f,
                                data_fd, n_data,
                                entry_fd, n_entries,
                                entry_array_fd, n_entry_arrays,
                                &last_usec,
                                show_progress);
-        if (r < 0)
-                goto fail;
 
-        r = verify_hash_table(f,
-                              data_fd, n_data,
-                              entry_fd, n_entries,
-                              entry_array_fd, n_entry_arrays,
-                              &last_usec,
-                              show_progress);
+        if (hf) {
+                assert_se(pthread_join(t, NULL) == 0);
+                journal_file_close(hf);
+                hf = NULL;
+
+                if (r >= 0)
+                        r = v.r;
+        } else if (r >= 0)
+                r = verify_hash_table(f,
+                                      data_fd, n_data,
+                                      entry_fd, n_entries,
+                                      entry_array_fd, n_entry_arrays,
+                                      &last_usec,
+                                      show_progress);
         if (r < 0)
                 goto fail;
 
@@ -33,6 +33,7 @@
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
+#include <pthread.h>
 
 #ifdef HAVE_ACL
 #include <sys/acl.h>
@@ -43,6 +44,7 @@
 
 #include "log.h"
 #include "logs-show.h"
+#include "logs-pipeline.h"
 #include "util.h"
 #include "path-util.h"
 #include "fileio.h"
@@ -58,6 +60,7 @@
 #include "fsprg.h"
 #include "unit-name.h"
 #include "catalog.h"
+#include "set.h"
 
 #define DEFAULT_FSS_INTERVAL_USEC (15*USEC_PER_MINUTE)
 
@@ -80,7 +83,9 @@ static bool arg_show_cursor = false;
 static const char *arg_directory = NULL;
 static char **arg_file = NULL;
 static int arg_priorities = 0xFF;
+static const char *arg_search = NULL;
 static const char *arg_verify_key = NULL;
+static const char *arg_verify_checkpoint = NULL;
 #ifdef HAVE_GCRYPT
 static usec_t arg_interval = DEFAULT_FSS_INTERVAL_USEC;
 static bool arg_force = false;
@@ -132,6 +137,7 @@ static int help(void) {
                "  -u --unit=UNIT           Show data only from the specified unit\n"
                "     --user-unit=UNIT      Show data only from the specified user session unit\n"
                "  -p --priority=RANGE      Show only messages within the specified priority range\n"
+               "     --search=WORDS        Show only messages containing all of the words\n"
                "  -e --pager-end           Immediately jump to end of the journal in the pager\n"
                "  -f --follow              Follow journal\n"
                "  -n --lines[=INTEGER]     Number of journal entries to show\n"
@@ -149,6 +155,9 @@ static int help(void) {
                "  -D --directory=PATH      Show journal files from directory\n"
                "     --file=PATH           Show journal file\n"
                "     --root=ROOT           Operate on catalog files underneath the root ROOT\n"
+               "     --verify-checkpoint=PATH\n"
+               "                           Skip files passed before with --verify, record\n"
+               "                           passing ones\n"
 #ifdef HAVE_GCRYPT
                "     --interval=TIME       Time interval for changing the FSS sealing key\n"
                "     --verify-key=KEY      Specify FSS verification key\n"
@@ -197,10 +206,12 @@ static int parse_argv(int argc, char *argv[]) {
                 ARG_AFTER_CURSOR,
                 ARG_SHOW_CURSOR,
                 ARG_USER_UNIT,
+                ARG_SEARCH,
                 ARG_LIST_CATALOG,
                 ARG_DUMP_CATALOG,
                 ARG_UPDATE_CATALOG,
                 ARG_FORCE,
+                ARG_VERIFY_CHECKPOINT,
         };
 
         static const struct option options[] = {
@@ -234,6 +245,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "interval",       required_argument, NULL, ARG_INTERVAL       },
                 { "verify",         no_argument,       NULL, ARG_VERIFY         },
                 { "verify-key",     required_argument, NULL, ARG_VERIFY_KEY     },
+                { "verify-checkpoint", required_argument, NULL, ARG_VERIFY_CHECKPOINT },
                 { "disk-usage",     no_argument,       NULL, ARG_DISK_USAGE     },
                 { "cursor",         required_argument, NULL, 'c'                },
                 { "after-cursor",   required_argument, NULL, ARG_AFTER_CURSOR   },
@@ -242,6 +254,7 @@ static int parse_argv(int argc, char *argv[]) {
                 { "until",          required_argument, NULL, ARG_UNTIL          },
                 { "unit",           required_argument, NULL, 'u'                },
                 { "user-unit",      required_argument, NULL, ARG_USER_UNIT      },
+                { "search",         required_argument, NULL, ARG_SEARCH         },
                 { "field",          required_argument, NULL, 'F'                },
                 { "catalog",        no_argument,       NULL, 'x'                },
                 { "list-catalog",   no_argument,       NULL, ARG_LIST_CATALOG   },
@@ -427,6 +440,11 @@ static int parse_argv(int argc, char *argv[]) {
                         arg_action = ACTION_VERIFY;
                         break;
 
+                case ARG_VERIFY_CHECKPOINT:
+                        arg_action = ACTION_VERIFY;
+                        arg_verify_checkpoint = optarg;
+                        break;
+
                 case ARG_DISK_USAGE:
                         arg_action = ACTION_DISK_USAGE;
                         break;
@@ -543,6 +561,10 @@ static int parse_argv(int argc, char *argv[]) {
                                 return log_oom();
                         break;
 
+                case ARG_SEARCH:
+                        arg_search = optarg;
+                        break;
+
                 case '?':
                         return -EINVAL;
 
@@ -713,70 +735,50 @@ static int boot_id_cmp(const void *a, const void *b) {
         return _a < _b ? -1 : (_a > _b ? 1 : 0);
 }
 
-static int list_boots(sd_journal *j) {
+static int get_boots(sd_journal *j, boot_id_t **ret, unsigned *n_ret) {
+        _cleanup_free_ BootRange *ranges = NULL;
+        unsigned n = 0, k;
+        boot_id_t *all_ids;
         int r;
-        const void *data;
-        unsigned int count = 0;
-        int w, i;
-        size_t length, allocated = 0;
-        boot_id_t *id;
-        _cleanup_free_ boot_id_t *all_ids = NULL;
 
-        r = sd_journal_query_unique(j, "_BOOT_ID");
+        assert(j);
+        assert(ret);
+        assert(n_ret);
+
+        /* The boot index of each file tells us right away when each
+         * boot started and ended, without looking at the entries */
+        r = journal_get_boots(j, &ranges, &n);
         if (r < 0)
                 return r;
 
-        SD_JOURNAL_FOREACH_UNIQUE(j, data, length) {
-                if (length < strlen("_BOOT_ID="))
-                        continue;
-
-                if (!GREEDY_REALLOC(all_ids, allocated, count + 1))
-                        return log_oom();
-
-                id = &all_ids[count];
-
-                r = sd_id128_from_string(((const char *)data) + strlen("_BOOT_ID="), &id->id);
-                if (r < 0)
-                        continue;
-
-                r = sd_journal_add_match(j, data, length);
-                if (r < 0)
-                        return r;
-
-                r = sd_journal_seek_head(j);
-                if (r < 0)
-                        return r;
-
-                r = sd_journal_next(j);
-                if (r < 0)
-                        return r;
-                else if (r == 0)
-                        goto flush;
+        all_ids = new(boot_id_t, MAX(n, 1U));
+        if (!all_ids)
+                return log_oom();
 
-                r = sd_journal_get_realtime_usec(j, &id->first);
-                if (r < 0)
-                        return r;
+        for (k = 0; k < n; k++) {
+                all_ids[k].id = ranges[k].boot_id;
+                all_ids[k].first = ranges[k].first_realtime;
+                all_ids[k].last = ranges[k].last_realtime;
+        }
 
-                r = sd_journal_seek_tail(j);
-                if (r < 0)
-                        return r;
+        qsort_safe(all_ids, n, sizeof(boot_id_t), boot_id_cmp);
 
-                r = sd_journal_previous(j);
-                if (r < 0)
-                        return r;
-                else if (r == 0)
-                        goto flush;
+        *ret = all_ids;
+        *n_ret = n;
 
-                r = sd_journal_get_realtime_usec(j, &id->last);
-                if (r < 0)
-                        return r;
+        return 0;
+}
 
-                count++;
-        flush:
-                sd_journal_flush_matches(j);
-        }
+static int list_boots(sd_journal *j) {
+        int r;
+        unsigned int count = 0;
+        int w, i;
+        boot_id_t *id;
+        _cleanup_free_ boot_id_t *all_ids = NULL;
 
-        qsort_safe(all_ids, count, sizeof(boot_id_t), boot_id_cmp);
+        r = get_boots(j, &all_ids, &count);
+        if (r < 0)
+                return r;
 
         /* numbers are one less, but we need an extra char for the sign */
         w = DECIMAL_STR_WIDTH(count - 1) + 1;
@@ -796,10 +798,8 @@ static int list_boots(sd_journal *j) {
 
 static int get_relative_boot_id(sd_journal *j, sd_id128_t *boot_id, int relative) {
         int r;
-        const void *data;
         unsigned int count = 0;
-        size_t length, allocated = 0;
-        boot_id_t ref_boot_id = {SD_ID128_NULL}, *id;
+        boot_id_t *id;
         _cleanup_free_ boot_id_t *all_ids = NULL;
 
         assert(j);
@@ -808,62 +808,23 @@ static int get_relative_boot_id(sd_journal *j, sd_id128_t *boot_id, int relative
         if (relative == 0 && !sd_id128_equal(*boot_id, SD_ID128_NULL))
                 return 0;
 
-        r = sd_journal_query_unique(j, "_BOOT_ID");
+        r = get_boots(j, &all_ids, &count);
         if (r < 0)
                 return r;
 
-        SD_JOURNAL_FOREACH_UNIQUE(j, data, length) {
-                if (length < strlen("_BOOT_ID="))
-                        continue;
-
-                if (!GREEDY_REALLOC(all_ids, allocated, count + 1))
-                        return log_oom();
-
-                id = &all_ids[count];
-
-                r = sd_id128_from_string(((const char *)data) + strlen("_BOOT_ID="), &id->id);
-                if (r < 0)
-                        continue;
-
-                r = sd_journal_add_match(j, data, length);
-                if (r < 0)
-                        return r;
-
-                r = sd_journal_seek_head(j);
-                if (r < 0)
-                        return r;
-
-                r = sd_journal_next(j);
-                if (r < 0)
-                        return r;
-                else if (r == 0)
-                        goto flush;
-
-                r = sd_journal_get_realtime_usec(j, &id->first);
-                if (r < 0)
-                        return r;
-
-                if (sd_id128_equal(id->id, *boot_id))
-                        ref_boot_id = *id;
-
-                count++;
-        flush:
-                sd_journal_flush_matches(j);
-        }
-
-        qsort_safe(all_ids, count, sizeof(boot_id_t), boot_id_cmp);
-
         if (sd_id128_equal(*boot_id, SD_ID128_NULL)) {
                 if (relative > (int) count || relative <= -(int)count)
                         return -EADDRNOTAVAIL;
 
                 *boot_id = all_ids[(relative <= 0)*count + relative - 1].id;
         } else {
-                id = bsearch(&ref_boot_id, all_ids, count, sizeof(boot_id_t), boot_id_cmp);
+                for (id = all_ids; id < all_ids + count; id++)
+                        if (sd_id128_equal(id->id, *boot_id))
+                                break;
 
-                if (!id ||
-                    relative <= 0 ? (id - all_ids) + relative < 0 :
-                                    (id - all_ids) + relative >= (int) count)
+                if (id >= all_ids + count ||
+                    (relative <= 0 ? (id - all_ids) + relative < 0 :
+                                     (id - all_ids) + relative >= (int) count))
                         return -EADDRNOTAVAIL;
 
                 *boot_id = (id + relative)->id;
@@ -1027,6 +988,33 @@ static int add_priorities(sd_journal *j) {
         return 0;
 }
 
+static int add_search(sd_journal *j) {
+        int r;
+
+        assert(j);
+
+        if (!arg_search)
+                return 0;
+
+        r = sd_journal_add_match_text(j, arg_search);
+        if (r == -EINVAL) {
+                log_error("No words to search for in \"%s\".", arg_search);
+                return r;
+        } else if (r == -E2BIG) {
+                log_error("Too many words to search for in \"%s\".", arg_search);
+                return r;
+        } else if (r < 0) {
+                log_error("Failed to add match: %s", strerror(-r));
+                return r;
+        }
+
+        r = sd_journal_add_conjunction(j);
+        if (r < 0)
+                return r;
+
+        return 0;
+}
+
 static int setup_keys(void) {
 #ifdef HAVE_GCRYPT
         size_t mpk_size, seed_size, state_size, i;
@@ -1239,7 +1227,204 @@ finish:
 #endif
 }
 
+typedef struct VerifyJob {
+        const char *path;
+        uint64_t size;
+        bool sealed;
+
+        /* The line recorded in the checkpoint file on success */
+        char *checkpoint;
+
+        int r;
+        usec_t first, validated, last;
+        usec_t usec;
+} VerifyJob;
+
+/* Files are verified by a pool of threads, each with handles of its
+ * own, and reported on by the main thread in the order they are
+ * done. */
+typedef struct VerifyPool {
+        VerifyJob *jobs;
+        unsigned n_jobs;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        /* Protected by mutex */
+        unsigned n_started;
+        unsigned *done;
+        unsigned n_done;
+        uint64_t bytes_done;
+        bool stop;
+} VerifyPool;
+
+static void *verify_thread(void *p) {
+        VerifyPool *pool = p;
+
+        assert_se(pthread_mutex_lock(&pool->mutex) == 0);
+
+        while (!pool->stop && pool->n_started < pool->n_jobs) {
+                unsigned k = pool->n_started++;
+                VerifyJob *job = pool->jobs + k;
+                JournalFile *f;
+                usec_t start;
+                int r;
+
+                assert_se(pthread_mutex_unlock(&pool->mutex) == 0);
+
+                start = now(CLOCK_MONOTONIC);
+
+                r = journal_file_open(job->path, O_RDONLY, 0, false, false, NULL, NULL, NULL, &f);
+                if (r >= 0) {
+                        r = journal_file_verify(f, arg_verify_key, &job->first, &job->validated, &job->last, false);
+                        journal_file_close(f);
+                }
+
+                job->r = r;
+                job->usec = now(CLOCK_MONOTONIC) - start;
+
+                assert_se(pthread_mutex_lock(&pool->mutex) == 0);
+
+                pool->done[pool->n_done++] = k;
+                pool->bytes_done += job->size;
+
+                /* If the key was invalid give up right-away. */
+                if (r == -EINVAL)
+                        pool->stop = true;
+
+                assert_se(pthread_cond_signal(&pool->cond) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&pool->mutex) == 0);
+
+        return NULL;
+}
+
+static void draw_verify_progress(VerifyPool *pool, usec_t start) {
+        char a[FORMAT_BYTES_MAX], b[FORMAT_BYTES_MAX], c[FORMAT_BYTES_MAX];
+        uint64_t total = 0;
+        usec_t n;
+        unsigned k;
+
+        if (!on_tty())
+                return;
+
+        for (k = 0; k < pool->n_jobs; k++)
+                total += pool->jobs[k].size;
+
+        n = now(CLOCK_MONOTONIC) - start;
+
+        printf("\rVerified %u of %u files, %s of %s (%s/s)\x1B[K",
+               pool->n_done, pool->n_jobs,
+               format_bytes(a, sizeof(a), pool->bytes_done),
+               format_bytes(b, sizeof(b), total),
+               format_bytes(c, sizeof(c), n > 0 ? pool->bytes_done * USEC_PER_SEC / n : 0));
+        fflush(stdout);
+}
+
+static void flush_verify_progress(void) {
+        if (!on_tty())
+                return;
+
+        fputs("\r\x1B[K", stdout);
+        fflush(stdout);
+}
+
+static int verify_report(VerifyJob *job, FILE *checkpoint) {
+        char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX], d[FORMAT_BYTES_MAX], e[FORMAT_BYTES_MAX];
+
+        if (job->r < 0) {
+                log_warning("FAIL: %s (%s)", job->path, strerror(-job->r));
+                return job->r;
+        }
+
+        log_info("PASS: %s (%s in %s, %s/s)",
+                 job->path,
+                 format_bytes(d, sizeof(d), job->size),
+                 format_timespan(c, sizeof(c), job->usec, USEC_PER_MSEC),
+                 format_bytes(e, sizeof(e), job->usec > 0 ? job->size * USEC_PER_SEC / job->usec : 0));
+
+        if (arg_verify_key && job->sealed) {
+                if (job->validated > 0) {
+                        log_info("=> Validated from %s to %s, final %s entries not sealed.",
+                                 format_timestamp(a, sizeof(a), job->first),
+                                 format_timestamp(b, sizeof(b), job->validated),
+                                 format_timespan(c, sizeof(c), job->last > job->validated ? job->last - job->validated : 0, 0));
+                } else if (job->last > 0)
+                        log_info("=> No sealing yet, %s of entries not sealed.",
+                                 format_timespan(c, sizeof(c), job->last - job->first, 0));
+                else
+                        log_info("=> No sealing yet, no entries in file.");
+        }
+
+        if (checkpoint) {
+                fprintf(checkpoint, "%s\n", job->checkpoint);
+                fflush(checkpoint);
+        }
+
+        return 0;
+}
+
+/* A file is identified by its ID, and how far it has been written
+ * to, so that files appended to since are verified again. Files
+ * verified without key are verified again if a key is passed. */
+static char *verify_checkpoint_line(JournalFile *f, bool keyed) {
+        char *l;
+
+        if (asprintf(&l, SD_ID128_FORMAT_STR " %"PRIu64" %"PRIu64" %s",
+                     SD_ID128_FORMAT_VAL(f->header->file_id),
+                     le64toh(f->header->tail_object_offset),
+                     le64toh(f->header->n_objects),
+                     keyed ? "key" : "nokey") < 0)
+                return NULL;
+
+        return l;
+}
+
+static int verify_checkpoint_load(Set **ret) {
+        _cleanup_set_free_free_ Set *s = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        char line[LINE_MAX];
+
+        assert(ret);
+
+        s = set_new(string_hash_func, string_compare_func);
+        if (!s)
+                return log_oom();
+
+        f = fopen(arg_verify_checkpoint, "re");
+        if (!f) {
+                if (errno != ENOENT) {
+                        log_error("Failed to open %s: %m", arg_verify_checkpoint);
+                        return -errno;
+                }
+        } else
+                FOREACH_LINE(line, f, break) {
+                        char *l;
+
+                        l = strdup(strstrip(line));
+                        if (!l)
+                                return log_oom();
+
+                        if (set_consume(s, l) < 0 && errno == ENOMEM)
+                                return log_oom();
+                }
+
+        *ret = s;
+        s = NULL;
+
+        return 0;
+}
+
 static int verify(sd_journal *j) {
+        _cleanup_set_free_free_ Set *passed = NULL;
+        _cleanup_fclose_ FILE *checkpoint = NULL;
+        _cleanup_free_ pthread_t *threads = NULL;
+        _cleanup_free_ unsigned *done = NULL;
+        VerifyPool pool = {};
+        unsigned n_threads, n_running = 0, n_reported = 0, k;
+        usec_t start;
+        long ncpus;
         int r = 0;
         Iterator i;
         JournalFile *f;
@@ -1248,41 +1433,127 @@ static int verify(sd_journal *j) {
 
         log_show_color(true);
 
+        if (arg_verify_checkpoint) {
+                r = verify_checkpoint_load(&passed);
+                if (r < 0)
+                        return r;
+
+                checkpoint = fopen(arg_verify_checkpoint, "ae");
+                if (!checkpoint) {
+                        log_error("Failed to open %s: %m", arg_verify_checkpoint);
+                        return -errno;
+                }
+        }
+
+        pool.jobs = new0(VerifyJob, hashmap_size(j->files));
+        done = new(unsigned, hashmap_size(j->files));
+        if (!pool.jobs || !done) {
+                free(pool.jobs);
+                return log_oom();
+        }
+
+        pool.done = done;
+
         HASHMAP_FOREACH(f, j->files, i) {
-                int k;
-                usec_t first, validated, last;
+                bool sealed = JOURNAL_HEADER_SEALED(f->header);
+                VerifyJob *job;
+                char *l;
 
 #ifdef HAVE_GCRYPT
-                if (!arg_verify_key && JOURNAL_HEADER_SEALED(f->header))
+                if (!arg_verify_key && sealed)
                         log_notice("Journal file %s has sealing enabled but verification key has not been passed using --verify-key=.", f->path);
 #endif
 
-                k = journal_file_verify(f, arg_verify_key, &first, &validated, &last, true);
-                if (k == -EINVAL) {
-                        /* If the key was invalid give up right-away. */
-                        return k;
-                } else if (k < 0) {
-                        log_warning("FAIL: %s (%s)", f->path, strerror(-k));
-                        r = k;
-                } else {
-                        char a[FORMAT_TIMESTAMP_MAX], b[FORMAT_TIMESTAMP_MAX], c[FORMAT_TIMESPAN_MAX];
-                        log_info("PASS: %s", f->path);
-
-                        if (arg_verify_key && JOURNAL_HEADER_SEALED(f->header)) {
-                                if (validated > 0) {
-                                        log_info("=> Validated from %s to %s, final %s entries not sealed.",
-                                                 format_timestamp(a, sizeof(a), first),
-                                                 format_timestamp(b, sizeof(b), validated),
-                                                 format_timespan(c, sizeof(c), last > validated ? last - validated : 0, 0));
-                                } else if (last > 0)
-                                        log_info("=> No sealing yet, %s of entries not sealed.",
-                                                 format_timespan(c, sizeof(c), last - first, 0));
-                                else
-                                        log_info("=> No sealing yet, no entries in file.");
-                        }
+                l = verify_checkpoint_line(f, arg_verify_key && sealed);
+                if (!l) {
+                        r = log_oom();
+                        goto finish;
+                }
+
+                if (passed && set_get(passed, l)) {
+                        log_info("SKIP: %s (passed before)", f->path);
+                        free(l);
+                        continue;
                 }
+
+                job = pool.jobs + pool.n_jobs++;
+                job->path = f->path;
+                job->size = f->last_stat.st_size;
+                job->sealed = sealed;
+                job->checkpoint = l;
+        }
+
+        assert_se(pthread_mutex_init(&pool.mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&pool.cond, NULL) == 0);
+
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpus < 1)
+                ncpus = 1;
+
+        n_threads = MIN((unsigned) ncpus, pool.n_jobs);
+
+        threads = new(pthread_t, MAX(n_threads, 1U));
+        if (!threads) {
+                r = log_oom();
+                goto finish_pool;
         }
 
+        start = now(CLOCK_MONOTONIC);
+
+        for (k = 0; k < n_threads; k++) {
+                if (pthread_create(threads + k, NULL, verify_thread, &pool) != 0)
+                        break;
+
+                n_running++;
+        }
+
+        if (n_running == 0 && pool.n_jobs > 0) {
+                log_error("Failed to start verification threads.");
+                r = -ENOMEM;
+                goto finish_pool;
+        }
+
+        assert_se(pthread_mutex_lock(&pool.mutex) == 0);
+
+        for (;;) {
+                struct timespec ts;
+
+                while (n_reported < pool.n_done) {
+                        int q;
+
+                        flush_verify_progress();
+
+                        q = verify_report(pool.jobs + pool.done[n_reported++], checkpoint);
+                        if (q < 0 && r != -EINVAL)
+                                r = q;
+                }
+
+                if (n_reported >= pool.n_started &&
+                    (pool.stop || pool.n_started >= pool.n_jobs))
+                        break;
+
+                draw_verify_progress(&pool, start);
+
+                timespec_store(&ts, now(CLOCK_REALTIME) + USEC_PER_SEC / 4);
+                pthread_cond_timedwait(&pool.cond, &pool.mutex, &ts);
+        }
+
+        assert_se(pthread_mutex_unlock(&pool.mutex) == 0);
+
+        flush_verify_progress();
+
+        for (k = 0; k < n_running; k++)
+                assert_se(pthread_join(threads[k], NULL) == 0);
+
+finish_pool:
+        pthread_cond_destroy(&pool.cond);
+        pthread_mutex_destroy(&pool.mutex);
+
+finish:
+        for (k = 0; k < pool.n_jobs; k++)
+                free(pool.jobs[k].checkpoint);
+        free(pool.jobs);
+
         return r;
 }
 
@@ -1395,14 +1666,26 @@ static int access_check(sd_journal *j) {
         return r;
 }
 
+static int open_journal(sd_journal **ret, void *userdata) {
+        assert(ret);
+
+        if (arg_directory)
+                return sd_journal_open_directory(ret, arg_directory, arg_journal_type);
+        else if (arg_file)
+                return sd_journal_open_files(ret, (const char**) arg_file, 0);
+        else
+                return sd_journal_open(ret, !arg_merge*SD_JOURNAL_LOCAL_ONLY + arg_journal_type);
+}
+
 int main(int argc, char *argv[]) {
         int r;
         _cleanup_journal_close_ sd_journal *j = NULL;
+        OutputPipeline *pipeline = NULL;
         bool need_seek = false;
         sd_id128_t previous_boot_id;
         bool previous_boot_id_valid = false, first_line = true;
         int n_shown = 0;
-        bool ellipsized = false;
+        int flags;
 
         setlocale(LC_ALL, "");
         log_parse_environment();
@@ -1459,12 +1742,7 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
-        if (arg_directory)
-                r = sd_journal_open_directory(&j, arg_directory, arg_journal_type);
-        else if (arg_file)
-                r = sd_journal_open_files(&j, (const char**) arg_file, 0);
-        else
-                r = sd_journal_open(&j, !arg_merge*SD_JOURNAL_LOCAL_ONLY + arg_journal_type);
+        r = open_journal(&j, NULL);
         if (r < 0) {
                 log_error("Failed to open %s: %s",
                           arg_directory ? arg_directory : arg_file ? "files" : "journal",
@@ -1525,6 +1803,10 @@ int main(int argc, char *argv[]) {
         if (r < 0)
                 return EXIT_FAILURE;
 
+        r = add_search(j);
+        if (r < 0)
+                return EXIT_FAILURE;
+
         r = add_matches(j, argv + optind);
         if (r < 0)
                 return EXIT_FAILURE;
@@ -1665,9 +1947,20 @@ int main(int argc, char *argv[]) {
                 }
         }
 
+        flags =
+                arg_all * OUTPUT_SHOW_ALL |
+                arg_full * OUTPUT_FULL_WIDTH |
+                on_tty() * OUTPUT_COLOR |
+                arg_catalog * OUTPUT_CATALOG;
+
+        r = output_pipeline_new(j, stdout, arg_output, 0, flags, arg_reverse, open_journal, NULL, &pipeline);
+        if (r < 0) {
+                log_oom();
+                goto finish;
+        }
+
         for (;;) {
                 while (arg_lines < 0 || n_shown < arg_lines || (arg_follow && !first_line)) {
-                        int flags;
 
                         if (need_seek) {
                                 if (!arg_reverse)
@@ -1712,22 +2005,22 @@ int main(int argc, char *argv[]) {
                                 r = sd_journal_get_monotonic_usec(j, NULL, &boot_id);
                                 if (r >= 0) {
                                         if (previous_boot_id_valid &&
-                                            !sd_id128_equal(boot_id, previous_boot_id))
-                                                printf("%s-- Reboot --%s\n",
-                                                       ansi_highlight(), ansi_highlight_off());
+                                            !sd_id128_equal(boot_id, previous_boot_id)) {
+                                                r = output_pipeline_add_text(pipeline, strappenda3(ansi_highlight(), "-- Reboot --", ansi_highlight_off()));
+                                                if (r < 0)
+                                                        goto finish;
+
+                                                r = output_pipeline_add_text(pipeline, "\n");
+                                                if (r < 0)
+                                                        goto finish;
+                                        }
 
                                         previous_boot_id = boot_id;
                                         previous_boot_id_valid = true;
                                 }
                         }
 
-                        flags =
-                                arg_all * OUTPUT_SHOW_ALL |
-                                arg_full * OUTPUT_FULL_WIDTH |
-                                on_tty() * OUTPUT_COLOR |
-                                arg_catalog * OUTPUT_CATALOG;
-
-                        r = output_journal(stdout, j, arg_output, 0, flags, &ellipsized);
+                        r = output_pipeline_add_entry(pipeline);
                         need_seek = true;
                         if (r == -EADDRNOTAVAIL)
                                 break;
@@ -1737,6 +2030,12 @@ int main(int argc, char *argv[]) {
                         n_shown++;
                 }
 
+                /* Everything shown so far should be out before we
+                 * wait for more */
+                r = output_pipeline_flush(pipeline);
+                if (r < 0)
+                        goto finish;
+
                 if (!arg_follow) {
                         if (arg_show_cursor) {
                                 _cleanup_free_ char *cursor = NULL;
@@ -1761,6 +2060,16 @@ int main(int argc, char *argv[]) {
         }
 
 finish:
+        if (pipeline) {
+                int q;
+
+                q = output_pipeline_flush(pipeline);
+                if (q < 0 && r >= 0)
+                        r = q;
+
+                output_pipeline_free(pipeline);
+        }
+
         pager_close();
 
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
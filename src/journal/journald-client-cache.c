@@ -0,0 +1,425 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <string.h>
+
+#include "journald-client-cache.h"
+#include "hashmap.h"
+#include "cgroup-util.h"
+#include "audit.h"
+
+/* How many processes to remember */
+#define CLIENTS_MAX 1024
+
+/* Processes may exec, change their name or credentials without us
+ * noticing, hence don't trust what we know about them for longer
+ * than this. */
+#define CLIENT_MAX_AGE_USEC (5*USEC_PER_SEC)
+
+struct ClientCache {
+        Hashmap *clients;
+        ClientInfo *lru, *lru_tail;
+
+        uint64_t n_hits;
+        uint64_t n_misses;
+};
+
+ClientCache *client_cache_new(void) {
+        ClientCache *c;
+
+        c = new0(ClientCache, 1);
+        if (!c)
+                return NULL;
+
+        c->clients = hashmap_new(trivial_hash_func, trivial_compare_func);
+        if (!c->clients) {
+                free(c);
+                return NULL;
+        }
+
+        return c;
+}
+
+static void client_info_clear_fields(ClientInfo *i) {
+        unsigned k;
+
+        assert(i);
+
+        for (k = 0; k < i->n_fields; k++)
+                free(i->fields[k]);
+
+        i->n_fields = 0;
+}
+
+static void client_info_clear_cgroup(ClientInfo *i) {
+        assert(i);
+
+        free(i->cgroup);
+        free(i->session);
+        free(i->unit);
+        free(i->user_unit);
+        free(i->slice);
+
+        i->cgroup = i->session = i->unit = i->user_unit = i->slice = NULL;
+        i->owner_uid_valid = false;
+}
+
+static void client_info_clear(ClientInfo *i) {
+        assert(i);
+
+        free(i->comm);
+        free(i->exe);
+        free(i->cmdline);
+        free(i->capeff);
+
+        i->comm = i->exe = i->cmdline = i->capeff = NULL;
+        i->uid_valid = i->gid_valid = false;
+        i->audit_session_valid = i->loginuid_valid = false;
+
+        client_info_clear_cgroup(i);
+        client_info_clear_fields(i);
+}
+
+ClientInfo *client_info_ref(ClientInfo *i) {
+        assert(i);
+        assert(i->n_ref > 0);
+
+        i->n_ref++;
+        return i;
+}
+
+ClientInfo *client_info_unref(ClientInfo *i) {
+        if (!i)
+                return NULL;
+
+        assert(i->n_ref > 0);
+        i->n_ref--;
+
+        if (i->n_ref > 0)
+                return NULL;
+
+        assert(!i->cache);
+
+        client_info_clear(i);
+        free(i);
+        return NULL;
+}
+
+static void client_cache_remove(ClientCache *c, ClientInfo *i) {
+        assert(c);
+        assert(i);
+        assert(i->cache == c);
+
+        /* Drops the cache's reference, whoever else still holds one
+         * keeps the object. */
+
+        if (c->lru_tail == i)
+                c->lru_tail = i->lru_prev;
+
+        LIST_REMOVE(lru, c->lru, i);
+        hashmap_remove(c->clients, UINT_TO_PTR(i->pid));
+
+        i->cache = NULL;
+        client_info_unref(i);
+}
+
+void client_cache_free(ClientCache *c) {
+        if (!c)
+                return;
+
+        while (c->lru)
+                client_cache_remove(c, c->lru);
+
+        hashmap_free(c->clients);
+        free(c);
+}
+
+static void client_info_add_field(ClientInfo *i, const char *field, const char *value) {
+        char *x;
+
+        assert(i);
+        assert(field);
+        assert(i->n_fields < CLIENT_FIELDS_MAX);
+
+        if (!value)
+                return;
+
+        /* Out of memory just means one field less */
+        x = strappend(field, value);
+        if (x)
+                i->fields[i->n_fields++] = x;
+}
+
+static void client_info_add_field_id(ClientInfo *i, const char *field, bool valid, unsigned long id) {
+        char buf[DECIMAL_STR_MAX(unsigned long)];
+
+        assert(i);
+
+        if (!valid)
+                return;
+
+        snprintf(buf, sizeof(buf), "%lu", id);
+        client_info_add_field(i, field, buf);
+}
+
+static void client_info_format(ClientInfo *i) {
+        assert(i);
+
+        client_info_clear_fields(i);
+
+        client_info_add_field(i, "_COMM=", i->comm);
+        client_info_add_field(i, "_EXE=", i->exe);
+        client_info_add_field(i, "_CMDLINE=", i->cmdline);
+        client_info_add_field(i, "_CAP_EFFECTIVE=", i->capeff);
+        client_info_add_field_id(i, "_AUDIT_SESSION=", i->audit_session_valid, i->audit_session);
+        client_info_add_field_id(i, "_AUDIT_LOGINUID=", i->loginuid_valid, i->loginuid);
+
+        if (!i->cgroup)
+                return;
+
+        client_info_add_field(i, "_SYSTEMD_CGROUP=", i->cgroup);
+        client_info_add_field(i, "_SYSTEMD_SESSION=", i->session);
+        client_info_add_field_id(i, "_SYSTEMD_OWNER_UID=", i->owner_uid_valid, i->owner_uid);
+        client_info_add_field(i, "_SYSTEMD_UNIT=", i->unit);
+        client_info_add_field(i, "_SYSTEMD_USER_UNIT=", i->user_unit);
+        client_info_add_field(i, "_SYSTEMD_SLICE=", i->slice);
+}
+
+static void client_info_set_cgroup(ClientInfo *i, char *cgroup) {
+        assert(i);
+
+        /* Takes possession of cgroup */
+
+        client_info_clear_cgroup(i);
+
+        i->cgroup = cgroup;
+        if (!cgroup)
+                return;
+
+        cg_path_get_session(cgroup, &i->session);
+        i->owner_uid_valid = cg_path_get_owner_uid(cgroup, &i->owner_uid) >= 0;
+        cg_path_get_unit(cgroup, &i->unit);
+        cg_path_get_user_unit(cgroup, &i->user_unit);
+        cg_path_get_slice(cgroup, &i->slice);
+}
+
+static void client_info_update_cgroup(ClientInfo *i, char *cgroup) {
+        client_info_set_cgroup(i, cgroup);
+        client_info_format(i);
+}
+
+static void client_info_fill(ClientInfo *i, char *cgroup) {
+        assert(i);
+
+        /* Takes possession of cgroup */
+
+        client_info_clear(i);
+
+        get_process_comm(i->pid, &i->comm);
+        get_process_exe(i->pid, &i->exe);
+        get_process_cmdline(i->pid, 0, false, &i->cmdline);
+        get_process_capeff(i->pid, &i->capeff);
+
+        i->uid_valid = get_process_uid(i->pid, &i->uid) >= 0;
+        i->gid_valid = get_process_gid(i->pid, &i->gid) >= 0;
+
+#ifdef HAVE_AUDIT
+        i->audit_session_valid = audit_session_from_pid(i->pid, &i->audit_session) >= 0;
+        i->loginuid_valid = audit_loginuid_from_pid(i->pid, &i->loginuid) >= 0;
+#endif
+
+        client_info_set_cgroup(i, cgroup);
+        client_info_format(i);
+}
+
+static void client_cache_bump(ClientCache *c, ClientInfo *i) {
+        assert(c);
+        assert(i);
+
+        if (c->lru == i)
+                return;
+
+        if (c->lru_tail == i)
+                c->lru_tail = i->lru_prev;
+
+        LIST_REMOVE(lru, c->lru, i);
+        LIST_PREPEND(lru, c->lru, i);
+}
+
+static int client_info_new(ClientCache *c, pid_t pid, ClientInfo **ret) {
+        ClientInfo *i;
+        int r;
+
+        assert(c);
+        assert(ret);
+
+        while (hashmap_size(c->clients) >= CLIENTS_MAX)
+                client_cache_remove(c, c->lru_tail);
+
+        i = new0(ClientInfo, 1);
+        if (!i)
+                return -ENOMEM;
+
+        i->n_ref = 1;
+        i->pid = pid;
+
+        r = hashmap_put(c->clients, UINT_TO_PTR(pid), i);
+        if (r < 0) {
+                free(i);
+                return r;
+        }
+
+        LIST_PREPEND(lru, c->lru, i);
+        if (!i->lru_next)
+                c->lru_tail = i;
+
+        i->cache = c;
+
+        *ret = i;
+        return 0;
+}
+
+int client_cache_get(ClientCache *c, pid_t pid, ClientInfo **ret) {
+        _cleanup_free_ char *cgroup = NULL;
+        unsigned long long starttime;
+        ClientInfo *i;
+        usec_t n;
+        int r;
+
+        assert(c);
+        assert(pid > 0);
+        assert(ret);
+
+        /* Returns what we know about pid, which stays valid until
+         * the next call. The start time of the process tells us
+         * whether the PID has been reused, and reading the cgroup
+         * whether it has been moved since we looked last. Both are
+         * single reads, unlike everything else we collect. */
+
+        i = hashmap_get(c->clients, UINT_TO_PTR(pid));
+
+        r = get_starttime_of_pid(pid, &starttime);
+        if (r < 0) {
+                /* The process is gone already */
+                if (i)
+                        client_cache_remove(c, i);
+                return r;
+        }
+
+        cg_pid_get_path_shifted(pid, NULL, &cgroup);
+
+        n = now(CLOCK_MONOTONIC);
+
+        if (i && i->starttime == starttime && i->timestamp + CLIENT_MAX_AGE_USEC > n) {
+                client_cache_bump(c, i);
+
+                if (streq_ptr(i->cgroup, cgroup)) {
+                        c->n_hits++;
+                        *ret = i;
+                        return 0;
+                }
+
+                if (i->n_ref <= 1) {
+                        client_info_update_cgroup(i, cgroup);
+                        cgroup = NULL;
+
+                        c->n_misses++;
+                        *ret = i;
+                        return 0;
+                }
+        }
+
+        if (i && i->n_ref > 1) {
+                /* Somebody else holds on to the old data, maybe
+                 * with its fields attached to a message right now,
+                 * leave it to them and start over */
+                client_cache_remove(c, i);
+                i = NULL;
+        }
+
+        if (i)
+                client_cache_bump(c, i);
+        else {
+                r = client_info_new(c, pid, &i);
+                if (r < 0)
+                        return r;
+        }
+
+        i->starttime = starttime;
+        i->timestamp = i->refresh_timestamp = n;
+        client_info_fill(i, cgroup);
+        cgroup = NULL;
+
+        c->n_misses++;
+        *ret = i;
+        return 0;
+}
+
+void client_cache_get_stats(ClientCache *c, uint64_t *hits, uint64_t *misses) {
+        assert(c);
+
+        if (hits)
+                *hits = c->n_hits;
+        if (misses)
+                *misses = c->n_misses;
+}
+
+int client_info_refresh(ClientInfo *i) {
+        _cleanup_free_ char *exe = NULL, *cgroup = NULL;
+        unsigned long long starttime;
+        int r;
+
+        assert(i);
+
+        /* For those holding on to the info of a process for a long
+         * time: check that the process is still around and re-read
+         * what we know if it executed something else or moved to a
+         * different cgroup. Cheaper than a cache lookup, since it
+         * does not look at anything but these. */
+
+        r = get_starttime_of_pid(i->pid, &starttime);
+        if (r < 0 || starttime != i->starttime) {
+                /* Gone, and the PID possibly reused. Don't
+                 * attribute anything to whoever has it now. */
+                client_info_clear(i);
+                return r < 0 ? r : -ESRCH;
+        }
+
+        get_process_exe(i->pid, &exe);
+        cg_pid_get_path_shifted(i->pid, NULL, &cgroup);
+
+        i->refresh_timestamp = now(CLOCK_MONOTONIC);
+
+        /* Only a full refill renews the data for the cache too, the
+         * rest might still be outdated */
+        if (!streq_ptr(i->exe, exe)) {
+                client_info_fill(i, cgroup);
+                cgroup = NULL;
+
+                i->timestamp = i->refresh_timestamp;
+        } else if (!streq_ptr(i->cgroup, cgroup)) {
+                client_info_update_cgroup(i, cgroup);
+                cgroup = NULL;
+        }
+
+        return 0;
+}
@@ -0,0 +1,94 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "macro.h"
+#include "util.h"
+#include "list.h"
+
+typedef struct ClientInfo ClientInfo;
+typedef struct ClientCache ClientCache;
+
+/* _COMM= to _SYSTEMD_SLICE= */
+#define CLIENT_FIELDS_MAX 12
+
+/* What we know about a process logging to us. Fields that could not
+ * be determined are NULL, or have their _valid flag unset. */
+struct ClientInfo {
+        unsigned n_ref;
+        ClientCache *cache;
+
+        pid_t pid;
+        unsigned long long starttime;
+
+        /* When everything was read, and when client_info_refresh()
+         * checked last */
+        usec_t timestamp;
+        usec_t refresh_timestamp;
+
+        bool uid_valid:1;
+        bool gid_valid:1;
+        bool audit_session_valid:1;
+        bool loginuid_valid:1;
+        bool owner_uid_valid:1;
+
+        uid_t uid;
+        gid_t gid;
+
+        char *comm;
+        char *exe;
+        char *cmdline;
+        char *capeff;
+
+        uint32_t audit_session;
+        uid_t loginuid;
+
+        char *cgroup;
+        char *session;
+        uid_t owner_uid;
+        char *unit;
+        char *user_unit;
+        char *slice;
+
+        /* The above formatted as trusted journal fields, ready to
+         * be attached to every message of this process. Does not
+         * include _SYSTEMD_UNIT= or _SYSTEMD_USER_UNIT= if these
+         * could not be derived from the cgroup, since the client
+         * might tell us its unit otherwise. */
+        char *fields[CLIENT_FIELDS_MAX];
+        unsigned n_fields;
+
+        LIST_FIELDS(ClientInfo, lru);
+};
+
+ClientCache *client_cache_new(void);
+void client_cache_free(ClientCache *c);
+int client_cache_get(ClientCache *c, pid_t pid, ClientInfo **ret);
+void client_cache_get_stats(ClientCache *c, uint64_t *hits, uint64_t *misses);
+
+ClientInfo *client_info_ref(ClientInfo *i);
+ClientInfo *client_info_unref(ClientInfo *i);
+int client_info_refresh(ClientInfo *i);
@@ -22,6 +22,7 @@
 #include <unistd.h>
 #include <stddef.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
 
 #include "socket-util.h"
 #include "path-util.h"
@@ -31,12 +32,17 @@
 #include "journald-kmsg.h"
 #include "journald-console.h"
 #include "journald-syslog.h"
+#include "missing.h"
 
 /* Make sure not to make this smaller than the maximum coredump
- * size. See COREDUMP_MAX in coredump.c */
+ * size. See COREDUMP_JOURNAL_MAX in coredump.c */
 #define ENTRY_SIZE_MAX (1024*1024*768)
 #define DATA_SIZE_MAX (1024*1024*768)
 
+/* What a memfd needs to be sealed with, so that it can neither be
+ * modified nor truncated while we look at it */
+#define SEALS_REQUIRED (F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE)
+
 static bool valid_user_field(const char *p, size_t l) {
         const char *a;
 
@@ -110,7 +116,7 @@ void server_process_native_message(
 
                 if (e == p) {
                         /* Entry separator */
-                        server_dispatch_message(s, iovec, n, m, ucred, tv, label, label_len, NULL, priority, object_pid);
+                        server_dispatch_message(s, iovec, n, m, ucred, NULL, tv, label, label_len, NULL, priority, object_pid);
                         n = 0;
                         priority = LOG_INFO;
 
@@ -267,7 +273,7 @@ void server_process_native_message(
                         server_forward_console(s, priority, identifier, message, ucred);
         }
 
-        server_dispatch_message(s, iovec, n, m, ucred, tv, label, label_len, NULL, priority, object_pid);
+        server_dispatch_message(s, iovec, n, m, ucred, NULL, tv, label, label_len, NULL, priority, object_pid);
 
 finish:
         for (j = 0; j < n; j++)  {
@@ -293,13 +299,19 @@ void server_process_native_file(
 
         struct stat st;
         _cleanup_free_ void *p = NULL;
+        bool sealed;
         ssize_t n;
         int r;
 
         assert(s);
         assert(fd >= 0);
 
-        if (!ucred || ucred->uid != 0) {
+        r = fcntl(fd, F_GET_SEALS);
+        sealed = r >= 0 && (r & SEALS_REQUIRED) == SEALS_REQUIRED;
+
+        /* Only memfds can be sealed, hence there's no need to check
+         * where a sealed file lives: it's in memory. */
+        if (!sealed && (!ucred || ucred->uid != 0)) {
                 _cleanup_free_ char *sl = NULL, *k = NULL;
                 const char *e;
 
@@ -330,11 +342,6 @@ void server_process_native_file(
                 }
         }
 
-        /* Data is in the passed file, since it didn't fit in a
-         * datagram. We can't map the file here, since clients might
-         * then truncate it and trigger a SIGBUS for us. So let's
-         * stupidly read it */
-
         if (fstat(fd, &st) < 0) {
                 log_error("Failed to stat passed file, ignoring: %m");
                 return;
@@ -353,6 +360,29 @@ void server_process_native_file(
                 return;
         }
 
+        if (sealed) {
+                void *q;
+
+                /* The sender can't change the size of a sealed memfd
+                 * anymore, hence we can map it and parse the message
+                 * where it is, without risking a SIGBUS. */
+
+                q = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (q == MAP_FAILED) {
+                        log_error("Failed to map memfd, ignoring: %m");
+                        return;
+                }
+
+                server_process_native_message(s, q, st.st_size, ucred, tv, label, label_len);
+                assert_se(munmap(q, st.st_size) >= 0);
+                return;
+        }
+
+        /* Data is in the passed file, since it didn't fit in a
+         * datagram. We can't map the file here, since clients might
+         * then truncate it and trigger a SIGBUS for us. So let's
+         * stupidly read it */
+
         p = malloc(st.st_size);
         if (!p) {
                 log_oom();
@@ -28,8 +28,16 @@
 #include "hashmap.h"
 
 #define POOLS_MAX 5
-#define BUCKETS_MAX 127
-#define GROUPS_MAX 2047
+#define GROUPS_MAX 8191
+
+/* The group table is open-addressed with linear probing and kept at
+ * most half full, so that a lookup rarely looks at more than two
+ * slots. It starts small and grows with the number of groups. */
+#define TABLE_SIZE_MIN 64U
+
+/* How many groups we count suppressed messages for, after that they
+ * are all accounted to the same line */
+#define COUNTERS_MAX 1024
 
 static const int priority_map[] = {
         [LOG_EMERG]   = 0,
@@ -44,6 +52,7 @@ static const int priority_map[] = {
 
 typedef struct JournalRateLimitPool JournalRateLimitPool;
 typedef struct JournalRateLimitGroup JournalRateLimitGroup;
+typedef struct JournalRateLimitCounter JournalRateLimitCounter;
 
 struct JournalRateLimitPool {
         usec_t begin;
@@ -58,18 +67,30 @@ struct JournalRateLimitGroup {
         JournalRateLimitPool pools[POOLS_MAX];
         unsigned hash;
 
-        LIST_FIELDS(JournalRateLimitGroup, bucket);
+        /* Where suppressed messages of this group are counted, once
+         * there were any. Outlives the group. */
+        JournalRateLimitCounter *counter;
+
         LIST_FIELDS(JournalRateLimitGroup, lru);
 };
 
+struct JournalRateLimitCounter {
+        char *id;
+        uint64_t suppressed;
+};
+
 struct JournalRateLimit {
         usec_t interval;
         unsigned burst;
 
-        JournalRateLimitGroup* buckets[BUCKETS_MAX];
-        JournalRateLimitGroup *lru, *lru_tail;
+        JournalRateLimitGroup **table;
+        unsigned table_size;
 
+        JournalRateLimitGroup *lru, *lru_tail;
         unsigned n_groups;
+
+        Hashmap *counters;
+        JournalRateLimitCounter other;
 };
 
 JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst) {
@@ -84,7 +105,105 @@ JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst) {
         r->interval = interval;
         r->burst = burst;
 
+        r->table = new0(JournalRateLimitGroup*, TABLE_SIZE_MIN);
+        if (!r->table)
+                goto fail;
+        r->table_size = TABLE_SIZE_MIN;
+
+        r->counters = hashmap_new(string_hash_func, string_compare_func);
+        if (!r->counters)
+                goto fail;
+
         return r;
+
+fail:
+        free(r->table);
+        free(r);
+        return NULL;
+}
+
+static unsigned hash_to_slot(JournalRateLimit *r, unsigned hash) {
+        assert(r);
+
+        /* DJB's hash is weak in the low bits, mix them up before
+         * masking them out */
+        hash ^= hash >> 16;
+        hash *= 0x45d9f3bU;
+        hash ^= hash >> 16;
+
+        return hash & (r->table_size - 1);
+}
+
+static void table_remove(JournalRateLimit *r, JournalRateLimitGroup *g) {
+        unsigned i, j, mask;
+
+        assert(r);
+        assert(g);
+
+        mask = r->table_size - 1;
+
+        for (i = hash_to_slot(r, g->hash); r->table[i] != g; i = (i + 1) & mask)
+                assert(r->table[i]);
+
+        /* Shift back whatever follows in the same run and would not
+         * be found anymore with the gap, instead of leaving a
+         * tombstone behind */
+        for (j = (i + 1) & mask; r->table[j]; j = (j + 1) & mask) {
+                unsigned k;
+
+                k = hash_to_slot(r, r->table[j]->hash);
+
+                /* Leave it if its home slot lies cyclically in
+                 * (i, j] */
+                if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+                        continue;
+
+                r->table[i] = r->table[j];
+                i = j;
+        }
+
+        r->table[i] = NULL;
+}
+
+static void table_insert(JournalRateLimit *r, JournalRateLimitGroup *g) {
+        unsigned i, mask;
+
+        assert(r);
+        assert(g);
+
+        mask = r->table_size - 1;
+
+        for (i = hash_to_slot(r, g->hash); r->table[i]; i = (i + 1) & mask)
+                ;
+
+        r->table[i] = g;
+}
+
+static int table_grow(JournalRateLimit *r) {
+        JournalRateLimitGroup **old;
+        unsigned i, old_size;
+
+        assert(r);
+
+        if ((r->n_groups + 1) * 2 <= r->table_size)
+                return 0;
+
+        old = r->table;
+        old_size = r->table_size;
+
+        r->table = new0(JournalRateLimitGroup*, old_size * 2);
+        if (!r->table) {
+                r->table = old;
+                return -ENOMEM;
+        }
+        r->table_size = old_size * 2;
+
+        for (i = 0; i < old_size; i++)
+                if (old[i])
+                        table_insert(r, old[i]);
+
+        free(old);
+        return 0;
 }
 
 static void journal_rate_limit_group_free(JournalRateLimitGroup *g) {
@@ -97,7 +216,7 @@ static void journal_rate_limit_group_free(JournalRateLimitGroup *g) {
                         g->parent->lru_tail = g->lru_prev;
 
                 LIST_REMOVE(lru, g->parent->lru, g);
-                LIST_REMOVE(bucket, g->parent->buckets[g->hash % BUCKETS_MAX], g);
+                table_remove(g->parent, g);
 
                 g->parent->n_groups --;
         }
@@ -107,11 +226,20 @@ static void journal_rate_limit_group_free(JournalRateLimitGroup *g) {
 }
 
 void journal_rate_limit_free(JournalRateLimit *r) {
+        JournalRateLimitCounter *c;
+
         assert(r);
 
         while (r->lru)
                 journal_rate_limit_group_free(r->lru);
 
+        while ((c = hashmap_steal_first(r->counters))) {
+                free(c->id);
+                free(c);
+        }
+
+        hashmap_free(r->counters);
+        free(r->table);
         free(r);
 }
 
@@ -138,7 +266,7 @@ static void journal_rate_limit_vacuum(JournalRateLimit *r, usec_t ts) {
                 journal_rate_limit_group_free(r->lru_tail);
 }
 
-static JournalRateLimitGroup* journal_rate_limit_group_new(JournalRateLimit *r, const char *id, usec_t ts) {
+static JournalRateLimitGroup* journal_rate_limit_group_new(JournalRateLimit *r, const char *id, unsigned hash, usec_t ts) {
         JournalRateLimitGroup *g;
 
         assert(r);
@@ -152,11 +280,14 @@ static JournalRateLimitGroup* journal_rate_limit_group_new(JournalRateLimit *r,
         if (!g->id)
                 goto fail;
 
-        g->hash = string_hash_func(g->id);
+        g->hash = hash;
 
         journal_rate_limit_vacuum(r, ts);
 
-        LIST_PREPEND(bucket, r->buckets[g->hash % BUCKETS_MAX], g);
+        if (table_grow(r) < 0)
+                goto fail;
+
+        table_insert(r, g);
         LIST_PREPEND(lru, r->lru, g);
         if (!g->lru_next)
                 r->lru_tail = g;
@@ -170,6 +301,48 @@ fail:
         return NULL;
 }
 
+static JournalRateLimitGroup* journal_rate_limit_group_find(JournalRateLimit *r, const char *id, unsigned hash) {
+        unsigned i, mask;
+
+        assert(r);
+        assert(id);
+
+        mask = r->table_size - 1;
+
+        for (i = hash_to_slot(r, hash); r->table[i]; i = (i + 1) & mask)
+                if (r->table[i]->hash == hash && streq(r->table[i]->id, id))
+                        return r->table[i];
+
+        return NULL;
+}
+
+static JournalRateLimitCounter* journal_rate_limit_counter_get(JournalRateLimit *r, const char *id) {
+        JournalRateLimitCounter *c;
+
+        assert(r);
+        assert(id);
+
+        c = hashmap_get(r->counters, id);
+        if (c)
+                return c;
+
+        if (hashmap_size(r->counters) >= COUNTERS_MAX)
+                return &r->other;
+
+        c = new0(JournalRateLimitCounter, 1);
+        if (!c)
+                return &r->other;
+
+        c->id = strdup(id);
+        if (!c->id || hashmap_put(r->counters, c->id, c) < 0) {
+                free(c->id);
+                free(c);
+                return &r->other;
+        }
+
+        return c;
+}
+
 static unsigned burst_modulate(unsigned burst, uint64_t available) {
         unsigned k;
 
@@ -218,14 +391,10 @@ int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, u
         ts = now(CLOCK_MONOTONIC);
 
         h = string_hash_func(id);
-        g = r->buckets[h % BUCKETS_MAX];
-
-        LIST_FOREACH(bucket, g, g)
-                if (streq(g->id, id))
-                        break;
 
+        g = journal_rate_limit_group_find(r, id, h);
         if (!g) {
-                g = journal_rate_limit_group_new(r, id, ts);
+                g = journal_rate_limit_group_new(r, id, h, ts);
                 if (!g)
                         return -ENOMEM;
         }
@@ -255,6 +424,39 @@ int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, u
                 return 1;
         }
 
+        if (!g->counter)
+                g->counter = journal_rate_limit_counter_get(r, g->id);
+        g->counter->suppressed++;
+
         p->suppressed++;
         return 0;
 }
+
+uint64_t journal_rate_limit_get_suppressed(JournalRateLimit *r, const char *id) {
+        JournalRateLimitCounter *c;
+
+        assert(r);
+        assert(id);
+
+        c = hashmap_get(r->counters, id);
+        return c ? c->suppressed : 0;
+}
+
+void journal_rate_limit_dump(JournalRateLimit *r, FILE *f) {
+        JournalRateLimitCounter *c;
+        Iterator i;
+
+        assert(r);
+        assert(f);
+
+        fprintf(f,
+                "RATE_LIMIT_GROUPS=%u\n"
+                "RATE_LIMIT_TABLE_SIZE=%u\n",
+                r->n_groups, r->table_size);
+
+        HASHMAP_FOREACH(c, r->counters, i)
+                fprintf(f, "SUPPRESSED=%"PRIu64" %s\n", c->suppressed, c->id);
+
+        if (r->other.suppressed > 0)
+                fprintf(f, "SUPPRESSED_OTHER=%"PRIu64"\n", r->other.suppressed);
+}
@@ -21,6 +21,8 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <stdio.h>
+
 #include "macro.h"
 #include "util.h"
 
@@ -29,3 +31,6 @@ typedef struct JournalRateLimit JournalRateLimit;
 JournalRateLimit *journal_rate_limit_new(usec_t interval, unsigned burst);
 void journal_rate_limit_free(JournalRateLimit *r);
 int journal_rate_limit_test(JournalRateLimit *r, const char *id, int priority, uint64_t available);
+
+uint64_t journal_rate_limit_get_suppressed(JournalRateLimit *r, const char *id);
+void journal_rate_limit_dump(JournalRateLimit *r, FILE *f);
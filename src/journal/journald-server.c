@@ -33,6 +33,7 @@
 
 #include "fileio.h"
 #include "mkdir.h"
+#include "path-util.h"
 #include "hashmap.h"
 #include "journal-file.h"
 #include "socket-util.h"
@@ -71,6 +72,27 @@
 
 #define RECHECK_AVAILABLE_SPACE_USEC (30*USEC_PER_SEC)
 
+/* Warnings about stalls back off exponentially while they persist,
+ * since they end up in the journal they are about */
+#define WARN_ALLOCATION_STALLS_MIN_USEC (30*USEC_PER_SEC)
+#define WARN_ALLOCATION_STALLS_MAX_USEC (USEC_PER_HOUR)
+
+#define STATUS_UPDATE_USEC (10*USEC_PER_SEC)
+
+/* How many entries to queue up at most before writing them out */
+#define PENDING_ENTRIES_MAX 64
+
+/* How many datagrams to receive at once, and how much room each of
+ * them gets. Larger ones are received on their own, sized by what
+ * the socket says. */
+#define RECV_BATCH_MAX 16
+#define RECV_BUFFER_SIZE (64U*1024U)
+
+/* A datagram that doesn't fit into a slot is lost if it isn't the
+ * first one queued. Large datagrams tend to come in bursts, hence
+ * after one was lost receive one by one for a while. */
+#define RECV_ONE_BY_ONE_USEC (10*USEC_PER_SEC)
+
 static const char* const storage_table[] = {
         [STORAGE_AUTO] = "auto",
         [STORAGE_VOLATILE] = "volatile",
@@ -90,16 +112,38 @@ static const char* const split_mode_table[] = {
 DEFINE_STRING_TABLE_LOOKUP(split_mode, SplitMode);
 DEFINE_CONFIG_PARSE_ENUM(config_parse_split_mode, split_mode, SplitMode, "Failed to parse split mode setting");
 
-static uint64_t available_space(Server *s, bool verbose) {
+/* The directory is read when the ledger is used first, and after
+ * that only if somebody else changed it */
+static VacuumLedger *server_get_ledger(Server *s, bool runtime) {
+        VacuumLedger **l = runtime ? &s->runtime_ledger : &s->system_ledger;
         char ids[33];
-        _cleanup_free_ char *p = NULL;
         sd_id128_t machine;
+        int r;
+
+        if (*l)
+                return *l;
+
+        r = sd_id128_get_machine(&machine);
+        if (r < 0)
+                return NULL;
+
+        sd_id128_to_string(machine, ids);
+
+        r = vacuum_ledger_new(strappenda(runtime ? "/run/log/journal/" : "/var/log/journal/", ids), l);
+        if (r < 0) {
+                log_error("Failed to allocate vacuum ledger: %s", strerror(-r));
+                return NULL;
+        }
+
+        return *l;
+}
+
+static uint64_t available_space(Server *s, bool verbose) {
+        VacuumLedger *l;
         struct statvfs ss;
         uint64_t sum = 0, ss_avail = 0, avail = 0;
         int r;
-        _cleanup_closedir_ DIR *d = NULL;
         usec_t ts;
-        const char *f;
         JournalMetrics *m;
 
         ts = now(CLOCK_MONOTONIC);
@@ -108,56 +152,19 @@ static uint64_t available_space(Server *s, bool verbose) {
             && !verbose)
                 return s->cached_available_space;
 
-        r = sd_id128_get_machine(&machine);
-        if (r < 0)
-                return 0;
-
-        if (s->system_journal) {
-                f = "/var/log/journal/";
-                m = &s->system_metrics;
-        } else {
-                f = "/run/log/journal/";
-                m = &s->runtime_metrics;
-        }
+        m = s->system_journal ? &s->system_metrics : &s->runtime_metrics;
 
-        assert(m);
-
-        p = strappend(f, sd_id128_to_string(machine, ids));
-        if (!p)
+        l = server_get_ledger(s, !s->system_journal);
+        if (!l)
                 return 0;
 
-        d = opendir(p);
-        if (!d)
+        r = vacuum_ledger_get_usage(l, &sum);
+        if (r < 0)
                 return 0;
 
-        if (fstatvfs(dirfd(d), &ss) < 0)
+        if (statvfs(vacuum_ledger_get_directory(l), &ss) < 0)
                 return 0;
 
-        for (;;) {
-                struct stat st;
-                struct dirent *de;
-                union dirent_storage buf;
-
-                r = readdir_r(d, &buf.de, &de);
-                if (r != 0)
-                        break;
-
-                if (!de)
-                        break;
-
-                if (!endswith(de->d_name, ".journal") &&
-                    !endswith(de->d_name, ".journal~"))
-                        continue;
-
-                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
-                        continue;
-
-                if (!S_ISREG(st.st_mode))
-                        continue;
-
-                sum += (uint64_t) st.st_blocks * 512UL;
-        }
-
         ss_avail = ss.f_bsize * ss.f_bavail;
         avail = ss_avail > m->keep_free ? ss_avail - m->keep_free : 0;
 
@@ -183,11 +190,6 @@ static uint64_t available_space(Server *s, bool verbose) {
 
 void server_fix_perms(Server *s, JournalFile *f, uid_t uid) {
         int r;
-#ifdef HAVE_ACL
-        acl_t acl;
-        acl_entry_t entry;
-        acl_permset_t permset;
-#endif
 
         assert(f);
 
@@ -199,40 +201,15 @@ void server_fix_perms(Server *s, JournalFile *f, uid_t uid) {
         if (uid <= 0)
                 return;
 
-        acl = acl_get_fd(f->fd);
-        if (!acl) {
-                log_warning("Failed to read ACL on %s, ignoring: %m", f->path);
-                return;
-        }
-
-        r = acl_find_uid(acl, uid, &entry);
-        if (r <= 0) {
-
-                if (acl_create_entry(&acl, &entry) < 0 ||
-                    acl_set_tag_type(entry, ACL_USER) < 0 ||
-                    acl_set_qualifier(entry, &uid) < 0) {
-                        log_warning("Failed to patch ACL on %s, ignoring: %m", f->path);
-                        goto finish;
-                }
-        }
-
-        /* We do not recalculate the mask unconditionally here,
-         * so that the fchmod() mask above stays intact. */
-        if (acl_get_permset(entry, &permset) < 0 ||
-            acl_add_perm(permset, ACL_READ) < 0 ||
-            calc_acl_mask_if_needed(&acl) < 0) {
-                log_warning("Failed to patch ACL on %s, ignoring: %m", f->path);
-                goto finish;
-        }
-
-        if (acl_set_fd(f->fd, acl) < 0)
-                log_warning("Failed to set ACL on %s, ignoring: %m", f->path);
-
-finish:
-        acl_free(acl);
+        r = acl_add_user_read_fd(f->fd, uid);
+        if (r < 0)
+                log_warning("Failed to patch ACL on %s, ignoring: %s", f->path, strerror(-r));
 #endif
 }
 
+static void server_stop_writers(Server *s);
+static void server_wait_writers(Server *s);
+
 static JournalFile* find_journal(Server *s, uid_t uid) {
         _cleanup_free_ char *p = NULL;
         int r;
@@ -266,6 +243,8 @@ static JournalFile* find_journal(Server *s, uid_t uid) {
 
         while (hashmap_size(s->user_journals) >= USER_JOURNALS_MAX) {
                 /* Too many open? Then let's close one */
+                server_stop_writers(s);
+
                 f = hashmap_steal_first(s->user_journals);
                 assert(f);
                 journal_file_close(f);
@@ -286,6 +265,106 @@ static JournalFile* find_journal(Server *s, uid_t uid) {
         return f;
 }
 
+static void collect_allocation_stalls(Server *s, JournalFile *f) {
+        JournalWriter *w;
+
+        assert(s);
+
+        if (!f)
+                return;
+
+        /* Files with a writer thread are its business */
+        w = hashmap_get(s->writers, f);
+        if (w) {
+                journal_writer_collect_allocation_stalls(w, &s->n_allocation_stalls, &s->allocation_stall_usec);
+                return;
+        }
+
+        s->n_allocation_stalls += f->n_allocation_stalls;
+        s->allocation_stall_usec += f->allocation_stall_usec;
+        f->n_allocation_stalls = 0;
+        f->allocation_stall_usec = 0;
+}
+
+static void server_collect_allocation_stalls(Server *s) {
+        JournalFile *f;
+        Iterator i;
+
+        collect_allocation_stalls(s, s->runtime_journal);
+        collect_allocation_stalls(s, s->system_journal);
+
+        HASHMAP_FOREACH(f, s->user_journals, i)
+                collect_allocation_stalls(s, f);
+}
+
+/* In ring buffer mode the runtime journal consists of max_use /
+ * max_size files at most, each allocated in full when it is created,
+ * so that it always takes up the same amount of memory. Since all of
+ * it is accounted for by max_use already, free space is not checked
+ * when allocating it. */
+static void fix_ring_metrics(JournalMetrics *m, int fd) {
+        uint64_t n;
+
+        assert(m);
+
+        journal_default_metrics(m, fd);
+
+        n = m->max_use / m->max_size;
+        m->max_size = (m->max_use / n) & ~((uint64_t) page_size() - 1);
+        m->max_use = n * m->max_size;
+
+        m->min_size = m->max_size;
+        m->preallocate = m->max_size;
+}
+
+/* Drops the oldest archived runtime journal files, until there is
+ * room for n more files in ring buffer mode */
+static void server_vacuum_ring(Server *s, uint64_t n) {
+        VacuumLedger *l;
+        uint64_t limit;
+        int r;
+
+        assert(s);
+
+        l = server_get_ledger(s, true);
+        if (!l)
+                return;
+
+        limit = s->runtime_metrics.max_use - n * s->runtime_metrics.max_size;
+
+        /* To vacuum_ledger_vacuum() 0 means no limit, but we want
+         * no archived file left then */
+        r = vacuum_ledger_vacuum(l, MAX(limit, 1ULL), 0, 0, NULL);
+        if (r < 0 && r != -ENOENT)
+                log_error("Failed to vacuum runtime journal: %s", strerror(-r));
+}
+
+/* Rotates the file, and tells the ledger of its directory about the
+ * archived file and the new one */
+static int server_rotate_file(Server *s, JournalFile **f, bool runtime, bool seal) {
+        _cleanup_free_ char *archived = NULL;
+        VacuumLedger *l;
+        int r;
+
+        assert(s);
+        assert(f);
+        assert(*f);
+
+        (void) journal_file_get_archived_path(*f, &archived);
+
+        r = journal_file_rotate(f, s->compress, seal);
+
+        l = server_get_ledger(s, runtime);
+        if (l) {
+                if (archived)
+                        vacuum_ledger_add(l, path_get_file_name(archived));
+                if (*f)
+                        vacuum_ledger_add(l, path_get_file_name((*f)->path));
+        }
+
+        return r;
+}
+
 void server_rotate(Server *s) {
         JournalFile *f;
         void *k;
@@ -294,8 +373,17 @@ void server_rotate(Server *s) {
 
         log_debug("Rotating...");
 
+        server_stop_writers(s);
+
+        /* Don't lose what the old files counted */
+        server_collect_allocation_stalls(s);
+
         if (s->runtime_journal) {
-                r = journal_file_rotate(&s->runtime_journal, s->compress, false);
+                /* The file being rotated and the new one count too */
+                if (s->runtime_ring_buffer)
+                        server_vacuum_ring(s, 2);
+
+                r = server_rotate_file(s, &s->runtime_journal, true, false);
                 if (r < 0)
                         if (s->runtime_journal)
                                 log_error("Failed to rotate %s: %s", s->runtime_journal->path, strerror(-r));
@@ -306,7 +394,7 @@ void server_rotate(Server *s) {
         }
 
         if (s->system_journal) {
-                r = journal_file_rotate(&s->system_journal, s->compress, s->seal);
+                r = server_rotate_file(s, &s->system_journal, false, s->seal);
                 if (r < 0)
                         if (s->system_journal)
                                 log_error("Failed to rotate %s: %s", s->system_journal->path, strerror(-r));
@@ -318,7 +406,7 @@ void server_rotate(Server *s) {
         }
 
         HASHMAP_FOREACH_KEY(f, k, s->user_journals, i) {
-                r = journal_file_rotate(&f, s->compress, s->seal);
+                r = server_rotate_file(s, &f, false, s->seal);
                 if (r < 0)
                         if (f)
                                 log_error("Failed to rotate %s: %s", f->path, strerror(-r));
@@ -333,21 +421,25 @@ void server_rotate(Server *s) {
         }
 }
 
-void server_sync(Server *s) {
+/* Unless told to wait, the files are synced and marked offline in
+ * the background, so that we can go on reading from the sockets */
+void server_sync(Server *s, bool wait) {
         static const struct itimerspec sync_timer_disable = {};
         JournalFile *f;
         void *k;
         Iterator i;
         int r;
 
+        server_wait_writers(s);
+
         if (s->system_journal) {
-                r = journal_file_set_offline(s->system_journal);
+                r = journal_file_set_offline(s->system_journal, wait);
                 if (r < 0)
                         log_error("Failed to sync system journal: %s", strerror(-r));
         }
 
         HASHMAP_FOREACH_KEY(f, k, s->user_journals, i) {
-                r = journal_file_set_offline(f);
+                r = journal_file_set_offline(f, wait);
                 if (r < 0)
                         log_error("Failed to sync user journal: %s", strerror(-r));
         }
@@ -360,36 +452,29 @@ void server_sync(Server *s) {
 }
 
 void server_vacuum(Server *s) {
-        char ids[33];
-        sd_id128_t machine;
+        VacuumLedger *l;
         int r;
 
         log_debug("Vacuuming...");
 
         s->oldest_file_usec = 0;
 
-        r = sd_id128_get_machine(&machine);
-        if (r < 0) {
-                log_error("Failed to get machine ID: %s", strerror(-r));
-                return;
-        }
-
-        sd_id128_to_string(machine, ids);
-
         if (s->system_journal) {
-                char *p = strappenda("/var/log/journal/", ids);
-
-                r = journal_directory_vacuum(p, s->system_metrics.max_use, s->system_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
-                if (r < 0 && r != -ENOENT)
-                        log_error("Failed to vacuum %s: %s", p, strerror(-r));
+                l = server_get_ledger(s, false);
+                if (l) {
+                        r = vacuum_ledger_vacuum(l, s->system_metrics.max_use, s->system_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
+                        if (r < 0 && r != -ENOENT)
+                                log_error("Failed to vacuum system journal: %s", strerror(-r));
+                }
         }
 
         if (s->runtime_journal) {
-                char *p = strappenda("/run/log/journal/", ids);
-
-                r = journal_directory_vacuum(p, s->runtime_metrics.max_use, s->runtime_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
-                if (r < 0 && r != -ENOENT)
-                        log_error("Failed to vacuum %s: %s", p, strerror(-r));
+                l = server_get_ledger(s, true);
+                if (l) {
+                        r = vacuum_ledger_vacuum(l, s->runtime_metrics.max_use, s->runtime_metrics.keep_free, s->max_retention_usec, &s->oldest_file_usec);
+                        if (r < 0 && r != -ENOENT)
+                                log_error("Failed to vacuum runtime journal: %s", strerror(-r));
+                }
         }
 
         s->cached_available_space_timestamp = 0;
@@ -424,13 +509,14 @@ bool shall_try_append_again(JournalFile *f, int r) {
         return true;
 }
 
-static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned n, int priority) {
+static void write_entries_to_journal(Server *s, uid_t uid, const JournalBatchEntry *entries, unsigned n, int priority) {
         JournalFile *f;
         bool vacuumed = false;
+        unsigned k;
         int r;
 
         assert(s);
-        assert(iovec);
+        assert(entries);
         assert(n > 0);
 
         f = find_journal(s, uid);
@@ -448,46 +534,290 @@ static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned
                         return;
         }
 
-        r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
-        if (r >= 0) {
-                server_schedule_sync(s, priority);
-                return;
+        while (n > 0) {
+                r = journal_file_append_entries(f, entries, n, &s->seqnum, &k);
+                if (k > 0)
+                        server_schedule_sync(s, priority);
+                if (r >= 0)
+                        return;
+
+                entries += k;
+                n -= k;
+
+                if (vacuumed || !shall_try_append_again(f, r)) {
+                        size_t size = 0;
+                        unsigned i;
+                        for (i = 0; i < entries->n_iovec; i++)
+                                size += entries->iovec[i].iov_len;
+
+                        log_error("Failed to write entry (%u items, %zu bytes)%s, ignoring: %s",
+                                  entries->n_iovec, size, vacuumed ? " despite vacuuming" : "", strerror(-r));
+
+                        entries++;
+                        n--;
+                        continue;
+                }
+
+                server_rotate(s);
+                server_vacuum(s);
+                vacuumed = true;
+
+                f = find_journal(s, uid);
+                if (!f)
+                        return;
+
+                log_debug("Retrying write.");
         }
+}
 
-        if (vacuumed || !shall_try_append_again(f, r)) {
-                size_t size = 0;
-                unsigned i;
-                for (i = 0; i < n; i++)
-                        size += iovec[i].iov_len;
+static void write_pending_entries(Server *s, PendingEntry *pending, size_t n) {
+        size_t i, j, k;
 
-                log_error("Failed to write entry (%d items, %zu bytes), ignoring: %s", n, size, strerror(-r));
-                return;
+        assert(s);
+        assert(pending || n == 0);
+
+        /* Write out runs of queued entries that go to the same
+         * file with a single append call each */
+        for (i = 0; i < n; i = j) {
+                JournalBatchEntry *entries;
+                int priority = pending[i].priority;
+
+                for (j = i + 1; j < n && pending[j].uid == pending[i].uid; j++)
+                        priority = MIN(priority, pending[j].priority);
+
+                entries = newa(JournalBatchEntry, j - i);
+                for (k = i; k < j; k++)
+                        entries[k - i] = pending[k].entry;
+
+                write_entries_to_journal(s, pending[i].uid, entries, j - i, priority);
         }
 
-        server_rotate(s);
-        server_vacuum(s);
+        for (i = 0; i < n; i++)
+                free((struct iovec*) pending[i].entry.iovec);
+}
 
-        f = find_journal(s, uid);
-        if (!f)
+static void server_stop_writers(Server *s) {
+        _cleanup_free_ PendingEntry *leftovers = NULL;
+        size_t n_leftovers = 0, n_allocated = 0;
+        JournalWriter *w;
+
+        assert(s);
+
+        if (!s->writers)
                 return;
 
-        log_debug("Retrying write.");
-        r = journal_file_append_entry(f, NULL, iovec, n, &s->seqnum, NULL, NULL);
+        /* Stop all of them before writing out what some of them
+         * left, since that might go to any file */
+        while ((w = hashmap_steal_first(s->writers))) {
+                _cleanup_free_ PendingEntry *l = NULL;
+                size_t n;
+
+                journal_writer_free(w, &l, &n);
+                if (n <= 0)
+                        continue;
+
+                if (!GREEDY_REALLOC(leftovers, n_allocated, n_leftovers + n)) {
+                        size_t i;
+
+                        log_error("Out of memory, dropping %zu entries.", n);
+                        for (i = 0; i < n; i++)
+                                free((struct iovec*) l[i].entry.iovec);
+                        continue;
+                }
+
+                memcpy(leftovers + n_leftovers, l, n * sizeof(PendingEntry));
+                n_leftovers += n;
+        }
+
+        /* These need the files rotated, which will happen when we
+         * try to write them here */
+        write_pending_entries(s, leftovers, n_leftovers);
+}
+
+static void server_wait_writers(Server *s) {
+        JournalWriter *w;
+        Iterator i;
+
+        assert(s);
+
+        HASHMAP_FOREACH(w, s->writers, i)
+                journal_writer_wait(w);
+}
+
+static JournalWriter* server_get_writer(Server *s, JournalFile *f) {
+        JournalWriter *w;
+        int r;
+
+        assert(s);
+        assert(f);
+
+        w = hashmap_get(s->writers, f);
+        if (w)
+                return w;
+
+        r = journal_writer_new(f, &s->seqnum, s->max_file_usec, &w);
+        if (r < 0) {
+                log_error("Failed to start writer thread for %s: %s", f->path, strerror(-r));
+                return NULL;
+        }
+
+        r = hashmap_put(s->writers, f, w);
         if (r < 0) {
-                size_t size = 0;
-                unsigned i;
-                for (i = 0; i < n; i++)
-                        size += iovec[i].iov_len;
+                PendingEntry *l;
+                size_t n;
+
+                journal_writer_free(w, &l, &n);
+                assert(n == 0);
+                return NULL;
+        }
 
-                log_error("Failed to write entry (%d items, %zu bytes) despite vacuuming, ignoring: %s", n, size, strerror(-r));
+        return w;
+}
+
+static void server_queue_pending(Server *s, PendingEntry *pending, size_t n) {
+        JournalWriter *w;
+        Iterator it;
+        size_t i, j, k;
+
+        assert(s);
+        assert(pending || n == 0);
+
+        /* If a writer couldn't go on, its file needs to be rotated
+         * and what it didn't write has to be written before
+         * anything else goes to the new file */
+        HASHMAP_FOREACH(w, s->writers, it)
+                if (journal_writer_broken(w)) {
+                        server_stop_writers(s);
+                        break;
+                }
+
+        for (i = 0; i < n; i = j) {
+                int priority = pending[i].priority;
+                JournalFile *f;
+
+                for (j = i + 1; j < n && pending[j].uid == pending[i].uid; j++)
+                        priority = MIN(priority, pending[j].priority);
+
+                f = find_journal(s, pending[i].uid);
+                if (!f) {
+                        for (k = i; k < j; k++)
+                                free((struct iovec*) pending[k].entry.iovec);
+                        continue;
+                }
+
+                w = server_get_writer(s, f);
+                if (w && journal_writer_enqueue(w, pending + i, j - i) >= 0) {
+                        server_schedule_sync(s, priority);
+                        continue;
+                }
+
+                /* Can't hand them off, write them here, which needs
+                 * the file to ourselves */
+                server_stop_writers(s);
+                write_pending_entries(s, pending + i, j - i);
+        }
+}
+
+void server_flush_pending(Server *s) {
+        PendingEntry *pending;
+        size_t n, n_allocated;
+
+        assert(s);
+
+        /* Writing these out might log something, which is queued
+         * anew and written out before we return */
+        pending = s->pending;
+        n = s->n_pending;
+        n_allocated = s->n_pending_allocated;
+
+        s->pending = NULL;
+        s->n_pending = s->n_pending_allocated = 0;
+
+        if (s->writers)
+                server_queue_pending(s, pending, n);
+        else
+                write_pending_entries(s, pending, n);
+
+        if (!s->pending) {
+                s->pending = pending;
+                s->n_pending_allocated = n_allocated;
         } else
-                server_schedule_sync(s, priority);
+                free(pending);
+}
+
+static int queue_entry(Server *s, uid_t uid, struct iovec *iovec, unsigned n, int priority) {
+        PendingEntry *e;
+        struct iovec *copy;
+        size_t size = 0;
+        uint8_t *p;
+        unsigned i;
+
+        assert(s);
+        assert(iovec);
+        assert(n > 0);
+
+        if (!GREEDY_REALLOC(s->pending, s->n_pending_allocated, s->n_pending + 1))
+                return -ENOMEM;
+
+        /* The iovecs point into buffers that are reused for the
+         * next message, hence copy them into a single allocation */
+        for (i = 0; i < n; i++)
+                size += iovec[i].iov_len;
+
+        copy = malloc(sizeof(struct iovec) * n + size);
+        if (!copy)
+                return -ENOMEM;
+
+        p = (uint8_t*) (copy + n);
+        for (i = 0; i < n; i++) {
+                copy[i].iov_base = p;
+                copy[i].iov_len = iovec[i].iov_len;
+                p = mempcpy(p, iovec[i].iov_base, iovec[i].iov_len);
+        }
+
+        e = s->pending + s->n_pending++;
+        e->uid = uid;
+        e->priority = priority;
+        e->entry.iovec = copy;
+        e->entry.n_iovec = n;
+        dual_timestamp_get(&e->entry.ts);
+
+        return 0;
+}
+
+static void write_to_journal(Server *s, uid_t uid, struct iovec *iovec, unsigned n, int priority) {
+        JournalBatchEntry e = {
+                .iovec = iovec,
+                .n_iovec = n,
+        };
+
+        assert(s);
+        assert(iovec);
+        assert(n > 0);
+
+        /* With writer threads everything goes through the queue,
+         * it's just flushed right away when not batching */
+        if (s->batch_writes || s->writers) {
+                if (queue_entry(s, uid, iovec, n, priority) >= 0) {
+                        if (!s->batch_writes || s->n_pending >= PENDING_ENTRIES_MAX)
+                                server_flush_pending(s);
+                        return;
+                }
+
+                /* Out of memory, write out what we have and this
+                 * entry directly */
+                server_flush_pending(s);
+                server_stop_writers(s);
+        }
+
+        write_entries_to_journal(s, uid, &e, 1, priority);
 }
 
 static void dispatch_message_real(
                 Server *s,
                 struct iovec *iovec, unsigned n, unsigned m,
                 struct ucred *ucred,
+                ClientInfo *info,
                 struct timeval *tv,
                 const char *label, size_t label_len,
                 const char *unit_id,
@@ -497,29 +827,23 @@ static void dispatch_message_real(
         char    pid[sizeof("_PID=") + DECIMAL_STR_MAX(pid_t)],
                 uid[sizeof("_UID=") + DECIMAL_STR_MAX(uid_t)],
                 gid[sizeof("_GID=") + DECIMAL_STR_MAX(gid_t)],
-                owner_uid[sizeof("_SYSTEMD_OWNER_UID=") + DECIMAL_STR_MAX(uid_t)],
                 source_time[sizeof("_SOURCE_REALTIME_TIMESTAMP=") + DECIMAL_STR_MAX(usec_t)],
                 boot_id[sizeof("_BOOT_ID=") + 32] = "_BOOT_ID=",
                 machine_id[sizeof("_MACHINE_ID=") + 32] = "_MACHINE_ID=",
                 o_uid[sizeof("OBJECT_UID=") + DECIMAL_STR_MAX(uid_t)],
                 o_gid[sizeof("OBJECT_GID=") + DECIMAL_STR_MAX(gid_t)],
                 o_owner_uid[sizeof("OBJECT_SYSTEMD_OWNER_UID=") + DECIMAL_STR_MAX(uid_t)];
-        uid_t object_uid;
-        gid_t object_gid;
+        ClientInfo *o;
         char *x;
         sd_id128_t id;
+        unsigned k;
         int r;
-        char *t, *c;
+        char *t;
         uid_t realuid = 0, owner = 0, journal_uid;
         bool owner_valid = false;
 #ifdef HAVE_AUDIT
-        char    audit_session[sizeof("_AUDIT_SESSION=") + DECIMAL_STR_MAX(uint32_t)],
-                audit_loginuid[sizeof("_AUDIT_LOGINUID=") + DECIMAL_STR_MAX(uid_t)],
-                o_audit_session[sizeof("OBJECT_AUDIT_SESSION=") + DECIMAL_STR_MAX(uint32_t)],
+        char    o_audit_session[sizeof("OBJECT_AUDIT_SESSION=") + DECIMAL_STR_MAX(uint32_t)],
                 o_audit_loginuid[sizeof("OBJECT_AUDIT_LOGINUID=") + DECIMAL_STR_MAX(uid_t)];
-
-        uint32_t audit;
-        uid_t loginuid;
 #endif
 
         assert(s);
@@ -539,94 +863,29 @@ static void dispatch_message_real(
                 sprintf(gid, "_GID=%lu", (unsigned long) ucred->gid);
                 IOVEC_SET_STRING(iovec[n++], gid);
 
-                r = get_process_comm(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strappenda("_COMM=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
+                if (info) {
+                        /* The fields are attached as they are, hence
+                         * keep the cache from refilling or dropping
+                         * them while we are at it */
+                        client_info_ref(info);
 
-                r = get_process_exe(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strappenda("_EXE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
-
-                r = get_process_cmdline(ucred->pid, 0, false, &t);
-                if (r >= 0) {
-                        x = strappenda("_CMDLINE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
-
-                r = get_process_capeff(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strappenda("_CAP_EFFECTIVE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
-
-#ifdef HAVE_AUDIT
-                r = audit_session_from_pid(ucred->pid, &audit);
-                if (r >= 0) {
-                        sprintf(audit_session, "_AUDIT_SESSION=%lu", (unsigned long) audit);
-                        IOVEC_SET_STRING(iovec[n++], audit_session);
-                }
-
-                r = audit_loginuid_from_pid(ucred->pid, &loginuid);
-                if (r >= 0) {
-                        sprintf(audit_loginuid, "_AUDIT_LOGINUID=%lu", (unsigned long) loginuid);
-                        IOVEC_SET_STRING(iovec[n++], audit_loginuid);
-                }
-#endif
-
-                r = cg_pid_get_path_shifted(ucred->pid, NULL, &c);
-                if (r >= 0) {
-                        char *session = NULL;
+                        for (k = 0; k < info->n_fields; k++)
+                                IOVEC_SET_STRING(iovec[n++], info->fields[k]);
 
-                        x = strappenda("_SYSTEMD_CGROUP=", c);
-                        IOVEC_SET_STRING(iovec[n++], x);
-
-                        r = cg_path_get_session(c, &t);
-                        if (r >= 0) {
-                                session = strappenda("_SYSTEMD_SESSION=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], session);
-                        }
-
-                        if (cg_path_get_owner_uid(c, &owner) >= 0) {
+                        if (info->owner_uid_valid) {
                                 owner_valid = true;
-
-                                sprintf(owner_uid, "_SYSTEMD_OWNER_UID=%lu", (unsigned long) owner);
-                                IOVEC_SET_STRING(iovec[n++], owner_uid);
-                        }
-
-                        if (cg_path_get_unit(c, &t) >= 0) {
-                                x = strappenda("_SYSTEMD_UNIT=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && !session) {
-                                x = strappenda("_SYSTEMD_UNIT=", unit_id);
-                                IOVEC_SET_STRING(iovec[n++], x);
-                        }
-
-                        if (cg_path_get_user_unit(c, &t) >= 0) {
-                                x = strappenda("_SYSTEMD_USER_UNIT=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && session) {
-                                x = strappenda("_SYSTEMD_USER_UNIT=", unit_id);
-                                IOVEC_SET_STRING(iovec[n++], x);
+                                owner = info->owner_uid;
                         }
 
-                        if (cg_path_get_slice(c, &t) >= 0) {
-                                x = strappenda("_SYSTEMD_SLICE=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], x);
+                        if (info->cgroup && unit_id) {
+                                if (!info->unit && !info->session) {
+                                        x = strappenda("_SYSTEMD_UNIT=", unit_id);
+                                        IOVEC_SET_STRING(iovec[n++], x);
+                                } else if (!info->user_unit && info->session) {
+                                        x = strappenda("_SYSTEMD_USER_UNIT=", unit_id);
+                                        IOVEC_SET_STRING(iovec[n++], x);
+                                }
                         }
-
-                        free(c);
                 }
 
 #ifdef HAVE_SELINUX
@@ -651,84 +910,67 @@ static void dispatch_message_real(
         }
         assert(n <= m);
 
-        if (object_pid) {
-                r = get_process_uid(object_pid, &object_uid);
-                if (r >= 0) {
-                        sprintf(o_uid, "OBJECT_UID=%lu", (unsigned long) object_uid);
+        if (object_pid > 0 && client_cache_get(s->client_cache, object_pid, &o) >= 0) {
+                if (o->uid_valid) {
+                        sprintf(o_uid, "OBJECT_UID=%lu", (unsigned long) o->uid);
                         IOVEC_SET_STRING(iovec[n++], o_uid);
                 }
 
-                r = get_process_gid(object_pid, &object_gid);
-                if (r >= 0) {
-                        sprintf(o_gid, "OBJECT_GID=%lu", (unsigned long) object_gid);
+                if (o->gid_valid) {
+                        sprintf(o_gid, "OBJECT_GID=%lu", (unsigned long) o->gid);
                         IOVEC_SET_STRING(iovec[n++], o_gid);
                 }
 
-                r = get_process_comm(object_pid, &t);
-                if (r >= 0) {
-                        x = strappenda("OBJECT_COMM=", t);
-                        free(t);
+                if (o->comm) {
+                        x = strappenda("OBJECT_COMM=", o->comm);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
-                r = get_process_exe(object_pid, &t);
-                if (r >= 0) {
-                        x = strappenda("OBJECT_EXE=", t);
-                        free(t);
+                if (o->exe) {
+                        x = strappenda("OBJECT_EXE=", o->exe);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
-                r = get_process_cmdline(object_pid, 0, false, &t);
-                if (r >= 0) {
-                        x = strappenda("OBJECT_CMDLINE=", t);
-                        free(t);
+                if (o->cmdline) {
+                        x = strappenda("OBJECT_CMDLINE=", o->cmdline);
                         IOVEC_SET_STRING(iovec[n++], x);
                 }
 
 #ifdef HAVE_AUDIT
-                r = audit_session_from_pid(object_pid, &audit);
-                if (r >= 0) {
-                        sprintf(o_audit_session, "OBJECT_AUDIT_SESSION=%lu", (unsigned long) audit);
+                if (o->audit_session_valid) {
+                        sprintf(o_audit_session, "OBJECT_AUDIT_SESSION=%lu", (unsigned long) o->audit_session);
                         IOVEC_SET_STRING(iovec[n++], o_audit_session);
                 }
 
-                r = audit_loginuid_from_pid(object_pid, &loginuid);
-                if (r >= 0) {
-                        sprintf(o_audit_loginuid, "OBJECT_AUDIT_LOGINUID=%lu", (unsigned long) loginuid);
+                if (o->loginuid_valid) {
+                        sprintf(o_audit_loginuid, "OBJECT_AUDIT_LOGINUID=%lu", (unsigned long) o->loginuid);
                         IOVEC_SET_STRING(iovec[n++], o_audit_loginuid);
                 }
 #endif
 
-                r = cg_pid_get_path_shifted(object_pid, NULL, &c);
-                if (r >= 0) {
-                        x = strappenda("OBJECT_SYSTEMD_CGROUP=", c);
+                if (o->cgroup) {
+                        x = strappenda("OBJECT_SYSTEMD_CGROUP=", o->cgroup);
                         IOVEC_SET_STRING(iovec[n++], x);
 
-                        r = cg_path_get_session(c, &t);
-                        if (r >= 0) {
-                                x = strappenda("OBJECT_SYSTEMD_SESSION=", t);
-                                free(t);
+                        if (o->session) {
+                                x = strappenda("OBJECT_SYSTEMD_SESSION=", o->session);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_owner_uid(c, &owner) >= 0) {
-                                sprintf(o_owner_uid, "OBJECT_SYSTEMD_OWNER_UID=%lu", (unsigned long) owner);
+                        if (o->owner_uid_valid) {
+                                sprintf(o_owner_uid, "OBJECT_SYSTEMD_OWNER_UID=%lu", (unsigned long) o->owner_uid);
                                 IOVEC_SET_STRING(iovec[n++], o_owner_uid);
                         }
 
-                        if (cg_path_get_unit(c, &t) >= 0) {
-                                x = strappenda("OBJECT_SYSTEMD_UNIT=", t);
-                                free(t);
+                        if (o->unit) {
+                                x = strappenda("OBJECT_SYSTEMD_UNIT=", o->unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_user_unit(c, &t) >= 0) {
-                                x = strappenda("OBJECT_SYSTEMD_USER_UNIT=", t);
-                                free(t);
+                        if (o->user_unit) {
+                                x = strappenda("OBJECT_SYSTEMD_USER_UNIT=", o->user_unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
-
-                        free(c);
                 }
         }
         assert(n <= m);
@@ -777,6 +1019,9 @@ static void dispatch_message_real(
                 journal_uid = 0;
 
         write_to_journal(s, journal_uid, iovec, n, priority);
+
+        if (ucred)
+                client_info_unref(info);
 }
 
 void server_driver_message(Server *s, sd_id128_t message_id, const char *format, ...) {
@@ -786,6 +1031,7 @@ void server_driver_message(Server *s, sd_id128_t message_id, const char *format,
         int n = 0;
         va_list ap;
         struct ucred ucred = {};
+        ClientInfo *info;
 
         assert(s);
         assert(format);
@@ -810,22 +1056,25 @@ void server_driver_message(Server *s, sd_id128_t message_id, const char *format,
         ucred.uid = getuid();
         ucred.gid = getgid();
 
-        dispatch_message_real(s, iovec, n, ELEMENTSOF(iovec), &ucred, NULL, NULL, 0, NULL, LOG_INFO, 0);
+        if (client_cache_get(s->client_cache, ucred.pid, &info) < 0)
+                info = NULL;
+
+        dispatch_message_real(s, iovec, n, ELEMENTSOF(iovec), &ucred, info, NULL, NULL, 0, NULL, LOG_INFO, 0);
 }
 
 void server_dispatch_message(
                 Server *s,
                 struct iovec *iovec, unsigned n, unsigned m,
                 struct ucred *ucred,
+                ClientInfo *info,
                 struct timeval *tv,
                 const char *label, size_t label_len,
                 const char *unit_id,
                 int priority,
                 pid_t object_pid) {
 
-        int rl, r;
-        _cleanup_free_ char *path = NULL;
-        char *c;
+        char *path, *c;
+        int rl;
 
         assert(s);
         assert(iovec || n == 0);
@@ -844,9 +1093,16 @@ void server_dispatch_message(
         if (!ucred)
                 goto finish;
 
-        r = cg_pid_get_path_shifted(ucred->pid, NULL, &path);
-        if (r < 0)
+        if (!info &&
+            (ucred->pid <= 0 || client_cache_get(s->client_cache, ucred->pid, &info) < 0)) {
+                info = NULL;
                 goto finish;
+        }
+
+        if (!info->cgroup)
+                goto finish;
+
+        path = strdupa(info->cgroup);
 
         /* example: /user/lennart/3/foobar
          *          /system/dbus.service/foobar
@@ -876,7 +1132,7 @@ void server_dispatch_message(
                                       "Suppressed %u messages from %s", rl - 1, path);
 
 finish:
-        dispatch_message_real(s, iovec, n, m, ucred, tv, label, label_len, unit_id, priority, object_pid);
+        dispatch_message_real(s, iovec, n, m, ucred, info, tv, label, label_len, unit_id, priority, object_pid);
 }
 
 
@@ -952,6 +1208,17 @@ static int system_journal_open(Server *s) {
                          * it if necessary. */
 
                         (void) mkdir_parents(fn, 0755);
+
+                        if (s->runtime_ring_buffer) {
+                                _cleanup_close_ int fd = -1;
+
+                                fd = open(strappenda("/run/log/journal/", ids), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+                                if (fd >= 0) {
+                                        fix_ring_metrics(&s->runtime_metrics, fd);
+                                        server_vacuum_ring(s, 1);
+                                }
+                        }
+
                         r = journal_file_open_reliably(fn, O_RDWR|O_CREAT, 0640, s->compress, false, &s->runtime_metrics, s->mmap, NULL, &s->runtime_journal);
                         free(fn);
 
@@ -984,6 +1251,8 @@ int server_flush_to_var(Server *s) {
         if (!s->runtime_journal)
                 return 0;
 
+        server_stop_writers(s);
+
         system_journal_open(s);
 
         if (!s->system_journal)
@@ -1056,6 +1325,193 @@ finish:
         return r;
 }
 
+/* We use NAME_MAX space for the SELinux label here. The kernel
+ * currently enforces no limit, but according to suggestions from the
+ * SELinux people this will change and it will probably be identical
+ * to NAME_MAX. For now we use that, but this should be updated one
+ * day when the final limit is known. */
+union DatagramControl {
+        struct cmsghdr cmsghdr;
+        uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
+                    CMSG_SPACE(sizeof(struct timeval)) +
+                    CMSG_SPACE(sizeof(int)) + /* fd */
+                    CMSG_SPACE(NAME_MAX)]; /* selinux label */
+};
+
+static void server_process_datagram(Server *s, int fd, struct msghdr *msghdr, char *buffer, size_t n) {
+        struct ucred *ucred = NULL;
+        struct timeval *tv = NULL;
+        struct cmsghdr *cmsg;
+        char *label = NULL;
+        size_t label_len = 0;
+        int *fds = NULL;
+        unsigned n_fds = 0;
+
+        for (cmsg = CMSG_FIRSTHDR(msghdr); cmsg; cmsg = CMSG_NXTHDR(msghdr, cmsg)) {
+
+                if (cmsg->cmsg_level == SOL_SOCKET &&
+                    cmsg->cmsg_type == SCM_CREDENTIALS &&
+                    cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred)))
+                        ucred = (struct ucred*) CMSG_DATA(cmsg);
+                else if (cmsg->cmsg_level == SOL_SOCKET &&
+                         cmsg->cmsg_type == SCM_SECURITY) {
+                        label = (char*) CMSG_DATA(cmsg);
+                        label_len = cmsg->cmsg_len - CMSG_LEN(0);
+                } else if (cmsg->cmsg_level == SOL_SOCKET &&
+                           cmsg->cmsg_type == SO_TIMESTAMP &&
+                           cmsg->cmsg_len == CMSG_LEN(sizeof(struct timeval)))
+                        tv = (struct timeval*) CMSG_DATA(cmsg);
+                else if (cmsg->cmsg_level == SOL_SOCKET &&
+                         cmsg->cmsg_type == SCM_RIGHTS) {
+                        fds = (int*) CMSG_DATA(cmsg);
+                        n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                }
+        }
+
+        if (msghdr->msg_flags & MSG_TRUNC)
+                log_warning("Got datagram larger than %zu bytes. Ignoring.", n);
+
+        else if (fd == s->syslog_fd) {
+                if (n > 0 && n_fds == 0) {
+                        buffer[n] = 0;
+                        server_process_syslog_message(s, strstrip(buffer), ucred, tv, label, label_len);
+                } else if (n_fds > 0)
+                        log_warning("Got file descriptors via syslog socket. Ignoring.");
+
+        } else {
+                if (n > 0 && n_fds == 0)
+                        server_process_native_message(s, buffer, n, ucred, tv, label, label_len);
+                else if (n == 0 && n_fds == 1)
+                        server_process_native_file(s, fds[0], ucred, tv, label, label_len);
+                else if (n_fds > 0)
+                        log_warning("Got too many file descriptors via native socket. Ignoring.");
+        }
+
+        close_many(fds, n_fds);
+}
+
+/* Receives a datagram too large for the batch buffers on its own,
+ * sized by what the socket says it is */
+static int server_receive_datagram(Server *s, int fd, size_t size) {
+        DatagramControl control = {};
+        struct iovec iovec;
+        struct msghdr msghdr = {
+                .msg_iov = &iovec,
+                .msg_iovlen = 1,
+                .msg_control = &control,
+                .msg_controllen = sizeof(control),
+        };
+        ssize_t n;
+
+        if (!GREEDY_REALLOC(s->buffer, s->buffer_size, LINE_MAX + size))
+                return log_oom();
+
+        iovec.iov_base = s->buffer;
+        iovec.iov_len = s->buffer_size - 1;
+
+        n = recvmsg(fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
+        if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN)
+                        return 0;
+
+                log_error("recvmsg() failed: %m");
+                return -errno;
+        }
+
+        server_process_datagram(s, fd, &msghdr, s->buffer, n);
+        return 1;
+}
+
+/* Drains a datagram socket, receiving up to RECV_BATCH_MAX datagrams
+ * with each recvmmsg(). */
+static int server_receive_datagrams(Server *s, int fd) {
+        unsigned k;
+        int m, v;
+
+        assert(s);
+
+        if (!s->recv_msgs) {
+                s->recv_msgs = new0(struct mmsghdr, RECV_BATCH_MAX);
+                s->recv_iovecs = new0(struct iovec, RECV_BATCH_MAX);
+                s->recv_controls = new0(DatagramControl, RECV_BATCH_MAX);
+                s->recv_buffers = new(char, RECV_BATCH_MAX * RECV_BUFFER_SIZE);
+                if (!s->recv_msgs || !s->recv_iovecs || !s->recv_controls || !s->recv_buffers) {
+                        free(s->recv_msgs);
+                        free(s->recv_iovecs);
+                        free(s->recv_controls);
+                        free(s->recv_buffers);
+                        s->recv_msgs = NULL;
+                        s->recv_iovecs = NULL;
+                        s->recv_controls = NULL;
+                        s->recv_buffers = NULL;
+                        return log_oom();
+                }
+        }
+
+        for (;;) {
+                if (ioctl(fd, SIOCINQ, &v) < 0) {
+                        log_error("SIOCINQ failed: %m");
+                        return -errno;
+                }
+
+                /* SIOCINQ tells us the size of the next datagram
+                 * only. Should it not fit into a slot, take it on its
+                 * own. */
+                if ((size_t) v >= RECV_BUFFER_SIZE ||
+                    (s->recv_truncated_usec > 0 && now(CLOCK_MONOTONIC) < s->recv_truncated_usec + RECV_ONE_BY_ONE_USEC)) {
+                        int r;
+
+                        r = server_receive_datagram(s, fd, v);
+                        if (r <= 0)
+                                return r < 0 ? r : 1;
+
+                        continue;
+                }
+
+                for (k = 0; k < RECV_BATCH_MAX; k++) {
+                        /* Leave room for a trailing NUL */
+                        s->recv_iovecs[k].iov_base = s->recv_buffers + k * RECV_BUFFER_SIZE;
+                        s->recv_iovecs[k].iov_len = RECV_BUFFER_SIZE - 1;
+
+                        s->recv_msgs[k].msg_hdr = (struct msghdr) {
+                                .msg_iov = &s->recv_iovecs[k],
+                                .msg_iovlen = 1,
+                                .msg_control = &s->recv_controls[k],
+                                .msg_controllen = sizeof(DatagramControl),
+                        };
+                        s->recv_msgs[k].msg_len = 0;
+                }
+
+                m = recvmmsg(fd, s->recv_msgs, RECV_BATCH_MAX, MSG_DONTWAIT|MSG_CMSG_CLOEXEC, NULL);
+                if (m < 0) {
+                        if (errno == EINTR || errno == EAGAIN)
+                                return 1;
+
+                        log_error("recvmmsg() failed: %m");
+                        return -errno;
+                }
+
+                for (k = 0; k < (unsigned) m; k++) {
+                        /* A large datagram queued behind the first
+                         * one got truncated, and the kernel dropped
+                         * what didn't fit. Receive one by one for a
+                         * while, each datagram sized by SIOCINQ, so
+                         * that no more are lost. */
+                        if (s->recv_msgs[k].msg_hdr.msg_flags & MSG_TRUNC)
+                                s->recv_truncated_usec = now(CLOCK_MONOTONIC);
+
+                        server_process_datagram(s, fd,
+                                                &s->recv_msgs[k].msg_hdr,
+                                                s->recv_iovecs[k].iov_base,
+                                                s->recv_msgs[k].msg_len);
+                }
+
+                /* Didn't fill the batch, the socket is empty */
+                if ((unsigned) m < RECV_BATCH_MAX)
+                        return 1;
+        }
+}
+
 int process_event(Server *s, struct epoll_event *ev) {
         assert(s);
         assert(ev);
@@ -1087,7 +1543,7 @@ int process_event(Server *s, struct epoll_event *ev) {
                                  sfsi.ssi_pid);
                         touch("/run/systemd/journal/flushed");
                         server_flush_to_var(s);
-                        server_sync(s);
+                        server_sync(s, true);
                         return 1;
                 }
 
@@ -1099,6 +1555,13 @@ int process_event(Server *s, struct epoll_event *ev) {
                         return 1;
                 }
 
+                if ((int) sfsi.ssi_signo == SIGRTMIN+1) {
+                        log_debug("Received request to dump statistics from PID %"PRIu32,
+                                  sfsi.ssi_pid);
+                        server_dump_stats(s);
+                        return 1;
+                }
+
                 log_info("Received SIG%s", signal_to_string(sfsi.ssi_signo));
 
                 return 0;
@@ -1113,7 +1576,7 @@ int process_event(Server *s, struct epoll_event *ev) {
                 if (r < 0)
                         return 0;
 
-                server_sync(s);
+                server_sync(s, false);
                 return 1;
 
         } else if (ev->data.fd == s->dev_kmsg_fd) {
@@ -1136,6 +1599,7 @@ int process_event(Server *s, struct epoll_event *ev) {
 
         } else if (ev->data.fd == s->native_fd ||
                    ev->data.fd == s->syslog_fd) {
+                int r;
 
                 if (ev->events != EPOLLIN) {
                         log_error("Got invalid event from epoll for %s: %"PRIx32,
@@ -1144,104 +1608,16 @@ int process_event(Server *s, struct epoll_event *ev) {
                         return -EIO;
                 }
 
-                for (;;) {
-                        struct ucred *ucred = NULL;
-                        struct timeval *tv = NULL;
-                        struct cmsghdr *cmsg;
-                        char *label = NULL;
-                        size_t label_len = 0;
-
-                        struct iovec iovec;
-                        union {
-                                struct cmsghdr cmsghdr;
-
-                                /* We use NAME_MAX space for the
-                                 * SELinux label here. The kernel
-                                 * currently enforces no limit, but
-                                 * according to suggestions from the
-                                 * SELinux people this will change and
-                                 * it will probably be identical to
-                                 * NAME_MAX. For now we use that, but
-                                 * this should be updated one day when
-                                 * the final limit is known.*/
-                                uint8_t buf[CMSG_SPACE(sizeof(struct ucred)) +
-                                            CMSG_SPACE(sizeof(struct timeval)) +
-                                            CMSG_SPACE(sizeof(int)) + /* fd */
-                                            CMSG_SPACE(NAME_MAX)]; /* selinux label */
-                        } control = {};
-                        struct msghdr msghdr = {
-                                .msg_iov = &iovec,
-                                .msg_iovlen = 1,
-                                .msg_control = &control,
-                                .msg_controllen = sizeof(control),
-                        };
-
-                        ssize_t n;
-                        int v;
-                        int *fds = NULL;
-                        unsigned n_fds = 0;
-
-                        if (ioctl(ev->data.fd, SIOCINQ, &v) < 0) {
-                                log_error("SIOCINQ failed: %m");
-                                return -errno;
-                        }
+                /* Drain the socket completely, and write everything
+                 * we got in one go */
+                s->batch_writes = true;
 
-                        if (!GREEDY_REALLOC(s->buffer, s->buffer_size, LINE_MAX + (size_t) v))
-                                return log_oom();
+                r = server_receive_datagrams(s, ev->data.fd);
 
-                        iovec.iov_base = s->buffer;
-                        iovec.iov_len = s->buffer_size;
+                s->batch_writes = false;
+                server_flush_pending(s);
 
-                        n = recvmsg(ev->data.fd, &msghdr, MSG_DONTWAIT|MSG_CMSG_CLOEXEC);
-                        if (n < 0) {
-                                if (errno == EINTR || errno == EAGAIN)
-                                        return 1;
-
-                                log_error("recvmsg() failed: %m");
-                                return -errno;
-                        }
-
-                        for (cmsg = CMSG_FIRSTHDR(&msghdr); cmsg; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
-
-                                if (cmsg->cmsg_level == SOL_SOCKET &&
-                                    cmsg->cmsg_type == SCM_CREDENTIALS &&
-                                    cmsg->cmsg_len == CMSG_LEN(sizeof(struct ucred)))
-                                        ucred = (struct ucred*) CMSG_DATA(cmsg);
-                                else if (cmsg->cmsg_level == SOL_SOCKET &&
-                                         cmsg->cmsg_type == SCM_SECURITY) {
-                                        label = (char*) CMSG_DATA(cmsg);
-                                        label_len = cmsg->cmsg_len - CMSG_LEN(0);
-                                } else if (cmsg->cmsg_level == SOL_SOCKET &&
-                                           cmsg->cmsg_type == SO_TIMESTAMP &&
-                                           cmsg->cmsg_len == CMSG_LEN(sizeof(struct timeval)))
-                                        tv = (struct timeval*) CMSG_DATA(cmsg);
-                                else if (cmsg->cmsg_level == SOL_SOCKET &&
-                                         cmsg->cmsg_type == SCM_RIGHTS) {
-                                        fds = (int*) CMSG_DATA(cmsg);
-                                        n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
-                                }
-                        }
-
-                        if (ev->data.fd == s->syslog_fd) {
-                                if (n > 0 && n_fds == 0) {
-                                        s->buffer[n] = 0;
-                                        server_process_syslog_message(s, strstrip(s->buffer), ucred, tv, label, label_len);
-                                } else if (n_fds > 0)
-                                        log_warning("Got file descriptors via syslog socket. Ignoring.");
-
-                        } else {
-                                if (n > 0 && n_fds == 0)
-                                        server_process_native_message(s, s->buffer, n, ucred, tv, label, label_len);
-                                else if (n == 0 && n_fds == 1)
-                                        server_process_native_file(s, fds[0], ucred, tv, label, label_len);
-                                else if (n_fds > 0)
-                                        log_warning("Got too many file descriptors via native socket. Ignoring.");
-                        }
-
-                        close_many(fds, n_fds);
-                }
-
-                return 1;
+                return r;
 
         } else if (ev->data.fd == s->stdout_fd) {
 
@@ -1272,9 +1648,14 @@ int process_event(Server *s, struct epoll_event *ev) {
 
                 stream = ev->data.ptr;
 
+                s->batch_writes = true;
+
                 if (stdout_stream_process(stream) <= 0)
                         stdout_stream_free(stream);
 
+                s->batch_writes = false;
+                server_flush_pending(s);
+
                 return 1;
         }
 
@@ -1289,7 +1670,7 @@ static int open_signalfd(Server *s) {
         assert(s);
 
         assert_se(sigemptyset(&mask) == 0);
-        sigset_add_many(&mask, SIGINT, SIGTERM, SIGUSR1, SIGUSR2, -1);
+        sigset_add_many(&mask, SIGINT, SIGTERM, SIGUSR1, SIGUSR2, SIGRTMIN+1, -1);
         assert_se(sigprocmask(SIG_SETMASK, &mask, NULL) == 0);
 
         s->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
@@ -1410,8 +1791,9 @@ int server_schedule_sync(Server *s, int priority) {
         assert(s);
 
         if (priority <= LOG_CRIT) {
-                /* Immediately sync to disk when this is of priority CRIT, ALERT, EMERG */
-                server_sync(s);
+                /* Immediately sync to disk when this is of priority
+                 * CRIT, ALERT, EMERG, and don't return before it is */
+                server_sync(s, true);
                 return 0;
         }
 
@@ -1475,9 +1857,17 @@ int server_init(Server *s) {
         if (!s->user_journals)
                 return log_oom();
 
-        s->mmap = mmap_cache_new();
-        if (!s->mmap)
-                return log_oom();
+        if (s->writer_threads) {
+                /* Each file gets its own mmap cache then, since
+                 * they are written to from different threads */
+                s->writers = hashmap_new(trivial_hash_func, trivial_compare_func);
+                if (!s->writers)
+                        return log_oom();
+        } else {
+                s->mmap = mmap_cache_new();
+                if (!s->mmap)
+                        return log_oom();
+        }
 
         s->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
         if (s->epoll_fd < 0) {
@@ -1563,6 +1953,10 @@ int server_init(Server *s) {
         if (!s->rate_limit)
                 return -ENOMEM;
 
+        s->client_cache = client_cache_new();
+        if (!s->client_cache)
+                return -ENOMEM;
+
         r = system_journal_open(s);
         if (r < 0)
                 return r;
@@ -1570,6 +1964,28 @@ int server_init(Server *s) {
         return 0;
 }
 
+#ifdef HAVE_GCRYPT
+static void maybe_append_tag(Server *s, JournalFile *f, usec_t n) {
+        JournalWriter *w;
+        usec_t u;
+
+        assert(s);
+
+        if (!f)
+                return;
+
+        w = hashmap_get(s->writers, f);
+        if (!w) {
+                journal_file_maybe_append_tag(f, n);
+                return;
+        }
+
+        /* Don't wake up the writer for nothing */
+        if (journal_file_next_evolve_usec(f, &u) && n >= u)
+                journal_writer_append_tag(w);
+}
+#endif
+
 void server_maybe_append_tags(Server *s) {
 #ifdef HAVE_GCRYPT
         JournalFile *f;
@@ -1578,18 +1994,110 @@ void server_maybe_append_tags(Server *s) {
 
         n = now(CLOCK_REALTIME);
 
-        if (s->system_journal)
-                journal_file_maybe_append_tag(s->system_journal, n);
+        maybe_append_tag(s, s->system_journal, n);
 
         HASHMAP_FOREACH(f, s->user_journals, i)
-                journal_file_maybe_append_tag(f, n);
+                maybe_append_tag(s, f, n);
 #endif
 }
 
+void server_maybe_warn_allocation_stalls(Server *s) {
+        char ts[FORMAT_TIMESPAN_MAX];
+        usec_t n;
+
+        assert(s);
+
+        server_collect_allocation_stalls(s);
+
+        n = now(CLOCK_MONOTONIC);
+        if (s->last_warn_allocation_stalls + s->warn_allocation_stalls_interval > n)
+                return;
+
+        if (s->n_allocation_stalls <= 0) {
+                /* No stalls for a whole interval, so report the
+                 * next one soon again */
+                s->warn_allocation_stalls_interval = 0;
+                return;
+        }
+
+        server_driver_message(s, SD_ID128_NULL, "Writing to the journal had to wait %u times for journal files to grow, %s in total.",
+                              s->n_allocation_stalls,
+                              format_timespan(ts, sizeof(ts), s->allocation_stall_usec, USEC_PER_MSEC));
+
+        s->n_allocation_stalls = 0;
+        s->allocation_stall_usec = 0;
+        s->last_warn_allocation_stalls = n;
+        s->warn_allocation_stalls_interval = CLAMP(s->warn_allocation_stalls_interval * 2,
+                                                   WARN_ALLOCATION_STALLS_MIN_USEC,
+                                                   WARN_ALLOCATION_STALLS_MAX_USEC);
+}
+
+void server_maybe_update_status(Server *s) {
+        uint64_t hits, misses;
+        usec_t n;
+
+        assert(s);
+
+        n = now(CLOCK_MONOTONIC);
+        if (s->last_status_update + STATUS_UPDATE_USEC > n)
+                return;
+
+        client_cache_get_stats(s->client_cache, &hits, &misses);
+        if (hits == s->last_status_hits && misses == s->last_status_misses)
+                return;
+
+        sd_notifyf(false,
+                   "STATUS=Processing requests... (process cache: %"PRIu64" hits, %"PRIu64" misses)",
+                   hits, misses);
+
+        s->last_status_hits = hits;
+        s->last_status_misses = misses;
+        s->last_status_update = n;
+}
+
+void server_dump_stats(Server *s) {
+        _cleanup_free_ char *temp_path = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        uint64_t hits, misses;
+        int r;
+
+        assert(s);
+
+        r = fopen_temporary("/run/systemd/journal/stats", &f, &temp_path);
+        if (r < 0) {
+                log_error("Failed to write statistics: %s", strerror(-r));
+                return;
+        }
+
+        fchmod(fileno(f), 0644);
+
+        client_cache_get_stats(s->client_cache, &hits, &misses);
+
+        fprintf(f,
+                "# This is private data. Do not parse.\n"
+                "CLIENT_CACHE_HITS=%"PRIu64"\n"
+                "CLIENT_CACHE_MISSES=%"PRIu64"\n",
+                hits, misses);
+
+        if (s->rate_limit)
+                journal_rate_limit_dump(s->rate_limit, f);
+
+        fflush(f);
+
+        if (ferror(f) || rename(temp_path, "/run/systemd/journal/stats") < 0) {
+                log_error("Failed to write statistics: %m");
+                unlink(temp_path);
+        }
+}
+
 void server_done(Server *s) {
         JournalFile *f;
         assert(s);
 
+        server_flush_pending(s);
+        server_stop_writers(s);
+        hashmap_free(s->writers);
+
         while (s->stdout_streams)
                 stdout_stream_free(s->stdout_streams);
 
@@ -1599,6 +2107,9 @@ void server_done(Server *s) {
         if (s->runtime_journal)
                 journal_file_close(s->runtime_journal);
 
+        vacuum_ledger_free(s->system_ledger);
+        vacuum_ledger_free(s->runtime_ledger);
+
         while ((f = hashmap_steal_first(s->user_journals)))
                 journal_file_close(f);
 
@@ -1628,10 +2139,17 @@ void server_done(Server *s) {
         if (s->rate_limit)
                 journal_rate_limit_free(s->rate_limit);
 
+        client_cache_free(s->client_cache);
+
         if (s->kernel_seqnum)
                 munmap(s->kernel_seqnum, sizeof(uint64_t));
 
+        free(s->pending);
         free(s->buffer);
+        free(s->recv_msgs);
+        free(s->recv_iovecs);
+        free(s->recv_controls);
+        free(s->recv_buffers);
         free(s->tty_path);
 
         if (s->mmap)
@@ -28,10 +28,13 @@
 #include <sys/socket.h>
 
 #include "journal-file.h"
+#include "journal-vacuum.h"
 #include "hashmap.h"
 #include "util.h"
 #include "audit.h"
 #include "journald-rate-limit.h"
+#include "journald-client-cache.h"
+#include "journald-writer.h"
 #include "list.h"
 
 typedef enum Storage {
@@ -53,6 +56,8 @@ typedef enum SplitMode {
 
 typedef struct StdoutStream StdoutStream;
 
+typedef union DatagramControl DatagramControl;
+
 typedef struct Server {
         int epoll_fd;
         int signal_fd;
@@ -70,7 +75,22 @@ typedef struct Server {
         char *buffer;
         size_t buffer_size;
 
+        /* Datagrams received together by recvmmsg() */
+        struct mmsghdr *recv_msgs;
+        struct iovec *recv_iovecs;
+        DatagramControl *recv_controls;
+        char *recv_buffers;
+
+        /* When a batch last had to truncate a datagram */
+        usec_t recv_truncated_usec;
+
+        /* What the current epoll_wait() returned and is yet to be
+         * processed, see stdout_stream_free() */
+        struct epoll_event *events;
+        unsigned n_events;
+
         JournalRateLimit *rate_limit;
+        ClientCache *client_cache;
         usec_t sync_interval_usec;
         usec_t rate_limit_interval;
         unsigned rate_limit_burst;
@@ -78,6 +98,16 @@ typedef struct Server {
         JournalMetrics runtime_metrics;
         JournalMetrics system_metrics;
 
+        /* If enabled, the runtime journal is kept in a fixed number
+         * of fully allocated files of equal size, the oldest of which
+         * is dropped before a new one is started */
+        bool runtime_ring_buffer;
+
+        /* What is in /var/log/journal/<machine> and
+         * /run/log/journal/<machine>, for vacuuming */
+        VacuumLedger *system_ledger;
+        VacuumLedger *runtime_ledger;
+
         bool compress;
         bool seal;
 
@@ -88,6 +118,15 @@ typedef struct Server {
         unsigned n_forward_syslog_missed;
         usec_t last_warn_forward_syslog_missed;
 
+        unsigned n_allocation_stalls;
+        usec_t allocation_stall_usec;
+        usec_t last_warn_allocation_stalls;
+        usec_t warn_allocation_stalls_interval;
+
+        uint64_t last_status_hits;
+        uint64_t last_status_misses;
+        usec_t last_status_update;
+
         uint64_t cached_available_space;
         usec_t cached_available_space_timestamp;
 
@@ -120,6 +159,17 @@ typedef struct Server {
 
         int sync_timer_fd;
         bool sync_scheduled;
+
+        /* Entries queued while draining a socket, written out
+         * together by server_flush_pending() */
+        bool batch_writes;
+        PendingEntry *pending;
+        size_t n_pending, n_pending_allocated;
+
+        /* If enabled, one JournalWriter per file that is written
+         * to, keyed by JournalFile */
+        bool writer_threads;
+        Hashmap *writers;
 } Server;
 
 #define N_IOVEC_META_FIELDS 20
@@ -127,7 +177,7 @@ typedef struct Server {
 #define N_IOVEC_UDEV_FIELDS 32
 #define N_IOVEC_OBJECT_FIELDS 11
 
-void server_dispatch_message(Server *s, struct iovec *iovec, unsigned n, unsigned m, struct ucred *ucred, struct timeval *tv, const char *label, size_t label_len, const char *unit_id, int priority, pid_t object_pid);
+void server_dispatch_message(Server *s, struct iovec *iovec, unsigned n, unsigned m, struct ucred *ucred, ClientInfo *info, struct timeval *tv, const char *label, size_t label_len, const char *unit_id, int priority, pid_t object_pid);
 void server_driver_message(Server *s, sd_id128_t message_id, const char *format, ...) _printf_(3,4);
 
 /* gperf lookup function */
@@ -147,10 +197,14 @@ void server_fix_perms(Server *s, JournalFile *f, uid_t uid);
 bool shall_try_append_again(JournalFile *f, int r);
 int server_init(Server *s);
 void server_done(Server *s);
-void server_sync(Server *s);
+void server_sync(Server *s, bool wait);
+void server_flush_pending(Server *s);
 void server_vacuum(Server *s);
 void server_rotate(Server *s);
 int server_schedule_sync(Server *s, int priority);
 int server_flush_to_var(Server *s);
 int process_event(Server *s, struct epoll_event *ev);
 void server_maybe_append_tags(Server *s);
+void server_maybe_warn_allocation_stalls(Server *s);
+void server_maybe_update_status(Server *s);
+void server_dump_stats(Server *s);
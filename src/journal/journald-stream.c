@@ -38,6 +38,10 @@
 
 #define STDOUT_STREAMS_MAX 4096
 
+/* How often to check whether the peer of a stream executed something
+ * else or was moved to a different cgroup */
+#define STDOUT_STREAM_REFRESH_USEC (1*USEC_PER_SEC)
+
 typedef enum StdoutStreamState {
         STDOUT_STREAM_IDENTIFIER,
         STDOUT_STREAM_UNIT_ID,
@@ -60,6 +64,11 @@ struct StdoutStream {
         security_context_t security_context;
 #endif
 
+        /* What we know about the peer, looked up once and then
+         * refreshed only now and then, since streams are usually
+         * connected for as long as the service runs */
+        ClientInfo *client;
+
         char *identifier;
         char *unit_id;
         int priority;
@@ -128,7 +137,10 @@ static int stdout_stream_log(StdoutStream *s, const char *p) {
         }
 #endif
 
-        server_dispatch_message(s->server, iovec, n, ELEMENTSOF(iovec), &s->ucred, NULL, label, label_len, s->unit_id, priority, 0);
+        if (s->client && s->client->refresh_timestamp + STDOUT_STREAM_REFRESH_USEC < now(CLOCK_MONOTONIC))
+                client_info_refresh(s->client);
+
+        server_dispatch_message(s->server, iovec, n, ELEMENTSOF(iovec), &s->ucred, s->client, NULL, label, label_len, s->unit_id, priority, 0);
 
         free(message);
         free(syslog_priority);
@@ -328,9 +340,18 @@ void stdout_stream_free(StdoutStream *s) {
         }
 
         if (s->fd >= 0) {
-                if (s->server)
+                if (s->server) {
+                        unsigned i;
+
                         epoll_ctl(s->server->epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
 
+                        /* Make sure an event for us that is still
+                         * to be processed is skipped */
+                        for (i = 0; i < s->server->n_events; i++)
+                                if (s->server->events[i].data.ptr == s)
+                                        s->server->events[i].events = 0;
+                }
+
                 close_nointr_nofail(s->fd);
         }
 
@@ -339,6 +360,8 @@ void stdout_stream_free(StdoutStream *s) {
                 freecon(s->security_context);
 #endif
 
+        client_info_unref(s->client);
+
         free(s->identifier);
         free(s);
 }
@@ -381,6 +404,12 @@ int stdout_stream_new(Server *s) {
                 goto fail;
         }
 
+        if (stream->ucred.pid > 0 &&
+            client_cache_get(s->client_cache, stream->ucred.pid, &stream->client) >= 0)
+                client_info_ref(stream->client);
+        else
+                stream->client = NULL;
+
 #ifdef HAVE_SELINUX
         if (use_selinux()) {
                 if (getpeercon(fd, &stream->security_context) < 0 && errno != ENOPROTOOPT)
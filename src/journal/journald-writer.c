@@ -0,0 +1,369 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+
+#include "journald-writer.h"
+#include "journal-authenticate.h"
+#include "journald-server.h"
+#include "log.h"
+
+/* How many entries may be waiting for a writer before whoever queues
+ * more has to wait */
+#define WRITER_QUEUE_MAX 4096U
+
+struct JournalWriter {
+        JournalFile *file;
+
+        /* Shared with all other writers and the main thread, and
+         * only ever updated atomically by
+         * journal_file_append_entries() */
+        uint64_t *seqnum;
+
+        usec_t max_file_usec;
+
+        pthread_t thread;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        /* Everything below is protected by mutex */
+
+        /* Filled by whoever queues entries... */
+        PendingEntry *queue;
+        size_t n_queue, n_queue_allocated;
+
+        /* ...and swapped with this one, which the thread works
+         * on. After the writer broke, what is left to write starts
+         * at work_index. */
+        PendingEntry *work;
+        size_t n_work, n_work_allocated, work_index;
+
+        unsigned n_allocation_stalls;
+        usec_t allocation_stall_usec;
+
+        bool busy:1;
+        bool broken:1;
+        bool stop:1;
+        bool append_tag:1;
+};
+
+static void free_entries(PendingEntry *entries, size_t n) {
+        size_t i;
+
+        for (i = 0; i < n; i++)
+                free((struct iovec*) entries[i].entry.iovec);
+}
+
+/* Runs in the writer thread, without the lock held. Returns how many
+ * entries have been dealt with, which is less than n only if the
+ * file needs to be rotated before the rest can be written. */
+static size_t writer_append(JournalWriter *w, PendingEntry *entries, size_t n) {
+        _cleanup_free_ JournalBatchEntry *batch = NULL;
+        size_t i, done = 0;
+
+        assert(w);
+        assert(entries);
+
+        if (journal_file_rotate_suggested(w->file, w->max_file_usec)) {
+                log_debug("%s: Journal header limits reached or header out-of-date, rotating.", w->file->path);
+                return 0;
+        }
+
+        batch = new(JournalBatchEntry, n);
+        if (!batch) {
+                /* Fall back to appending one by one */
+                for (i = 0; i < n; i++) {
+                        int r;
+
+                        r = journal_file_append_entries(w->file, &entries[i].entry, 1, w->seqnum, NULL);
+                        if (r < 0 && shall_try_append_again(w->file, r))
+                                return i;
+                }
+
+                return n;
+        }
+
+        for (i = 0; i < n; i++)
+                batch[i] = entries[i].entry;
+
+        while (done < n) {
+                unsigned k;
+                int r;
+
+                r = journal_file_append_entries(w->file, batch + done, n - done, w->seqnum, &k);
+                done += k;
+
+                if (r >= 0)
+                        break;
+
+                if (shall_try_append_again(w->file, r))
+                        break;
+
+                log_error("Failed to write entry (%u items), ignoring: %s",
+                          batch[done].n_iovec, strerror(-r));
+                done++;
+        }
+
+        return done;
+}
+
+static void *writer_thread(void *p) {
+        JournalWriter *w = p;
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+        for (;;) {
+                PendingEntry *t;
+                size_t n, done, a;
+                bool append_tag;
+
+                while (!w->stop && !w->append_tag && (w->broken || w->n_queue == 0))
+                        assert_se(pthread_cond_wait(&w->cond, &w->mutex) == 0);
+
+                if (w->stop && (w->broken || w->n_queue == 0))
+                        break;
+
+                append_tag = w->append_tag && !w->broken;
+                w->append_tag = false;
+
+                if (w->broken)
+                        /* Only woken up to add a tag, which makes no
+                         * sense for a file about to be rotated */
+                        continue;
+
+                /* Take everything queued so far */
+                t = w->work;
+                w->work = w->queue;
+                w->queue = t;
+
+                a = w->n_work_allocated;
+                w->n_work_allocated = w->n_queue_allocated;
+                w->n_queue_allocated = a;
+
+                n = w->n_work = w->n_queue;
+                w->n_queue = 0;
+                w->work_index = 0;
+
+                w->busy = true;
+
+                /* There is room in the queue again */
+                assert_se(pthread_cond_broadcast(&w->cond) == 0);
+                assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+                done = n > 0 ? writer_append(w, w->work, n) : 0;
+                free_entries(w->work, done);
+
+                if (append_tag) {
+#ifdef HAVE_GCRYPT
+                        journal_file_maybe_append_tag(w->file, now(CLOCK_REALTIME));
+#endif
+                }
+
+                assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+                w->busy = false;
+
+                w->n_allocation_stalls += w->file->n_allocation_stalls;
+                w->allocation_stall_usec += w->file->allocation_stall_usec;
+                w->file->n_allocation_stalls = 0;
+                w->file->allocation_stall_usec = 0;
+
+                if (done < n) {
+                        w->broken = true;
+                        w->work_index = done;
+                } else
+                        w->n_work = 0;
+
+                assert_se(pthread_cond_broadcast(&w->cond) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        return NULL;
+}
+
+int journal_writer_new(JournalFile *f, uint64_t *seqnum, usec_t max_file_usec, JournalWriter **ret) {
+        JournalWriter *w;
+        sigset_t ss, saved_ss;
+        int r;
+
+        assert(f);
+        assert(seqnum);
+        assert(ret);
+
+        w = new0(JournalWriter, 1);
+        if (!w)
+                return -ENOMEM;
+
+        w->file = f;
+        w->seqnum = seqnum;
+        w->max_file_usec = max_file_usec;
+
+        assert_se(pthread_mutex_init(&w->mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&w->cond, NULL) == 0);
+
+        /* Signals are for the main thread only */
+        assert_se(sigfillset(&ss) >= 0);
+        r = pthread_sigmask(SIG_BLOCK, &ss, &saved_ss);
+        if (r)
+                goto fail;
+
+        r = pthread_create(&w->thread, NULL, writer_thread, w);
+
+        assert_se(pthread_sigmask(SIG_SETMASK, &saved_ss, NULL) == 0);
+
+        if (r)
+                goto fail;
+
+        *ret = w;
+        return 0;
+
+fail:
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->mutex);
+        free(w);
+        return -r;
+}
+
+void journal_writer_free(JournalWriter *w, PendingEntry **leftovers, size_t *n_leftovers) {
+        size_t n;
+
+        assert(w);
+        assert(leftovers);
+        assert(n_leftovers);
+
+        /* Writes out everything queued, unless the writer broke, in
+         * which case what is left is returned in order. */
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        w->stop = true;
+        assert_se(pthread_cond_broadcast(&w->cond) == 0);
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        assert_se(pthread_join(w->thread, NULL) == 0);
+
+        *leftovers = NULL;
+        *n_leftovers = 0;
+
+        n = w->n_work - w->work_index;
+        if (n + w->n_queue > 0) {
+                PendingEntry *l;
+
+                l = new(PendingEntry, n + w->n_queue);
+                if (l) {
+                        memcpy(l, w->work + w->work_index, n * sizeof(PendingEntry));
+                        memcpy(l + n, w->queue, w->n_queue * sizeof(PendingEntry));
+
+                        *leftovers = l;
+                        *n_leftovers = n + w->n_queue;
+                } else {
+                        log_error("Out of memory, dropping %zu entries.", n + w->n_queue);
+                        free_entries(w->work + w->work_index, n);
+                        free_entries(w->queue, w->n_queue);
+                }
+        }
+
+        free(w->work);
+        free(w->queue);
+
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->mutex);
+        free(w);
+}
+
+int journal_writer_enqueue(JournalWriter *w, PendingEntry *entries, size_t n) {
+        int r = 0;
+
+        assert(w);
+        assert(entries || n == 0);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+        /* A broken writer doesn't make progress, so don't wait for
+         * it; the queue is bounded by whoever notices it's broken
+         * next. */
+        while (!w->broken && w->n_queue >= WRITER_QUEUE_MAX)
+                assert_se(pthread_cond_wait(&w->cond, &w->mutex) == 0);
+
+        if (!GREEDY_REALLOC(w->queue, w->n_queue_allocated, w->n_queue + n)) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        memcpy(w->queue + w->n_queue, entries, n * sizeof(PendingEntry));
+        w->n_queue += n;
+
+        assert_se(pthread_cond_broadcast(&w->cond) == 0);
+
+finish:
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+        return r;
+}
+
+void journal_writer_wait(JournalWriter *w) {
+        assert(w);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+        while (w->busy || w->append_tag || (!w->broken && w->n_queue > 0))
+                assert_se(pthread_cond_wait(&w->cond, &w->mutex) == 0);
+
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+}
+
+bool journal_writer_broken(JournalWriter *w) {
+        bool b;
+
+        assert(w);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        b = w->broken;
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+
+        return b;
+}
+
+void journal_writer_append_tag(JournalWriter *w) {
+        assert(w);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+        w->append_tag = true;
+        assert_se(pthread_cond_broadcast(&w->cond) == 0);
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+}
+
+void journal_writer_collect_allocation_stalls(JournalWriter *w, unsigned *n, usec_t *usec) {
+        assert(w);
+        assert(n);
+        assert(usec);
+
+        assert_se(pthread_mutex_lock(&w->mutex) == 0);
+
+        *n += w->n_allocation_stalls;
+        *usec += w->allocation_stall_usec;
+        w->n_allocation_stalls = 0;
+        w->allocation_stall_usec = 0;
+
+        assert_se(pthread_mutex_unlock(&w->mutex) == 0);
+}
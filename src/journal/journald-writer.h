@@ -0,0 +1,53 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/types.h>
+
+#include "journal-file.h"
+#include "util.h"
+
+typedef struct PendingEntry {
+        uid_t uid;
+        int priority;
+        JournalBatchEntry entry;
+} PendingEntry;
+
+typedef struct JournalWriter JournalWriter;
+
+/* A thread appending to one journal file, fed through a bounded
+ * queue. Entries are appended in the order they are queued, and the
+ * file must not be touched by anybody else while the writer is
+ * busy. If appending fails in a way that requires rotating the file,
+ * the writer stops and hands back what it could not write when it
+ * is freed. Sequence numbers are taken from the counter passed in,
+ * which all writers and the main thread share. */
+
+int journal_writer_new(JournalFile *f, uint64_t *seqnum, usec_t max_file_usec, JournalWriter **ret);
+void journal_writer_free(JournalWriter *w, PendingEntry **leftovers, size_t *n_leftovers);
+
+int journal_writer_enqueue(JournalWriter *w, PendingEntry *entries, size_t n);
+void journal_writer_wait(JournalWriter *w);
+bool journal_writer_broken(JournalWriter *w);
+
+void journal_writer_append_tag(JournalWriter *w);
+void journal_writer_collect_allocation_stalls(JournalWriter *w, unsigned *n, usec_t *usec);
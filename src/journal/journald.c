@@ -33,6 +33,9 @@
 #include "journald-kmsg.h"
 #include "journald-syslog.h"
 
+/* How many events to handle per epoll_wait() */
+#define EPOLL_EVENTS_MAX 16
+
 int main(int argc, char *argv[]) {
         Server server;
         int r;
@@ -70,8 +73,9 @@ int main(int argc, char *argv[]) {
                   "STATUS=Processing requests...");
 
         for (;;) {
-                struct epoll_event event;
-                int t = -1;
+                struct epoll_event events[EPOLL_EVENTS_MAX];
+                unsigned k;
+                int t = -1, q = 1;
                 usec_t n;
 
                 n = now(CLOCK_REALTIME);
@@ -103,7 +107,7 @@ int main(int argc, char *argv[]) {
                 }
 #endif
 
-                r = epoll_wait(server.epoll_fd, &event, 1, t);
+                r = epoll_wait(server.epoll_fd, events, ELEMENTSOF(events), t);
                 if (r < 0) {
 
                         if (errno == EINTR)
@@ -114,16 +118,34 @@ int main(int argc, char *argv[]) {
                         goto finish;
                 }
 
-                if (r > 0) {
-                        r = process_event(&server, &event);
+                server.events = events;
+                server.n_events = r;
+
+                for (k = 0; k < (unsigned) r; k++) {
+                        /* The stdout stream this was for is gone */
+                        if (events[k].events == 0)
+                                continue;
+
+                        q = process_event(&server, &events[k]);
+                        if (q <= 0)
+                                break;
+                }
+
+                server.events = NULL;
+                server.n_events = 0;
+
+                if (k < (unsigned) r) {
+                        r = q;
                         if (r < 0)
                                 goto finish;
-                        else if (r == 0)
+                        else
                                 break;
                 }
 
                 server_maybe_append_tags(&server);
                 server_maybe_warn_forward_syslog_missed(&server);
+                server_maybe_warn_allocation_stalls(&server);
+                server_maybe_update_status(&server);
         }
 
         log_debug("systemd-journald stopped as pid %lu", (unsigned long) getpid());
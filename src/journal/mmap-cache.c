@@ -34,6 +34,7 @@
 typedef struct Window Window;
 typedef struct Context Context;
 typedef struct FileDescriptor FileDescriptor;
+typedef struct AccessPattern AccessPattern;
 
 struct Window {
         MMapCache *cache;
@@ -62,10 +63,23 @@ struct Context {
         LIST_FIELDS(Context, by_window);
 };
 
+/* The range of the last window mapped for a context of a file, and
+ * how many of the last mappings continued right after or right
+ * before the previous one, or went somewhere else entirely */
+struct AccessPattern {
+        uint64_t last_offset, last_end;
+        unsigned n_forward, n_backward, n_random;
+};
+
+/* Contexts with larger ids are not tracked */
+#define PATTERNS_MAX 16
+
 struct FileDescriptor {
         MMapCache *cache;
         int fd;
         LIST_HEAD(Window, windows);
+
+        AccessPattern patterns[PATTERNS_MAX];
 };
 
 struct MMapCache {
@@ -77,11 +91,22 @@ struct MMapCache {
 
         LIST_HEAD(Window, unused);
         Window *last_unused;
+
+        uint64_t n_hit, n_missed, n_mapped, n_unmapped;
 };
 
 #define WINDOWS_MIN 64
 #define WINDOW_SIZE (8ULL*1024ULL*1024ULL)
 
+/* Contexts that scan through a file get larger windows, contexts
+ * that jump around get smaller ones */
+#define WINDOW_SIZE_SEQUENTIAL (32ULL*1024ULL*1024ULL)
+#define WINDOW_SIZE_RANDOM (1ULL*1024ULL*1024ULL)
+
+/* How many mappings in a row need to follow a pattern before we
+ * size windows for it */
+#define PATTERN_MIN 2
+
 MMapCache* mmap_cache_new(void) {
         MMapCache *m;
 
@@ -106,8 +131,10 @@ static void window_unlink(Window *w) {
 
         assert(w);
 
-        if (w->ptr)
+        if (w->ptr) {
                 munmap(w->ptr, w->size);
+                w->cache->n_unmapped++;
+        }
 
         if (w->fd)
                 LIST_REMOVE(by_fd, w->fd->windows, w);
@@ -376,6 +403,7 @@ static int try_context(
         }
 
         c->window->keep_always = c->window->keep_always || keep_always;
+        m->n_hit++;
 
         *ret = (uint8_t*) c->window->ptr + (offset - c->window->offset);
         return 1;
@@ -420,11 +448,32 @@ static int find_mmap(
 
         context_attach_window(c, w);
         w->keep_always = w->keep_always || keep_always;
+        m->n_hit++;
 
         *ret = (uint8_t*) w->ptr + (offset - w->offset);
         return 1;
 }
 
+static void pattern_track(AccessPattern *a, uint64_t offset) {
+        assert(a);
+
+        if (a->last_end == 0)
+                return;
+
+        /* Continuing at most one default window past either end
+         * of the previous window counts as scanning */
+        if (offset >= a->last_offset && offset < a->last_end + WINDOW_SIZE) {
+                a->n_forward++;
+                a->n_backward = a->n_random = 0;
+        } else if (offset < a->last_offset && offset + WINDOW_SIZE >= a->last_offset) {
+                a->n_backward++;
+                a->n_forward = a->n_random = 0;
+        } else {
+                a->n_random++;
+                a->n_forward = a->n_backward = 0;
+        }
+}
+
 static int add_mmap(
                 MMapCache *m,
                 int fd,
@@ -439,8 +488,10 @@ static int add_mmap(
         uint64_t woffset, wsize;
         Context *c;
         FileDescriptor *f;
+        AccessPattern *a;
         Window *w;
         void *d;
+        bool forward = false, backward = false, random = false;
         int r;
 
         assert(m);
@@ -449,21 +500,56 @@ static int add_mmap(
         assert(size > 0);
         assert(ret);
 
+        m->n_missed++;
+
+        c = context_add(m, context);
+        if (!c)
+                return -ENOMEM;
+
+        f = fd_add(m, fd);
+        if (!f)
+                return -ENOMEM;
+
+        a = context < PATTERNS_MAX ? f->patterns + context : NULL;
+        if (a) {
+                pattern_track(a, offset);
+                forward = a->n_forward >= PATTERN_MIN;
+                backward = a->n_backward >= PATTERN_MIN;
+                random = a->n_random >= PATTERN_MIN;
+        }
+
         woffset = offset & ~((uint64_t) page_size() - 1ULL);
         wsize = size + (offset - woffset);
         wsize = PAGE_ALIGN(wsize);
 
-        if (wsize < WINDOW_SIZE) {
-                uint64_t delta;
+        if (forward) {
+                /* Scanning forward, map what comes next */
+                if (wsize < WINDOW_SIZE_SEQUENTIAL)
+                        wsize = WINDOW_SIZE_SEQUENTIAL;
+        } else if (backward) {
+                /* Scanning backward, map what came before */
+                if (wsize < WINDOW_SIZE_SEQUENTIAL) {
+                        uint64_t delta;
+
+                        delta = WINDOW_SIZE_SEQUENTIAL - wsize;
+                        woffset = delta > woffset ? 0 : woffset - delta;
+                        wsize = WINDOW_SIZE_SEQUENTIAL;
+                }
+        } else {
+                uint64_t window_size, delta;
+
+                window_size = random ? WINDOW_SIZE_RANDOM : WINDOW_SIZE;
 
-                delta = PAGE_ALIGN((WINDOW_SIZE - wsize) / 2);
+                if (wsize < window_size) {
+                        delta = PAGE_ALIGN((window_size - wsize) / 2);
 
-                if (delta > offset)
-                        woffset = 0;
-                else
-                        woffset -= delta;
+                        if (delta > offset)
+                                woffset = 0;
+                        else
+                                woffset -= delta;
 
-                wsize = WINDOW_SIZE;
+                        wsize = window_size;
+                }
         }
 
         if (st) {
@@ -492,13 +578,23 @@ static int add_mmap(
                         return -ENOMEM;
         }
 
-        c = context_add(m, context);
-        if (!c)
-                return -ENOMEM;
+        m->n_mapped++;
+
+        /* Tell the kernel what to expect. Writers (journald) touch
+         * the tail of the file only, leave their mappings alone. */
+        if (!(prot & PROT_WRITE)) {
+                if (forward)
+                        madvise(d, wsize, MADV_SEQUENTIAL);
+                if (forward || backward)
+                        madvise(d, wsize, MADV_WILLNEED);
+                else if (random)
+                        madvise(d, wsize, MADV_RANDOM);
+        }
 
-        f = fd_add(m, fd);
-        if (!f)
-                return -ENOMEM;
+        if (a) {
+                a->last_offset = woffset;
+                a->last_end = woffset + wsize;
+        }
 
         w = window_add(m);
         if (!w)
@@ -554,6 +650,30 @@ int mmap_cache_get(
         return add_mmap(m, fd, prot, context, keep_always, offset, size, st, ret);
 }
 
+uint64_t mmap_cache_get_hit(MMapCache *m) {
+        assert(m);
+
+        return m->n_hit;
+}
+
+uint64_t mmap_cache_get_missed(MMapCache *m) {
+        assert(m);
+
+        return m->n_missed;
+}
+
+uint64_t mmap_cache_get_mapped(MMapCache *m) {
+        assert(m);
+
+        return m->n_mapped;
+}
+
+uint64_t mmap_cache_get_unmapped(MMapCache *m) {
+        assert(m);
+
+        return m->n_unmapped;
+}
+
 void mmap_cache_close_fd(MMapCache *m, int fd) {
         FileDescriptor *f;
 
@@ -34,3 +34,8 @@ MMapCache* mmap_cache_unref(MMapCache *m);
 int mmap_cache_get(MMapCache *m, int fd, int prot, unsigned context, bool keep_always, uint64_t offset, size_t size, struct stat *st, void **ret);
 void mmap_cache_close_fd(MMapCache *m, int fd);
 void mmap_cache_close_context(MMapCache *m, unsigned context);
+
+uint64_t mmap_cache_get_hit(MMapCache *m);
+uint64_t mmap_cache_get_missed(MMapCache *m);
+uint64_t mmap_cache_get_mapped(MMapCache *m);
+uint64_t mmap_cache_get_unmapped(MMapCache *m);
@@ -44,6 +44,9 @@
 
 #define JOURNAL_FILES_MAX 1024
 
+#define FIELD_CACHE_BITS 12
+#define FIELD_CACHE_SIZE (1U << FIELD_CACHE_BITS)
+
 #define JOURNAL_FILES_RECHECK_USEC (2 * USEC_PER_SEC)
 
 #define REPLACE_VAR_MAX 256
@@ -74,12 +77,24 @@ static int set_put_error(sd_journal *j, int r) {
         return set_put(j->errors, INT_TO_PTR(r));
 }
 
+static void invalidate_candidates(sd_journal *j) {
+        assert(j);
+
+        prioq_free(j->candidates);
+        j->candidates = NULL;
+        j->candidates_consumed = false;
+
+        set_clear(j->candidates_exhausted);
+}
+
 static void detach_location(sd_journal *j) {
         Iterator i;
         JournalFile *f;
 
         assert(j);
 
+        invalidate_candidates(j);
+
         j->current_file = NULL;
         j->current_field = 0;
 
@@ -202,6 +217,7 @@ static void match_free(Match *m) {
                 LIST_REMOVE(matches, m->parent->matches, m);
 
         free(m->data);
+        free(m->tokens);
         free(m);
 }
 
@@ -212,29 +228,14 @@ static void match_free_if_empty(Match *m) {
         match_free(m);
 }
 
-_public_ int sd_journal_add_match(sd_journal *j, const void *data, size_t size) {
-        Match *l3, *l4, *add_here = NULL, *m;
-        le64_t le_hash;
-
-        if (!j)
-                return -EINVAL;
-        if (journal_pid_changed(j))
-                return -ECHILD;
-
-        if (!data)
-                return -EINVAL;
-
-        if (size == 0)
-                size = strlen(data);
-
-        if (!match_is_valid(data, size))
-                return -EINVAL;
+static int match_add_levels(sd_journal *j) {
+        assert(j);
 
         /* level 0: AND term
          * level 1: OR terms
          * level 2: AND terms
          * level 3: OR terms
-         * level 4: concrete matches */
+         * level 4: concrete matches, or a single text match */
 
         if (!j->level0) {
                 j->level0 = match_new(NULL, MATCH_AND_TERM);
@@ -258,13 +259,44 @@ _public_ int sd_journal_add_match(sd_journal *j, const void *data, size_t size)
         assert(j->level1->type == MATCH_OR_TERM);
         assert(j->level2->type == MATCH_AND_TERM);
 
+        return 0;
+}
+
+_public_ int sd_journal_add_match(sd_journal *j, const void *data, size_t size) {
+        Match *l3, *l4, *add_here = NULL, *m;
+        le64_t le_hash;
+        int r;
+
+        if (!j)
+                return -EINVAL;
+        if (journal_pid_changed(j))
+                return -ECHILD;
+
+        if (!data)
+                return -EINVAL;
+
+        if (size == 0)
+                size = strlen(data);
+
+        if (!match_is_valid(data, size))
+                return -EINVAL;
+
+        j->match_generation++;
+
+        r = match_add_levels(j);
+        if (r < 0)
+                return r;
+
         le_hash = htole64(hash64(data, size));
 
         LIST_FOREACH(matches, l3, j->level2->matches) {
                 assert(l3->type == MATCH_OR_TERM);
 
                 LIST_FOREACH(matches, l4, l3->matches) {
-                        assert(l4->type == MATCH_DISCRETE);
+                        assert(l4->type == MATCH_DISCRETE || l4->type == MATCH_TEXT);
+
+                        if (l4->type == MATCH_TEXT)
+                                break;
 
                         /* Exactly the same match already? Then ignore
                          * this addition */
@@ -313,6 +345,66 @@ fail:
         return -ENOMEM;
 }
 
+_public_ int sd_journal_add_match_text(sd_journal *j, const char *text) {
+        _cleanup_free_ uint64_t *tokens = NULL;
+        Match *add_here = NULL, *m;
+        unsigned n_tokens;
+        int r;
+
+        if (!j)
+                return -EINVAL;
+        if (journal_pid_changed(j))
+                return -ECHILD;
+
+        if (!text)
+                return -EINVAL;
+
+        r = journal_text_tokenize(text, strlen(text), &tokens, &n_tokens);
+        if (r < 0)
+                return r;
+        if (n_tokens == 0)
+                return -EINVAL;
+
+        j->match_generation++;
+
+        r = match_add_levels(j);
+        if (r < 0)
+                return r;
+
+        /* Text matches get an OR term of their own, they are never
+         * combined with others of the same field */
+        add_here = match_new(j->level2, MATCH_OR_TERM);
+        if (!add_here)
+                goto fail;
+
+        m = match_new(add_here, MATCH_TEXT);
+        if (!m)
+                goto fail;
+
+        m->data = strdup(text);
+        if (!m->data) {
+                match_free(m);
+                goto fail;
+        }
+
+        m->size = strlen(text);
+        m->tokens = tokens;
+        m->n_tokens = n_tokens;
+        tokens = NULL;
+
+        detach_location(j);
+
+        return 0;
+
+fail:
+        match_free_if_empty(add_here);
+        match_free_if_empty(j->level2);
+        match_free_if_empty(j->level1);
+        match_free_if_empty(j->level0);
+
+        return -ENOMEM;
+}
+
 _public_ int sd_journal_add_conjunction(sd_journal *j) {
         if (!j)
                 return -EINVAL;
@@ -367,6 +459,9 @@ static char *match_make_string(Match *m) {
         if (m->type == MATCH_DISCRETE)
                 return strndup(m->data, m->size);
 
+        if (m->type == MATCH_TEXT)
+                return strjoin("MESSAGE~\"", m->data, "\"", NULL);
+
         p = NULL;
         LIST_FOREACH(matches, i, m->matches) {
                 char *t, *k;
@@ -407,6 +502,45 @@ char *journal_make_match_string(sd_journal *j) {
         return match_make_string(j->level0);
 }
 
+int journal_copy_matches(sd_journal *j, sd_journal *source) {
+        Match *l1, *l2, *l3, *l4;
+        int r;
+
+        assert(j);
+        assert(source);
+
+        /* Adds the matches of source, which results in the same
+         * tree of terms, as long as j has none yet */
+
+        if (!source->level0)
+                return 0;
+
+        LIST_FOREACH(matches, l1, source->level0->matches) {
+                LIST_FOREACH(matches, l2, l1->matches) {
+                        LIST_FOREACH(matches, l3, l2->matches) {
+                                LIST_FOREACH(matches, l4, l3->matches) {
+                                        if (l4->type == MATCH_TEXT)
+                                                r = sd_journal_add_match_text(j, l4->data);
+                                        else
+                                                r = sd_journal_add_match(j, l4->data, l4->size);
+                                        if (r < 0)
+                                                return r;
+                                }
+                        }
+
+                        r = sd_journal_add_disjunction(j);
+                        if (r < 0)
+                                return r;
+                }
+
+                r = sd_journal_add_conjunction(j);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
 _public_ void sd_journal_flush_matches(sd_journal *j) {
         if (!j)
                 return;
@@ -415,6 +549,7 @@ _public_ void sd_journal_flush_matches(sd_journal *j) {
                 match_free(j->level0);
 
         j->level0 = j->level1 = j->level2 = NULL;
+        j->match_generation++;
 
         detach_location(j);
 }
@@ -563,6 +698,295 @@ _pure_ static int compare_with_location(JournalFile *af, Object *ao, Location *l
         return 0;
 }
 
+typedef struct MatchCacheEntry {
+        /* For concrete matches the offset of the data object, for
+         * terms and text matches non-zero, if there is a chance they
+         * match. Otherwise 0 as long as the file has n_objects
+         * objects, since data may be appended to it at any time. */
+        uint64_t offset;
+        uint64_t n_objects;
+
+        /* For text matches, the data objects that contain the words,
+         * followed by the entries referencing them, both in
+         * ascending order. Both cover the file up to the tail object
+         * and entry at the time they were looked for. */
+        uint64_t tail_object_offset;
+        uint64_t tail_entry_seqnum;
+        size_t n_data, n_entries;
+        uint64_t offsets[];
+} MatchCacheEntry;
+
+static int match_cache_entry_add(JournalFile *f, Match *m, MatchCacheEntry **e,
+                                 const uint64_t *data, size_t n_data,
+                                 const uint64_t *entries, size_t n_entries) {
+        MatchCacheEntry *n;
+        size_t n_old_data, n_old_entries;
+        int r;
+
+        assert(f);
+        assert(m);
+        assert(e);
+
+        if (*e && n_data == 0 && n_entries == 0)
+                return 0;
+
+        r = hashmap_ensure_allocated(&f->match_cache, trivial_hash_func, trivial_compare_func);
+        if (r < 0)
+                return r;
+
+        n_old_data = *e ? (*e)->n_data : 0;
+        n_old_entries = *e ? (*e)->n_entries : 0;
+
+        n = realloc(*e, offsetof(MatchCacheEntry, offsets) + (n_old_data + n_data + n_old_entries + n_entries) * sizeof(uint64_t));
+        if (!n)
+                return -ENOMEM;
+
+        if (!*e) {
+                zero(*n);
+
+                r = hashmap_put(f->match_cache, m, n);
+                if (r < 0) {
+                        free(n);
+                        return r;
+                }
+        } else
+                hashmap_replace(f->match_cache, m, n);
+
+        /* Everything added is beyond what we had already */
+        memmove(n->offsets + n_old_data + n_data, n->offsets + n_old_data, n_old_entries * sizeof(uint64_t));
+        memcpy(n->offsets + n_old_data, data, n_data * sizeof(uint64_t));
+        memcpy(n->offsets + n_old_data + n_data + n_old_entries, entries, n_entries * sizeof(uint64_t));
+
+        n->n_data += n_data;
+        n->n_entries += n_entries;
+
+        *e = n;
+        return 0;
+}
+
+static int uint64_compare(const void *_a, const void *_b) {
+        uint64_t a = *(const uint64_t*) _a, b = *(const uint64_t*) _b;
+
+        return a < b ? -1 : a > b ? 1 : 0;
+}
+
+static int text_match_resolve(sd_journal *j, Match *m, JournalFile *f, MatchCacheEntry **e) {
+        _cleanup_free_ uint64_t *data = NULL, *entries = NULL;
+        size_t n_data = 0, n_entries = 0, n_allocated = 0, i;
+        uint64_t tail_object_offset, tail_entry_seqnum;
+        int r;
+
+        assert(j);
+        assert(m);
+        assert(f);
+        assert(e);
+
+        tail_object_offset = le64toh(f->header->tail_object_offset);
+        tail_entry_seqnum = le64toh(f->header->tail_entry_seqnum);
+
+        /* Only messages added since we looked last need to be looked
+         * at... */
+        r = journal_file_find_text(f, m->tokens, m->n_tokens, *e ? (*e)->tail_object_offset : 0, &data, &n_data);
+        if (r < 0)
+                return r;
+
+        if (!*e) {
+                /* ...and the first time around all entries of the
+                 * messages found */
+                for (i = 0; i < n_data; i++) {
+                        r = journal_file_append_data_entries(f, data[i], &entries, &n_entries, &n_allocated);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (n_entries > 0) {
+                        size_t k;
+
+                        /* An entry may carry more than one of them */
+                        qsort(entries, n_entries, sizeof(uint64_t), uint64_compare);
+
+                        for (i = 1, k = 1; i < n_entries; i++)
+                                if (entries[i] != entries[k-1])
+                                        entries[k++] = entries[i];
+                        n_entries = k;
+                }
+
+        } else if ((*e)->n_data + n_data > 0 &&
+                   (*e)->tail_entry_seqnum < tail_entry_seqnum) {
+                Object *o;
+                uint64_t p;
+
+                /* ...and later only the entries appended since,
+                 * which might reference old messages as well as new
+                 * ones */
+                r = match_cache_entry_add(f, m, e, data, n_data, NULL, 0);
+                if (r < 0)
+                        return r;
+
+                n_data = 0;
+
+                r = journal_file_move_to_entry_by_seqnum(f, (*e)->tail_entry_seqnum + 1, DIRECTION_DOWN, &o, &p);
+                while (r > 0) {
+                        uint64_t k, n_items;
+
+                        n_items = journal_file_entry_n_items(o);
+                        for (k = 0; k < n_items; k++) {
+                                uint64_t q = le64toh(o->entry.items[k].object_offset);
+
+                                if (bsearch(&q, (*e)->offsets, (*e)->n_data, sizeof(uint64_t), uint64_compare) &&
+                                    ((*e)->n_entries == 0 || p > (*e)->offsets[(*e)->n_data + (*e)->n_entries - 1])) {
+                                        if (!GREEDY_REALLOC(entries, n_allocated, n_entries + 1))
+                                                return -ENOMEM;
+
+                                        entries[n_entries++] = p;
+                                        break;
+                                }
+                        }
+
+                        r = journal_file_next_entry(f, o, p, DIRECTION_DOWN, &o, &p);
+                }
+                if (r < 0)
+                        return r;
+        }
+
+        r = match_cache_entry_add(f, m, e, data, n_data, entries, n_entries);
+        if (r < 0)
+                return r;
+
+        (*e)->offset = (*e)->n_entries > 0;
+        (*e)->tail_object_offset = tail_object_offset;
+        (*e)->tail_entry_seqnum = tail_entry_seqnum;
+
+        return 0;
+}
+
+static int match_resolve(sd_journal *j, Match *m, JournalFile *f, MatchCacheEntry **ret) {
+        uint64_t n_objects, offset = 0;
+        MatchCacheEntry *e;
+        Match *i;
+        int r;
+
+        assert(j);
+        assert(m);
+        assert(f);
+
+        /* Looking up data objects means hashing and walking a hash
+         * chain, hence remember what each match resolves to in each
+         * file. Terms that cannot match in a file because a match
+         * they depend on isn't in there are remembered too, so that
+         * whole subtrees are skipped right away. */
+
+        if (f->match_generation != j->match_generation) {
+                hashmap_clear_free(f->match_cache);
+                f->match_generation = j->match_generation;
+        }
+
+        n_objects = le64toh(f->header->n_objects);
+
+        e = hashmap_get(f->match_cache, m);
+        if (e && (e->n_objects == n_objects || (e->offset > 0 && m->type != MATCH_TEXT)))
+                goto finish;
+
+        if (m->type == MATCH_TEXT) {
+                r = text_match_resolve(j, m, f, &e);
+                if (r < 0)
+                        return r;
+
+                e->n_objects = n_objects;
+                goto finish;
+
+        } else if (m->type == MATCH_DISCRETE) {
+                r = journal_file_find_data_object_with_hash(f, m->data, m->size, le64toh(m->le_hash), NULL, &offset);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        offset = 0;
+
+        } else if (m->type == MATCH_OR_TERM) {
+                LIST_FOREACH(matches, i, m->matches) {
+                        r = match_resolve(j, i, f, NULL);
+                        if (r < 0)
+                                return r;
+                        if (r > 0) {
+                                offset = 1;
+                                break;
+                        }
+                }
+
+        } else {
+                assert(m->type == MATCH_AND_TERM);
+
+                offset = m->matches ? 1 : 0;
+
+                LIST_FOREACH(matches, i, m->matches) {
+                        r = match_resolve(j, i, f, NULL);
+                        if (r < 0)
+                                return r;
+                        if (r == 0) {
+                                offset = 0;
+                                break;
+                        }
+                }
+        }
+
+        r = match_cache_entry_add(f, m, &e, NULL, 0, NULL, 0);
+        if (r < 0)
+                return r;
+
+        e->offset = offset;
+        e->n_objects = n_objects;
+
+finish:
+        if (ret)
+                *ret = e;
+
+        return e->offset > 0;
+}
+
+static int next_for_text_match(
+                MatchCacheEntry *e,
+                uint64_t after_offset,
+                direction_t direction,
+                uint64_t *offset) {
+
+        const uint64_t *entries;
+        size_t a, b;
+
+        assert(e);
+        assert(offset);
+
+        /* The first matching entry at or beyond after_offset */
+
+        entries = e->offsets + e->n_data;
+        a = 0;
+        b = e->n_entries;
+
+        while (a < b) {
+                size_t c = (a + b) / 2;
+
+                if (entries[c] < after_offset)
+                        a = c + 1;
+                else
+                        b = c;
+        }
+
+        if (direction == DIRECTION_DOWN) {
+                if (a >= e->n_entries)
+                        return 0;
+
+                *offset = entries[a];
+        } else {
+                if (a < e->n_entries && entries[a] == after_offset)
+                        *offset = entries[a];
+                else if (a > 0)
+                        *offset = entries[a-1];
+                else
+                        return 0;
+        }
+
+        return 1;
+}
+
 static int next_for_match(
                 sd_journal *j,
                 Match *m,
@@ -572,23 +996,27 @@ static int next_for_match(
                 Object **ret,
                 uint64_t *offset) {
 
-        int r;
+        MatchCacheEntry *e;
         uint64_t np = 0;
         Object *n;
+        int r;
 
         assert(j);
         assert(m);
         assert(f);
 
+        r = match_resolve(j, m, f, &e);
+        if (r <= 0)
+                return r;
+
         if (m->type == MATCH_DISCRETE) {
-                uint64_t dp;
+                return journal_file_move_to_entry_by_offset_for_data(f, e->offset, after_offset, direction, ret, offset);
 
-                r = journal_file_find_data_object_with_hash(f, m->data, m->size, le64toh(m->le_hash), NULL, &dp);
+        } else if (m->type == MATCH_TEXT) {
+                r = next_for_text_match(e, after_offset, direction, &np);
                 if (r <= 0)
                         return r;
 
-                return journal_file_move_to_entry_by_offset_for_data(f, dp, after_offset, direction, ret, offset);
-
         } else if (m->type == MATCH_OR_TERM) {
                 Match *i;
 
@@ -655,6 +1083,67 @@ static int next_for_match(
         return 1;
 }
 
+static int find_location_without_matches(
+                sd_journal *j,
+                JournalFile *f,
+                direction_t direction,
+                Object **ret,
+                uint64_t *offset) {
+
+        int r;
+
+        assert(j);
+        assert(f);
+
+        if (j->current_location.type == LOCATION_HEAD)
+                return journal_file_next_entry(f, NULL, 0, DIRECTION_DOWN, ret, offset);
+        if (j->current_location.type == LOCATION_TAIL)
+                return journal_file_next_entry(f, NULL, 0, DIRECTION_UP, ret, offset);
+        if (j->current_location.seqnum_set && sd_id128_equal(j->current_location.seqnum_id, f->header->seqnum_id))
+                return journal_file_move_to_entry_by_seqnum(f, j->current_location.seqnum, direction, ret, offset);
+        if (j->current_location.monotonic_set) {
+                r = journal_file_move_to_entry_by_monotonic(f, j->current_location.boot_id, j->current_location.monotonic, direction, ret, offset);
+                if (r != -ENOENT)
+                        return r;
+        }
+        if (j->current_location.realtime_set)
+                return journal_file_move_to_entry_by_realtime(f, j->current_location.realtime, direction, ret, offset);
+
+        return journal_file_next_entry(f, NULL, 0, direction, ret, offset);
+}
+
+static int find_location_for_data(
+                sd_journal *j,
+                JournalFile *f,
+                uint64_t dp,
+                direction_t direction,
+                Object **ret,
+                uint64_t *offset) {
+
+        int r;
+
+        assert(j);
+        assert(f);
+
+        /* FIXME: missing: find by monotonic */
+
+        if (j->current_location.type == LOCATION_HEAD)
+                return journal_file_next_entry_for_data(f, NULL, 0, dp, DIRECTION_DOWN, ret, offset);
+        if (j->current_location.type == LOCATION_TAIL)
+                return journal_file_next_entry_for_data(f, NULL, 0, dp, DIRECTION_UP, ret, offset);
+        if (j->current_location.seqnum_set && sd_id128_equal(j->current_location.seqnum_id, f->header->seqnum_id))
+                return journal_file_move_to_entry_by_seqnum_for_data(f, dp, j->current_location.seqnum, direction, ret, offset);
+        if (j->current_location.monotonic_set) {
+                r = journal_file_move_to_entry_by_monotonic_for_data(f, dp, j->current_location.boot_id, j->current_location.monotonic, direction, ret, offset);
+                if (r != -ENOENT)
+                        return r;
+        }
+        if (j->current_location.realtime_set)
+                return journal_file_move_to_entry_by_realtime_for_data(f, dp, j->current_location.realtime, direction, ret, offset);
+
+        return journal_file_next_entry_for_data(f, NULL, 0, dp, direction, ret, offset);
+}
+
 static int find_location_for_match(
                 sd_journal *j,
                 Match *m,
@@ -663,36 +1152,45 @@ static int find_location_for_match(
                 Object **ret,
                 uint64_t *offset) {
 
+        MatchCacheEntry *e;
         int r;
 
         assert(j);
         assert(m);
         assert(f);
 
-        if (m->type == MATCH_DISCRETE) {
-                uint64_t dp;
+        r = match_resolve(j, m, f, &e);
+        if (r <= 0)
+                return r;
+
+        if (m->type == MATCH_DISCRETE)
+                return find_location_for_data(j, f, e->offset, direction, ret, offset);
+
+        if (m->type == MATCH_TEXT) {
+                uint64_t cp, np;
+                Object *n;
+
+                /* Find where we are without matches, and the
+                 * nearest matching entry from there */
 
-                r = journal_file_find_data_object_with_hash(f, m->data, m->size, le64toh(m->le_hash), NULL, &dp);
+                r = find_location_without_matches(j, f, direction, &n, &cp);
                 if (r <= 0)
                         return r;
 
-                /* FIXME: missing: find by monotonic */
-
-                if (j->current_location.type == LOCATION_HEAD)
-                        return journal_file_next_entry_for_data(f, NULL, 0, dp, DIRECTION_DOWN, ret, offset);
-                if (j->current_location.type == LOCATION_TAIL)
-                        return journal_file_next_entry_for_data(f, NULL, 0, dp, DIRECTION_UP, ret, offset);
-                if (j->current_location.seqnum_set && sd_id128_equal(j->current_location.seqnum_id, f->header->seqnum_id))
-                        return journal_file_move_to_entry_by_seqnum_for_data(f, dp, j->current_location.seqnum, direction, ret, offset);
-                if (j->current_location.monotonic_set) {
-                        r = journal_file_move_to_entry_by_monotonic_for_data(f, dp, j->current_location.boot_id, j->current_location.monotonic, direction, ret, offset);
-                        if (r != -ENOENT)
-                                return r;
-                }
-                if (j->current_location.realtime_set)
-                        return journal_file_move_to_entry_by_realtime_for_data(f, dp, j->current_location.realtime, direction, ret, offset);
+                r = next_for_text_match(e, cp, direction, &np);
+                if (r <= 0)
+                        return r;
 
-                return journal_file_next_entry_for_data(f, NULL, 0, dp, direction, ret, offset);
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, np, &n);
+                if (r < 0)
+                        return r;
+
+                if (ret)
+                        *ret = n;
+                if (offset)
+                        *offset = np;
+
+                return 1;
 
         } else if (m->type == MATCH_OR_TERM) {
                 uint64_t np = 0;
@@ -761,32 +1259,15 @@ static int find_location_with_matches(
                 Object **ret,
                 uint64_t *offset) {
 
-        int r;
-
         assert(j);
         assert(f);
         assert(ret);
         assert(offset);
 
-        if (!j->level0) {
+        if (!j->level0)
                 /* No matches is simple */
-
-                if (j->current_location.type == LOCATION_HEAD)
-                        return journal_file_next_entry(f, NULL, 0, DIRECTION_DOWN, ret, offset);
-                if (j->current_location.type == LOCATION_TAIL)
-                        return journal_file_next_entry(f, NULL, 0, DIRECTION_UP, ret, offset);
-                if (j->current_location.seqnum_set && sd_id128_equal(j->current_location.seqnum_id, f->header->seqnum_id))
-                        return journal_file_move_to_entry_by_seqnum(f, j->current_location.seqnum, direction, ret, offset);
-                if (j->current_location.monotonic_set) {
-                        r = journal_file_move_to_entry_by_monotonic(f, j->current_location.boot_id, j->current_location.monotonic, direction, ret, offset);
-                        if (r != -ENOENT)
-                                return r;
-                }
-                if (j->current_location.realtime_set)
-                        return journal_file_move_to_entry_by_realtime(f, j->current_location.realtime, direction, ret, offset);
-
-                return journal_file_next_entry(f, NULL, 0, direction, ret, offset);
-        } else
+                return find_location_without_matches(j, f, direction, ret, offset);
+        else
                 return find_location_for_match(j, j->level0, f, direction, ret, offset);
 }
 
@@ -818,17 +1299,14 @@ static int next_with_matches(
         return next_for_match(j, j->level0, f, direction == DIRECTION_DOWN ? cp+1 : cp-1, direction, ret, offset);
 }
 
-static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direction, Object **ret, uint64_t *offset) {
+static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direction, uint64_t cp, Object **ret, uint64_t *offset) {
         Object *c;
-        uint64_t cp;
         int r;
 
         assert(j);
         assert(f);
 
-        if (f->last_direction == direction && f->current_offset > 0) {
-                cp = f->current_offset;
-
+        if (cp > 0) {
                 r = journal_file_move_to_object(f, OBJECT_ENTRY, cp, &c);
                 if (r < 0)
                         return r;
@@ -876,11 +1354,110 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         }
 }
 
-static int real_journal_next(sd_journal *j, direction_t direction) {
-        JournalFile *f, *new_file = NULL;
-        uint64_t new_offset = 0;
+static int compare_candidates(JournalFile *af, JournalFile *bf) {
         Object *o;
+        int r;
+
+        r = journal_file_move_to_object(af, OBJECT_ENTRY, af->candidate_offset, &o);
+        if (r < 0)
+                return strcmp(af->path, bf->path);
+
+        return compare_entry_order(af, o, bf, bf->candidate_offset);
+}
+
+static int compare_candidates_down(const void *a, const void *b) {
+        return compare_candidates((JournalFile*) a, (JournalFile*) b);
+}
+
+static int compare_candidates_up(const void *a, const void *b) {
+        return compare_candidates((JournalFile*) b, (JournalFile*) a);
+}
+
+static int advance_candidate(sd_journal *j, JournalFile *f, direction_t direction) {
         uint64_t p;
+        int r;
+
+        assert(j);
+        assert(f);
+
+        /* Continue from the last entry we queued for this file, or
+         * find the spot from scratch */
+        r = next_beyond_location(j, f, direction, f->candidate_offset, NULL, &p);
+        if (r > 0) {
+                f->candidate_offset = p;
+                set_remove(j->candidates_exhausted, f);
+
+                if (f->candidate_idx != PRIOQ_IDX_NULL)
+                        return prioq_reshuffle(j->candidates, f, &f->candidate_idx);
+
+                return prioq_put(j->candidates, f, &f->candidate_idx);
+        }
+
+        if (r < 0)
+                log_debug("Can't iterate through %s, ignoring: %s", f->path, strerror(-r));
+
+        if (f->candidate_idx != PRIOQ_IDX_NULL) {
+                prioq_remove(j->candidates, f, &f->candidate_idx);
+                f->candidate_idx = PRIOQ_IDX_NULL;
+        }
+
+        /* Files that are still being written to might get new
+         * entries at the end, remember to look at them again when
+         * they do */
+        if (r == 0 &&
+            direction == DIRECTION_DOWN &&
+            f->header->state != STATE_ARCHIVED) {
+                f->candidate_n_entries = le64toh(f->header->n_entries);
+
+                r = set_ensure_allocated(&j->candidates_exhausted, trivial_hash_func, trivial_compare_func);
+                if (r < 0)
+                        return r;
+
+                r = set_put(j->candidates_exhausted, f);
+                if (r < 0 && r != -EEXIST)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int build_candidates(sd_journal *j, direction_t direction) {
+        JournalFile *f;
+        Iterator i;
+        bool resume;
+        int r;
+
+        assert(j);
+
+        /* When we keep going in the same direction, files may
+         * continue from the entry they returned last. After turning
+         * around that entry might be the one to return next, hence
+         * look for the spot from scratch. */
+        resume = j->candidates_direction == direction;
+
+        invalidate_candidates(j);
+
+        j->candidates = prioq_new(direction == DIRECTION_DOWN ? compare_candidates_down : compare_candidates_up);
+        if (!j->candidates)
+                return -ENOMEM;
+
+        j->candidates_direction = direction;
+
+        HASHMAP_FOREACH(f, j->files, i) {
+                f->candidate_offset = resume && f->last_direction == direction ? f->current_offset : 0;
+                f->candidate_idx = PRIOQ_IDX_NULL;
+
+                r = advance_candidate(j, f, direction);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int real_journal_next(sd_journal *j, direction_t direction) {
+        JournalFile *f;
+        Object *o;
         Iterator i;
         int r;
 
@@ -889,40 +1466,67 @@ static int real_journal_next(sd_journal *j, direction_t direction) {
         if (journal_pid_changed(j))
                 return -ECHILD;
 
-        HASHMAP_FOREACH(f, j->files, i) {
-                bool found;
+        /* All files are kept in a priority queue, ordered by the
+         * next entry each of them would return. The queue is built
+         * on the first step after the location was changed, and from
+         * then on only the file we returned the last entry from is
+         * moved forward. */
 
-                r = next_beyond_location(j, f, direction, &o, &p);
+        if (!j->candidates || j->candidates_direction != direction) {
+                r = build_candidates(j, direction);
                 if (r < 0) {
-                        log_debug("Can't iterate through %s, ignoring: %s", f->path, strerror(-r));
-                        continue;
-                } else if (r == 0)
-                        continue;
-
-                if (!new_file)
-                        found = true;
-                else {
-                        int k;
-
-                        k = compare_entry_order(f, o, new_file, new_offset);
+                        invalidate_candidates(j);
+                        return r;
+                }
+        } else {
+                if (j->candidates_consumed) {
+                        f = prioq_peek(j->candidates);
+                        assert(f);
 
-                        found = direction == DIRECTION_DOWN ? k < 0 : k > 0;
+                        r = advance_candidate(j, f, direction);
+                        if (r < 0)
+                                return r;
                 }
 
-                if (found) {
-                        new_file = f;
-                        new_offset = p;
+                SET_FOREACH(f, j->candidates_exhausted, i) {
+                        if (le64toh(f->header->n_entries) == f->candidate_n_entries)
+                                continue;
+
+                        r = advance_candidate(j, f, direction);
+                        if (r < 0)
+                                return r;
                 }
         }
 
-        if (!new_file)
-                return 0;
+        j->candidates_consumed = false;
 
-        r = journal_file_move_to_object(new_file, OBJECT_ENTRY, new_offset, &o);
-        if (r < 0)
-                return r;
+        for (;;) {
+                int k;
+
+                f = prioq_peek(j->candidates);
+                if (!f)
+                        return 0;
+
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->candidate_offset, &o);
+                if (r < 0)
+                        return r;
+
+                if (j->current_location.type != LOCATION_DISCRETE)
+                        break;
 
-        set_location(j, LOCATION_DISCRETE, new_file, o, direction, new_offset);
+                /* Entries that exist in more than one file are
+                 * returned only once, skip the other copies */
+                k = compare_with_location(f, o, &j->current_location);
+                if (direction == DIRECTION_DOWN ? k > 0 : k < 0)
+                        break;
+
+                r = advance_candidate(j, f, direction);
+                if (r < 0)
+                        return r;
+        }
+
+        set_location(j, LOCATION_DISCRETE, f, o, direction, f->candidate_offset);
+        j->candidates_consumed = true;
 
         return 1;
 }
@@ -1340,6 +1944,7 @@ static int add_any_file(sd_journal *j, const char *path) {
 
         check_network(j, f->fd);
 
+        invalidate_candidates(j);
         j->current_invalidate_counter ++;
 
         return 0;
@@ -1398,6 +2003,7 @@ static int remove_file(sd_journal *j, const char *prefix, const char *filename)
                 j->unique_offset = 0;
         }
 
+        invalidate_candidates(j);
         journal_file_close(f);
 
         j->current_invalidate_counter ++;
@@ -1541,7 +2147,7 @@ static int add_root_directory(sd_journal *j, const char *p) {
 
                 m->wd = inotify_add_watch(j->inotify_fd, m->path,
                                           IN_CREATE|IN_MOVED_TO|IN_MODIFY|IN_ATTRIB|IN_DELETE|
-                                          IN_ONLYDIR);
+                                          IN_MOVED_FROM|IN_ONLYDIR);
 
                 if (m->wd > 0 && hashmap_put(j->directories_by_wd, INT_TO_PTR(m->wd), m) < 0)
                         inotify_rm_watch(j->inotify_fd, m->wd);
@@ -1831,12 +2437,20 @@ _public_ void sd_journal_close(sd_journal *j) {
         if (j->inotify_fd >= 0)
                 close_nointr_nofail(j->inotify_fd);
 
-        if (j->mmap)
+        if (j->mmap) {
+                log_debug("mmap cache statistics: %"PRIu64" hit, %"PRIu64" miss, %"PRIu64" mapped, %"PRIu64" unmapped",
+                          mmap_cache_get_hit(j->mmap),
+                          mmap_cache_get_missed(j->mmap),
+                          mmap_cache_get_mapped(j->mmap),
+                          mmap_cache_get_unmapped(j->mmap));
                 mmap_cache_unref(j->mmap);
+        }
 
         free(j->path);
         free(j->unique_field);
+        set_free_free(j->unique_values);
         set_free(j->errors);
+        set_free(j->candidates_exhausted);
         free(j);
 }
 
@@ -1934,9 +2548,59 @@ static bool field_is_valid(const char *field) {
         return true;
 }
 
-_public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **data, size_t *size) {
+static FieldCacheItem *field_cache_slot(JournalFile *f, uint64_t p) {
+        assert(f);
+
+        /* Direct mapped, most recently seen data object wins */
+
+        if (!f->field_cache) {
+                f->field_cache = new0(FieldCacheItem, FIELD_CACHE_SIZE);
+                if (!f->field_cache)
+                        return NULL;
+        }
+
+        return f->field_cache + ((p * 0x9E3779B97F4A7C15ULL) >> (64 - FIELD_CACHE_BITS));
+}
+
+static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **data, size_t *size) {
+        size_t t;
+        uint64_t l;
+        int compression;
+
+        l = le64toh(o->object.size) - offsetof(Object, data.payload);
+        t = (size_t) l;
+
+        /* We can't read objects larger than 4G on a 32bit machine */
+        if ((uint64_t) t != l)
+                return -E2BIG;
+
+        compression = o->object.flags & OBJECT_COMPRESSION_MASK;
+        if (compression) {
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+                uint64_t rsize;
+
+                if (!uncompress_blob(compression,
+                                     o->data.payload, l,
+                                     &f->compress_buffer, &f->compress_buffer_size, &rsize,
+                                     j->data_threshold))
+                        return -EBADMSG;
+
+                *data = f->compress_buffer;
+                *size = (size_t) rsize;
+#else
+                return -EPROTONOSUPPORT;
+#endif
+        } else {
+                *data = o->data.payload;
+                *size = t;
+        }
+
+        return 0;
+}
+
+static int get_data(sd_journal *j, const char *field, bool last, const void **data, size_t *size) {
         JournalFile *f;
-        uint64_t i, n;
+        uint64_t i, n, field_hash, found = 0;
         size_t field_length;
         int r;
         Object *o;
@@ -1967,15 +2631,26 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
                 return r;
 
         field_length = strlen(field);
+        field_hash = hash64(field, field_length);
 
         n = journal_file_entry_n_items(o);
         for (i = 0; i < n; i++) {
+                FieldCacheItem *c;
                 uint64_t p, l;
                 le64_t le_hash;
-                size_t t;
+                int compression;
 
                 p = le64toh(o->entry.items[i].object_offset);
                 le_hash = o->entry.items[i].hash;
+
+                /* Entries of a file share most of their data
+                 * objects, hence remember which field each is of,
+                 * and don't even look at those of other fields
+                 * again. */
+                c = field_cache_slot(f, p);
+                if (c && c->data_offset == p && c->field_hash != field_hash)
+                        continue;
+
                 r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
                 if (r < 0)
                         return r;
@@ -1985,81 +2660,69 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
                 l = le64toh(o->object.size) - offsetof(Object, data.payload);
 
-                if (o->object.flags & OBJECT_COMPRESSED) {
+                compression = o->object.flags & OBJECT_COMPRESSION_MASK;
+                if (compression) {
 
-#ifdef HAVE_XZ
-                        if (uncompress_startswith(o->data.payload, l,
+#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+                        if (uncompress_startswith(compression,
+                                                  o->data.payload, l,
                                                   &f->compress_buffer, &f->compress_buffer_size,
                                                   field, field_length, '=')) {
 
-                                uint64_t rsize;
-
-                                if (!uncompress_blob(o->data.payload, l,
-                                                     &f->compress_buffer, &f->compress_buffer_size, &rsize,
-                                                     j->data_threshold))
-                                        return -EBADMSG;
-
-                                *data = f->compress_buffer;
-                                *size = (size_t) rsize;
-
-                                return 0;
+                                found = p;
+                                if (!last)
+                                        break;
                         }
 #else
                         return -EPROTONOSUPPORT;
 #endif
 
-                } else if (l >= field_length+1 &&
-                           memcmp(o->data.payload, field, field_length) == 0 &&
-                           o->data.payload[field_length] == '=') {
-
-                        t = (size_t) l;
-
-                        if ((uint64_t) t != l)
-                                return -E2BIG;
-
-                        *data = o->data.payload;
-                        *size = t;
-
-                        return 0;
-                }
-
-                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
-                if (r < 0)
-                        return r;
-        }
-
-        return -ENOENT;
-}
+                } else {
+                        const uint8_t *eq;
 
-static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **data, size_t *size) {
-        size_t t;
-        uint64_t l;
+                        eq = memchr(o->data.payload, '=', l);
+                        if (c && eq) {
+                                c->data_offset = p;
+                                c->field_hash = hash64(o->data.payload, eq - o->data.payload);
+                        }
 
-        l = le64toh(o->object.size) - offsetof(Object, data.payload);
-        t = (size_t) l;
+                        if (eq == o->data.payload + field_length &&
+                            memcmp(o->data.payload, field, field_length) == 0) {
 
-        /* We can't read objects larger than 4G on a 32bit machine */
-        if ((uint64_t) t != l)
-                return -E2BIG;
+                                found = p;
+                                if (!last)
+                                        break;
+                        }
+                }
 
-        if (o->object.flags & OBJECT_COMPRESSED) {
-#ifdef HAVE_XZ
-                uint64_t rsize;
+                r = journal_file_move_to_object(f, OBJECT_ENTRY, f->current_offset, &o);
+                if (r < 0)
+                        return r;
+        }
 
-                if (!uncompress_blob(o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, j->data_threshold))
-                        return -EBADMSG;
+        if (found == 0)
+                return -ENOENT;
 
-                *data = f->compress_buffer;
-                *size = (size_t) rsize;
-#else
-                return -EPROTONOSUPPORT;
-#endif
-        } else {
-                *data = o->data.payload;
-                *size = t;
+        /* When looking for the last value we went on and moved
+         * away from it */
+        if (last) {
+                r = journal_file_move_to_object(f, OBJECT_DATA, found, &o);
+                if (r < 0)
+                        return r;
         }
 
-        return 0;
+        return return_data(j, f, o, data, size);
+}
+
+_public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **data, size_t *size) {
+        return get_data(j, field, false, data, size);
+}
+
+/* Like sd_journal_get_data(), but if the field is set more than once
+ * in the current entry, returns the value listed last, the same one
+ * that enumerating all data and keeping the last match ends up with */
+int journal_get_data_last(sd_journal *j, const char *field, const void **data, size_t *size) {
+        return get_data(j, field, true, data, size);
 }
 
 _public_ int sd_journal_enumerate_data(sd_journal *j, const void **data, size_t *size) {
@@ -2454,6 +3117,18 @@ void journal_print_header(sd_journal *j) {
 
                 journal_file_print_header(f);
         }
+
+        if (newline)
+                putchar('\n');
+
+        printf("MMap cache hits: %"PRIu64"\n"
+               "MMap cache misses: %"PRIu64"\n"
+               "MMap cache maps: %"PRIu64"\n"
+               "MMap cache unmaps: %"PRIu64"\n",
+               mmap_cache_get_hit(j->mmap),
+               mmap_cache_get_missed(j->mmap),
+               mmap_cache_get_mapped(j->mmap),
+               mmap_cache_get_unmapped(j->mmap));
 }
 
 _public_ int sd_journal_get_usage(sd_journal *j, uint64_t *bytes) {
@@ -2481,6 +3156,59 @@ _public_ int sd_journal_get_usage(sd_journal *j, uint64_t *bytes) {
         return 0;
 }
 
+/* Values up to this size are remembered in memory when enumerating
+ * unique values, larger ones are looked up in the files instead. So
+ * are all values once the remembered ones take up the total size. */
+#define UNIQUE_VALUE_REMEMBER_MAX 4096U
+#define UNIQUE_VALUES_SIZE_MAX (4U*1024U*1024U)
+
+static unsigned unique_value_hash_func(const void *p) {
+        const UniqueValue *v = p;
+
+        return (unsigned) v->hash;
+}
+
+static int unique_value_compare_func(const void *a, const void *b) {
+        const UniqueValue *x = a, *y = b;
+
+        if (x->hash != y->hash)
+                return x->hash < y->hash ? -1 : 1;
+
+        if (x->size != y->size)
+                return x->size < y->size ? -1 : 1;
+
+        return memcmp(x->data, y->data, x->size);
+}
+
+static UniqueValue *unique_value_new(uint64_t hash, const void *data, size_t size) {
+        UniqueValue *v;
+
+        v = malloc(sizeof(UniqueValue) + size);
+        if (!v)
+                return NULL;
+
+        v->hash = hash;
+        v->data = memcpy(v + 1, data, size);
+        v->size = size;
+        v->n_entries = 0;
+        v->first_realtime = (usec_t) -1;
+        v->last_realtime = 0;
+
+        return v;
+}
+
+static void reset_unique(sd_journal *j) {
+        assert(j);
+
+        j->unique_file = NULL;
+        j->unique_offset = 0;
+        j->unique_summary_offset = 0;
+        j->unique_summary_item = 0;
+
+        set_clear_free(j->unique_values);
+        j->unique_values_size = 0;
+}
+
 _public_ int sd_journal_query_unique(sd_journal *j, const char *field) {
         char *f;
 
@@ -2499,12 +3227,31 @@ _public_ int sd_journal_query_unique(sd_journal *j, const char *field) {
 
         free(j->unique_field);
         j->unique_field = f;
-        j->unique_file = NULL;
-        j->unique_offset = 0;
+        reset_unique(j);
 
         return 0;
 }
 
+static int next_unique_summary_item(sd_journal *j) {
+        Object *o;
+        int r;
+
+        assert(j);
+        assert(j->unique_summary_offset > 0);
+
+        r = journal_file_move_to_object(j->unique_file, OBJECT_FIELD_SUMMARY, j->unique_summary_offset, &o);
+        if (r < 0)
+                return r;
+
+        if (j->unique_summary_item >= journal_file_field_summary_n_items(o)) {
+                j->unique_offset = 0;
+                return 0;
+        }
+
+        j->unique_offset = le64toh(o->field_summary.items[j->unique_summary_item++].data_offset);
+        return 1;
+}
+
 _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_t *l) {
         Object *o;
         size_t k;
@@ -2537,13 +3284,32 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
                 size_t ol;
                 bool found;
 
-                /* Proceed to next data object in the field's linked list */
+                /* Proceed to next data object in the field's linked
+                 * list, or in the field's summary, if the file has
+                 * one */
                 if (j->unique_offset == 0) {
-                        r = journal_file_find_field_object(j->unique_file, j->unique_field, k, &o, NULL);
+                        r = journal_file_find_field_summary(j->unique_file, j->unique_field, k, NULL, &j->unique_summary_offset);
                         if (r < 0)
                                 return r;
+                        if (r > 0) {
+                                j->unique_summary_item = 0;
+
+                                r = next_unique_summary_item(j);
+                                if (r < 0)
+                                        return r;
+                        } else {
+                                j->unique_summary_offset = 0;
 
-                        j->unique_offset = r > 0 ? le64toh(o->field.head_data_offset) : 0;
+                                r = journal_file_find_field_object(j->unique_file, j->unique_field, k, &o, NULL);
+                                if (r < 0)
+                                        return r;
+
+                                j->unique_offset = r > 0 ? le64toh(o->field.head_data_offset) : 0;
+                        }
+                } else if (j->unique_summary_offset > 0) {
+                        r = next_unique_summary_item(j);
+                        if (r < 0)
+                                return r;
                 } else {
                         r = journal_file_move_to_object(j->unique_file, OBJECT_DATA, j->unique_offset, &o);
                         if (r < 0)
@@ -2580,8 +3346,42 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
                         return r;
 
                 /* OK, now let's see if we already returned this data
-                 * object by checking if it exists in the earlier
-                 * traversed files. */
+                 * object. Small values we remember, as long as they
+                 * don't take up too much memory altogether, for the
+                 * others check if they exist in the earlier traversed
+                 * files. */
+                if (ol <= UNIQUE_VALUE_REMEMBER_MAX) {
+                        UniqueValue key = {
+                                .hash = le64toh(o->data.hash),
+                                .data = odata,
+                                .size = ol,
+                        }, *v;
+
+                        if (set_contains(j->unique_values, &key))
+                                continue;
+
+                        if (j->unique_values_size + sizeof(UniqueValue) + ol <= UNIQUE_VALUES_SIZE_MAX) {
+                                r = set_ensure_allocated(&j->unique_values, unique_value_hash_func, unique_value_compare_func);
+                                if (r < 0)
+                                        return r;
+
+                                v = unique_value_new(key.hash, odata, ol);
+                                if (!v)
+                                        return -ENOMEM;
+
+                                r = set_consume(j->unique_values, v);
+                                if (r < 0)
+                                        return r;
+
+                                j->unique_values_size += sizeof(UniqueValue) + ol;
+
+                                *data = odata;
+                                *l = ol;
+
+                                return 1;
+                        }
+                }
+
                 found = false;
                 HASHMAP_FOREACH(of, j->files, i) {
                         Object *oo;
@@ -2600,8 +3400,10 @@ _public_ int sd_journal_enumerate_unique(sd_journal *j, const void **data, size_
                         if (r < 0)
                                 return r;
 
-                        if (r > 0)
+                        if (r > 0) {
                                 found = true;
+                                break;
+                        }
                 }
 
                 if (found)
@@ -2619,8 +3421,301 @@ _public_ void sd_journal_restart_unique(sd_journal *j) {
         if (!j)
                 return;
 
-        j->unique_file = NULL;
-        j->unique_offset = 0;
+        reset_unique(j);
+}
+
+static int add_unique_value(sd_journal *j, Set *values, JournalFile *f, uint64_t p,
+                            uint64_t n_entries, usec_t first, usec_t last) {
+        UniqueValue key = {}, *v;
+        Object *o;
+        int r;
+
+        assert(j);
+        assert(values);
+        assert(f);
+
+        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+        if (r < 0)
+                return r;
+
+        key.hash = le64toh(o->data.hash);
+
+        r = return_data(j, f, o, &key.data, &key.size);
+        if (r < 0)
+                return r;
+
+        v = set_get(values, &key);
+        if (!v) {
+                v = unique_value_new(key.hash, key.data, key.size);
+                if (!v)
+                        return -ENOMEM;
+
+                r = set_consume(values, v);
+                if (r < 0)
+                        return r;
+        }
+
+        v->n_entries += n_entries;
+        v->first_realtime = MIN(v->first_realtime, first);
+        v->last_realtime = MAX(v->last_realtime, last);
+
+        return 0;
+}
+
+static int add_unique_values_from_summary(sd_journal *j, Set *values, JournalFile *f, uint64_t q) {
+        uint64_t i, n;
+        Object *o;
+        int r;
+
+        r = journal_file_move_to_object(f, OBJECT_FIELD_SUMMARY, q, &o);
+        if (r < 0)
+                return r;
+
+        n = journal_file_field_summary_n_items(o);
+
+        for (i = 0; i < n; i++) {
+                FieldSummaryItem item;
+
+                r = journal_file_move_to_object(f, OBJECT_FIELD_SUMMARY, q, &o);
+                if (r < 0)
+                        return r;
+
+                item = o->field_summary.items[i];
+
+                r = add_unique_value(j, values, f,
+                                     le64toh(item.data_offset),
+                                     le64toh(item.n_entries),
+                                     le64toh(item.first_realtime),
+                                     le64toh(item.last_realtime));
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int add_unique_values_from_entries(sd_journal *j, Set *values, JournalFile *f, const char *field) {
+        Object *o;
+        uint64_t p;
+        int r;
+
+        r = journal_file_find_field_object(f, field, strlen(field), &o, NULL);
+        if (r <= 0)
+                return r;
+
+        p = le64toh(o->field.head_data_offset);
+        while (p > 0) {
+                uint64_t next, n_entries;
+                usec_t first, last;
+
+                r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                if (r < 0)
+                        return r;
+
+                next = le64toh(o->data.next_field_offset);
+                n_entries = le64toh(o->data.n_entries);
+
+                if (n_entries > 0) {
+                        r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_DOWN, &o, NULL);
+                        if (r < 0)
+                                return r;
+                        if (r == 0)
+                                goto next;
+
+                        first = le64toh(o->entry.realtime);
+
+                        r = journal_file_next_entry_for_data(f, NULL, 0, p, DIRECTION_UP, &o, NULL);
+                        if (r < 0)
+                                return r;
+                        if (r == 0)
+                                goto next;
+
+                        last = le64toh(o->entry.realtime);
+
+                        r = add_unique_value(j, values, f, p, n_entries, first, last);
+                        if (r < 0)
+                                return r;
+                }
+
+        next:
+                p = next;
+        }
+
+        return 0;
+}
+
+static int add_unique_values(sd_journal *j, Set *values, JournalFile *f, const char *field) {
+        uint64_t q;
+        int r;
+
+        r = journal_file_find_field_summary(f, field, strlen(field), NULL, &q);
+        if (r > 0)
+                r = add_unique_values_from_summary(j, values, f, q);
+        else if (r == 0)
+                r = add_unique_values_from_entries(j, values, f, field);
+        if (r == -ENOMEM)
+                return r;
+        if (r < 0)
+                log_debug("Can't read values of %s from %s, ignoring: %s", field, f->path, strerror(-r));
+
+        return 0;
+}
+
+/* Returns the distinct values of a field over all files, regardless
+ * of matches. Files that were summarized when they were closed are
+ * answered from their summary, all others by looking at the first
+ * and last entry of every value. */
+int journal_get_unique_values(sd_journal *j, const char *field, UniqueValue ***ret, unsigned *n_ret) {
+        _cleanup_set_free_free_ Set *values = NULL;
+        UniqueValue **array, *v;
+        JournalFile *f;
+        Iterator i;
+        unsigned n = 0;
+        int r;
+
+        assert(j);
+        assert(field);
+        assert(ret);
+        assert(n_ret);
+
+        if (!field_is_valid(field))
+                return -EINVAL;
+
+        values = set_new(unique_value_hash_func, unique_value_compare_func);
+        if (!values)
+                return -ENOMEM;
+
+        HASHMAP_FOREACH(f, j->files, i) {
+                r = add_unique_values(j, values, f, field);
+                if (r < 0)
+                        return r;
+        }
+
+        array = new(UniqueValue*, MAX(set_size(values), 1U));
+        if (!array)
+                return -ENOMEM;
+
+        while ((v = set_steal_first(values)))
+                array[n++] = v;
+
+        *ret = array;
+        *n_ret = n;
+
+        return 0;
+}
+
+void unique_values_free(UniqueValue **values, unsigned n) {
+        unsigned i;
+
+        for (i = 0; i < n; i++)
+                free(values[i]);
+
+        free(values);
+}
+
+static int boot_range_cmp(const void *a, const void *b) {
+        return memcmp(&((const BootRange*) a)->boot_id, &((const BootRange*) b)->boot_id, sizeof(sd_id128_t));
+}
+
+static int add_boot_range(BootRange **ranges, size_t *n_allocated, unsigned *n, sd_id128_t boot_id, usec_t first, usec_t last) {
+        BootRange *b;
+
+        if (!GREEDY_REALLOC(*ranges, *n_allocated, *n + 1))
+                return -ENOMEM;
+
+        b = &(*ranges)[(*n)++];
+        b->boot_id = boot_id;
+        b->first_realtime = first;
+        b->last_realtime = last;
+
+        return 0;
+}
+
+/* Returns the boots over all files, regardless of matches. Files
+ * with a boot index are answered from it, all others the same way
+ * as journal_get_unique_values() answers for _BOOT_ID. */
+int journal_get_boots(sd_journal *j, BootRange **ret, unsigned *n_ret) {
+        _cleanup_set_free_free_ Set *values = NULL;
+        _cleanup_free_ BootRange *ranges = NULL;
+        size_t n_allocated = 0;
+        unsigned n = 0, k, l;
+        UniqueValue *v;
+        JournalFile *f;
+        Iterator i;
+        int r;
+
+        assert(j);
+        assert(ret);
+        assert(n_ret);
+
+        values = set_new(unique_value_hash_func, unique_value_compare_func);
+        if (!values)
+                return -ENOMEM;
+
+        HASHMAP_FOREACH(f, j->files, i) {
+                _cleanup_free_ BootIndexItem *items = NULL;
+                unsigned n_items = 0;
+
+                r = journal_file_get_boot_index(f, &items, &n_items);
+                if (r == -ENOMEM)
+                        return r;
+                if (r < 0)
+                        log_debug("Can't read boot index of %s, ignoring: %s", f->path, strerror(-r));
+                if (r <= 0) {
+                        r = add_unique_values(j, values, f, "_BOOT_ID");
+                        if (r < 0)
+                                return r;
+
+                        continue;
+                }
+
+                for (k = 0; k < n_items; k++) {
+                        r = add_boot_range(&ranges, &n_allocated, &n,
+                                           items[k].boot_id,
+                                           le64toh(items[k].first_realtime),
+                                           le64toh(items[k].last_realtime));
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        SET_FOREACH(v, values, i) {
+                _cleanup_free_ char *s = NULL;
+                sd_id128_t id;
+
+                if (v->size < strlen("_BOOT_ID="))
+                        continue;
+
+                s = strndup((const char*) v->data + strlen("_BOOT_ID="), v->size - strlen("_BOOT_ID="));
+                if (!s)
+                        return -ENOMEM;
+
+                if (sd_id128_from_string(s, &id) < 0)
+                        continue;
+
+                r = add_boot_range(&ranges, &n_allocated, &n, id, v->first_realtime, v->last_realtime);
+                if (r < 0)
+                        return r;
+        }
+
+        /* A boot may have written to several files, and may come
+         * back in a file after another boot's entries, hence merge
+         * all ranges of the same boot */
+        qsort_safe(ranges, n, sizeof(BootRange), boot_range_cmp);
+
+        for (k = 0, l = 0; k < n; k++) {
+                if (l > 0 && sd_id128_equal(ranges[l-1].boot_id, ranges[k].boot_id)) {
+                        ranges[l-1].first_realtime = MIN(ranges[l-1].first_realtime, ranges[k].first_realtime);
+                        ranges[l-1].last_realtime = MAX(ranges[l-1].last_realtime, ranges[k].last_realtime);
+                } else
+                        ranges[l++] = ranges[k];
+        }
+
+        *ret = ranges;
+        *n_ret = l;
+        ranges = NULL;
+
+        return 0;
 }
 
 _public_ int sd_journal_reliable_fd(sd_journal *j) {
@@ -0,0 +1,225 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "sd-journal.h"
+#include "journal-internal.h"
+#include "compress.h"
+
+/* Same threshold journal-file.c uses before attempting to compress
+ * a DATA object */
+#define THRESHOLD 512
+#define PAYLOAD_MAX (64U*1024U*1024U)
+
+typedef struct Payloads {
+        struct iovec *iovec;
+        unsigned n;
+        size_t allocated;
+        uint64_t total;
+} Payloads;
+
+static int payloads_add(Payloads *p, const void *data, size_t size) {
+        void *d;
+
+        if (!GREEDY_REALLOC(p->iovec, p->allocated, p->n + 1))
+                return -ENOMEM;
+
+        d = memdup(data, size);
+        if (!d)
+                return -ENOMEM;
+
+        p->iovec[p->n].iov_base = d;
+        p->iovec[p->n].iov_len = size;
+        p->n++;
+        p->total += size;
+
+        return 0;
+}
+
+static void payloads_free(Payloads *p) {
+        unsigned i;
+
+        for (i = 0; i < p->n; i++)
+                free(p->iovec[i].iov_base);
+        free(p->iovec);
+}
+
+static int load_journal_payloads(Payloads *p) {
+        _cleanup_journal_close_ sd_journal *j = NULL;
+        int r;
+
+        /* Use the DATA objects of the local journal as test
+         * payloads, so that we measure what journald actually
+         * ends up compressing */
+
+        r = sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY);
+        if (r < 0)
+                return r;
+
+        sd_journal_set_data_threshold(j, 0);
+
+        SD_JOURNAL_FOREACH_BACKWARDS(j) {
+                const void *data;
+                size_t size;
+
+                SD_JOURNAL_FOREACH_DATA(j, data, size) {
+                        if (size < THRESHOLD)
+                                continue;
+
+                        r = payloads_add(p, data, size);
+                        if (r < 0)
+                                return r;
+                }
+
+                if (p->total >= PAYLOAD_MAX)
+                        break;
+        }
+
+        return 0;
+}
+
+static int make_synthetic_payloads(Payloads *p) {
+        unsigned i;
+        int r;
+
+        /* Fallback if there's no journal around: backtraces and
+         * similar log output, which is the kind of data that ends up
+         * in large DATA objects */
+
+        for (i = 0; i < 4096; i++) {
+                _cleanup_free_ char *s = NULL;
+                unsigned k;
+
+                s = strdup("MESSAGE=Process crashed, stack trace follows:\n");
+                if (!s)
+                        return -ENOMEM;
+
+                for (k = 0; k < 8 + i % 24; k++) {
+                        char *t;
+
+                        if (asprintf(&t, "%s#%u 0x%016llx in function_%u (arg=0x%x) at src/module%u/file%u.c:%u\n",
+                                     s, k, random_ull() & 0xffffffffULL, (i + k) % 97,
+                                     (unsigned) random_ull() & 0xffff, k % 7, i % 13, (i * k) % 2000) < 0)
+                                return -ENOMEM;
+
+                        free(s);
+                        s = t;
+                }
+
+                r = payloads_add(p, s, strlen(s));
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static void benchmark(Payloads *p, int compression) {
+        uint64_t uncompressed = 0, stored = 0, alloc = 0;
+        usec_t c_start, c_end, d_end;
+        _cleanup_free_ uint8_t *buf = NULL;
+        _cleanup_free_ void *out = NULL;
+        size_t buf_size = 0;
+        unsigned i, n_compressed = 0;
+        char a[FORMAT_BYTES_MAX], b[FORMAT_BYTES_MAX];
+
+        c_start = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < p->n; i++) {
+                uint64_t rsize;
+
+                assert_se(GREEDY_REALLOC(buf, buf_size, p->iovec[i].iov_len));
+
+                if (compress_blob(compression, p->iovec[i].iov_base, p->iovec[i].iov_len, buf, &rsize)) {
+                        n_compressed++;
+                        stored += rsize;
+                } else
+                        stored += p->iovec[i].iov_len;
+        }
+
+        c_end = now(CLOCK_MONOTONIC);
+
+        /* Now measure the read side, compressing once more outside
+         * of the timed region */
+        d_end = 0;
+        for (i = 0; i < p->n; i++) {
+                uint64_t rsize, usize;
+                usec_t t;
+
+                if (!compress_blob(compression, p->iovec[i].iov_base, p->iovec[i].iov_len, buf, &rsize))
+                        continue;
+
+                t = now(CLOCK_MONOTONIC);
+                assert_se(uncompress_blob(compression, buf, rsize, &out, &alloc, &usize, 0));
+                d_end += now(CLOCK_MONOTONIC) - t;
+
+                assert_se(usize == p->iovec[i].iov_len);
+                assert_se(memcmp(out, p->iovec[i].iov_base, usize) == 0);
+
+                uncompressed += usize;
+        }
+
+        printf("%-4s %6u objects, %s -> %s (ratio %.3f), %u compressed, "
+               "compress %.1f MB/s, uncompress %.1f MB/s\n",
+               object_compressed_to_string(compression),
+               p->n,
+               format_bytes(a, sizeof(a), p->total),
+               format_bytes(b, sizeof(b), stored),
+               (double) stored / (double) p->total,
+               n_compressed,
+               (double) p->total / (double) MAX(c_end - c_start, 1ULL),
+               (double) uncompressed / (double) MAX(d_end, 1ULL));
+}
+
+int main(int argc, char *argv[]) {
+        Payloads p = {};
+        int r;
+
+        log_set_max_level(LOG_INFO);
+
+        r = load_journal_payloads(&p);
+        if (r < 0 || p.n == 0) {
+                log_info("No journal payloads available, using synthetic data.");
+
+                r = make_synthetic_payloads(&p);
+                if (r < 0) {
+                        log_error("Failed to generate payloads: %s", strerror(-r));
+                        return EXIT_FAILURE;
+                }
+        }
+
+#ifdef HAVE_XZ
+        benchmark(&p, OBJECT_COMPRESSED_XZ);
+#endif
+#ifdef HAVE_LZ4
+        benchmark(&p, OBJECT_COMPRESSED_LZ4);
+#endif
+
+        payloads_free(&p);
+
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,190 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "compress.h"
+
+static const char text[] =
+        "text\0foofoofoofoo AAAA aaaaaaaaa ghost busters barbarbar FFF"
+        "foofoofoofoo AAAA aaaaaaaaa ghost busters barbarbar FFF"
+        "foofoofoofoo AAAA aaaaaaaaa ghost busters barbarbar FFF";
+
+static void test_compress_uncompress(int compression) {
+        char compressed[sizeof(text)];
+        uint64_t csize = 0, usize = 0, alloc = 0;
+        _cleanup_free_ char *decompressed = NULL;
+
+        log_info("/* testing %s blob compression/uncompression */",
+                 object_compressed_to_string(compression));
+
+        assert_se(compress_blob(compression, text, sizeof(text), compressed, &csize));
+        assert_se(csize > 0 && csize < sizeof(text));
+
+        assert_se(uncompress_blob(compression, compressed, csize,
+                                  (void**) &decompressed, &alloc, &usize, 0));
+        assert_se(usize == sizeof(text));
+        assert_se(memcmp(decompressed, text, sizeof(text)) == 0);
+
+        /* Asking for a prefix only must still return at least
+         * that much of the blob */
+        assert_se(uncompress_blob(compression, compressed, csize,
+                                  (void**) &decompressed, &alloc, &usize, 10));
+        assert_se(usize >= 10);
+        assert_se(memcmp(decompressed, text, 10) == 0);
+
+        assert_se(!uncompress_blob(compression, "garbage", 8,
+                                   (void**) &decompressed, &alloc, &usize, 0));
+}
+
+static void test_uncompress_startswith(int compression) {
+        char compressed[sizeof(text)];
+        uint64_t csize = 0, alloc = 0;
+        _cleanup_free_ char *buf = NULL;
+
+        log_info("/* testing %s startswith */",
+                 object_compressed_to_string(compression));
+
+        assert_se(compress_blob(compression, text, sizeof(text), compressed, &csize));
+
+        assert_se(uncompress_startswith(compression, compressed, csize,
+                                        (void**) &buf, &alloc, "foofoofoofoo", 12, ' ') == false);
+        assert_se(uncompress_startswith(compression, compressed, csize,
+                                        (void**) &buf, &alloc, "text", 4, '\0') == true);
+        assert_se(uncompress_startswith(compression, compressed, csize,
+                                        (void**) &buf, &alloc, "text", 4, 'X') == false);
+}
+
+static void test_compress_incompressible(int compression) {
+        char data[256], compressed[256];
+        uint64_t csize = 0;
+        unsigned i;
+
+        log_info("/* testing %s incompressible data */",
+                 object_compressed_to_string(compression));
+
+        for (i = 0; i < sizeof(data); i++)
+                data[i] = (char) random_ull();
+
+        /* Must refuse rather than grow the data */
+        assert_se(!compress_blob(compression, data, sizeof(data), compressed, &csize));
+}
+
+#ifdef HAVE_XZ
+static int make_temporary(void) {
+        char path[] = "/tmp/test-compress.XXXXXX";
+        int fd;
+
+        fd = mkostemp(path, O_CLOEXEC|O_RDWR);
+        assert_se(fd >= 0);
+        assert_se(unlink(path) >= 0);
+
+        return fd;
+}
+
+static void test_compress_stream(void) {
+        _cleanup_free_ char *data = NULL, *back = NULL;
+        int src, compressed, decompressed;
+        size_t size = 3*1024*1024 + 17, i;
+        off_t csize;
+
+        log_info("/* testing XZ stream compression/decompression */");
+
+        /* Larger than the buffers used, and some of it compressible */
+        data = malloc(size);
+        back = malloc(size);
+        assert_se(data && back);
+
+        for (i = 0; i < size; i++)
+                data[i] = i % 4096 < 1024 ? (char) ((i * 2654435761U) >> 11) : text[i % sizeof(text)];
+
+        src = make_temporary();
+        compressed = make_temporary();
+        decompressed = make_temporary();
+
+        assert_se(loop_write(src, data, size, false) == (ssize_t) size);
+
+        assert_se(lseek(src, 0, SEEK_SET) == 0);
+        assert_se(compress_stream(src, compressed, size - 1) == -EFBIG);
+
+        assert_se(lseek(src, 0, SEEK_SET) == 0);
+        assert_se(ftruncate(compressed, 0) >= 0);
+        assert_se(lseek(compressed, 0, SEEK_SET) == 0);
+        assert_se(compress_stream(src, compressed, size) == 0);
+
+        csize = lseek(compressed, 0, SEEK_CUR);
+        assert_se(csize > 0 && csize < (off_t) size);
+
+        assert_se(lseek(compressed, 0, SEEK_SET) == 0);
+        assert_se(decompress_stream(compressed, decompressed, size) == 0);
+
+        assert_se(lseek(decompressed, 0, SEEK_CUR) == (off_t) size);
+        assert_se(pread(decompressed, back, size, 0) == (ssize_t) size);
+        assert_se(memcmp(data, back, size) == 0);
+
+        /* Refuse to write more than we were told to */
+        assert_se(lseek(compressed, 0, SEEK_SET) == 0);
+        assert_se(lseek(decompressed, 0, SEEK_SET) == 0);
+        assert_se(decompress_stream(compressed, decompressed, size - 1) == -EFBIG);
+
+        /* A truncated stream is not silently accepted */
+        assert_se(ftruncate(compressed, csize / 2) >= 0);
+        assert_se(lseek(compressed, 0, SEEK_SET) == 0);
+        assert_se(lseek(decompressed, 0, SEEK_SET) == 0);
+        assert_se(decompress_stream(compressed, decompressed, size) == -EBADMSG);
+
+        close_nointr_nofail(src);
+        close_nointr_nofail(compressed);
+        close_nointr_nofail(decompressed);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(streq(object_compressed_to_string(OBJECT_COMPRESSED_XZ), "XZ"));
+        assert_se(object_compressed_from_string("LZ4") == OBJECT_COMPRESSED_LZ4);
+
+#ifdef HAVE_XZ
+        test_compress_uncompress(OBJECT_COMPRESSED_XZ);
+        test_uncompress_startswith(OBJECT_COMPRESSED_XZ);
+        test_compress_incompressible(OBJECT_COMPRESSED_XZ);
+        test_compress_stream();
+#else
+        log_info("/* XZ test skipped */");
+#endif
+
+#ifdef HAVE_LZ4
+        test_compress_uncompress(OBJECT_COMPRESSED_LZ4);
+        test_uncompress_startswith(OBJECT_COMPRESSED_LZ4);
+        test_compress_incompressible(OBJECT_COMPRESSED_LZ4);
+#else
+        log_info("/* LZ4 test skipped */");
+#endif
+
+        return 0;
+}
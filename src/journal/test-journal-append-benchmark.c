@@ -0,0 +1,163 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "journal-file.h"
+
+#define N_ENTRIES_DEFAULT 100000U
+#define BATCH_SIZE 64U
+#define N_FIELDS 15
+
+/* The fields journald attaches to a typical message: everything
+ * but MESSAGE= and _PID= repeats from entry to entry */
+static const char * const fixed_fields[] = {
+        "PRIORITY=6",
+        "SYSLOG_FACILITY=3",
+        "SYSLOG_IDENTIFIER=benchmark",
+        "_UID=0",
+        "_GID=0",
+        "_COMM=benchmark",
+        "_EXE=/usr/lib/systemd/benchmark",
+        "_CMDLINE=/usr/lib/systemd/benchmark --verbose",
+        "_SYSTEMD_CGROUP=/system/benchmark.service",
+        "_SYSTEMD_UNIT=benchmark.service",
+        "_TRANSPORT=syslog",
+        "_BOOT_ID=0123456789abcdef0123456789abcdef",
+        "_MACHINE_ID=fedcba9876543210fedcba9876543210",
+        "_HOSTNAME=localhost",
+};
+
+typedef struct Entry {
+        char message[sizeof("MESSAGE=Benchmark message , with some padding to make it look realistic") + DECIMAL_STR_MAX(unsigned)];
+        char pid[sizeof("_PID=") + DECIMAL_STR_MAX(unsigned)];
+        struct iovec iovec[N_FIELDS + 1];
+} Entry;
+
+static void make_entry(Entry *e, unsigned i) {
+        unsigned k;
+
+        snprintf(e->message, sizeof(e->message), "MESSAGE=Benchmark message %u, with some padding to make it look realistic", i);
+        snprintf(e->pid, sizeof(e->pid), "_PID=%u", 1000 + i / 1000);
+
+        IOVEC_SET_STRING(e->iovec[0], e->message);
+        IOVEC_SET_STRING(e->iovec[1], e->pid);
+        for (k = 0; k < ELEMENTSOF(fixed_fields); k++)
+                IOVEC_SET_STRING(e->iovec[2 + k], fixed_fields[k]);
+}
+
+static JournalFile* open_file(const char *fn) {
+        JournalFile *f;
+
+        assert_se(journal_file_open(fn, O_RDWR|O_CREAT, 0644, false, false, NULL, NULL, NULL, &f) == 0);
+        return f;
+}
+
+static void report(const char *name, JournalFile *f, unsigned n, usec_t duration) {
+        char a[FORMAT_BYTES_MAX];
+
+        printf("%-10s %u entries in %.3fs, %.0f entries/s, %s\n",
+               name, n,
+               (double) duration / USEC_PER_SEC,
+               (double) n * USEC_PER_SEC / (double) MAX(duration, 1ULL),
+               format_bytes(a, sizeof(a), le64toh(f->header->header_size) + le64toh(f->header->arena_size)));
+}
+
+static void benchmark_single(unsigned n) {
+        JournalFile *f;
+        usec_t start;
+        unsigned i;
+        Entry e;
+
+        f = open_file("single.journal");
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n; i++) {
+                make_entry(&e, i);
+                assert_se(journal_file_append_entry(f, NULL, e.iovec, ELEMENTSOF(e.iovec), NULL, NULL, NULL) == 0);
+        }
+
+        report("single", f, n, now(CLOCK_MONOTONIC) - start);
+        journal_file_close(f);
+}
+
+static void benchmark_batch(unsigned n) {
+        _cleanup_free_ Entry *e = NULL;
+        JournalBatchEntry batch[BATCH_SIZE];
+        JournalFile *f;
+        usec_t start;
+        unsigned i, k, m;
+
+        e = new(Entry, BATCH_SIZE);
+        assert_se(e);
+
+        f = open_file("batch.journal");
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n; i += k) {
+                m = MIN(BATCH_SIZE, n - i);
+
+                for (k = 0; k < m; k++) {
+                        make_entry(&e[k], i + k);
+
+                        batch[k].iovec = e[k].iovec;
+                        batch[k].n_iovec = ELEMENTSOF(e[k].iovec);
+                        dual_timestamp_get(&batch[k].ts);
+                }
+
+                assert_se(journal_file_append_entries(f, batch, m, NULL, &k) == 0);
+                assert_se(k == m);
+        }
+
+        report("batch", f, n, now(CLOCK_MONOTONIC) - start);
+        journal_file_close(f);
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/journal-append-XXXXXX";
+        unsigned n = N_ENTRIES_DEFAULT;
+
+        log_set_max_level(LOG_INFO);
+
+        if (argc > 1)
+                assert_se(safe_atou(argv[1], &n) >= 0);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        benchmark_single(n);
+        benchmark_batch(n);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return 0;
+}
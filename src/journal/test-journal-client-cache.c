@@ -0,0 +1,120 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2011 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "journald-client-cache.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+static void test_self(void) {
+        _cleanup_free_ char *comm = NULL;
+        ClientCache *c;
+        ClientInfo *i, *j;
+        unsigned long long starttime;
+        uint64_t hits, misses;
+
+        c = client_cache_new();
+        assert_se(c);
+
+        assert_se(client_cache_get(c, getpid(), &i) >= 0);
+        assert_se(i->pid == getpid());
+        assert_se(i->uid_valid && i->uid == getuid());
+        assert_se(i->gid_valid && i->gid == getgid());
+
+        assert_se(get_process_comm(getpid(), &comm) >= 0);
+        assert_se(streq_ptr(i->comm, comm));
+
+        assert_se(i->n_fields > 0);
+        assert_se(startswith(i->fields[0], "_COMM="));
+        assert_se(streq(i->fields[0] + strlen("_COMM="), comm));
+
+        client_cache_get_stats(c, &hits, &misses);
+        assert_se(hits == 0 && misses == 1);
+
+        assert_se(client_cache_get(c, getpid(), &j) >= 0);
+        assert_se(i == j);
+
+        client_cache_get_stats(c, &hits, &misses);
+        assert_se(hits == 1 && misses == 1);
+
+        /* Pretend the PID got reused */
+        starttime = i->starttime;
+        i->starttime++;
+
+        assert_se(client_cache_get(c, getpid(), &j) >= 0);
+        assert_se(j->starttime == starttime);
+
+        client_cache_get_stats(c, &hits, &misses);
+        assert_se(hits == 1 && misses == 2);
+
+        client_cache_free(c);
+}
+
+static void test_gone(void) {
+        ClientCache *c;
+        ClientInfo *i, *j;
+        pid_t pid;
+
+        c = client_cache_new();
+        assert_se(c);
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                pause();
+                _exit(EXIT_SUCCESS);
+        }
+
+        assert_se(client_cache_get(c, pid, &i) >= 0);
+        assert_se(i->pid == pid);
+
+        /* Hold on to it like a stdout stream does */
+        client_info_ref(i);
+        assert_se(client_info_refresh(i) >= 0);
+        assert_se(i->n_fields > 0);
+
+        assert_se(kill(pid, SIGKILL) >= 0);
+        assert_se(waitpid(pid, NULL, 0) == pid);
+
+        assert_se(client_cache_get(c, pid, &j) < 0);
+
+        /* Dropped from the cache, but still there for us */
+        assert_se(client_info_refresh(i) < 0);
+        assert_se(i->n_fields == 0);
+        assert_se(!i->comm);
+
+        client_cache_free(c);
+        client_info_unref(i);
+}
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_DEBUG);
+
+        test_self();
+        test_gone();
+
+        return 0;
+}
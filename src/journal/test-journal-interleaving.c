@@ -74,6 +74,29 @@ static void append_number(JournalFile *f, int n, uint64_t *seqnum) {
         free(p);
 }
 
+/* Like append_number(), but makes sure that consecutive entries
+ * never share a timestamp, so that their order is well defined
+ * across files */
+static void append_number_ordered(JournalFile *f, int n) {
+        static dual_timestamp last = {};
+        dual_timestamp ts;
+        char *p;
+        struct iovec iovec[1];
+
+        dual_timestamp_get(&ts);
+        if (ts.realtime <= last.realtime || ts.monotonic <= last.monotonic) {
+                ts.realtime = last.realtime + 1;
+                ts.monotonic = last.monotonic + 1;
+        }
+        last = ts;
+
+        assert_se(asprintf(&p, "NUMBER=%d", n) >= 0);
+        iovec[0].iov_base = p;
+        iovec[0].iov_len = strlen(p);
+        assert_ret(journal_file_append_entry(f, &ts, iovec, 1, NULL, NULL, NULL));
+        free(p);
+}
+
 static void test_check_number (sd_journal *j, int n) {
         const void *d;
         _cleanup_free_ char *k;
@@ -197,6 +220,80 @@ static void test_skip(void (*setup)(void)) {
         puts("------------------------------------------------------------");
 }
 
+static void test_merge_many(void) {
+        char t[] = "/tmp/journal-merge-XXXXXX";
+        JournalFile *files[8];
+        sd_journal *j;
+        unsigned i;
+        int r;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(files); i++) {
+                char name[sizeof("file-.journal") + DECIMAL_STR_MAX(unsigned)];
+
+                snprintf(name, sizeof(name), "file-%u.journal", i);
+                files[i] = test_open(name);
+        }
+
+        /* Spread the entries over the files in an irregular
+         * pattern, so that the merge has to switch files at
+         * different points */
+        for (i = 1; i <= 64; i++)
+                append_number_ordered(files[(i * 5 + i / 7) % ELEMENTSOF(files)], i);
+
+        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_seek_head(j));
+        assert_ret(sd_journal_next(j));
+        test_check_numbers_down(j, 64);
+
+        /* Turn around at the tail */
+        assert_ret(sd_journal_seek_tail(j));
+        assert_ret(sd_journal_previous(j));
+        test_check_numbers_up(j, 64);
+
+        /* Change direction in the middle */
+        assert_ret(sd_journal_seek_head(j));
+        assert_ret(r = sd_journal_next_skip(j, 40));
+        assert_se(r == 40);
+        test_check_number(j, 40);
+        assert_se(sd_journal_previous(j) == 1);
+        test_check_number(j, 39);
+        assert_se(sd_journal_next(j) == 1);
+        test_check_number(j, 40);
+
+        /* Entries appended to a file after we reached the end show
+         * up on the next step */
+        assert_ret(r = sd_journal_next_skip(j, 100));
+        assert_se(r == 24);
+        test_check_number(j, 64);
+        assert_se(sd_journal_next(j) == 0);
+
+        append_number_ordered(files[3], 65);
+        append_number_ordered(files[6], 66);
+
+        assert_se(sd_journal_next(j) == 1);
+        test_check_number(j, 65);
+        assert_se(sd_journal_next(j) == 1);
+        test_check_number(j, 66);
+        assert_se(sd_journal_next(j) == 0);
+
+        sd_journal_close(j);
+
+        for (i = 0; i < ELEMENTSOF(files); i++)
+                test_close(files[i]);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
 static void test_sequence_numbers(void) {
 
         char t[] = "/tmp/journal-seq-XXXXXX";
@@ -292,6 +389,8 @@ int main(int argc, char *argv[]) {
         test_skip(setup_sequential);
         test_skip(setup_interleaved);
 
+        test_merge_many();
+
         test_sequence_numbers();
 
         return 0;
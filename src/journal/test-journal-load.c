@@ -0,0 +1,191 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Sends messages to the running journald as fast as it takes them,
+ * or at a fixed rate, and follows the journal to see how long each
+ * took to become visible. Rate limiting in journald should be turned
+ * off (RateLimitBurst=0) for this to be meaningful. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+#define N_MESSAGES_DEFAULT 100000U
+
+/* Give up once nothing new showed up for this long */
+#define IDLE_TIMEOUT_USEC (10*USEC_PER_SEC)
+
+static void send_messages(const char *run, unsigned n, unsigned rate) {
+        usec_t start;
+        unsigned i;
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n; i++) {
+                if (rate > 0) {
+                        usec_t next, t;
+
+                        next = start + (usec_t) i * USEC_PER_SEC / rate;
+                        t = now(CLOCK_MONOTONIC);
+                        if (next > t)
+                                usleep(next - t);
+                }
+
+                assert_se(sd_journal_send("MESSAGE=Load test message %u", i,
+                                          "LOAD_RUN=%s", run,
+                                          "LOAD_SEQ=%u", i,
+                                          "LOAD_SENT=%llu", (unsigned long long) now(CLOCK_MONOTONIC),
+                                          NULL) >= 0);
+        }
+}
+
+static int get_field_u64(sd_journal *j, const char *field, uint64_t *ret) {
+        _cleanup_free_ char *s = NULL;
+        const void *data;
+        size_t l, k;
+        int r;
+
+        r = sd_journal_get_data(j, field, &data, &l);
+        if (r < 0)
+                return r;
+
+        k = strlen(field) + 1;
+        s = strndup((const char*) data + k, l - k);
+        if (!s)
+                return -ENOMEM;
+
+        return safe_atou64(s, ret);
+}
+
+static int usec_cmp(const void *a, const void *b) {
+        usec_t x = *(const usec_t*) a, y = *(const usec_t*) b;
+
+        return x < y ? -1 : x > y ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+        char run[33], match[sizeof("LOAD_RUN=") + 32];
+        char a[FORMAT_TIMESPAN_MAX], b[FORMAT_TIMESPAN_MAX], c[FORMAT_TIMESPAN_MAX];
+        unsigned n = N_MESSAGES_DEFAULT, rate = 0, received = 0;
+        _cleanup_free_ usec_t *latency = NULL;
+        usec_t first_sent = 0, last_seen = 0, last_progress;
+        sd_id128_t id;
+        sd_journal *j;
+        pid_t pid;
+
+        log_set_max_level(LOG_INFO);
+
+        if (argc > 1)
+                assert_se(safe_atou(argv[1], &n) >= 0);
+        if (argc > 2)
+                assert_se(safe_atou(argv[2], &rate) >= 0);
+
+        assert_se(n > 0);
+
+        latency = new(usec_t, n);
+        assert_se(latency);
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+        sd_id128_to_string(id, run);
+        snprintf(match, sizeof(match), "LOAD_RUN=%s", run);
+
+        /* Start following before anything is sent */
+        if (sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY) < 0) {
+                log_info("Can't open the journal, skipping.");
+                return EXIT_TEST_SKIP;
+        }
+
+        /* Not seeking to the tail, as the file might not even
+         * exist yet */
+        assert_se(sd_journal_add_match(j, match, 0) >= 0);
+        assert_se(sd_journal_seek_realtime_usec(j, now(CLOCK_REALTIME)) >= 0);
+        assert_se(sd_journal_get_fd(j) >= 0);
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                send_messages(run, n, rate);
+                _exit(EXIT_SUCCESS);
+        }
+
+        last_progress = now(CLOCK_MONOTONIC);
+
+        while (received < n) {
+                uint64_t seq, sent;
+                usec_t t;
+                int r;
+
+                r = sd_journal_next(j);
+                assert_se(r >= 0);
+
+                if (r == 0) {
+                        if (now(CLOCK_MONOTONIC) > last_progress + IDLE_TIMEOUT_USEC)
+                                break;
+
+                        assert_se(sd_journal_wait(j, 100 * USEC_PER_MSEC) >= 0);
+                        continue;
+                }
+
+                t = now(CLOCK_MONOTONIC);
+
+                if (get_field_u64(j, "LOAD_SEQ", &seq) < 0 ||
+                    get_field_u64(j, "LOAD_SENT", &sent) < 0 ||
+                    seq >= n)
+                        continue;
+
+                if (received == 0 || sent < first_sent)
+                        first_sent = sent;
+
+                latency[received++] = t > sent ? t - sent : 0;
+                last_seen = t;
+                last_progress = t;
+        }
+
+        assert_se(waitpid(pid, NULL, 0) == pid);
+        sd_journal_close(j);
+
+        if (received == 0) {
+                log_error("None of the %u messages showed up in the journal.", n);
+                return EXIT_FAILURE;
+        }
+
+        qsort(latency, received, sizeof(usec_t), usec_cmp);
+
+        printf("%u/%u messages, %.0f messages/s, latency p50 %s, p99 %s, max %s\n",
+               received, n,
+               (double) received * USEC_PER_SEC / (double) MAX(last_seen - first_sent, 1ULL),
+               format_timespan(a, sizeof(a), latency[received / 2], 1),
+               format_timespan(b, sizeof(b), latency[received * 99 / 100], 1),
+               format_timespan(c, sizeof(c), latency[received - 1], 1));
+
+        if (received < n)
+                log_warning("%u messages were lost, is rate limiting turned off?", n - received);
+
+        return received < n ? EXIT_FAILURE : EXIT_SUCCESS;
+}
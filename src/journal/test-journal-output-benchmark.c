@@ -0,0 +1,162 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sd-journal.h"
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "journal-file.h"
+#include "logs-show.h"
+
+#define N_ENTRIES_DEFAULT 200000U
+#define N_PROCESSES 32U
+#define BATCH_SIZE 64U
+
+/* Roughly what journald attaches to a syslog message */
+#define N_FIELDS 22U
+
+static void fill(JournalFile *f, unsigned n) {
+        JournalBatchEntry batch[BATCH_SIZE];
+        char fields[BATCH_SIZE][N_FIELDS][128];
+        struct iovec iovec[BATCH_SIZE][N_FIELDS];
+        dual_timestamp ts;
+        unsigned i, k, m, l;
+
+        dual_timestamp_get(&ts);
+
+        for (i = 0; i < n; i += m) {
+                m = MIN(BATCH_SIZE, n - i);
+
+                for (k = 0; k < m; k++) {
+                        unsigned p = (i + k) % N_PROCESSES;
+
+                        l = 0;
+                        snprintf(fields[k][l++], 128, "_TRANSPORT=syslog");
+                        snprintf(fields[k][l++], 128, "_BOOT_ID=4b3a16b2c8e84cbc9e9e8f5d0e1c2a3b");
+                        snprintf(fields[k][l++], 128, "_MACHINE_ID=8d5a6c2e1f0b4a3c9d7e6f5a4b3c2d1e");
+                        snprintf(fields[k][l++], 128, "_HOSTNAME=benchmark");
+                        snprintf(fields[k][l++], 128, "PRIORITY=%u", 3 + (i + k) % 4);
+                        snprintf(fields[k][l++], 128, "SYSLOG_FACILITY=3");
+                        snprintf(fields[k][l++], 128, "SYSLOG_IDENTIFIER=daemon%u", p);
+                        snprintf(fields[k][l++], 128, "SYSLOG_PID=%u", 1000 + p);
+                        snprintf(fields[k][l++], 128, "_PID=%u", 1000 + p);
+                        snprintf(fields[k][l++], 128, "_UID=%u", p % 4);
+                        snprintf(fields[k][l++], 128, "_GID=%u", p % 4);
+                        snprintf(fields[k][l++], 128, "_COMM=daemon%u", p);
+                        snprintf(fields[k][l++], 128, "_EXE=/usr/sbin/daemon%u", p);
+                        snprintf(fields[k][l++], 128, "_CMDLINE=/usr/sbin/daemon%u --foreground --config /etc/daemon%u.conf", p, p);
+                        snprintf(fields[k][l++], 128, "_CAP_EFFECTIVE=0");
+                        snprintf(fields[k][l++], 128, "_SYSTEMD_CGROUP=/system.slice/daemon%u.service", p);
+                        snprintf(fields[k][l++], 128, "_SYSTEMD_UNIT=daemon%u.service", p);
+                        snprintf(fields[k][l++], 128, "_SYSTEMD_SLICE=system.slice");
+                        snprintf(fields[k][l++], 128, "CODE_FILE=src/daemon/main.c");
+                        snprintf(fields[k][l++], 128, "CODE_LINE=%u", 100 + (i + k) % 50);
+                        snprintf(fields[k][l++], 128, "CODE_FUNC=handle_request");
+                        snprintf(fields[k][l++], 128, "MESSAGE=Output benchmark entry %u from daemon %u", i + k, p);
+                        assert_se(l == N_FIELDS);
+
+                        for (l = 0; l < N_FIELDS; l++)
+                                IOVEC_SET_STRING(iovec[k][l], fields[k][l]);
+
+                        ts.realtime += USEC_PER_MSEC;
+                        ts.monotonic += USEC_PER_MSEC;
+
+                        batch[k].ts = ts;
+                        batch[k].iovec = iovec[k];
+                        batch[k].n_iovec = N_FIELDS;
+                }
+
+                assert_se(journal_file_append_entries(f, batch, m, NULL, NULL) == 0);
+        }
+}
+
+static void output(const char *dir, unsigned n, OutputMode mode, const char *name) {
+        _cleanup_fclose_ FILE *null = NULL;
+        sd_journal *j;
+        unsigned k = 0;
+        usec_t t;
+
+        null = fopen("/dev/null", "we");
+        assert_se(null);
+
+        assert_se(sd_journal_open_directory(&j, dir, 0) >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+
+        SD_JOURNAL_FOREACH(j) {
+                assert_se(output_journal(null, j, mode, 0, 0, NULL) >= 0);
+                k++;
+        }
+
+        t = now(CLOCK_MONOTONIC) - t;
+        assert_se(k == n);
+
+        printf("%-12s %u entries in %.2fs, %.0f entries/s\n",
+               name, n, (double) t / USEC_PER_SEC, (double) n * USEC_PER_SEC / t);
+
+        sd_journal_close(j);
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/journal-output-XXXXXX";
+        unsigned n = N_ENTRIES_DEFAULT;
+        JournalMetrics metrics = {
+                .max_use = (uint64_t) -1,
+                .max_size = 1024ULL*1024ULL*1024ULL,
+                .min_size = (uint64_t) -1,
+                .keep_free = 0,
+        };
+        JournalFile *f;
+
+        log_set_max_level(LOG_INFO);
+
+        if (argc > 1)
+                assert_se(safe_atou(argv[1], &n) >= 0);
+
+        assert_se(n > 0);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        /* Size the hash table for a big file, so that filling it
+         * doesn't take forever */
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0644, false, false, &metrics, NULL, NULL, &f) == 0);
+        fill(f, n);
+        journal_file_close(f);
+
+        output(t, n, OUTPUT_SHORT, "short");
+        output(t, n, OUTPUT_CAT, "cat");
+        output(t, n, OUTPUT_JSON, "json");
+        output(t, n, OUTPUT_JSON_PRETTY, "json-pretty");
+        output(t, n, OUTPUT_EXPORT, "export");
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return 0;
+}
@@ -0,0 +1,119 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <syslog.h>
+
+#include "journald-rate-limit.h"
+#include "log.h"
+#include "util.h"
+
+/* More than the limiter keeps track of at once */
+#define N_GROUPS 20000U
+
+/* What the limiter keeps track of at once */
+#define GROUPS_MAX 8191U
+
+static void test_burst(void) {
+        JournalRateLimit *r;
+        unsigned i;
+
+        r = journal_rate_limit_new(USEC_PER_HOUR, 10);
+        assert_se(r);
+
+        /* The first message starts the interval, and burst more
+         * are let through */
+        for (i = 0; i < 11; i++)
+                assert_se(journal_rate_limit_test(r, "/system/foo.service", LOG_INFO, 0) == 1);
+
+        for (i = 0; i < 5; i++)
+                assert_se(journal_rate_limit_test(r, "/system/foo.service", LOG_INFO, 0) == 0);
+
+        /* Priorities are limited separately, and so are groups */
+        assert_se(journal_rate_limit_test(r, "/system/foo.service", LOG_ERR, 0) == 1);
+        assert_se(journal_rate_limit_test(r, "/system/bar.service", LOG_INFO, 0) == 1);
+
+        assert_se(journal_rate_limit_get_suppressed(r, "/system/foo.service") == 5);
+        assert_se(journal_rate_limit_get_suppressed(r, "/system/bar.service") == 0);
+
+        journal_rate_limit_free(r);
+}
+
+static void test_many_groups(void) {
+        JournalRateLimit *r;
+        char id[64];
+        unsigned i, k;
+
+        r = journal_rate_limit_new(USEC_PER_HOUR, 1);
+        assert_se(r);
+
+        /* Get every group rate limited, while older groups are
+         * pushed out as more are added */
+        for (i = 0; i < N_GROUPS; i++) {
+                snprintf(id, sizeof(id), "/system/unit-%u.service", i);
+
+                for (k = 0; k < 2; k++)
+                        assert_se(journal_rate_limit_test(r, id, LOG_INFO, 0) == 1);
+
+                assert_se(journal_rate_limit_test(r, id, LOG_INFO, 0) == 0);
+        }
+
+        /* The most recent groups are still known and limited, the
+         * others start over */
+        for (i = N_GROUPS; i > 0; i--) {
+                snprintf(id, sizeof(id), "/system/unit-%u.service", i - 1);
+
+                if (N_GROUPS - i < GROUPS_MAX)
+                        assert_se(journal_rate_limit_test(r, id, LOG_INFO, 0) == 0);
+                else
+                        assert_se(journal_rate_limit_test(r, id, LOG_INFO, 0) == 1);
+        }
+
+        /* Suppressed messages are counted even for groups that
+         * have been forgotten since */
+        assert_se(journal_rate_limit_get_suppressed(r, "/system/unit-0.service") == 1);
+
+        journal_rate_limit_dump(r, stdout);
+        journal_rate_limit_free(r);
+}
+
+static void test_disabled(void) {
+        JournalRateLimit *r;
+        unsigned i;
+
+        r = journal_rate_limit_new(0, 0);
+        assert_se(r);
+
+        for (i = 0; i < 100; i++)
+                assert_se(journal_rate_limit_test(r, "/system/foo.service", LOG_INFO, 0) == 1);
+
+        journal_rate_limit_free(r);
+}
+
+int main(int argc, char *argv[]) {
+        log_set_max_level(LOG_DEBUG);
+
+        test_burst();
+        test_many_groups();
+        test_disabled();
+
+        return 0;
+}
@@ -0,0 +1,148 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+#include "journal-file.h"
+
+#define N_ENTRIES_DEFAULT 1000000U
+#define N_SEEKS 20000U
+#define BATCH_SIZE 64U
+
+static void fill(JournalFile *f, unsigned n, dual_timestamp *first) {
+        JournalBatchEntry batch[BATCH_SIZE];
+        char messages[BATCH_SIZE][sizeof("MESSAGE=Seek benchmark entry ") + DECIMAL_STR_MAX(unsigned)];
+        struct iovec iovec[BATCH_SIZE][2];
+        dual_timestamp ts;
+        unsigned i, k, m;
+
+        dual_timestamp_get(&ts);
+        *first = ts;
+
+        for (i = 0; i < n; i += m) {
+                m = MIN(BATCH_SIZE, n - i);
+
+                for (k = 0; k < m; k++) {
+                        snprintf(messages[k], sizeof(messages[k]), "MESSAGE=Seek benchmark entry %u", i + k);
+                        IOVEC_SET_STRING(iovec[k][0], messages[k]);
+                        IOVEC_SET_STRING(iovec[k][1], "_SYSTEMD_UNIT=benchmark.service");
+
+                        /* One entry per millisecond */
+                        ts.realtime += USEC_PER_MSEC;
+                        ts.monotonic += USEC_PER_MSEC;
+
+                        batch[k].ts = ts;
+                        batch[k].iovec = iovec[k];
+                        batch[k].n_iovec = ELEMENTSOF(iovec[k]);
+                }
+
+                assert_se(journal_file_append_entries(f, batch, m, NULL, NULL) == 0);
+        }
+}
+
+static void seek(JournalFile *f, unsigned n, const dual_timestamp *first, bool use_index) {
+        usec_t seqnum_usec = 0, realtime_usec = 0;
+        unsigned i;
+
+        if (use_index)
+                f->header->compatible_flags |= htole32(HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX);
+        else
+                f->header->compatible_flags &= ~htole32(HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX);
+
+        srand(4711);
+
+        for (i = 0; i < N_SEEKS; i++) {
+                uint64_t k = (uint64_t) rand() % n;
+                Object *o;
+                usec_t t;
+
+                /* Measure cold seeks, as a reader jumping around in
+                 * the file would do them */
+                hashmap_clear_free(f->chain_cache);
+
+                t = now(CLOCK_MONOTONIC);
+                assert_se(journal_file_move_to_entry_by_seqnum(f, k + 1, DIRECTION_DOWN, &o, NULL) == 1);
+                seqnum_usec += now(CLOCK_MONOTONIC) - t;
+                assert_se(le64toh(o->entry.seqnum) == k + 1);
+
+                hashmap_clear_free(f->chain_cache);
+
+                t = now(CLOCK_MONOTONIC);
+                assert_se(journal_file_move_to_entry_by_realtime(f, first->realtime + (k + 1) * USEC_PER_MSEC, DIRECTION_DOWN, &o, NULL) == 1);
+                realtime_usec += now(CLOCK_MONOTONIC) - t;
+                assert_se(le64toh(o->entry.seqnum) == k + 1);
+        }
+
+        printf("%-14s %u seeks, by seqnum %.2f us/seek, by realtime %.2f us/seek\n",
+               use_index ? "with index" : "without index",
+               N_SEEKS,
+               (double) seqnum_usec / N_SEEKS,
+               (double) realtime_usec / N_SEEKS);
+}
+
+int main(int argc, char *argv[]) {
+        char t[] = "/tmp/journal-seek-XXXXXX";
+        unsigned n = N_ENTRIES_DEFAULT;
+        JournalMetrics metrics = {
+                .max_use = (uint64_t) -1,
+                .max_size = 1024ULL*1024ULL*1024ULL,
+                .min_size = (uint64_t) -1,
+                .keep_free = 0,
+        };
+        dual_timestamp first;
+        JournalFile *f;
+
+        log_set_max_level(LOG_INFO);
+
+        if (argc > 1)
+                assert_se(safe_atou(argv[1], &n) >= 0);
+
+        assert_se(n > 0);
+
+        /* journal_file_open requires a valid machine id */
+        if (access("/etc/machine-id", F_OK) != 0)
+                return EXIT_TEST_SKIP;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        /* Size the hash table for a big file, so that filling it
+         * doesn't dominate the run time */
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0644, false, false, &metrics, NULL, NULL, &f) == 0);
+
+        fill(f, n, &first);
+
+        printf("%u entries, %"PRIu64" entry arrays\n", n, le64toh(f->header->n_entry_arrays));
+
+        seek(f, n, &first, false);
+        seek(f, n, &first, true);
+
+        journal_file_close(f);
+
+        assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        return 0;
+}
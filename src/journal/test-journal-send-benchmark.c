@@ -0,0 +1,142 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/* Sends messages too large for a datagram to the running journald,
+ * for sizes from 64K to 16M, and follows the journal to see how long
+ * it takes for them to show up. Rate limiting in journald should be
+ * turned off (RateLimitBurst=0) for this to be meaningful. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <systemd/sd-journal.h>
+
+#include "log.h"
+#include "macro.h"
+#include "util.h"
+
+#define MESSAGE_SIZE_MIN (64ULL*1024ULL)
+#define MESSAGE_SIZE_MAX (16ULL*1024ULL*1024ULL)
+
+/* How much to send of each size */
+#define BYTES_PER_SIZE (128ULL*1024ULL*1024ULL)
+#define N_MESSAGES_MIN 8U
+
+/* Give up once nothing new showed up for this long */
+#define IDLE_TIMEOUT_USEC (10*USEC_PER_SEC)
+
+static int benchmark(size_t size) {
+        char a[FORMAT_BYTES_MAX], run[33], match[sizeof("BENCHMARK_RUN=") + 32];
+        _cleanup_free_ char *message = NULL;
+        usec_t start, sent, last_progress, last_seen = 0;
+        unsigned n, i, received = 0;
+        struct iovec iovec[2];
+        sd_id128_t id;
+        sd_journal *j;
+        size_t k;
+
+        n = MAX(BYTES_PER_SIZE / size, (unsigned long long) N_MESSAGES_MIN);
+
+        /* Something that compresses about as well as a stack trace
+         * would */
+        message = malloc(size);
+        assert_se(message);
+
+        k = strlen("MESSAGE=");
+        memcpy(message, "MESSAGE=", k);
+        for (i = 0; k < size; k++, i++)
+                message[k] = i % 79 == 78 ? '\n' : 'a' + (i * 7 + i / 79) % 26;
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+        sd_id128_to_string(id, run);
+        snprintf(match, sizeof(match), "BENCHMARK_RUN=%s", run);
+
+        iovec[0].iov_base = message;
+        iovec[0].iov_len = size;
+        IOVEC_SET_STRING(iovec[1], match);
+
+        assert_se(sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY) >= 0);
+        assert_se(sd_journal_add_match(j, match, 0) >= 0);
+        assert_se(sd_journal_seek_realtime_usec(j, now(CLOCK_REALTIME)) >= 0);
+        assert_se(sd_journal_get_fd(j) >= 0);
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (i = 0; i < n; i++)
+                assert_se(sd_journal_sendv(iovec, ELEMENTSOF(iovec)) >= 0);
+
+        sent = now(CLOCK_MONOTONIC);
+        last_progress = sent;
+
+        while (received < n) {
+                int r;
+
+                r = sd_journal_next(j);
+                assert_se(r >= 0);
+
+                if (r == 0) {
+                        if (now(CLOCK_MONOTONIC) > last_progress + IDLE_TIMEOUT_USEC)
+                                break;
+
+                        assert_se(sd_journal_wait(j, 100 * USEC_PER_MSEC) >= 0);
+                        continue;
+                }
+
+                received++;
+                last_seen = last_progress = now(CLOCK_MONOTONIC);
+        }
+
+        sd_journal_close(j);
+
+        printf("%8s: %3u/%3u messages, sending %.3fs, until written %.3fs, %.1f MiB/s\n",
+               format_bytes(a, sizeof(a), size), received, n,
+               (double) (sent - start) / USEC_PER_SEC,
+               (double) (last_seen - start) / USEC_PER_SEC,
+               (double) size * received / 1024 / 1024 * USEC_PER_SEC / (double) MAX(last_seen - start, 1ULL));
+
+        if (received < n) {
+                log_warning("%u messages were lost, is rate limiting turned off?", n - received);
+                return -EIO;
+        }
+
+        return 0;
+}
+
+int main(int argc, char *argv[]) {
+        sd_journal *j;
+        size_t size;
+        int r = 0;
+
+        log_set_max_level(LOG_INFO);
+
+        if (sd_journal_open(&j, SD_JOURNAL_LOCAL_ONLY) < 0) {
+                log_info("Can't open the journal, skipping.");
+                return EXIT_TEST_SKIP;
+        }
+        sd_journal_close(j);
+
+        for (size = MESSAGE_SIZE_MIN; size <= MESSAGE_SIZE_MAX; size *= 4)
+                if (benchmark(size) < 0)
+                        r = -EIO;
+
+        return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
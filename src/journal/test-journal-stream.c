@@ -26,6 +26,7 @@
 
 #include "journal-file.h"
 #include "journal-internal.h"
+#include "logs-show.h"
 #include "util.h"
 #include "log.h"
 
@@ -179,6 +180,86 @@ int main(int argc, char *argv[]) {
         SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
                 printf("%.*s\n", (int) l, (const char*) data);
 
+        printf("NEXT TEST\n");
+        sd_journal_flush_matches(j);
+        assert_se(sd_journal_add_match(j, "MAGIC=late", 0) >= 0);
+        assert_se(sd_journal_add_match(j, "NUMBER=1", 0) >= 0);
+        assert_se(sd_journal_add_disjunction(j) >= 0);
+        assert_se(sd_journal_add_match(j, "MAGIC=quux", 0) >= 0);
+        assert_se(sd_journal_add_match(j, "NUMBER=5", 0) >= 0);
+
+        /* The first term cannot match in any file... */
+        i = 0;
+        SD_JOURNAL_FOREACH(j)
+                i++;
+        assert_se(i == 1);
+
+        /* ...until the data it needs is appended */
+        assert_se(journal_file_open("one.journal", O_RDWR, 0, true, false, NULL, NULL, NULL, &one) == 0);
+        {
+                dual_timestamp ts;
+                struct iovec iovec[2];
+
+                dual_timestamp_get(&ts);
+                IOVEC_SET_STRING(iovec[0], "NUMBER=1");
+                IOVEC_SET_STRING(iovec[1], "MAGIC=late");
+                assert_se(journal_file_append_entry(one, &ts, iovec, 2, NULL, NULL, NULL) == 0);
+        }
+        journal_file_close(one);
+
+        i = 0;
+        SD_JOURNAL_FOREACH(j)
+                i++;
+        assert_se(i == 2);
+
+        printf("NEXT TEST\n");
+        assert_se(journal_file_open("one.journal", O_RDWR, 0, true, false, NULL, NULL, NULL, &one) == 0);
+        {
+                dual_timestamp ts;
+                struct iovec iovec[5];
+
+                dual_timestamp_get(&ts);
+                IOVEC_SET_STRING(iovec[0], "NUMBER=repeated");
+                IOVEC_SET_STRING(iovec[1], "MESSAGE=first message");
+                IOVEC_SET_STRING(iovec[2], "PRIORITY=7");
+                IOVEC_SET_STRING(iovec[3], "MESSAGE=second message");
+                IOVEC_SET_STRING(iovec[4], "PRIORITY=2");
+                assert_se(journal_file_append_entry(one, &ts, iovec, 5, NULL, NULL, NULL) == 0);
+        }
+        journal_file_close(one);
+
+        sd_journal_flush_matches(j);
+        assert_se(sd_journal_add_match(j, "NUMBER=repeated", 0) >= 0);
+
+        /* If a field is set more than once, -o short shows the
+         * value that comes last */
+        i = 0;
+        SD_JOURNAL_FOREACH(j) {
+                _cleanup_free_ char *buf = NULL;
+                _cleanup_fclose_ FILE *f = NULL;
+                size_t size;
+
+                assert_se(sd_journal_get_data(j, "MESSAGE", &data, &l) >= 0);
+                assert_se(l == strlen("MESSAGE=first message") && memcmp(data, "MESSAGE=first message", l) == 0);
+
+                assert_se(journal_get_data_last(j, "MESSAGE", &data, &l) >= 0);
+                assert_se(l == strlen("MESSAGE=second message") && memcmp(data, "MESSAGE=second message", l) == 0);
+
+                assert_se(journal_get_data_last(j, "PRIORITY", &data, &l) >= 0);
+                assert_se(l == strlen("PRIORITY=2") && memcmp(data, "PRIORITY=2", l) == 0);
+
+                assert_se(f = open_memstream(&buf, &size));
+                assert_se(output_journal(f, j, OUTPUT_SHORT, 0, 0, NULL) >= 0);
+                fflush(f);
+                printf("%s", buf);
+
+                assert_se(strstr(buf, "second message"));
+                assert_se(!strstr(buf, "first message"));
+
+                i++;
+        }
+        assert_se(i == 1);
+
         assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
 
         return 0;
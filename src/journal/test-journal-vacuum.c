@@ -0,0 +1,176 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal-file.h"
+#include "journal-vacuum.h"
+#include "log.h"
+#include "path-util.h"
+#include "util.h"
+
+#define N_FILES 6
+
+static uint64_t usage_of(const char *dir, const char *name) {
+        _cleanup_free_ char *p = NULL;
+        struct stat st;
+
+        p = strjoin(dir, "/", name, NULL);
+        assert_se(p);
+
+        if (stat(p, &st) < 0) {
+                assert_se(errno == ENOENT);
+                return 0;
+        }
+
+        return 512UL * (uint64_t) st.st_blocks;
+}
+
+static bool exists(const char *dir, const char *name) {
+        _cleanup_free_ char *p = NULL;
+
+        p = strjoin(dir, "/", name, NULL);
+        assert_se(p);
+
+        return access(p, F_OK) >= 0;
+}
+
+static void remove_file(const char *dir, const char *name) {
+        _cleanup_free_ char *p = NULL;
+
+        p = strjoin(dir, "/", name, NULL);
+        assert_se(p);
+
+        assert_se(unlink(p) >= 0);
+}
+
+static void append(JournalFile *f) {
+        struct iovec iovec;
+        dual_timestamp ts;
+
+        dual_timestamp_get(&ts);
+        IOVEC_SET_STRING(iovec, "MESSAGE=test");
+
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+}
+
+/* Rotates f and returns the name of the archived file */
+static char *rotate(JournalFile **f, VacuumLedger *l) {
+        _cleanup_free_ char *p = NULL;
+        char *name;
+
+        assert_se(journal_file_get_archived_path(*f, &p) >= 0);
+        assert_se(journal_file_rotate(f, false, false) >= 0);
+
+        name = strdup(path_get_file_name(p));
+        assert_se(name);
+
+        if (l) {
+                assert_se(vacuum_ledger_add(l, name) >= 0);
+                assert_se(vacuum_ledger_add(l, "system.journal") >= 0);
+        }
+
+        return name;
+}
+
+static uint64_t ledger_usage(VacuumLedger *l) {
+        uint64_t u;
+
+        assert_se(vacuum_ledger_get_usage(l, &u) >= 0);
+        return u;
+}
+
+int main(int argc, char *argv[]) {
+        char dir[] = "/tmp/journal-vacuum-XXXXXX";
+        char *archived[N_FILES + 1];
+        _cleanup_free_ char *fn = NULL;
+        JournalFile *f;
+        VacuumLedger *l;
+        uint64_t sum = 0;
+        unsigned i;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(dir));
+
+        fn = strappend(dir, "/system.journal");
+        assert_se(fn);
+
+        assert_se(journal_file_open(fn, O_RDWR|O_CREAT, 0644, false, false, NULL, NULL, NULL, &f) == 0);
+
+        for (i = 0; i < N_FILES; i++) {
+                append(f);
+                archived[i] = rotate(&f, NULL);
+                sum += usage_of(dir, archived[i]);
+        }
+
+        append(f);
+
+        /* The directory is read when the ledger is used first */
+        assert_se(vacuum_ledger_new(dir, &l) >= 0);
+        assert_se(ledger_usage(l) == sum + usage_of(dir, "system.journal"));
+
+        /* Drops the oldest files, until the rest fits */
+        assert_se(vacuum_ledger_vacuum(l, sum - usage_of(dir, archived[0]) - usage_of(dir, archived[1]), 0, 0, NULL) >= 0);
+        assert_se(!exists(dir, archived[0]));
+        assert_se(!exists(dir, archived[1]));
+        for (i = 2; i < N_FILES; i++)
+                assert_se(exists(dir, archived[i]));
+
+        sum = 0;
+        for (i = 2; i < N_FILES; i++)
+                sum += usage_of(dir, archived[i]);
+        assert_se(ledger_usage(l) == sum + usage_of(dir, "system.journal"));
+
+        /* Files we are told about are accounted for... */
+        archived[N_FILES] = rotate(&f, l);
+        sum += usage_of(dir, archived[N_FILES]);
+        assert_se(ledger_usage(l) == sum + usage_of(dir, "system.journal"));
+
+        /* ...and archived empty ones deleted right away */
+        free(rotate(&f, l));
+        assert_se(ledger_usage(l) == sum + usage_of(dir, "system.journal"));
+
+        /* Changes made by somebody else are noticed, once they
+         * happen in a later tick of the file system clock */
+        usleep(100 * USEC_PER_MSEC);
+        sum -= usage_of(dir, archived[2]);
+        remove_file(dir, archived[2]);
+        assert_se(ledger_usage(l) == sum + usage_of(dir, "system.journal"));
+
+        /* Everything but the active file */
+        assert_se(vacuum_ledger_vacuum(l, 1, 0, 0, NULL) >= 0);
+        for (i = 0; i <= N_FILES; i++)
+                assert_se(!exists(dir, archived[i]));
+        assert_se(ledger_usage(l) == usage_of(dir, "system.journal"));
+
+        vacuum_ledger_free(l);
+        journal_file_close(f);
+
+        for (i = 0; i <= N_FILES; i++)
+                free(archived[i]);
+
+        assert_se(rm_rf_dangerous(dir, false, true, false) >= 0);
+
+        return 0;
+}
@@ -20,6 +20,7 @@
 ***/
 
 #include <fcntl.h>
+#include <glob.h>
 #include <unistd.h>
 
 #include <systemd/sd-journal.h>
@@ -28,6 +29,8 @@
 #include "journal-file.h"
 #include "journal-authenticate.h"
 #include "journal-vacuum.h"
+#include "journal-verify.h"
+#include "journal-internal.h"
 
 static bool arg_keep = false;
 
@@ -176,6 +179,628 @@ static void test_empty(void) {
         journal_file_close(f4);
 }
 
+static void test_hash_chain_depth(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        char t[] = "/tmp/journal-XXXXXX";
+        unsigned i;
+        uint64_t n_data;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+
+        dual_timestamp_get(&ts);
+
+        for (i = 0; i < 1000; i++) {
+                char buf[sizeof("TEST=") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec;
+
+                snprintf(buf, sizeof(buf), "TEST=%u", i);
+                iovec.iov_base = buf;
+                iovec.iov_len = strlen(buf);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        /* 1000 objects in 2047 buckets can't do without collisions */
+        assert_se(le64toh(f->header->data_hash_chain_depth) > 0);
+        assert_se(le64toh(f->header->field_hash_chain_depth) == 0);
+        assert_se(!journal_file_rotate_suggested(f, 0));
+
+        /* Pretend the chains got too long, and see that the
+         * successor gets a hash table with more room */
+        f->header->data_hash_chain_depth = htole64(1000);
+        assert_se(journal_file_rotate_suggested(f, 0));
+
+        n_data = le64toh(f->header->n_data);
+        assert_se(journal_file_rotate(&f, false, false) >= 0);
+
+        assert_se(le64toh(f->header->data_hash_chain_depth) == 0);
+        assert_se(le64toh(f->header->data_hash_table_size) / sizeof(HashItem) >= n_data * 2 * 4 / 3);
+
+        journal_file_print_header(f);
+        journal_file_close(f);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else {
+                journal_directory_vacuum(".", 3000000, 0, 0, NULL);
+
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+        }
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_append_entries(void) {
+        JournalBatchEntry entries[10];
+        struct iovec iovec[10][3];
+        char messages[10][sizeof("MESSAGE=") + DECIMAL_STR_MAX(unsigned)];
+        static const char hostname[] = "_HOSTNAME=foo", boot_id[] = "_BOOT_ID=bar";
+        dual_timestamp ts;
+        JournalFile *f;
+        char t[] = "/tmp/journal-XXXXXX";
+        unsigned i, n;
+        Object *o;
+        uint64_t p;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+
+        dual_timestamp_get(&ts);
+
+        for (i = 0; i < ELEMENTSOF(entries); i++) {
+                snprintf(messages[i], sizeof(messages[i]), "MESSAGE=%u", i);
+                IOVEC_SET_STRING(iovec[i][0], messages[i]);
+                IOVEC_SET_STRING(iovec[i][1], hostname);
+                IOVEC_SET_STRING(iovec[i][2], boot_id);
+
+                entries[i].ts = ts;
+                entries[i].iovec = iovec[i];
+                entries[i].n_iovec = 3;
+        }
+
+        assert_se(journal_file_append_entries(f, entries, ELEMENTSOF(entries), NULL, &n) == 0);
+        assert_se(n == ELEMENTSOF(entries));
+
+        /* The shared fields are only stored once */
+        assert_se(le64toh(f->header->n_entries) == 10);
+        assert_se(le64toh(f->header->n_data) == 12);
+
+        assert_se(journal_file_find_data_object(f, hostname, strlen(hostname), &o, &p) == 1);
+        assert_se(le64toh(o->data.n_entries) == 10);
+
+        assert_se(journal_file_move_to_entry_by_seqnum(f, 5, DIRECTION_DOWN, &o, NULL) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 5);
+        assert_se(journal_file_entry_n_items(o) == 3);
+
+        /* A batch stops at the first entry that can't be written */
+        entries[3].ts.monotonic = 0;
+        assert_se(journal_file_append_entries(f, entries, ELEMENTSOF(entries), NULL, &n) == -EINVAL);
+        assert_se(n == 3);
+        assert_se(le64toh(f->header->n_entries) == 13);
+
+        journal_file_close(f);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else {
+                journal_directory_vacuum(".", 3000000, 0, 0, NULL);
+
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+        }
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_entry_array_index(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        char t[] = "/tmp/journal-XXXXXX";
+        unsigned i;
+        Object *o;
+        uint64_t p;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(JOURNAL_HEADER_ENTRY_ARRAY_INDEX(f->header));
+
+        dual_timestamp_get(&ts);
+
+        for (i = 0; i < 10000; i++) {
+                char buf[sizeof("TEST=") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec;
+
+                /* Every realtime timestamp appears twice */
+                ts.realtime += i % 2;
+                ts.monotonic++;
+
+                snprintf(buf, sizeof(buf), "TEST=%u", i);
+                IOVEC_SET_STRING(iovec, buf);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        assert_se(f->header->entry_array_index_offset != 0);
+        assert_se(journal_file_move_to_object(f, OBJECT_ENTRY_ARRAY_INDEX, le64toh(f->header->entry_array_index_offset), &o) == 0);
+        assert_se(le64toh(o->entry_array_index.n_items) > 5);
+
+        journal_file_print_header(f);
+
+        /* Seeks have to end up in the same place with and without
+         * the index */
+        for (i = 0; i < 10000; i += 7) {
+                uint64_t with[4], without[4];
+                unsigned k;
+
+                for (k = 0; k < 2; k++) {
+                        uint64_t *r = k == 0 ? with : without;
+
+                        if (k == 1)
+                                f->header->compatible_flags &= ~htole32(HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX);
+
+                        assert_se(journal_file_move_to_entry_by_seqnum(f, i + 1, DIRECTION_DOWN, &o, &r[0]) == 1);
+                        assert_se(le64toh(o->entry.seqnum) == i + 1);
+                        assert_se(journal_file_move_to_entry_by_seqnum(f, i + 1, DIRECTION_UP, &o, &r[1]) == 1);
+                        assert_se(le64toh(o->entry.seqnum) == i + 1);
+
+                        assert_se(journal_file_move_to_entry_by_realtime(f, ts.realtime - i / 2, DIRECTION_DOWN, &o, &r[2]) == 1);
+                        assert_se(journal_file_move_to_entry_by_realtime(f, ts.realtime - i / 2, DIRECTION_UP, &o, &r[3]) == 1);
+                        assert_se(le64toh(o->entry.realtime) == ts.realtime - i / 2);
+
+                        if (k == 1)
+                                f->header->compatible_flags |= htole32(HEADER_COMPATIBLE_ENTRY_ARRAY_INDEX);
+                }
+
+                assert_se(memcmp(with, without, sizeof(with)) == 0);
+        }
+
+        assert_se(journal_file_move_to_entry_by_seqnum(f, 10001, DIRECTION_DOWN, &o, &p) == 0);
+        assert_se(journal_file_move_to_entry_by_seqnum(f, 10001, DIRECTION_UP, &o, &p) == 1);
+        assert_se(le64toh(o->entry.seqnum) == 10000);
+
+        journal_file_close(f);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else {
+                journal_directory_vacuum(".", 3000000, 0, 0, NULL);
+
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+        }
+
+        puts("------------------------------------------------------------");
+}
+
+static void append_summary_entries(JournalFile *f, unsigned first, unsigned n, usec_t realtime) {
+        unsigned i;
+
+        for (i = first; i < first + n; i++) {
+                char message[sizeof("MESSAGE=") + DECIMAL_STR_MAX(unsigned)];
+                char unit[sizeof("UNIT=unit-.service") + DECIMAL_STR_MAX(unsigned)];
+                struct iovec iovec[2];
+                dual_timestamp ts;
+
+                snprintf(message, sizeof(message), "MESSAGE=%u", i);
+                snprintf(unit, sizeof(unit), "UNIT=unit-%u.service", i % 3);
+                IOVEC_SET_STRING(iovec[0], message);
+                IOVEC_SET_STRING(iovec[1], unit);
+
+                dual_timestamp_get(&ts);
+                ts.realtime = realtime + i;
+
+                assert_se(journal_file_append_entry(f, &ts, iovec, ELEMENTSOF(iovec), NULL, NULL, NULL) == 0);
+        }
+}
+
+static void test_field_summary(void) {
+        static const char unit0[] = "UNIT=unit-0.service";
+        char t[] = "/tmp/journal-summary-XXXXXX";
+        UniqueValue **values;
+        unsigned n_values, i, n;
+        const void *data;
+        size_t l;
+        JournalFile *f;
+        sd_journal *j;
+        Object *o;
+        uint64_t p;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        /* MESSAGE= has too many values to be summarized, UNIT= is */
+        assert_se(journal_file_open("one.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+        append_summary_entries(f, 0, FIELD_SUMMARY_ITEMS_MAX + 1, 1000000);
+        journal_file_close(f);
+
+        assert_se(journal_file_open("one.journal", O_RDONLY, 0, false, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(journal_file_field_summaries_current(f));
+        assert_se(journal_file_find_field_summary(f, "MESSAGE", strlen("MESSAGE"), NULL, NULL) == 0);
+        assert_se(journal_file_find_field_summary(f, "UNIT", strlen("UNIT"), &o, NULL) == 1);
+        assert_se(journal_file_field_summary_n_items(o) == 3);
+
+        assert_se(journal_file_find_data_object(f, unit0, strlen(unit0), NULL, &p) == 1);
+        assert_se(journal_file_find_field_summary(f, "UNIT", strlen("UNIT"), &o, NULL) == 1);
+        for (i = 0; i < 3; i++)
+                if (le64toh(o->field_summary.items[i].data_offset) == p)
+                        break;
+        assert_se(i < 3);
+        assert_se(le64toh(o->field_summary.items[i].n_entries) == (FIELD_SUMMARY_ITEMS_MAX + 3) / 3);
+        assert_se(le64toh(o->field_summary.items[i].first_realtime) == 1000000);
+        assert_se(le64toh(o->field_summary.items[i].last_realtime) == 1000000 + FIELD_SUMMARY_ITEMS_MAX / 3 * 3);
+        journal_file_close(f);
+
+        /* Appending makes the summaries outdated, until the file is
+         * closed again */
+        assert_se(journal_file_open("one.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+        append_summary_entries(f, FIELD_SUMMARY_ITEMS_MAX + 1, 1, 1000000);
+        assert_se(!journal_file_field_summaries_current(f));
+        assert_se(journal_file_find_field_summary(f, "UNIT", strlen("UNIT"), NULL, NULL) == 0);
+        journal_file_close(f);
+
+        /* A second file, which is still open and hence not
+         * summarized, shares one value with the first one */
+        assert_se(journal_file_open("two.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+        append_summary_entries(f, 2, 2, 5000000);
+
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+
+        assert_se(journal_get_unique_values(j, "UNIT", &values, &n_values) >= 0);
+        assert_se(n_values == 3);
+        for (i = 0; i < n_values; i++)
+                if (values[i]->size == strlen(unit0) && memcmp(values[i]->data, unit0, strlen(unit0)) == 0) {
+                        assert_se(values[i]->n_entries == (FIELD_SUMMARY_ITEMS_MAX + 3) / 3 + 1);
+                        assert_se(values[i]->first_realtime == 1000000);
+                        assert_se(values[i]->last_realtime == 5000000 + 3);
+                }
+        unique_values_free(values, n_values);
+
+        assert_se(sd_journal_query_unique(j, "UNIT") >= 0);
+        n = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                n++;
+        assert_se(n == 3);
+
+        assert_se(sd_journal_query_unique(j, "MESSAGE") >= 0);
+        n = 0;
+        SD_JOURNAL_FOREACH_UNIQUE(j, data, l)
+                n++;
+        assert_se(n == FIELD_SUMMARY_ITEMS_MAX + 2);
+
+        sd_journal_close(j);
+        journal_file_close(f);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void append_boot_entries(JournalFile *f, sd_id128_t boot_id, unsigned n, usec_t realtime) {
+        struct iovec iovec;
+        dual_timestamp ts;
+        unsigned i;
+
+        f->header->boot_id = boot_id;
+
+        IOVEC_SET_STRING(iovec, "MESSAGE=boot");
+
+        for (i = 0; i < n; i++) {
+                dual_timestamp_get(&ts);
+                ts.realtime = realtime + i;
+
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+}
+
+static void test_boot_index(void) {
+        char t[] = "/tmp/journal-boots-XXXXXX";
+        sd_id128_t boots[BOOT_INDEX_ITEMS_MAX + 1];
+        _cleanup_free_ BootIndexItem *items = NULL;
+        _cleanup_free_ BootRange *ranges = NULL;
+        unsigned n_items, n_ranges, i, k;
+        JournalFile *f;
+        sd_journal *j;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        for (i = 0; i < ELEMENTSOF(boots); i++)
+                assert_se(sd_id128_randomize(&boots[i]) >= 0);
+
+        /* More boots than fit into one index object, and the first
+         * boot coming back at the end */
+        assert_se(journal_file_open("one.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(JOURNAL_HEADER_BOOT_INDEX(f->header));
+        for (i = 0; i < ELEMENTSOF(boots); i++)
+                append_boot_entries(f, boots[i], 3, (i + 1) * 1000000);
+        append_boot_entries(f, boots[0], 1, 100000000);
+
+        assert_se(journal_file_get_boot_index(f, &items, &n_items) == 1);
+        assert_se(n_items == ELEMENTSOF(boots) + 1);
+        for (i = 0; i < ELEMENTSOF(boots); i++) {
+                assert_se(sd_id128_equal(items[i].boot_id, boots[i]));
+                assert_se(le64toh(items[i].first_seqnum) == i * 3 + 1);
+                assert_se(le64toh(items[i].last_seqnum) == i * 3 + 3);
+                assert_se(le64toh(items[i].first_realtime) == (i + 1) * 1000000);
+                assert_se(le64toh(items[i].last_realtime) == (i + 1) * 1000000 + 2);
+        }
+        assert_se(sd_id128_equal(items[i].boot_id, boots[0]));
+        assert_se(items[i].first_seqnum == items[i].last_seqnum);
+        assert_se(items[i].first_entry_offset == items[i].last_entry_offset);
+
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+        journal_file_close(f);
+
+        /* A second file continuing the last boot */
+        assert_se(journal_file_open("two.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+        append_boot_entries(f, boots[BOOT_INDEX_ITEMS_MAX], 2, 200000000);
+
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+        assert_se(journal_get_boots(j, &ranges, &n_ranges) >= 0);
+        assert_se(n_ranges == ELEMENTSOF(boots));
+
+        for (k = 0; k < n_ranges; k++) {
+                for (i = 0; i < ELEMENTSOF(boots); i++)
+                        if (sd_id128_equal(ranges[k].boot_id, boots[i]))
+                                break;
+                assert_se(i < ELEMENTSOF(boots));
+
+                assert_se(ranges[k].first_realtime == (i + 1) * 1000000);
+                if (i == 0)
+                        assert_se(ranges[k].last_realtime == 100000000);
+                else if (i == BOOT_INDEX_ITEMS_MAX)
+                        assert_se(ranges[k].last_realtime == 200000000 + 1);
+                else
+                        assert_se(ranges[k].last_realtime == (i + 1) * 1000000 + 2);
+        }
+
+        sd_journal_close(j);
+        journal_file_close(f);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static const char* const text_messages[] = {
+        "MESSAGE=Starting Foo Service...",
+        "MESSAGE=Started Foo Service.",
+        "MESSAGE=foo: connection refused, retrying",
+        "MESSAGE=Stopping Bar Service...",
+        "MESSAGE=bar: connection timed out",
+};
+
+static void append_text_entries(JournalFile *f, unsigned n) {
+        unsigned i;
+
+        for (i = 0; i < n; i++) {
+                struct iovec iovec;
+                dual_timestamp ts;
+
+                IOVEC_SET_STRING(iovec, text_messages[i % ELEMENTSOF(text_messages)]);
+                dual_timestamp_get(&ts);
+
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+}
+
+static unsigned count_text_matches(sd_journal *j, const char *text) {
+        unsigned n = 0;
+
+        sd_journal_flush_matches(j);
+        assert_se(sd_journal_add_match_text(j, text) >= 0);
+
+        SD_JOURNAL_FOREACH(j)
+                n++;
+
+        return n;
+}
+
+static void test_text_index(void) {
+        char t[] = "/tmp/journal-text-XXXXXX";
+        _cleanup_free_ uint64_t *tokens = NULL;
+        unsigned n_tokens;
+        glob_t g = {};
+        JournalFile *f;
+        sd_journal *j;
+        Object *o;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_text_tokenize("Connection refused, CONNECTION", strlen("Connection refused, CONNECTION"), &tokens, &n_tokens) >= 0);
+        assert_se(n_tokens == 2);
+
+        assert_se(journal_file_open("one.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+        append_text_entries(f, 50);
+        assert_se(!journal_file_text_index_current(f));
+        journal_file_close(f);
+
+        /* Merely closing the file doesn't index it... */
+        assert_se(journal_file_open("one.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(!journal_file_text_index_current(f));
+
+        /* ...but archiving it does */
+        assert_se(journal_file_rotate(&f, false, false) >= 0);
+        journal_file_close(f);
+        assert_se(unlink("one.journal") >= 0);
+
+        assert_se(glob("one@*.journal", 0, NULL, &g) == 0);
+        assert_se(g.gl_pathc == 1);
+        assert_se(journal_file_open(g.gl_pathv[0], O_RDONLY, 0, false, false, NULL, NULL, NULL, &f) == 0);
+        globfree(&g);
+        assert_se(journal_file_text_index_current(f));
+        assert_se(journal_file_move_to_object(f, OBJECT_TEXT_INDEX, le64toh(f->header->text_index_offset), &o) >= 0);
+        assert_se(le64toh(o->text_index.n_postings) == 17);
+        journal_file_close(f);
+
+        /* A second file is still open and hence not indexed */
+        assert_se(journal_file_open("two.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+        append_text_entries(f, 5);
+
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+
+        assert_se(count_text_matches(j, "foo service") == 22);
+        assert_se(count_text_matches(j, "CONNECTION") == 22);
+        assert_se(count_text_matches(j, "refused connection foo") == 11);
+        assert_se(count_text_matches(j, "connection service") == 0);
+        assert_se(count_text_matches(j, "conn") == 0);
+
+        /* Combined with other matches */
+        assert_se(sd_journal_add_match(j, "MESSAGE=bar: connection timed out", 0) >= 0);
+        assert_se(sd_journal_add_disjunction(j) >= 0);
+        assert_se(sd_journal_add_match(j, "MESSAGE=Started Foo Service.", 0) >= 0);
+        n_tokens = 0;
+        SD_JOURNAL_FOREACH_BACKWARDS(j)
+                n_tokens++;
+        assert_se(n_tokens == 11);
+
+        /* Messages appended later are found */
+        assert_se(count_text_matches(j, "bar") == 22);
+        append_text_entries(f, 5);
+        assert_se(count_text_matches(j, "bar") == 24);
+
+        assert_se(sd_journal_add_match_text(j, ",.") == -EINVAL);
+
+        sd_journal_close(j);
+        journal_file_close(f);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_offline(void) {
+        char t[] = "/tmp/journal-offline-XXXXXX";
+        struct iovec iovec;
+        JournalFile *f;
+        unsigned i;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, false, false, NULL, NULL, NULL, &f) == 0);
+
+        IOVEC_SET_STRING(iovec, "MESSAGE=offline");
+
+        /* Appending while the file is taken offline in the
+         * background either cancels that or waits for it */
+        for (i = 0; i < 100; i++) {
+                assert_se(journal_file_append_entry(f, NULL, &iovec, 1, NULL, NULL, NULL) == 0);
+                assert_se(f->header->state == STATE_ONLINE);
+
+                assert_se(journal_file_set_offline(f, false) == 0);
+                if (i % 2 == 0)
+                        assert_se(journal_file_set_offline(f, false) == 0);
+        }
+
+        assert_se(journal_file_set_offline(f, true) == 0);
+        assert_se(!journal_file_is_offlining(f));
+        assert_se(f->offline_state == OFFLINE_JOINED);
+        assert_se(f->header->state == STATE_OFFLINE);
+        assert_se(le64toh(f->header->n_entries) == 100);
+
+        journal_file_close(f);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_preallocate(void) {
+        char t[] = "/tmp/journal-preallocate-XXXXXX";
+        JournalMetrics metrics = {
+                .max_use = (uint64_t) -1,
+                .max_size = 16ULL*1024ULL*1024ULL,
+                .min_size = (uint64_t) -1,
+                .keep_free = 0,
+                .preallocate = 1024ULL*1024ULL,
+        };
+        struct iovec iovec;
+        struct stat st;
+        JournalFile *f;
+        uint64_t size;
+        unsigned i;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        /* Files grow in steps of the preallocation, hence only a
+         * few appends have to wait for it */
+        assert_se(journal_file_open("grow.journal", O_RDWR|O_CREAT, 0666, false, false, &metrics, NULL, NULL, &f) == 0);
+        IOVEC_SET_STRING(iovec, "MESSAGE=preallocated");
+        for (i = 0; i < 10000; i++)
+                assert_se(journal_file_append_entry(f, NULL, &iovec, 1, NULL, NULL, NULL) == 0);
+
+        size = le64toh(f->header->header_size) + le64toh(f->header->arena_size);
+        assert_se(size >= le64toh(f->header->tail_object_offset));
+        assert_se(f->n_allocation_stalls > 0);
+        assert_se(f->n_allocation_stalls <= size / metrics.preallocate);
+
+        /* Taking the file offline in the background tops up the
+         * preallocation, which the next append claims */
+        assert_se(journal_file_set_offline(f, false) == 0);
+        assert_se(journal_file_set_online(f) == 0);
+        assert_se(journal_file_set_offline(f, true) == 0);
+        assert_se(fstat(f->fd, &st) >= 0);
+        assert_se((uint64_t) st.st_size >= le64toh(f->header->tail_object_offset) + metrics.preallocate / 2);
+        journal_file_close(f);
+
+        /* Reserve the whole file up front */
+        metrics.preallocate = metrics.max_size;
+        assert_se(journal_file_open("reserved.journal", O_RDWR|O_CREAT, 0666, false, false, &metrics, NULL, NULL, &f) == 0);
+        assert_se(le64toh(f->header->header_size) + le64toh(f->header->arena_size) == metrics.max_size);
+        for (i = 0; i < 100; i++)
+                assert_se(journal_file_append_entry(f, NULL, &iovec, 1, NULL, NULL, NULL) == 0);
+        assert_se(f->n_allocation_stalls == 0);
+        journal_file_close(f);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf_dangerous(t, false, true, false) >= 0);
+
+        puts("------------------------------------------------------------");
+}
+
 int main(int argc, char *argv[]) {
         arg_keep = argc > 1;
 
@@ -185,6 +810,14 @@ int main(int argc, char *argv[]) {
 
         test_non_empty();
         test_empty();
+        test_hash_chain_depth();
+        test_append_entries();
+        test_entry_array_index();
+        test_field_summary();
+        test_boot_index();
+        test_text_index();
+        test_offline();
+        test_preallocate();
 
         return 0;
 }
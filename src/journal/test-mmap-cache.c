@@ -19,6 +19,7 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <unistd.h>
@@ -28,6 +29,63 @@
 #include "util.h"
 #include "mmap-cache.h"
 
+static void print_stats(MMapCache *m) {
+        printf("%"PRIu64" hit, %"PRIu64" missed, %"PRIu64" mapped, %"PRIu64" unmapped\n",
+               mmap_cache_get_hit(m),
+               mmap_cache_get_missed(m),
+               mmap_cache_get_mapped(m),
+               mmap_cache_get_unmapped(m));
+}
+
+static void test_scan(int fd) {
+        MMapCache *m;
+        uint64_t offset;
+        void *p;
+        int r;
+
+        assert_se(m = mmap_cache_new());
+
+        /* Scanning forward through 128M should only need a few
+         * large windows */
+        for (offset = 0; offset < 128ULL*1024ULL*1024ULL; offset += 4096) {
+                r = mmap_cache_get(m, fd, PROT_READ, 2, false, offset, 64, NULL, &p);
+                assert_se(r >= 0);
+        }
+
+        print_stats(m);
+        assert_se(mmap_cache_get_mapped(m) <= 8);
+        assert_se(mmap_cache_get_missed(m) == mmap_cache_get_mapped(m));
+
+        mmap_cache_unref(m);
+}
+
+static void test_lookups(int fd) {
+        MMapCache *m;
+        unsigned i;
+        void *p;
+        int r;
+
+        assert_se(m = mmap_cache_new());
+
+        /* Jumping around gives us small windows */
+        for (i = 0; i < 4; i++) {
+                r = mmap_cache_get(m, fd, PROT_READ, 3, false, (i * 7 % 4) * 256ULL*1024ULL*1024ULL, 64, NULL, &p);
+                assert_se(r >= 0);
+        }
+
+        assert_se(mmap_cache_get_missed(m) == 4);
+
+        /* Close by, but outside of a small window */
+        r = mmap_cache_get(m, fd, PROT_READ, 4, false, 256ULL*1024ULL*1024ULL + 2ULL*1024ULL*1024ULL, 64, NULL, &p);
+        assert_se(r >= 0);
+
+        print_stats(m);
+        assert_se(mmap_cache_get_missed(m) == 5);
+        assert_se(mmap_cache_get_hit(m) == 0);
+
+        mmap_cache_unref(m);
+}
+
 int main(int argc, char *argv[]) {
         int x, y, z, r;
         char px[] = "/tmp/testmmapXXXXXXX", py[] = "/tmp/testmmapYXXXXXX", pz[] = "/tmp/testmmapZXXXXXX";
@@ -69,8 +127,17 @@ int main(int argc, char *argv[]) {
 
         assert((uint8_t*) p + 1 == (uint8_t*) q);
 
+        print_stats(m);
+        assert_se(mmap_cache_get_hit(m) == 3);
+        assert_se(mmap_cache_get_missed(m) == 2);
+        assert_se(mmap_cache_get_mapped(m) == 2);
+        assert_se(mmap_cache_get_unmapped(m) == 0);
+
         mmap_cache_unref(m);
 
+        test_scan(y);
+        test_lookups(z);
+
         close_nointr_nofail(x);
         close_nointr_nofail(y);
         close_nointr_nofail(z);
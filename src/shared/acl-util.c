@@ -97,6 +97,49 @@ int calc_acl_mask_if_needed(acl_t *acl_p) {
         return 0;
 }
 
+int acl_add_user_read_fd(int fd, uid_t uid) {
+        acl_t acl;
+        acl_entry_t entry;
+        acl_permset_t permset;
+        int r;
+
+        assert(fd >= 0);
+
+        /* Lets uid read the file, without changing anything else */
+
+        acl = acl_get_fd(fd);
+        if (!acl)
+                return -errno;
+
+        r = acl_find_uid(acl, uid, &entry);
+        if (r <= 0) {
+                if (acl_create_entry(&acl, &entry) < 0 ||
+                    acl_set_tag_type(entry, ACL_USER) < 0 ||
+                    acl_set_qualifier(entry, &uid) < 0) {
+                        r = -errno;
+                        goto finish;
+                }
+        }
+
+        /* We do not recalculate the mask unconditionally here,
+         * so that the access mode of the file stays intact. */
+        if (acl_get_permset(entry, &permset) < 0 ||
+            acl_add_perm(permset, ACL_READ) < 0) {
+                r = -errno;
+                goto finish;
+        }
+
+        r = calc_acl_mask_if_needed(&acl);
+        if (r < 0)
+                goto finish;
+
+        r = acl_set_fd(fd, acl) < 0 ? -errno : 0;
+
+finish:
+        acl_free(acl);
+        return r;
+}
+
 int search_acl_groups(char*** dst, const char* path, bool* belong) {
         acl_t acl;
 
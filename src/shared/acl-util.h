@@ -25,4 +25,5 @@
 
 int acl_find_uid(acl_t acl, uid_t uid, acl_entry_t *entry);
 int calc_acl_mask_if_needed(acl_t *acl_p);
+int acl_add_user_read_fd(int fd, uid_t uid);
 int search_acl_groups(char*** dst, const char* path, bool* belong);
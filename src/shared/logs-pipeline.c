@@ -0,0 +1,605 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logs-pipeline.h"
+#include "logs-show.h"
+#include "journal-internal.h"
+#include "log.h"
+#include "util.h"
+
+/* How many entries are formatted right away, before the threads are
+ * started */
+#define PIPELINE_DIRECT_ENTRIES 1024U
+
+#define PIPELINE_BATCH_ENTRIES 256U
+#define PIPELINE_THREADS_MAX 8U
+
+/* How many batches may be in flight per thread */
+#define PIPELINE_BATCHES_PER_THREAD 4U
+
+typedef struct PipelineBatch {
+        /* Where each entry is, so that whoever formats them can
+         * check it sees the same ones */
+        char *cursors[PIPELINE_BATCH_ENTRIES];
+        unsigned n_entries;
+
+        /* How much text was added in front of the entries */
+        size_t text_length;
+
+        /* Reused for every batch in this slot, and only ever touched
+         * by whoever owns the slot: the main thread while it is
+         * filled and written out, one of the threads in between. */
+        FILE *f;
+        char *buf;
+        size_t size;
+
+        size_t length;
+        int r;
+
+        /* Protected by the mutex */
+        bool done;
+} PipelineBatch;
+
+typedef struct PipelineThread {
+        OutputPipeline *pipeline;
+        sd_journal *journal;
+        pthread_t thread;
+} PipelineThread;
+
+struct OutputPipeline {
+        sd_journal *journal;
+        FILE *f;
+        OutputMode mode;
+        unsigned n_columns;
+        OutputFlags flags;
+        bool reverse;
+
+        OutputPipelineOpen open_journal;
+        void *userdata;
+
+        unsigned n_direct;
+        bool parallel;
+        bool no_threads;
+
+        PipelineThread *threads;
+        unsigned n_threads, n_threads_allocated;
+
+        PipelineBatch *batches;
+        unsigned n_batches;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+
+        /* The batches added, taken by threads and written out so
+         * far, in order. Batch k lives in slot k % n_batches. The
+         * one being filled is the one after the last queued. */
+        uint64_t n_queued;
+        uint64_t n_taken;
+        uint64_t n_written;
+        bool stop;
+};
+
+static void pipeline_batch_reset(PipelineBatch *b) {
+        unsigned k;
+
+        assert(b);
+
+        for (k = 0; k < b->n_entries; k++) {
+                free(b->cursors[k]);
+                b->cursors[k] = NULL;
+        }
+
+        b->n_entries = 0;
+        b->text_length = 0;
+        b->length = 0;
+        b->r = 0;
+}
+
+static int pipeline_format_batch(OutputPipeline *p, sd_journal *j, PipelineBatch *b) {
+        unsigned k;
+        int r;
+
+        assert(p);
+        assert(j);
+        assert(b);
+
+        if (b->n_entries <= 0)
+                return 0;
+
+        r = sd_journal_seek_cursor(j, b->cursors[0]);
+        if (r < 0)
+                return r;
+
+        for (k = 0; k < b->n_entries; k++) {
+                r = p->reverse ? sd_journal_previous(j) : sd_journal_next(j);
+                if (r < 0)
+                        return r;
+
+                /* Our journal must see the same entries as the one
+                 * that was iterated through */
+                if (r == 0)
+                        return -ESTALE;
+
+                r = sd_journal_test_cursor(j, b->cursors[k]);
+                if (r < 0)
+                        return r;
+                if (r == 0)
+                        return -ESTALE;
+
+                r = output_journal(b->f, j, p->mode, p->n_columns, p->flags, NULL);
+
+                /* Like journalctl does when showing entries
+                 * directly, stop at one that vanished */
+                if (r == -EADDRNOTAVAIL)
+                        break;
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int pipeline_finish_batch(PipelineBatch *b, int r) {
+        long l;
+
+        assert(b);
+
+        if (fflush(b->f) != 0 && r >= 0)
+                r = -errno;
+
+        l = ftell(b->f);
+        if (l < 0 && r >= 0)
+                r = -errno;
+        b->length = l < 0 ? 0 : (size_t) l;
+
+        return r;
+}
+
+static int pipeline_reformat_batch(OutputPipeline *p, PipelineBatch *b) {
+        _cleanup_free_ char *cursor = NULL;
+        int r, q;
+
+        assert(p);
+        assert(b);
+
+        /* The thread's journal didn't see the entries of the batch,
+         * for example because it hasn't caught up yet with files
+         * that were rotated or vacuumed in the meantime. Format the
+         * batch with the journal that was iterated through then, and
+         * move it back to where it was. */
+
+        r = sd_journal_get_cursor(p->journal, &cursor);
+        if (r < 0)
+                return r;
+
+        if (fseek(b->f, b->text_length, SEEK_SET) < 0)
+                return -errno;
+
+        r = pipeline_finish_batch(b, pipeline_format_batch(p, p->journal, b));
+
+        q = sd_journal_seek_cursor(p->journal, cursor);
+        if (q >= 0)
+                q = p->reverse ? sd_journal_previous(p->journal) : sd_journal_next(p->journal);
+        if (q >= 0)
+                q = sd_journal_test_cursor(p->journal, cursor);
+        if (q == 0)
+                q = -ESTALE;
+        if (q < 0) {
+                log_error("Failed to return to the current entry: %s", strerror(-q));
+                return q;
+        }
+
+        return r;
+}
+
+static void *pipeline_thread(void *userdata) {
+        PipelineThread *t = userdata;
+        OutputPipeline *p = t->pipeline;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        for (;;) {
+                PipelineBatch *b;
+                int r;
+
+                while (!p->stop && p->n_taken >= p->n_queued)
+                        assert_se(pthread_cond_wait(&p->cond, &p->mutex) == 0);
+
+                if (p->n_taken >= p->n_queued)
+                        break;
+
+                b = p->batches + p->n_taken++ % p->n_batches;
+
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+                /* Catch up with files added or removed since the
+                 * entries of the batch were iterated through */
+                r = sd_journal_process(t->journal);
+                if (r < 0)
+                        log_debug("Failed to process journal changes: %s", strerror(-r));
+
+                b->r = pipeline_finish_batch(b, pipeline_format_batch(p, t->journal, b));
+
+                assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+                b->done = true;
+                assert_se(pthread_cond_broadcast(&p->cond) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        return NULL;
+}
+
+static void pipeline_stop_threads(OutputPipeline *p) {
+        unsigned k;
+
+        assert(p);
+
+        if (p->n_threads <= 0)
+                return;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        p->stop = true;
+        assert_se(pthread_cond_broadcast(&p->cond) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        for (k = 0; k < p->n_threads; k++)
+                assert_se(pthread_join(p->threads[k].thread, NULL) == 0);
+
+        p->n_threads = 0;
+}
+
+static int pipeline_start_threads(OutputPipeline *p) {
+        unsigned n, k;
+        long ncpus;
+        int r;
+
+        assert(p);
+
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (ncpus < 1)
+                ncpus = 1;
+
+        n = MIN((unsigned) ncpus, PIPELINE_THREADS_MAX);
+
+        /* Formatting on a single thread is what we do anyway */
+        if (n <= 1)
+                return -EOPNOTSUPP;
+
+        p->threads = new0(PipelineThread, n);
+        if (!p->threads)
+                return -ENOMEM;
+
+        p->n_threads_allocated = n;
+
+        p->batches = new0(PipelineBatch, n * PIPELINE_BATCHES_PER_THREAD);
+        if (!p->batches)
+                return -ENOMEM;
+
+        for (k = 0; k < n * PIPELINE_BATCHES_PER_THREAD; k++) {
+                PipelineBatch *b = p->batches + k;
+
+                b->f = open_memstream(&b->buf, &b->size);
+                if (!b->f)
+                        return -errno;
+
+                p->n_batches++;
+        }
+
+        for (k = 0; k < n; k++) {
+                PipelineThread *t = p->threads + k;
+
+                t->pipeline = p;
+
+                r = p->open_journal(&t->journal, p->userdata);
+                if (r < 0)
+                        break;
+
+                r = journal_copy_matches(t->journal, p->journal);
+                if (r < 0)
+                        break;
+
+                /* Watch for changes, so that they can be processed
+                 * before each batch */
+                r = sd_journal_get_fd(t->journal);
+                if (r < 0)
+                        break;
+
+                r = pthread_create(&t->thread, NULL, pipeline_thread, t);
+                if (r != 0) {
+                        r = -r;
+                        break;
+                }
+
+                p->n_threads++;
+        }
+
+        if (p->n_threads <= 0)
+                return r;
+
+        return 0;
+}
+
+static int pipeline_write_batches(OutputPipeline *p, bool wait) {
+        int r = 0;
+
+        assert(p);
+
+        /* Writes out the batches that are done, in order. If wait is
+         * true at least the oldest one, waiting for it if need be. */
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        while (p->n_written < p->n_queued) {
+                PipelineBatch *b = p->batches + p->n_written % p->n_batches;
+
+                if (!b->done) {
+                        if (!wait)
+                                break;
+
+                        assert_se(pthread_cond_wait(&p->cond, &p->mutex) == 0);
+                        continue;
+                }
+
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+                if (b->r == -ESTALE) {
+                        log_debug("Formatting batch of %u entries on this thread.", b->n_entries);
+                        b->r = pipeline_reformat_batch(p, b);
+                }
+
+                fwrite(b->buf, 1, b->length, p->f);
+
+                if (b->r < 0 && r >= 0)
+                        r = b->r;
+
+                pipeline_batch_reset(b);
+                rewind(b->f);
+
+                assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+                b->done = false;
+                p->n_written++;
+                wait = false;
+        }
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        return r;
+}
+
+static PipelineBatch *pipeline_current_batch(OutputPipeline *p) {
+        assert(p);
+
+        return p->batches + p->n_queued % p->n_batches;
+}
+
+static int pipeline_make_room(OutputPipeline *p) {
+        int r;
+
+        assert(p);
+
+        /* The slot of the batch to fill next must be written out */
+        while (p->n_queued - p->n_written >= p->n_batches) {
+                r = pipeline_write_batches(p, true);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int pipeline_queue_batch(OutputPipeline *p) {
+        assert(p);
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        p->n_queued++;
+        assert_se(pthread_cond_broadcast(&p->cond) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        return pipeline_write_batches(p, false);
+}
+
+int output_pipeline_new(
+                sd_journal *j,
+                FILE *f,
+                OutputMode mode,
+                unsigned n_columns,
+                OutputFlags flags,
+                bool reverse,
+                OutputPipelineOpen open_journal,
+                void *userdata,
+                OutputPipeline **ret) {
+
+        OutputPipeline *p;
+
+        assert(j);
+        assert(f);
+        assert(open_journal);
+        assert(ret);
+
+        p = new0(OutputPipeline, 1);
+        if (!p)
+                return -ENOMEM;
+
+        p->journal = j;
+        p->f = f;
+        p->mode = mode;
+        p->n_columns = n_columns;
+        p->flags = flags;
+        p->reverse = reverse;
+        p->open_journal = open_journal;
+        p->userdata = userdata;
+
+        assert_se(pthread_mutex_init(&p->mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&p->cond, NULL) == 0);
+
+        *ret = p;
+        return 0;
+}
+
+void output_pipeline_free(OutputPipeline *p) {
+        unsigned k;
+
+        if (!p)
+                return;
+
+        pipeline_stop_threads(p);
+
+        for (k = 0; k < p->n_threads_allocated; k++)
+                if (p->threads[k].journal)
+                        sd_journal_close(p->threads[k].journal);
+
+        for (k = 0; k < p->n_batches; k++) {
+                pipeline_batch_reset(p->batches + k);
+                fclose(p->batches[k].f);
+                free(p->batches[k].buf);
+        }
+
+        free(p->threads);
+        free(p->batches);
+
+        pthread_cond_destroy(&p->cond);
+        pthread_mutex_destroy(&p->mutex);
+
+        free(p);
+}
+
+int output_pipeline_add_entry(OutputPipeline *p) {
+        PipelineBatch *b;
+        int r;
+
+        assert(p);
+
+        if (!p->parallel) {
+                if (p->n_direct >= PIPELINE_DIRECT_ENTRIES && !p->no_threads) {
+                        r = pipeline_start_threads(p);
+                        if (r < 0) {
+                                log_debug("Formatting entries on this thread only: %s", strerror(-r));
+                                p->no_threads = true;
+                        } else
+                                p->parallel = true;
+                }
+
+                if (!p->parallel) {
+                        p->n_direct++;
+                        return output_journal(p->f, p->journal, p->mode, p->n_columns, p->flags, NULL);
+                }
+        }
+
+        r = pipeline_make_room(p);
+        if (r < 0)
+                return r;
+
+        b = pipeline_current_batch(p);
+
+        if (b->n_entries <= 0) {
+                long l;
+
+                l = ftell(b->f);
+                if (l < 0)
+                        return -errno;
+
+                b->text_length = (size_t) l;
+        }
+
+        r = sd_journal_get_cursor(p->journal, &b->cursors[b->n_entries]);
+        if (r < 0)
+                return r;
+
+        b->n_entries++;
+
+        if (b->n_entries >= PIPELINE_BATCH_ENTRIES)
+                return pipeline_queue_batch(p);
+
+        return 0;
+}
+
+int output_pipeline_add_text(OutputPipeline *p, const char *text) {
+        PipelineBatch *b;
+        int r;
+
+        assert(p);
+        assert(text);
+
+        if (!p->parallel) {
+                fputs(text, p->f);
+                return 0;
+        }
+
+        r = pipeline_make_room(p);
+        if (r < 0)
+                return r;
+
+        /* The text goes in front of the entries of a new batch */
+
+        b = pipeline_current_batch(p);
+        if (b->n_entries > 0) {
+                r = pipeline_queue_batch(p);
+                if (r < 0)
+                        return r;
+
+                r = pipeline_make_room(p);
+                if (r < 0)
+                        return r;
+
+                b = pipeline_current_batch(p);
+        }
+
+        fputs(text, b->f);
+        return 0;
+}
+
+int output_pipeline_flush(OutputPipeline *p) {
+        PipelineBatch *b;
+        int r;
+
+        assert(p);
+
+        if (!p->parallel)
+                return 0;
+
+        b = pipeline_current_batch(p);
+        if (b->n_entries > 0 || ftell(b->f) > 0) {
+                r = pipeline_queue_batch(p);
+                if (r < 0)
+                        return r;
+        }
+
+        while (p->n_written < p->n_queued) {
+                r = pipeline_write_batches(p, true);
+                if (r < 0)
+                        return r;
+        }
+
+        /* The caller might wait for more entries now, so make sure
+         * what was formatted actually got out */
+        if (fflush(p->f) != 0)
+                return -errno;
+
+        return 0;
+}
@@ -0,0 +1,63 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  Copyright 2013 Lennart Poettering
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <systemd/sd-journal.h>
+
+#include "output-mode.h"
+
+typedef struct OutputPipeline OutputPipeline;
+
+/* Opens a journal with the same files as the one iterated through,
+ * the pipeline adds the matches itself */
+typedef int (*OutputPipelineOpen)(sd_journal **ret, void *userdata);
+
+/* Formats the entries of a journal like output_journal(), but on a
+ * number of threads. The caller iterates through the journal as
+ * usual and adds each entry it wants shown. Batches of them are then
+ * formatted by threads with journals of their own, and written out
+ * in the order they were added. Batches a thread's journal doesn't
+ * see the same way, for example after files were rotated, are
+ * formatted with the caller's journal instead. The first entries are formatted
+ * right away, so that short listings neither wait nor pay for the
+ * threads. */
+
+int output_pipeline_new(
+                sd_journal *j,
+                FILE *f,
+                OutputMode mode,
+                unsigned n_columns,
+                OutputFlags flags,
+                bool reverse,
+                OutputPipelineOpen open_journal,
+                void *userdata,
+                OutputPipeline **ret);
+void output_pipeline_free(OutputPipeline *p);
+
+int output_pipeline_add_entry(OutputPipeline *p);
+int output_pipeline_add_text(OutputPipeline *p, const char *text);
+
+/* Waits until everything added so far has been written out */
+int output_pipeline_flush(OutputPipeline *p);
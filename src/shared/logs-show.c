@@ -29,7 +29,6 @@
 #include "log.h"
 #include "util.h"
 #include "utf8.h"
-#include "hashmap.h"
 #include "journal-internal.h"
 
 /* up to three lines (each up to 100 characters),
@@ -90,6 +89,45 @@ static int parse_field(const void *data, size_t length, const char *field, char
         return 1;
 }
 
+static int get_field(sd_journal *j, const char *field, char **target, size_t *target_size) {
+        const void *data;
+        size_t length, fl;
+        char *buf;
+        int r;
+
+        assert(j);
+        assert(field);
+        assert(target);
+        assert(target_size);
+
+        /* Unlike iterating through all fields, this doesn't look at
+         * the fields we aren't interested in. If a field is set more
+         * than once the last value wins, as it always did. */
+
+        r = journal_get_data_last(j, field, &data, &length);
+        if (r == -ENOENT)
+                return 0;
+        if (r < 0)
+                return r;
+
+        fl = strlen(field) + 1;
+        if (length < fl)
+                return 0;
+
+        buf = malloc(length - fl + 1);
+        if (!buf)
+                return log_oom();
+
+        memcpy(buf, (const char*) data + fl, length - fl);
+        buf[length - fl] = 0;
+
+        free(*target);
+        *target = buf;
+        *target_size = length - fl;
+
+        return 1;
+}
+
 static bool shall_print(const char *p, size_t l, OutputFlags flags) {
         assert(p);
 
@@ -189,8 +227,6 @@ static int output_short(
                 OutputFlags flags) {
 
         int r;
-        const void *data;
-        size_t length;
         size_t n = 0;
         _cleanup_free_ char *hostname = NULL, *identifier = NULL, *comm = NULL, *pid = NULL, *fake_pid = NULL, *message = NULL, *realtime = NULL, *monotonic = NULL, *priority = NULL;
         size_t hostname_len = 0, identifier_len = 0, comm_len = 0, pid_len = 0, fake_pid_len = 0, message_len = 0, realtime_len = 0, monotonic_len = 0, priority_len = 0;
@@ -208,66 +244,41 @@ static int output_short(
          */
         sd_journal_set_data_threshold(j, flags & (OUTPUT_SHOW_ALL|OUTPUT_FULL_WIDTH) ? 0 : PRINT_CHAR_THRESHOLD + 1);
 
-        JOURNAL_FOREACH_DATA_RETVAL(j, data, length, r) {
-
-                r = parse_field(data, length, "PRIORITY=", &priority, &priority_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "_HOSTNAME=", &hostname, &hostname_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
-
-                r = parse_field(data, length, "SYSLOG_IDENTIFIER=", &identifier, &identifier_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
+        r = get_field(j, "MESSAGE", &message, &message_len);
+        if (r <= 0)
+                return r;
 
-                r = parse_field(data, length, "_COMM=", &comm, &comm_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
+        r = get_field(j, "PRIORITY", &priority, &priority_len);
+        if (r < 0)
+                return r;
 
-                r = parse_field(data, length, "_PID=", &pid, &pid_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
+        r = get_field(j, "_HOSTNAME", &hostname, &hostname_len);
+        if (r < 0)
+                return r;
 
-                r = parse_field(data, length, "SYSLOG_PID=", &fake_pid, &fake_pid_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
+        r = get_field(j, "SYSLOG_IDENTIFIER", &identifier, &identifier_len);
+        if (r < 0)
+                return r;
 
-                r = parse_field(data, length, "_SOURCE_REALTIME_TIMESTAMP=", &realtime, &realtime_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
+        r = get_field(j, "_COMM", &comm, &comm_len);
+        if (r < 0)
+                return r;
 
-                r = parse_field(data, length, "_SOURCE_MONOTONIC_TIMESTAMP=", &monotonic, &monotonic_len);
-                if (r < 0)
-                        return r;
-                else if (r > 0)
-                        continue;
+        r = get_field(j, "_PID", &pid, &pid_len);
+        if (r < 0)
+                return r;
 
-                r = parse_field(data, length, "MESSAGE=", &message, &message_len);
-                if (r < 0)
-                        return r;
-        }
+        r = get_field(j, "SYSLOG_PID", &fake_pid, &fake_pid_len);
+        if (r < 0)
+                return r;
 
+        r = get_field(j, "_SOURCE_REALTIME_TIMESTAMP", &realtime, &realtime_len);
         if (r < 0)
                 return r;
 
-        if (!message)
-                return 0;
+        r = get_field(j, "_SOURCE_MONOTONIC_TIMESTAMP", &monotonic, &monotonic_len);
+        if (r < 0)
+                return r;
 
         if (!(flags & OUTPUT_SHOW_ALL))
                 strip_tab_ansi(&message, &message_len);
@@ -568,57 +579,170 @@ static int output_export(
         return 0;
 }
 
-void json_escape(
-                FILE *f,
+/* JSON output is assembled in a buffer, and written out when that is
+ * full, rather than byte by byte */
+typedef struct JsonWriter {
+        FILE *f;
+        size_t n;
+        char buf[4096];
+} JsonWriter;
+
+static void json_writer_flush(JsonWriter *w) {
+        fwrite(w->buf, 1, w->n, w->f);
+        w->n = 0;
+}
+
+static void json_writer_write(JsonWriter *w, const char *p, size_t l) {
+        if (l > sizeof(w->buf) - w->n) {
+                json_writer_flush(w);
+
+                if (l > sizeof(w->buf)) {
+                        fwrite(p, 1, l, w->f);
+                        return;
+                }
+        }
+
+        memcpy(w->buf + w->n, p, l);
+        w->n += l;
+}
+
+static void json_writer_putc(JsonWriter *w, char c) {
+        if (w->n >= sizeof(w->buf))
+                json_writer_flush(w);
+
+        w->buf[w->n++] = c;
+}
+
+static void json_writer_puts(JsonWriter *w, const char *s) {
+        json_writer_write(w, s, strlen(s));
+}
+
+static bool json_plain(char c) {
+        return (uint8_t) c >= ' ' && (uint8_t) c < 0x7F && c != '"' && c != '\\';
+}
+
+/* Returns how many bytes at the beginning of p may be put between
+ * quotes as they are: printable ASCII other than quotes and
+ * backslashes. Looks at a word at a time, as that is what most
+ * fields consist of. */
+static size_t json_plain_length(const char *p, size_t l) {
+        const unsigned long ones = ((unsigned long) -1) / 0xFF, highs = ones * 0x80;
+        size_t i;
+
+#define HAS_ZERO(x) (((x) - ones) & ~(x) & highs)
+
+        for (i = 0; i + sizeof(unsigned long) <= l; i += sizeof(unsigned long)) {
+                unsigned long x;
+
+                memcpy(&x, p + i, sizeof(x));
+
+                if ((x & highs) ||
+                    ((x - ones * ' ') & ~x & highs) ||
+                    HAS_ZERO(x ^ (ones * '"')) ||
+                    HAS_ZERO(x ^ (ones * '\\')) ||
+                    HAS_ZERO(x ^ (ones * 0x7F)))
+                        break;
+        }
+
+#undef HAS_ZERO
+
+        while (i < l && json_plain(p[i]))
+                i++;
+
+        return i;
+}
+
+static void json_writer_escape(
+                JsonWriter *w,
                 const char* p,
                 size_t l,
                 OutputFlags flags) {
 
-        assert(f);
-        assert(p);
+        size_t n;
 
-        if (!(flags & OUTPUT_SHOW_ALL) && l >= JSON_THRESHOLD)
+        assert(w);
+        assert(p);
 
-                fputs("null", f);
+        if (!(flags & OUTPUT_SHOW_ALL) && l >= JSON_THRESHOLD) {
+                json_writer_puts(w, "null");
+                return;
+        }
 
-        else if (!utf8_is_printable(p, l)) {
-                bool not_first = false;
+        /* The plain beginning is printable for sure, only the rest
+         * needs a closer look */
+        n = json_plain_length(p, l);
 
-                fputs("[ ", f);
+        if (n < l && !utf8_is_printable(p + n, l - n)) {
+                char s[DECIMAL_STR_MAX(uint8_t) + 2];
 
-                while (l > 0) {
-                        if (not_first)
-                                fprintf(f, ", %u", (uint8_t) *p);
-                        else {
-                                not_first = true;
-                                fprintf(f, "%u", (uint8_t) *p);
-                        }
+                json_writer_puts(w, "[ ");
 
-                        p++;
-                        l--;
+                for (n = 0; n < l; n++) {
+                        snprintf(s, sizeof(s), n > 0 ? ", %u" : "%u", (uint8_t) p[n]);
+                        json_writer_puts(w, s);
                 }
 
-                fputs(" ]", f);
-        } else {
-                fputc('\"', f);
-
-                while (l > 0) {
-                        if (*p == '"' || *p == '\\') {
-                                fputc('\\', f);
-                                fputc(*p, f);
-                        } else if (*p == '\n')
-                                fputs("\\n", f);
-                        else if (*p < ' ')
-                                fprintf(f, "\\u%04x", *p);
-                        else
-                                fputc(*p, f);
-
-                        p++;
-                        l--;
-                }
+                json_writer_puts(w, " ]");
+                return;
+        }
+
+        json_writer_putc(w, '\"');
+
+        for (;;) {
+                json_writer_write(w, p, n);
+                p += n;
+                l -= n;
+
+                if (l == 0)
+                        break;
+
+                if (*p == '"' || *p == '\\') {
+                        json_writer_putc(w, '\\');
+                        json_writer_putc(w, *p);
+                } else if (*p == '\n')
+                        json_writer_puts(w, "\\n");
+                else if ((uint8_t) *p < ' ') {
+                        char s[7];
+
+                        snprintf(s, sizeof(s), "\\u%04x", (uint8_t) *p);
+                        json_writer_puts(w, s);
+                } else
+                        json_writer_putc(w, *p);
+
+                p++;
+                l--;
 
-                fputc('\"', f);
+                n = json_plain_length(p, l);
         }
+
+        json_writer_putc(w, '\"');
+}
+
+void json_escape(
+                FILE *f,
+                const char* p,
+                size_t l,
+                OutputFlags flags) {
+
+        JsonWriter w = {
+                .f = f,
+        };
+
+        assert(f);
+
+        json_writer_escape(&w, p, l, flags);
+        json_writer_flush(&w);
+}
+
+/* A field of an entry, copied into the entry's buffer */
+typedef struct JsonField {
+        size_t offset, length, name_length;
+        bool shown;
+} JsonField;
+
+static bool json_field_same_name(const char *buf, const JsonField *a, const JsonField *b) {
+        return a->name_length == b->name_length &&
+                memcmp(buf + a->offset, buf + b->offset, a->name_length) == 0;
 }
 
 static int output_json(
@@ -629,14 +753,18 @@ static int output_json(
                 OutputFlags flags) {
 
         uint64_t realtime, monotonic;
-        _cleanup_free_ char *cursor = NULL;
+        _cleanup_free_ char *cursor = NULL, *buf = NULL;
+        _cleanup_free_ JsonField *fields = NULL;
+        size_t fields_allocated = 0, buf_allocated = 0, buf_size = 0;
+        unsigned n_fields = 0, i, k;
+        JsonWriter w = {
+                .f = f,
+        };
         const void *data;
         size_t length;
         sd_id128_t boot_id;
-        char sid[33], *k;
+        char sid[33];
         int r;
-        Hashmap *h = NULL;
-        bool done, separator;
 
         assert(j);
 
@@ -660,6 +788,40 @@ static int output_json(
                 return r;
         }
 
+        /* Iterate through the entry only once, and copy its fields,
+         * so that we can find the ones that appear more than once
+         * without going through it again */
+        JOURNAL_FOREACH_DATA_RETVAL(j, data, length, r) {
+                const char *eq;
+
+                /* We already print the boot id, from the data in
+                 * the header, hence let's suppress it here */
+                if (length >= 9 &&
+                    memcmp(data, "_BOOT_ID=", 9) == 0)
+                        continue;
+
+                eq = memchr(data, '=', length);
+                if (!eq)
+                        continue;
+
+                if (!GREEDY_REALLOC(fields, fields_allocated, n_fields + 1) ||
+                    !GREEDY_REALLOC(buf, buf_allocated, buf_size + length))
+                        return -ENOMEM;
+
+                memcpy(buf + buf_size, data, length);
+
+                fields[n_fields++] = (JsonField) {
+                        .offset = buf_size,
+                        .length = length,
+                        .name_length = eq - (const char*) data,
+                };
+
+                buf_size += length;
+        }
+
+        if (r < 0)
+                return r;
+
         if (mode == OUTPUT_JSON_PRETTY)
                 fprintf(f,
                         "{\n"
@@ -686,160 +848,61 @@ static int output_json(
                         sd_id128_to_string(boot_id, sid));
         }
 
-        h = hashmap_new(string_hash_func, string_compare_func);
-        if (!h)
-                return -ENOMEM;
-
-        /* First round, iterate through the entry and count how often each field appears */
-        JOURNAL_FOREACH_DATA_RETVAL(j, data, length, r) {
-                const char *eq;
-                char *n;
-                unsigned u;
-
-                if (length >= 9 &&
-                    memcmp(data, "_BOOT_ID=", 9) == 0)
-                        continue;
+        /* Entries have a few dozen fields at most, hence simply
+         * compare each one with the ones after it */
+        for (i = 0; i < n_fields; i++) {
+                JsonField *field = fields + i;
+                const char *p = buf + field->offset;
+                size_t m = field->name_length;
 
-                eq = memchr(data, '=', length);
-                if (!eq)
+                if (field->shown)
                         continue;
 
-                n = strndup(data, eq - (const char*) data);
-                if (!n) {
-                        r = -ENOMEM;
-                        goto finish;
-                }
-
-                u = PTR_TO_UINT(hashmap_get(h, n));
-                if (u == 0) {
-                        r = hashmap_put(h, n, UINT_TO_PTR(1));
-                        if (r < 0) {
-                                free(n);
-                                goto finish;
-                        }
-                } else {
-                        r = hashmap_update(h, n, UINT_TO_PTR(u + 1));
-                        free(n);
-                        if (r < 0)
-                                goto finish;
-                }
-        }
-
-        if (r < 0)
-                return r;
-
-        separator = true;
-        do {
-                done = true;
-
-                SD_JOURNAL_FOREACH_DATA(j, data, length) {
-                        const char *eq;
-                        char *kk, *n;
-                        size_t m;
-                        unsigned u;
-
-                        /* We already printed the boot id, from the data in
-                         * the header, hence let's suppress it here */
-                        if (length >= 9 &&
-                            memcmp(data, "_BOOT_ID=", 9) == 0)
-                                continue;
-
-                        eq = memchr(data, '=', length);
-                        if (!eq)
-                                continue;
-
-                        if (separator) {
-                                if (mode == OUTPUT_JSON_PRETTY)
-                                        fputs(",\n\t", f);
-                                else
-                                        fputs(", ", f);
-                        }
-
-                        m = eq - (const char*) data;
-
-                        n = strndup(data, m);
-                        if (!n) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
-
-                        u = PTR_TO_UINT(hashmap_get2(h, n, (void**) &kk));
-                        if (u == 0) {
-                                /* We already printed this, let's jump to the next */
-                                free(n);
-                                separator = false;
-
-                                continue;
-                        } else if (u == 1) {
-                                /* Field only appears once, output it directly */
+                if (mode == OUTPUT_JSON_PRETTY)
+                        json_writer_puts(&w, ",\n\t");
+                else
+                        json_writer_puts(&w, ", ");
 
-                                json_escape(f, data, m, flags);
-                                fputs(" : ", f);
+                json_writer_escape(&w, p, m, flags);
 
-                                json_escape(f, eq + 1, length - m - 1, flags);
+                for (k = i + 1; k < n_fields; k++)
+                        if (json_field_same_name(buf, field, fields + k))
+                                break;
 
-                                hashmap_remove(h, n);
-                                free(kk);
-                                free(n);
+                if (k >= n_fields) {
+                        /* Field only appears once, output it directly */
+                        json_writer_puts(&w, " : ");
+                        json_writer_escape(&w, p + m + 1, field->length - m - 1, flags);
+                        continue;
+                }
 
-                                separator = true;
+                /* Field appears multiple times, output it as array */
+                json_writer_puts(&w, " : [ ");
+                json_writer_escape(&w, p + m + 1, field->length - m - 1, flags);
 
+                for (; k < n_fields; k++) {
+                        if (!json_field_same_name(buf, field, fields + k))
                                 continue;
 
-                        } else {
-                                /* Field appears multiple times, output it as array */
-                                json_escape(f, data, m, flags);
-                                fputs(" : [ ", f);
-                                json_escape(f, eq + 1, length - m - 1, flags);
-
-                                /* Iterate through the end of the list */
-
-                                while (sd_journal_enumerate_data(j, &data, &length) > 0) {
-                                        if (length < m + 1)
-                                                continue;
-
-                                        if (memcmp(data, n, m) != 0)
-                                                continue;
+                        json_writer_puts(&w, ", ");
+                        json_writer_escape(&w, buf + fields[k].offset + m + 1, fields[k].length - m - 1, flags);
 
-                                        if (((const char*) data)[m] != '=')
-                                                continue;
-
-                                        fputs(", ", f);
-                                        json_escape(f, (const char*) data + m + 1, length - m - 1, flags);
-                                }
-
-                                fputs(" ]", f);
-
-                                hashmap_remove(h, n);
-                                free(kk);
-                                free(n);
-
-                                /* Iterate data fields form the beginning */
-                                done = false;
-                                separator = true;
-
-                                break;
-                        }
+                        fields[k].shown = true;
                 }
 
-        } while (!done);
+                json_writer_puts(&w, " ]");
+        }
 
         if (mode == OUTPUT_JSON_PRETTY)
-                fputs("\n}\n", f);
+                json_writer_puts(&w, "\n}\n");
         else if (mode == OUTPUT_JSON_SSE)
-                fputs("}\n\n", f);
+                json_writer_puts(&w, "}\n\n");
         else
-                fputs(" }\n", f);
-
-        r = 0;
-
-finish:
-        while ((k = hashmap_steal_first_key(h)))
-                free(k);
+                json_writer_puts(&w, " }\n");
 
-        hashmap_free(h);
+        json_writer_flush(&w);
 
-        return r;
+        return 0;
 }
 
 static int output_cat(
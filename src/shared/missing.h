@@ -25,6 +25,7 @@
 
 #include <sys/resource.h>
 #include <sys/syscall.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -292,6 +293,57 @@ static inline int name_to_handle_at(int fd, const char *name, struct file_handle
 }
 #endif
 
+#if defined __x86_64__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 319
+#  endif
+#elif defined __i386__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 356
+#  endif
+#elif defined __arm__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 385
+#  endif
+#elif defined __aarch64__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 279
+#  endif
+#elif defined __powerpc__
+#  ifndef __NR_memfd_create
+#    define __NR_memfd_create 360
+#  endif
+#endif
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#if !HAVE_DECL_MEMFD_CREATE
+static inline int memfd_create(const char *name, unsigned int flags) {
+#ifdef __NR_memfd_create
+        return syscall(__NR_memfd_create, name, flags);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (F_LINUX_SPECIFIC_BASE + 9)
+#define F_GET_SEALS (F_LINUX_SPECIFIC_BASE + 10)
+
+#define F_SEAL_SEAL     0x0001
+#define F_SEAL_SHRINK   0x0002
+#define F_SEAL_GROW     0x0004
+#define F_SEAL_WRITE    0x0008
+#endif
+
 #ifndef HAVE_SECURE_GETENV
 #  ifdef HAVE___SECURE_GETENV
 #    define secure_getenv __secure_getenv
@@ -2256,6 +2256,37 @@ ssize_t loop_write(int fd, const void *buf, size_t nbytes, bool do_poll) {
         return n;
 }
 
+int copy_bytes(int fdf, int fdt, uint64_t max_bytes) {
+        uint8_t buf[64*1024];
+        uint64_t n = 0;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        /* Copies everything until EOF, but fails with -EFBIG after
+         * more than max_bytes */
+
+        for (;;) {
+                ssize_t l, k;
+
+                l = loop_read(fdf, buf, sizeof(buf), false);
+                if (l < 0)
+                        return (int) l;
+                if (l == 0)
+                        return 0;
+
+                n += l;
+                if (n > max_bytes)
+                        return -EFBIG;
+
+                k = loop_write(fdt, buf, l, false);
+                if (k < 0)
+                        return (int) k;
+                if (k != l)
+                        return -EIO;
+        }
+}
+
 int parse_bytes(const char *t, off_t *bytes) {
         static const struct {
                 const char *suffix;